@@ -28,16 +28,20 @@ To use a file-like object as input/output, use dump() & load() methods instead.
 """
 
 try:
-    from _bjdata import dump, dumpb, load, loadb
+    from _bjdata import dump, dumpb, dumpb_iov, load, loadb, validate
     EXTENSION_ENABLED = True
 except ImportError:  # pragma: no cover
-    from .encoder import dump, dumpb
-    from .decoder import load, loadb
+    from .encoder import dump, dumpb, dumpb_iov
+    from .decoder import load, loadb, validate
     EXTENSION_ENABLED = False
 
-from .encoder import EncoderException
+from .encoder import EncoderException, namedtuple_as_object, slots_as_object
 from .decoder import DecoderException
+from .raw import RawBJData, preencode
+from .shared import SharedValue, dump_shared, load_shared
 
 __version__ = '0.3.4'
 
-__all__ = ('EXTENSION_ENABLED', 'dump', 'dumpb', 'EncoderException', 'load', 'loadb', 'DecoderException')
+__all__ = ('EXTENSION_ENABLED', 'dump', 'dumpb', 'dumpb_iov', 'EncoderException', 'load', 'loadb', 'DecoderException',
+           'validate', 'RawBJData', 'preencode', 'namedtuple_as_object', 'slots_as_object', 'dump_shared',
+           'load_shared', 'SharedValue')
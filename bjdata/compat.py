@@ -51,6 +51,7 @@ if PY2:
     UNICODE_TYPE = unicode  # noqa: F821
     TEXT_TYPES = (str, unicode)  # noqa: F821
     BYTES_TYPES = (str, bytearray)
+    RANGE_TYPE = xrange  # noqa: F821
 
     STDIN_RAW = stdin
     STDOUT_RAW = stdout
@@ -65,6 +66,7 @@ else:
     UNICODE_TYPE = str
     TEXT_TYPES = (str,)
     BYTES_TYPES = (bytes, bytearray)
+    RANGE_TYPE = range
 
     STDIN_RAW = getattr(stdin, 'buffer', stdin)
     STDOUT_RAW = getattr(stdout, 'buffer', stdout)
@@ -73,9 +75,9 @@ else:
 
 try:
     # introduced in v3.3
-    from collections.abc import Mapping, Sequence  # noqa: F401
+    from collections.abc import Mapping, Sequence, Iterator  # noqa: F401
 except ImportError:
-    from collections import Mapping, Sequence  # noqa: F401
+    from collections import Mapping, Sequence, Iterator  # noqa: F401
 
 
 if version_info[:2] == (3, 2):
@@ -17,23 +17,30 @@
 """BJData (Draft 2) and UBJSON encoder"""
 
 from io import BytesIO
+from re import compile as re_compile, IGNORECASE
 from struct import Struct, pack, error as StructError
 from decimal import Decimal, DecimalException
 from functools import reduce
 
-from .compat import raise_from, intern_unicode
+from .compat import raise_from, intern_unicode, UNICODE_TYPE, INTEGER_TYPES
+from .raw import RawBJData
+from .encoder import _field_names
 from .markers import (TYPE_NONE, TYPE_NULL, TYPE_NOOP, TYPE_BOOL_TRUE, TYPE_BOOL_FALSE, TYPE_INT8, TYPE_UINT8,
                       TYPE_INT16, TYPE_INT32, TYPE_INT64, TYPE_FLOAT32, TYPE_FLOAT64, TYPE_HIGH_PREC, TYPE_CHAR,
 		      TYPE_UINT16, TYPE_UINT32, TYPE_UINT64, TYPE_FLOAT16,
-                      TYPE_STRING, OBJECT_START, OBJECT_END, ARRAY_START, ARRAY_END, CONTAINER_TYPE, CONTAINER_COUNT)
+                      TYPE_STRING, OBJECT_START, OBJECT_END, ARRAY_START, ARRAY_END, CONTAINER_TYPE, CONTAINER_COUNT,
+                      DIALECT_BJDATA, DIALECT_UBJSON, BUFFER_KEY_INDEX, BUFFER_KEY_DTYPE, BUFFER_KEY_SHAPE)
 from numpy import array as ndarray, dtype as npdtype, frombuffer as buffer2numpy, half as halfprec
 from array import array as typedarray
 
 __TYPES = frozenset((TYPE_NULL, TYPE_BOOL_TRUE, TYPE_BOOL_FALSE, TYPE_INT8, TYPE_UINT8, TYPE_INT16, TYPE_INT32,
                      TYPE_INT64, TYPE_FLOAT32, TYPE_FLOAT64, TYPE_UINT16, TYPE_UINT32, TYPE_UINT64, TYPE_FLOAT16, 
 		     TYPE_HIGH_PREC, TYPE_CHAR, TYPE_STRING, ARRAY_START, OBJECT_START))
+# UBJSON (Draft 12) has no unsigned types other than uint8 and no half precision
+__TYPES_UBJSON = __TYPES - frozenset((TYPE_UINT16, TYPE_UINT32, TYPE_UINT64, TYPE_FLOAT16))
 __TYPES_NO_DATA = frozenset((TYPE_NULL, TYPE_BOOL_FALSE, TYPE_BOOL_TRUE))
 __TYPES_INT = frozenset((TYPE_INT8, TYPE_UINT8, TYPE_INT16, TYPE_INT32, TYPE_INT64, TYPE_UINT16, TYPE_UINT32, TYPE_UINT64))
+__TYPES_INT_UBJSON = frozenset((TYPE_INT8, TYPE_UINT8, TYPE_INT16, TYPE_INT32, TYPE_INT64))
 __TYPES_FIXLEN = frozenset((TYPE_INT8, TYPE_UINT8, TYPE_INT16, TYPE_INT32, TYPE_INT64, TYPE_UINT16, TYPE_UINT32, TYPE_UINT64,
                      TYPE_FLOAT16, TYPE_FLOAT32, TYPE_FLOAT64, TYPE_CHAR))
 
@@ -93,8 +100,8 @@ class DecoderException(ValueError):
 
 
 # pylint: disable=unused-argument
-def __decode_high_prec(fp_read, marker, le=1):
-    length = __decode_int_non_negative(fp_read, fp_read(1),le)
+def __decode_high_prec(fp_read, marker, le=1, ubj=False, max_length=None):
+    length = __decode_length(fp_read, fp_read(1), le, ubj, max_length)
     raw = fp_read(length)
     if len(raw) < length:
         raise DecoderException('High prec. too short')
@@ -106,8 +113,8 @@ def __decode_high_prec(fp_read, marker, le=1):
         raise_from(DecoderException('Failed to decode decimal'), ex)
 
 
-def __decode_int_non_negative(fp_read, marker, le=1):
-    if marker not in __TYPES_INT:
+def __decode_int_non_negative(fp_read, marker, le=1, ubj=False):
+    if marker not in (__TYPES_INT_UBJSON if ubj else __TYPES_INT):
         raise DecoderException('Integer marker expected')
     value = __METHOD_MAP[marker](fp_read, marker, le)
     if value < 0:
@@ -115,6 +122,13 @@ def __decode_int_non_negative(fp_read, marker, le=1):
     return value
 
 
+def __decode_length(fp_read, marker, le=1, ubj=False, max_length=None):
+    length = __decode_int_non_negative(fp_read, marker, le, ubj)
+    if max_length is not None and length > max_length:
+        raise DecoderException('String length exceeds max_string_length')
+    return length
+
+
 def __decode_int8(fp_read, marker, le=1):
     try:
         return __SMALL_INTS_DECODED[le][fp_read(1)]
@@ -200,9 +214,9 @@ def __decode_char(fp_read, marker, le=1):
         raise_from(DecoderException('Failed to decode char'), ex)
 
 
-def __decode_string(fp_read, marker, le=1):
+def __decode_string(fp_read, marker, le=1, ubj=False, max_length=None):
     # current marker is string identifier, so read next byte which identifies integer type
-    length = __decode_int_non_negative(fp_read, fp_read(1), le)
+    length = __decode_length(fp_read, fp_read(1), le, ubj, max_length)
     raw = fp_read(length)
     if len(raw) < length:
         raise DecoderException('String too short')
@@ -213,8 +227,8 @@ def __decode_string(fp_read, marker, le=1):
 
 
 # same as string, except there is no 'S' marker
-def __decode_object_key(fp_read, marker, intern_object_keys, le=1):
-    length = __decode_int_non_negative(fp_read, marker, le)
+def __decode_object_key(fp_read, marker, intern_object_keys, le=1, ubj=False, max_length=None):
+    length = __decode_length(fp_read, marker, le, ubj, max_length)
     raw = fp_read(length)
     if len(raw) < length:
         raise DecoderException('String too short')
@@ -242,18 +256,308 @@ __METHOD_MAP = {TYPE_NULL: (lambda _, __, ___: None),
                 TYPE_CHAR: __decode_char,
                 TYPE_STRING: __decode_string}
 
+# UBJSON variant: no uint16/32/64 or float16 and lengths must use UBJSON integer types
+__METHOD_MAP_UBJSON = {marker: method for marker, method in __METHOD_MAP.items() if marker in __TYPES_UBJSON}
+__METHOD_MAP_UBJSON[TYPE_HIGH_PREC] = lambda fp_read, marker, le: __decode_high_prec(fp_read, marker, le, True)
+__METHOD_MAP_UBJSON[TYPE_STRING] = lambda fp_read, marker, le: __decode_string(fp_read, marker, le, True)
+
+
+class _DecoderContext(object):  # pylint: disable=too-few-public-methods
+    """Per-call decoding options & state, shared by the container decoding functions"""
+
+    __slots__ = ('ubj', 'method_map', 'max_container_count', 'max_string_length', 'max_depth', 'depth', 'dict_class',
+                 'array_as_tuple', 'records_rows', 'exclude_paths', 'filter_node', 'raw_depth', 'raw_node', 'classes',
+                 'class_node', 'buffers', 'read_view')
+
+    def __init__(self, ubj, method_map, max_container_count=None, max_string_length=None, max_depth=None,
+                 dict_class=dict, array_as_tuple=False, records_rows=False, path_filter=None, exclude_paths=False,
+                 raw_depth=None, raw_paths=None, classes=None, class_paths=None, buffers=None, read_view=None):
+        self.ubj = ubj
+        self.method_map = method_map
+        self.max_container_count = max_container_count
+        self.max_string_length = max_string_length
+        self.max_depth = max_depth
+        self.depth = 0
+        self.dict_class = dict_class
+        self.array_as_tuple = array_as_tuple
+        self.records_rows = records_rows
+        self.exclude_paths = exclude_paths
+        # include/exclude trie node applying to members of the object being decoded (None if not filtering)
+        self.filter_node = path_filter
+        self.raw_depth = raw_depth
+        # raw_paths trie node applying to members of the object being decoded (None if none)
+        self.raw_node = raw_paths
+        # class specs (see _class_spec) by frozenset of their field names (None if none)
+        self.classes = classes
+        # class_paths trie node applying to members of the object being decoded (None if none)
+        self.class_node = class_paths
+        # out-of-band buffers (see buffer_callback of encoder.dump) or None
+        self.buffers = buffers
+        # reads (like fp_read) a view of the input rather than a copy, for packed arrays (see zero_copy) or None
+        self.read_view = read_view
+
+
+class _LimitedReader(object):  # pylint: disable=too-few-public-methods
+    """Wraps fp.read (and optionally fp.read_view), raising DecoderException once more than max_total_bytes would have
+       been read"""
+
+    __slots__ = ('fp_read', 'fp_read_view', 'remaining')
+
+    def __init__(self, fp_read, max_total_bytes, fp_read_view=None):
+        self.fp_read = fp_read
+        self.fp_read_view = fp_read_view
+        self.remaining = max_total_bytes
+
+    def __call__(self, size):
+        if size > self.remaining:
+            raise DecoderException('Input exceeds max_total_bytes')
+        raw = self.fp_read(size)
+        self.remaining -= len(raw)
+        return raw
+
+    def view(self, size):
+        if size > self.remaining:
+            raise DecoderException('Input exceeds max_total_bytes')
+        raw = self.fp_read_view(size)
+        self.remaining -= len(raw)
+        return raw
+
+
+class _SegmentReader(object):
+    """Read/tell-able view over a sequence of bytes-like segments, only joining reads which span more than one"""
+
+    __slots__ = ('segments', 'index', 'pos', 'total')
+
+    def __init__(self, segments):
+        self.segments = [view.cast('B') if view.itemsize != 1 else view for view in map(memoryview, segments)]
+        self.index = 0
+        self.pos = 0
+        self.total = 0
+
+    def read(self, size):
+        parts = []
+        while size > 0 and self.index < len(self.segments):
+            segment = self.segments[self.index]
+            chunk = segment[self.pos:self.pos + size]
+            parts.append(chunk)
+            size -= len(chunk)
+            self.pos += len(chunk)
+            if self.pos >= len(segment):
+                self.index += 1
+                self.pos = 0
+        raw = parts[0].tobytes() if len(parts) == 1 else b''.join(parts)
+        self.total += len(raw)
+        return raw
+
+    def read_view(self, size):
+        """As read() but returns a memoryview (slice of a segment) if the bytes lie within a single segment"""
+        while self.index < len(self.segments) and self.pos >= len(self.segments[self.index]):
+            self.index += 1
+            self.pos = 0
+        if self.index < len(self.segments) and size <= len(self.segments[self.index]) - self.pos:
+            raw = self.segments[self.index][self.pos:self.pos + size]
+            self.pos += size
+            self.total += size
+            return raw
+        return self.read(size)
+
+    def tell(self):
+        return self.total
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.segments = []
+
+
+def __path_keys(path, name):
+    """Returns tuple of keys of the given path, either a str of '.'-separated keys or a sequence of keys"""
+    keys = tuple(path.split('.')) if isinstance(path, UNICODE_TYPE) else tuple(path)
+    if not keys:
+        raise ValueError('%s paths must not be empty' % name)
+    for key in keys:
+        if not isinstance(key, UNICODE_TYPE):
+            raise TypeError('%s path keys must be str' % name)
+    return keys
+
+
+def __compile_paths(paths, name):
+    """Returns trie (nested dicts, with None marking the end of a path) of the given include/exclude paths"""
+    if isinstance(paths, UNICODE_TYPE):
+        paths = (paths,)
+    trie = {}
+    for path in paths:
+        keys = __path_keys(path, name)
+        node = trie
+        for i, key in enumerate(keys):
+            if key in node and node[key] is None:
+                # a prefix of this path has already been given
+                break
+            if i == len(keys) - 1:
+                node[key] = None
+            else:
+                node = node.setdefault(key, {})
+    return trie
+
+
+def _class_spec(cls):
+    """Returns (cls, field names, {name: index}, whether to set attributes) for a class to decode objects into.
+       Instances of namedtuples, dataclasses and attrs classes are created by calling cls with the fields as keyword
+       arguments, those of other classes using __slots__ without calling __init__ (i.e. by setting the slots)."""
+    if not isinstance(cls, type):
+        raise TypeError('classes must be types')
+    names = getattr(cls, '_fields', None) if issubclass(cls, tuple) else _field_names(cls)
+    setattrs = names is None
+    if setattrs:
+        names = _field_names(cls, True)
+        if not names:
+            raise TypeError('Cannot decode into %s (not a namedtuple, dataclass, attrs or __slots__ class)' %
+                            cls.__name__)
+    names = tuple(names)
+    return cls, names, dict((name, i) for i, name in enumerate(names)), setattrs
+
+
+def _compile_classes(classes, class_paths):
+    """Returns ({frozenset of field names: class spec}, trie) for the given classes & class_paths (either possibly None,
+       as is the corresponding result). The trie is as for include paths, except that the node for the end of a path
+       has the spec of the class (see _class_spec) as its None item."""
+    signatures = None
+    if classes is not None:
+        signatures = {}
+        for cls in classes:
+            spec = _class_spec(cls)
+            signature = frozenset(spec[1])
+            if signature in signatures and signatures[signature][0] is not cls:
+                raise ValueError('Classes %s and %s have the same fields' % (signatures[signature][0].__name__,
+                                                                            cls.__name__))
+            signatures[signature] = spec
+    trie = None
+    if class_paths is not None:
+        trie = {}
+        for path, cls in class_paths.items():
+            node = trie
+            for key in __path_keys(path, 'class_paths'):
+                node = node.setdefault(key, {})
+            node[None] = _class_spec(cls)
+    return signatures, trie
+
+
+def __class_new(spec, members):
+    """Returns instance of the class of spec (see _class_spec) with the given members (dict of field values)"""
+    cls, _, _, setattrs = spec
+    if not setattrs:
+        return cls(**members)
+    obj = cls.__new__(cls)
+    for name, value in members.items():
+        setattr(obj, name, value)
+    return obj
+
+
+def __skip_bytes(fp_read, length):
+    # read in chunks so that skipping a large value does not require a large buffer
+    while length > 0:
+        chunk = min(length, 65536)
+        if len(fp_read(chunk)) < chunk:
+            raise DecoderException('Insufficient input (skipped value)')
+        length -= chunk
+
+
+def __skip_value(fp_read, marker, islittle, ctx):
+    """Consumes value with the given marker without decoding it (e.g. an object member not wanted by
+       include/exclude)"""
+    if marker in (ARRAY_START, OBJECT_START):
+        if ctx.max_depth is not None and ctx.depth >= ctx.max_depth:
+            raise DecoderException('Container nesting exceeds max_depth')
+        ctx.depth += 1
+        __skip_container(fp_read, marker, islittle, ctx)
+        ctx.depth -= 1
+    elif marker in __TYPES_NO_DATA:
+        pass
+    elif marker in (TYPE_STRING, TYPE_HIGH_PREC):
+        __skip_bytes(fp_read, __decode_length(fp_read, fp_read(1), islittle, ctx.ubj, ctx.max_string_length))
+    elif marker in __DTYPELEN_MAP and marker in ctx.method_map:
+        __skip_bytes(fp_read, __DTYPELEN_MAP[marker])
+    else:
+        raise DecoderException('Invalid marker')
+
+
+def __skip_container(fp_read, marker, islittle, ctx):
+    in_mapping = marker == OBJECT_START
+    end = OBJECT_END if in_mapping else ARRAY_END
+    marker, counting, count, type_, _ = __get_container_params(fp_read, in_mapping, False, None, None, False, islittle,
+                                                               ctx)
+    if not in_mapping and type_ in __TYPES_FIXLEN:
+        __skip_bytes(fp_read, count * __DTYPELEN_MAP[type_])
+        return
+    if not in_mapping and type_ in __TYPES_NO_DATA:
+        return
+
+    size = 0
+    count_limit = float('inf') if ctx.max_container_count is None else ctx.max_container_count
+    while count > 0 and (counting or marker != end):
+        if marker == TYPE_NOOP:
+            marker = fp_read(1)
+            continue
+        if not counting:
+            if size >= count_limit:
+                raise DecoderException('Container count exceeds max_container_count')
+            size += 1
+        if in_mapping:
+            __skip_bytes(fp_read, __decode_length(fp_read, marker, islittle, ctx.ubj, ctx.max_string_length))
+            marker = fp_read(1) if type_ == TYPE_NONE else type_
+        __skip_value(fp_read, marker, islittle, ctx)
+        if counting:
+            count -= 1
+        if count > 0:
+            marker = fp_read(1) if (in_mapping or type_ == TYPE_NONE) else type_
+
+
+def __decode_raw(fp_read, marker, islittle, ctx):
+    """Returns RawBJData holding the encoded form of the value with the given (already read) marker"""
+    chunks = [marker]
+
+    def capture(size):
+        raw = fp_read(size)
+        chunks.append(raw)
+        return raw
+
+    __skip_value(capture, marker, islittle, ctx)
+    return RawBJData._from_valid(b''.join(chunks), islittle, DIALECT_UBJSON if ctx.ubj else DIALECT_BJDATA)
+
+
+def __check_container_count(count, ctx):
+    if ctx.max_container_count is not None and count > ctx.max_container_count:
+        raise DecoderException('Container count exceeds max_container_count')
+
+
+def __decode_container(fp_read, marker, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle, ctx):
+    if ctx.raw_depth is not None and ctx.depth >= ctx.raw_depth:
+        return __decode_raw(fp_read, marker, islittle, ctx)
+    if ctx.max_depth is not None and ctx.depth >= ctx.max_depth:
+        raise DecoderException('Container nesting exceeds max_depth')
+    ctx.depth += 1
+    if marker == ARRAY_START:
+        value = __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle, ctx)
+    else:
+        value = __decode_object(fp_read, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle, ctx)
+    ctx.depth -= 1
+    return value
+
+
 def prodlist(mylist):
     result = 1
     for x in mylist: 
          result = result * x
     return result
 
-def __get_container_params(fp_read, in_mapping, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle):
+def __get_container_params(fp_read, in_mapping, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle,
+                           ctx):
     marker = fp_read(1)
     dims = []
     if marker == CONTAINER_TYPE:
         marker = fp_read(1)
-        if marker not in __TYPES:
+        if marker not in (__TYPES_UBJSON if ctx.ubj else __TYPES):
             raise DecoderException('Invalid container type')
         type_ = marker
         marker = fp_read(1)
@@ -261,16 +565,18 @@ def __get_container_params(fp_read, in_mapping, no_bytes, object_hook, object_pa
         type_ = TYPE_NONE
     if marker == CONTAINER_COUNT:
         marker = fp_read(1)
-        if marker == ARRAY_START:
-            dims = __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle)
+        if marker == ARRAY_START and not ctx.ubj:
+            dims = __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle, ctx)
             count = prodlist(dims)
         else:
-            count = __decode_int_non_negative(fp_read, marker, islittle)
+            count = __decode_int_non_negative(fp_read, marker, islittle, ctx.ubj)
+        __check_container_count(count, ctx)
         counting = True
 
-        # special cases (no data (None or bool) / bytes array) will be handled in calling functions
-        if not (type_ in __TYPES_NO_DATA or
-                (type_ == TYPE_UINT8 and not in_mapping and not no_bytes)):
+        # special cases (no data (None or bool) / bytes array) will be handled in calling functions. (Nothing follows
+        # an empty container.)
+        if count > 0 and not (type_ in __TYPES_NO_DATA or
+                              (type_ == TYPE_UINT8 and not in_mapping and not no_bytes)):
             # Reading ahead is just to capture type, which will not exist if type is fixed
             marker = fp_read(1) if (in_mapping or type_ == TYPE_NONE) else type_
 
@@ -284,51 +590,96 @@ def __get_container_params(fp_read, in_mapping, no_bytes, object_hook, object_pa
 
 
 def __decode_object(fp_read, no_bytes, object_hook, object_pairs_hook,  # pylint: disable=too-many-branches
-                    intern_object_keys, islittle):
-    marker, counting, count, type_, dims = __get_container_params(fp_read, True, no_bytes,object_hook, object_pairs_hook,intern_object_keys, islittle)
+                    intern_object_keys, islittle, ctx):
+    marker, counting, count, type_, dims = __get_container_params(fp_read, True, no_bytes,object_hook, object_pairs_hook,intern_object_keys, islittle, ctx)
     has_pairs_hook = object_pairs_hook is not None
-    obj = [] if has_pairs_hook else {}
+    obj = [] if has_pairs_hook else ctx.dict_class()
+    method_map = ctx.method_map
+    ubj = ctx.ubj
+    max_length = ctx.max_string_length
+    node = ctx.filter_node
+    exclude = ctx.exclude_paths
+    raw_node = ctx.raw_node
+    class_node = ctx.class_node
+    # class_paths: class (spec) this object is decoded into
+    spec = None if class_node is None else class_node.get(None)
 
     le=islittle
 
     # special case - no data (None or bool)
     if type_ in __TYPES_NO_DATA:
         value = __METHOD_MAP[type_](fp_read, type_, le)
-        if has_pairs_hook:
-            for _ in range(count):
-                obj.append((__decode_object_key(fp_read, fp_read(1), intern_object_keys, le), value))
-            return object_pairs_hook(obj)
-
-        for _ in range(count):
-            obj[__decode_object_key(fp_read, fp_read(1), intern_object_keys, le)] = value
-        return object_hook(obj)
+        keys = (__decode_object_key(fp_read, fp_read(1), intern_object_keys, le, ubj, max_length)
+                for _ in range(count))
+        if node is not None:
+            keys = [key for key in keys if (node.get(key, True) is not None if exclude else key in node)]
+        for key in keys:
+            if spec is not None and key not in spec[2]:
+                raise DecoderException('Object key is not a field of the class decoded into')
+            if has_pairs_hook:
+                obj.append((key, value))
+            else:
+                obj[key] = value
+        return __end_object(obj, spec, object_hook, object_pairs_hook, ctx)
 
+    # unsized objects are checked as they grow
+    count_limit = float('inf') if ctx.max_container_count is None else ctx.max_container_count
     while count > 0 and (counting or marker != OBJECT_END):
         if marker == TYPE_NOOP:
             marker = fp_read(1)
             continue
 
+        if not counting and len(obj) >= count_limit:
+            raise DecoderException('Container count exceeds max_container_count')
+
         # decode key for object
-        key = __decode_object_key(fp_read, marker, intern_object_keys, le)
+        key = __decode_object_key(fp_read, marker, intern_object_keys, le, ubj, max_length)
         marker = fp_read(1) if type_ == TYPE_NONE else type_
 
-        # decode value
-        try:
-            value = __METHOD_MAP[marker](fp_read, marker, islittle)
-        except KeyError:
-            handled = False
-        else:
+        # include/exclude: None for a key means the end of a path (i.e. the whole value is included/excluded)
+        child = None
+        if node is not None:
+            if key in node:
+                child = node[key]
+                skip = exclude and child is None
+            else:
+                skip = not exclude
+            if skip:
+                __skip_value(fp_read, marker, islittle, ctx)
+                if counting:
+                    count -= 1
+                if count > 0:
+                    marker = fp_read(1)
+                continue
+
+        # decode value (raw_paths: None for a key means the end of a path, i.e. the value is not decoded)
+        if raw_node is not None and key in raw_node and raw_node[key] is None:
+            value = __decode_raw(fp_read, marker, islittle, ctx)
             handled = True
+        else:
+            try:
+                value = method_map[marker](fp_read, marker, islittle)
+            except KeyError:
+                handled = False
+            else:
+                handled = True
 
         # handle outside above except (on KeyError) so do not have unfriendly "exception within except" backtrace
         if not handled:
-            if marker == ARRAY_START:
-                value = __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle)
-            elif marker == OBJECT_START:
-                value = __decode_object(fp_read, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle)
+            if marker in (ARRAY_START, OBJECT_START):
+                ctx.filter_node = child
+                ctx.raw_node = None if raw_node is None else raw_node.get(key)
+                ctx.class_node = None if class_node is None else class_node.get(key)
+                value = __decode_container(fp_read, marker, no_bytes, object_hook, object_pairs_hook, intern_object_keys,
+                                           islittle, ctx)
+                ctx.filter_node = node
+                ctx.raw_node = raw_node
+                ctx.class_node = class_node
             else:
                 raise DecoderException('Invalid marker within object')
 
+        if spec is not None and key not in spec[2]:
+            raise DecoderException('Object key is not a field of the class decoded into')
         if has_pairs_hook:
             obj.append((key, value))
         else:
@@ -338,15 +689,55 @@ def __decode_object(fp_read, no_bytes, object_hook, object_pairs_hook,  # pylint
         if count > 0:
             marker = fp_read(1)
 
-    return object_pairs_hook(obj) if has_pairs_hook else object_hook(obj)
+    return __end_object(obj, spec, object_hook, object_pairs_hook, ctx)
 
 
-def __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle):
-    marker, counting, count, type_, dims = __get_container_params(fp_read, False, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle)
+def __out_of_band_array(obj, buffers):
+    """Returns ndarray viewing the one of buffers the dict obj refers to (see buffer_callback of encoder.dump) or None
+       if obj is not such a reference"""
+    if len(obj) != 3 or BUFFER_KEY_INDEX not in obj or BUFFER_KEY_DTYPE not in obj or BUFFER_KEY_SHAPE not in obj:
+        return None
+    index, dtype, shape = obj[BUFFER_KEY_INDEX], obj[BUFFER_KEY_DTYPE], obj[BUFFER_KEY_SHAPE]
+    if not (isinstance(index, INTEGER_TYPES) and isinstance(dtype, UNICODE_TYPE) and isinstance(shape, list)):
+        raise DecoderException('Invalid out-of-band buffer reference')
+    if not 0 <= index < len(buffers):
+        raise DecoderException('Out-of-band buffer index out of range')
+    # numpy's errors for an unsuitable dtype, shape or buffer are raised as DecoderException
+    try:
+        flat = buffer2numpy(buffers[index], npdtype(dtype))
+        size = reduce(lambda size, dim: size * int(dim), shape, 1)
+    except (TypeError, ValueError) as ex:
+        raise_from(DecoderException('Invalid out-of-band buffer reference'), ex)
+    if flat.size != size:
+        raise DecoderException('Out-of-band buffer size does not match reference')
+    try:
+        return flat.reshape(shape)
+    except (TypeError, ValueError) as ex:
+        raise_from(DecoderException('Invalid out-of-band buffer reference'), ex)
+
+
+def __end_object(obj, spec, object_hook, object_pairs_hook, ctx):
+    """Returns the decoded object for the given members (dict, list of pairs or dict_class instance), i.e. the array
+       viewing the out-of-band buffer it refers to (if buffers set), an instance of the class of spec (if set, see
+       class_paths) or of that matching its keys (see classes), otherwise the result of the object hook."""
+    if ctx.buffers is not None and spec is None and isinstance(obj, dict):
+        array = __out_of_band_array(obj, ctx.buffers)
+        if array is not None:
+            return array
+    if spec is None and ctx.classes is not None:
+        spec = ctx.classes.get(frozenset(obj))
+    if spec is not None:
+        return __class_new(spec, obj if type(obj) is dict else dict(obj))  # pylint: disable=unidiomatic-typecheck
+    return object_pairs_hook(obj) if object_pairs_hook is not None else object_hook(obj)
+
+
+def __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle, ctx):
+    marker, counting, count, type_, dims = __get_container_params(fp_read, False, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle, ctx)
+    method_map = ctx.method_map
 
     # special case - no data (None or bool)
     if type_ in __TYPES_NO_DATA:
-        return [__METHOD_MAP[type_](fp_read, type_, islittle)] * count
+        return (tuple if ctx.array_as_tuple else list)([__METHOD_MAP[type_](fp_read, type_, islittle)] * count)
 
     # special case - bytes array
     if type_ == TYPE_UINT8 and not no_bytes and len(dims)==0:
@@ -356,10 +747,11 @@ def __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_obj
         return container
 
     if type_ in __TYPES_FIXLEN and count>0:
+        packed_read = fp_read if ctx.read_view is None else ctx.read_view
         if hasattr(count, 'dtype'):
-            container = fp_read(count.item()*__DTYPELEN_MAP[type_])
+            container = packed_read(count.item()*__DTYPELEN_MAP[type_])
         else:
-            container = fp_read(count*__DTYPELEN_MAP[type_])
+            container = packed_read(count*__DTYPELEN_MAP[type_])
         if len(container) < count*__DTYPELEN_MAP[type_]:
             raise DecoderException('Container bytes array too short')
 
@@ -372,14 +764,18 @@ def __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_obj
         return container
 
     container = []
+    # unsized arrays are checked as they grow
+    count_limit = float('inf') if ctx.max_container_count is None else ctx.max_container_count
     while count > 0 and (counting or marker != ARRAY_END):
         if marker == TYPE_NOOP:
             marker = fp_read(1)
             continue
+        if not counting and len(container) >= count_limit:
+            raise DecoderException('Container count exceeds max_container_count')
 
         # decode value
         try:
-            value = __METHOD_MAP[marker](fp_read, marker, islittle)
+            value = method_map[marker](fp_read, marker, islittle)
         except KeyError:
             handled = False
         else:
@@ -387,10 +783,9 @@ def __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_obj
 
         # handle outside above except (on KeyError) so do not have unfriendly "exception within except" backtrace
         if not handled:
-            if marker == ARRAY_START:
-                value = __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle)
-            elif marker == OBJECT_START:
-                value = __decode_object(fp_read, no_bytes, object_hook, object_pairs_hook, intern_object_keys, islittle)
+            if marker in (ARRAY_START, OBJECT_START):
+                value = __decode_container(fp_read, marker, no_bytes, object_hook, object_pairs_hook, intern_object_keys,
+                                           islittle, ctx)
             else:
                 raise DecoderException('Invalid marker within array')
 
@@ -403,15 +798,38 @@ def __decode_array(fp_read, no_bytes, object_hook, object_pairs_hook, intern_obj
     if len(dims)>0:
         container=list(reduce(lambda x, y: map(list, zip(*y*(x,))), (iter(container), ) +tuple(dims[:0:-1])))
         container=ndarray(container, dtype=npdtype(__DTYPE_MAP[type_]))
+    else:
+        if ctx.array_as_tuple:
+            container = tuple(container)
+        if ctx.records_rows:
+            container = __rows_from_records(container, ctx)
 
     return container
 
 
+def __rows_from_records(container, ctx):
+    """Returns (keys, rows) if all items of container are (non-empty) dicts with the same keys in the same order,
+       otherwise container itself."""
+    if not container:
+        return container
+    first = container[0]
+    if type(first) is not dict or not first:  # pylint: disable=unidiomatic-typecheck
+        return container
+    keys = tuple(first)
+    for item in container:
+        if type(item) is not dict or len(item) != len(keys) or tuple(item) != keys:  # pylint: disable=unidiomatic-typecheck
+            return container
+    return keys, (tuple if ctx.array_as_tuple else list)(tuple(item.values()) for item in container)
+
+
 def __object_hook_noop(obj):
     return obj
 
 
-def load(fp, no_bytes=False, object_hook=None, object_pairs_hook=None, intern_object_keys=False, islittle=True):
+def load(fp, no_bytes=False, object_hook=None, object_pairs_hook=None, intern_object_keys=False, islittle=True,
+         dialect=DIALECT_BJDATA, max_container_count=None, max_total_bytes=None, max_depth=None,
+         max_string_length=None, dict_class=None, array_as='list', records=None, include=None, exclude=None,
+         raw_depth=None, raw_paths=None, classes=None, class_paths=None, buffers=None, zero_copy=False):
     """Decodes and returns BJData/UBJSON from the given file-like object
 
     Args:
@@ -433,6 +851,92 @@ def load(fp, no_bytes=False, object_hook=None, object_pairs_hook=None, intern_ob
         islittle (1 or 0): default is 1 for little-endian for all numerics (for 
                             BJData Draft 2), change to 0 to use big-endian
                             (for UBJSON for BJData Draft 1)
+        dialect (str): Wire format to accept, either 'bjdata' (default) or
+                       'ubjson'. In the latter case uint16/32/64 and float16
+                       markers as well as ND-array dimensions are rejected.
+        max_container_count (int): If set, the maximum number of values in
+                                   any one array or object (including the
+                                   number of elements of an ND-array).
+        max_total_bytes (int): If set, the maximum number of bytes to read
+                               from fp.
+        max_depth (int): If set, the maximum nesting depth of containers.
+        max_string_length (int): If set, the maximum length (in bytes) of any
+                                 string, high-precision number or object key.
+        dict_class (callable): If set, objects are decoded by calling this
+                               without arguments and then setting each key
+                               on the result (e.g. OrderedDict). Unlike
+                               object_pairs_hook, no intermediate list of
+                               pairs is created. Cannot be combined with
+                               object_pairs_hook.
+        array_as (str): Whether to decode arrays as 'list' (default) or as
+                        'tuple'. Does not apply to typed arrays decoded as
+                        bytes or numpy arrays.
+        records (str): If set to 'rows', any (non-empty) array whose items
+                       are all (non-empty) dicts with the same keys in the
+                       same order is decoded as a (keys, rows) tuple instead,
+                       where keys is a tuple of the object keys and rows a
+                       list (or tuple, see array_as) of value tuples. This
+                       saves memory for large tables of records. Objects not
+                       decoded as dict (see object_hook & dict_class) are
+                       never treated as records.
+        include (iterable): If set, only object members on (or below) one
+                            of these paths are decoded. Each path is either
+                            a str of '.'-separated keys (e.g. 'a.b') or a
+                            sequence of keys (e.g. ('a', 'b')). Paths start
+                            at the top-level object and arrays are
+                            transparent, i.e. for an array of records 'a'
+                            keeps member 'a' of each record. Any other
+                            member is skipped without being decoded (so its
+                            contents are only checked as far as required to
+                            find its end).
+        exclude (iterable): Like include, except that object members on the
+                            given paths are skipped (and all others decoded).
+                            Cannot be combined with include.
+        raw_depth (int): If set, containers nested deeper than this (with
+                         the outermost one being at depth 1) are not
+                         decoded but returned as RawBJData, which holds
+                         their encoded form and is written as-is by dump()
+                         and dumpb(). E.g. with raw_depth=1 only the members
+                         of the top-level container are decoded. Unlike
+                         max_depth this is not an error.
+        raw_paths (iterable): If set, object members on these paths (see
+                              include) are returned as RawBJData (whatever
+                              their type).
+        classes (iterable): If set, any object whose keys are exactly the
+                            fields of one of these classes is decoded into
+                            an instance of it (instead of a dict, i.e.
+                            without calling object_hook). Namedtuples,
+                            dataclasses & attrs classes are called with the
+                            fields as keyword arguments, other classes using
+                            __slots__ are created without calling __init__
+                            and their slots set. The values are stored
+                            directly, i.e. no intermediate dict is created
+                            (except for the first of an array of objects).
+                            Cannot be combined with object_pairs_hook or
+                            dict_class.
+        class_paths (mapping): If set, objects which are members on one of
+                               these paths (see include) are decoded into
+                               an instance of the class the path maps to
+                               (as for classes). Keys which are not a field
+                               of the class are an error whereas missing
+                               fields are left to the class (e.g. to use
+                               their default). Takes precedence over
+                               classes.
+        buffers (iterable): If set, the bytes-like objects holding the
+                            payloads passed out-of-band when encoding (see
+                            buffer_callback of dump), in the order passed.
+                            Objects referring to one of these are decoded as
+                            a numpy array viewing it (i.e. without copying).
+                            This only applies to objects decoded as dict.
+        zero_copy (bool): If set, numpy arrays (from packed arrays) are
+                          decoded as views of the input rather than copies,
+                          i.e. keeping the input's buffer exported for as
+                          long as they exist (and being read-only if the
+                          input is). Only applies to loadb(), for arrays
+                          lying within a single input segment.
+
+    Limits are checked before anything is allocated based on a size read from
+    the input, so they should be set when decoding untrusted input.
 
     Returns:
         Decoded object
@@ -470,28 +974,80 @@ def load(fp, no_bytes=False, object_hook=None, object_pairs_hook=None, intern_ob
         | null                             | None          |
         +----------------------------------+---------------+
     """
+    if dict_class is None:
+        dict_class = dict
+    elif dict_class is not dict:
+        if not callable(dict_class):
+            raise TypeError('dict_class must be callable')
+        if object_pairs_hook is not None:
+            raise ValueError('dict_class and object_pairs_hook are mutually exclusive')
+    if array_as not in ('list', 'tuple'):
+        raise ValueError("Unsupported array_as '%s' (expected 'list' or 'tuple')" % array_as)
+    if records not in (None, 'rows'):
+        raise ValueError("Unsupported records '%s' (expected None or 'rows')" % records)
+    path_filter = None
+    if include is not None:
+        if exclude is not None:
+            raise ValueError('include and exclude are mutually exclusive')
+        path_filter = __compile_paths(include, 'include')
+    elif exclude is not None:
+        path_filter = __compile_paths(exclude, 'exclude')
+    if raw_depth is not None and raw_depth < 0:
+        raise ValueError('raw_depth must be non-negative')
+    if raw_paths is not None:
+        raw_paths = __compile_paths(raw_paths, 'raw_paths')
+    if classes is not None and (object_pairs_hook is not None or dict_class is not dict):
+        raise ValueError('classes cannot be combined with object_pairs_hook or dict_class')
+    classes, class_paths = _compile_classes(classes, class_paths)
     if object_pairs_hook is None and object_hook is None:
         object_hook = __object_hook_noop
 
     if not callable(fp.read):
         raise TypeError('fp.read not callable')
     fp_read = fp.read
+    if dialect not in (DIALECT_BJDATA, DIALECT_UBJSON):
+        raise ValueError("Unsupported dialect '%s' (expected 'bjdata' or 'ubjson')" % dialect)
+    for name, limit in (('max_container_count', max_container_count), ('max_total_bytes', max_total_bytes),
+                        ('max_depth', max_depth), ('max_string_length', max_string_length)):
+        if limit is not None and limit < 0:
+            raise ValueError('%s must be non-negative' % name)
+    ubj = dialect == DIALECT_UBJSON
+    method_map = __METHOD_MAP_UBJSON if ubj else __METHOD_MAP
+    if max_string_length is not None:
+        method_map = dict(method_map)
+        method_map[TYPE_HIGH_PREC] = lambda fp_read, marker, le: __decode_high_prec(fp_read, marker, le, ubj,
+                                                                                    max_string_length)
+        method_map[TYPE_STRING] = lambda fp_read, marker, le: __decode_string(fp_read, marker, le, ubj,
+                                                                              max_string_length)
+    read_view = getattr(fp, 'read_view', None) if zero_copy else None
+    if max_total_bytes is not None:
+        fp_read = _LimitedReader(fp_read, max_total_bytes, read_view)
+        if read_view is not None:
+            read_view = fp_read.view
+    ctx = _DecoderContext(ubj, method_map, max_container_count=max_container_count,
+                          max_string_length=max_string_length, max_depth=max_depth, dict_class=dict_class,
+                          array_as_tuple=(array_as == 'tuple'), records_rows=(records == 'rows'),
+                          path_filter=path_filter, exclude_paths=(exclude is not None), raw_depth=raw_depth,
+                          raw_paths=raw_paths, classes=classes, class_paths=class_paths,
+                          buffers=(None if buffers is None else tuple(buffers)), read_view=read_view)
 
     newobj=[]
 
     while True:
+        # input might end exactly at limit
+        if newobj and max_total_bytes is not None and fp_read.remaining == 0:
+            break
         marker = fp_read(1)
         if len(marker) == 0:
             break
         try:
             try:
-                return __METHOD_MAP[marker](fp_read, marker, islittle)
+                return method_map[marker](fp_read, marker, islittle)
             except KeyError:
                 pass
-            if marker == ARRAY_START:
-                newobj.append(__decode_array(fp_read, bool(no_bytes), object_hook, object_pairs_hook, intern_object_keys, islittle))
-            if marker == OBJECT_START:
-                newobj.append(__decode_object(fp_read, bool(no_bytes), object_hook, object_pairs_hook, intern_object_keys, islittle))
+            if marker in (ARRAY_START, OBJECT_START):
+                newobj.append(__decode_container(fp_read, marker, bool(no_bytes), object_hook, object_pairs_hook,
+                                                 intern_object_keys, islittle, ctx))
             raise DecoderException('Invalid marker')
         except DecoderException as ex:
             if len(newobj)>0:
@@ -505,9 +1061,248 @@ def load(fp, no_bytes=False, object_hook=None, object_pairs_hook=None, intern_ob
 
     return newobj;
 
-def loadb(chars, no_bytes=False, object_hook=None, object_pairs_hook=None, intern_object_keys=False, islittle=True):
-    """Decodes and returns BJData/UBJSON from the given bytes or bytesarray object. See
-       load() for available arguments."""
-    with BytesIO(chars) as fp:
+def loadb(chars, no_bytes=False, object_hook=None, object_pairs_hook=None, intern_object_keys=False, islittle=True,
+          dialect=DIALECT_BJDATA, max_container_count=None, max_total_bytes=None, max_depth=None,
+          max_string_length=None, dict_class=None, array_as='list', records=None, include=None, exclude=None,
+          raw_depth=None, raw_paths=None, classes=None, class_paths=None, buffers=None, zero_copy=False):
+    """Decodes and returns BJData/UBJSON from the given bytes or bytesarray object, or from a list (or tuple) of such
+       segments without joining them first (e.g. as received in parts from a socket). See load() for available
+       arguments."""
+    if isinstance(chars, (list, tuple)):
+        fp = _SegmentReader(chars)
+    else:
+        fp = _SegmentReader([chars]) if zero_copy else BytesIO(chars)
+    with fp:
         return load(fp, no_bytes=no_bytes, object_hook=object_hook, object_pairs_hook=object_pairs_hook,
-                    intern_object_keys=intern_object_keys, islittle=islittle)
+                    intern_object_keys=intern_object_keys, islittle=islittle, dialect=dialect,
+                    max_container_count=max_container_count, max_total_bytes=max_total_bytes, max_depth=max_depth,
+                    max_string_length=max_string_length, dict_class=dict_class, array_as=array_as,
+                    records=records, include=include, exclude=exclude, raw_depth=raw_depth, raw_paths=raw_paths,
+                    classes=classes, class_paths=class_paths, buffers=buffers, zero_copy=zero_copy)
+
+
+
+# Struct (little-, big-endian) for each fixed length type, as used by validate()
+__VALIDATE_FIXLEN = {marker: [Struct('>' + __DTYPE_MAP[marker]), Struct('<' + __DTYPE_MAP[marker])]
+                     for marker in __TYPES_FIXLEN}
+__TYPES_FIXLEN_UBJSON = __TYPES_FIXLEN & __TYPES_UBJSON
+# largest count/length which can be decoded
+__VALIDATE_MAX_COUNT = 2 ** 63 - 1
+# high precision number as accepted by Decimal, except for surrounding whitespace, underscores and non-ASCII digits
+__VALIDATE_DECIMAL = re_compile(br'[+-]?(?:(?:[0-9]+\.?[0-9]*|\.[0-9]+)(?:e[+-]?[0-9]+)?|inf(?:inity)?|s?nan[0-9]*)\Z',
+                                IGNORECASE)
+
+
+class _InvalidAt(Exception):
+    """Used internally by validate() to signal the offset of the first invalid item."""
+
+
+def __validate_count(chars, pos, int_types, le, limit, marker=None):
+    """Returns count/length at pos and the position following it. The integer marker is read from the input unless
+    given (e.g. for typed ND-array dimensions)."""
+    start = pos
+    if marker is None:
+        marker = chars[pos:pos + 1]
+        pos += 1
+    if marker not in int_types:
+        raise _InvalidAt(start)
+    unpack = __VALIDATE_FIXLEN[marker][le]
+    if pos + unpack.size > len(chars):
+        raise _InvalidAt(start)
+    value = unpack.unpack_from(chars, pos)[0]
+    if not 0 <= value <= limit:
+        raise _InvalidAt(start)
+    return value, pos + unpack.size
+
+
+def __validate_utf8(chars, pos, length):
+    """Returns the position following the UTF-8 string of the given length at pos"""
+    if pos + length > len(chars):
+        raise _InvalidAt(pos)
+    try:
+        chars[pos:pos + length].decode('utf-8')
+    except UnicodeDecodeError as ex:
+        raise _InvalidAt(pos + ex.start)
+    return pos + length
+
+
+def __validate_high_prec(chars, pos, length):
+    """Returns the position following the high precision number of the given length at pos"""
+    if pos + length > len(chars) or not __VALIDATE_DECIMAL.match(chars, pos, pos + length):
+        raise _InvalidAt(pos)
+    return pos + length
+
+
+def __validate_container_params(chars, pos, in_mapping, ubj, le, limit):
+    """Returns type, count (None if not counted), whether the container is an ND-array and the position following the
+    container parameters (starting at pos)"""
+    int_types = __TYPES_INT_UBJSON if ubj else __TYPES_INT
+    type_ = TYPE_NONE
+    count = None
+    nd_array = False
+    if chars[pos:pos + 1] == CONTAINER_TYPE:
+        type_ = chars[pos + 1:pos + 2]
+        if type_ not in (__TYPES_UBJSON if ubj else __TYPES):
+            raise _InvalidAt(pos + 1)
+        pos += 2
+    if chars[pos:pos + 1] == CONTAINER_COUNT:
+        pos += 1
+        # ND-array dimensions (BJData arrays only)
+        if chars[pos:pos + 1] == ARRAY_START and not (ubj or in_mapping):
+            dims_pos = pos
+            ndim = 0
+            count = 1
+            pos += 1
+            dim_type = None
+            if chars[pos:pos + 1] == CONTAINER_TYPE:
+                dim_type = chars[pos + 1:pos + 2]
+                if chars[pos + 2:pos + 3] != CONTAINER_COUNT:
+                    raise _InvalidAt(pos + 2)
+                pos += 2
+            # typed or untyped with count
+            if chars[pos:pos + 1] == CONTAINER_COUNT:
+                ndim, pos = __validate_count(chars, pos + 1, int_types, le, limit)
+                for _ in range(ndim):
+                    length, pos = __validate_count(chars, pos, int_types, le, limit, dim_type)
+                    count *= length
+                    if count > limit:
+                        raise _InvalidAt(dims_pos)
+            else:
+                while chars[pos:pos + 1] != ARRAY_END:
+                    length, pos = __validate_count(chars, pos, int_types, le, limit)
+                    count *= length
+                    if count > limit:
+                        raise _InvalidAt(dims_pos)
+                    ndim += 1
+                pos += 1
+            nd_array = ndim > 0
+            if nd_array and type_ != TYPE_NONE and type_ not in __TYPES_FIXLEN:
+                raise _InvalidAt(dims_pos)
+        else:
+            count, pos = __validate_count(chars, pos, int_types, le, limit)
+    elif type_ != TYPE_NONE:
+        raise _InvalidAt(pos)
+    return type_, count, nd_array, pos
+
+
+def __validate(chars, max_depth, limit, ubj, le):  # pylint: disable=too-many-branches,too-many-statements
+    int_types = __TYPES_INT_UBJSON if ubj else __TYPES_INT
+    fixlen_types = __TYPES_FIXLEN_UBJSON if ubj else __TYPES_FIXLEN
+    # open containers: [is object, container type, remaining count (None if not counted)]
+    stack = []
+    marker_pos = 0
+    marker = chars[0:1]
+    if not marker:
+        raise _InvalidAt(0)
+    pos = 1
+
+    while True:
+        # validate value (marker at marker_pos, data from pos)
+        if marker in fixlen_types:
+            size = __VALIDATE_FIXLEN[marker][le].size
+            if pos + size > len(chars):
+                raise _InvalidAt(pos)
+            if marker == TYPE_CHAR and ord(chars[pos:pos + 1]) >= 0x80:
+                raise _InvalidAt(pos)
+            pos += size
+        elif marker in __TYPES_NO_DATA:
+            pass
+        elif marker == TYPE_STRING:
+            length, pos = __validate_count(chars, pos, int_types, le, limit)
+            pos = __validate_utf8(chars, pos, length)
+        elif marker == TYPE_HIGH_PREC:
+            length, pos = __validate_count(chars, pos, int_types, le, limit)
+            pos = __validate_high_prec(chars, pos, length)
+        elif marker == ARRAY_START or marker == OBJECT_START:
+            if max_depth is not None and len(stack) >= max_depth:
+                raise _InvalidAt(marker_pos)
+            in_mapping = marker == OBJECT_START
+            type_, count, nd_array, pos = __validate_container_params(chars, pos, in_mapping, ubj, le, limit)
+            if not in_mapping and count is not None and (type_ in __TYPES_FIXLEN or type_ in __TYPES_NO_DATA):
+                # packed (or no data) array
+                if type_ in __TYPES_FIXLEN:
+                    size = count * __VALIDATE_FIXLEN[type_][le].size
+                    if pos + size > len(chars):
+                        raise _InvalidAt(pos)
+                    pos += size
+            else:
+                stack.append([in_mapping, type_, count])
+        else:
+            raise _InvalidAt(marker_pos)
+
+        # find next value
+        while True:
+            if not stack:
+                return None
+            frame = stack[-1]
+            in_mapping, type_, count = frame
+            if count == 0:
+                stack.pop()
+                continue
+            if not in_mapping and type_ != TYPE_NONE:
+                marker_pos = pos
+                marker = type_
+                frame[2] -= 1
+                break
+            marker_pos = pos
+            marker = chars[pos:pos + 1]
+            if not marker:
+                raise _InvalidAt(pos)
+            pos += 1
+            if marker == TYPE_NOOP and not (in_mapping and count is not None and type_ in __TYPES_NO_DATA):
+                continue
+            if count is None and marker == (OBJECT_END if in_mapping else ARRAY_END):
+                stack.pop()
+                continue
+            if in_mapping:
+                length, pos = __validate_count(chars, marker_pos, int_types, le, limit)
+                pos = __validate_utf8(chars, pos, length)
+                if type_ == TYPE_NONE:
+                    marker_pos = pos
+                    marker = chars[pos:pos + 1]
+                    if not marker:
+                        raise _InvalidAt(pos)
+                    pos += 1
+                else:
+                    marker_pos = pos
+                    marker = type_
+            if count is not None:
+                frame[2] -= 1
+            break
+
+
+def validate(chars, max_depth=None, max_size=None, islittle=True, dialect=DIALECT_BJDATA):
+    """Checks whether the given bytes-like object starts with a valid BJData/UBJSON value without decoding it.
+
+    Args:
+        chars: bytes-like object to check
+        max_depth (int): Maximum container nesting depth (None for no limit)
+        max_size (int): Maximum number of bytes the value may occupy. Any
+                        length or container count exceeding this is also
+                        treated as invalid (None for no limit).
+        islittle (1 or 0): See load()
+        dialect (str): See load()
+
+    Returns:
+        None if valid, otherwise the byte offset of the first invalid item,
+        i.e. the offending marker, length, payload or (for strings) the
+        start of the invalid UTF-8 sequence. Like loadb(), any data following
+        the first value is ignored. High precision numbers have to be decimal
+        number strings as accepted by Decimal, though without surrounding
+        whitespace, underscores or non-ASCII digits.
+    """
+    if isinstance(chars, UNICODE_TYPE):
+        raise TypeError('chars must be a bytes-like object, not str')
+    if dialect not in (DIALECT_BJDATA, DIALECT_UBJSON):
+        raise ValueError("Unsupported dialect '%s' (expected 'bjdata' or 'ubjson')" % dialect)
+    for name, value in (('max_depth', max_depth), ('max_size', max_size)):
+        if value is not None and value < 0:
+            raise ValueError('%s must be non-negative' % name)
+    chars = memoryview(chars).tobytes()
+    if max_size is not None:
+        chars = chars[:max_size]
+    limit = __VALIDATE_MAX_COUNT if max_size is None else min(max_size, __VALIDATE_MAX_COUNT)
+    try:
+        return __validate(chars, max_depth, limit, dialect == DIALECT_UBJSON, 1 if islittle else 0)
+    except _InvalidAt as ex:
+        return ex.args[0]
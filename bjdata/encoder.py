@@ -20,12 +20,15 @@ from struct import pack, Struct
 from decimal import Decimal
 from io import BytesIO
 from math import isinf, isnan
+from itertools import islice
 
-from .compat import Mapping, Sequence, INTEGER_TYPES, UNICODE_TYPE, TEXT_TYPES, BYTES_TYPES
+from .compat import Mapping, Sequence, Iterator, INTEGER_TYPES, UNICODE_TYPE, TEXT_TYPES, BYTES_TYPES, RANGE_TYPE
+from .raw import RawBJData
 from .markers import (TYPE_NULL, TYPE_BOOL_TRUE, TYPE_BOOL_FALSE, TYPE_INT8, TYPE_UINT8, TYPE_INT16, TYPE_INT32,
                       TYPE_INT64, TYPE_UINT16, TYPE_UINT32, TYPE_UINT64, TYPE_FLOAT16, TYPE_FLOAT32, 
 		      TYPE_FLOAT64, TYPE_HIGH_PREC, TYPE_CHAR, TYPE_STRING, OBJECT_START,
-                      OBJECT_END, ARRAY_START, ARRAY_END, CONTAINER_TYPE, CONTAINER_COUNT)
+                      OBJECT_END, ARRAY_START, ARRAY_END, CONTAINER_TYPE, CONTAINER_COUNT, DIALECT_BJDATA,
+                      DIALECT_UBJSON, TYPE_NOOP, BUFFER_KEY_INDEX, BUFFER_KEY_DTYPE, BUFFER_KEY_SHAPE)
 
 # Lookup tables for encoding small intergers, pre-initialised larger integer & float packers
 __SMALL_INTS_ENCODED = [{i: TYPE_INT8 + pack('>b', i) for i in range(-128, 128)}, {i: TYPE_INT8 + pack('<b', i) for i in range(-128, 128)}]
@@ -56,28 +59,154 @@ __DTYPE_TO_MARKER = {
     'S1' : TYPE_CHAR
 }
 
+# dtypes without a UBJSON (Draft 12) equivalent
+__DTYPES_NOT_UBJSON = frozenset(('u2', 'u4', 'u8', 'f2'))
+
+# Integer types (and their struct format) which a range can be written as packed array of (see __encode_range), smallest
+# first. Not uint8 since such an array is decoded as bytes.
+__RANGE_TYPES = ((TYPE_INT8, 'b', -2 ** 7, 2 ** 7), (TYPE_UINT16, 'H', 0, 2 ** 16), (TYPE_UINT32, 'I', 0, 2 ** 32),
+                 (TYPE_UINT64, 'Q', 0, 2 ** 63), (TYPE_INT16, 'h', -2 ** 15, 2 ** 15),
+                 (TYPE_INT32, 'i', -2 ** 31, 2 ** 31), (TYPE_INT64, 'q', -2 ** 63, 2 ** 63))
+__RANGE_TYPES_UBJSON = tuple(entry for entry in __RANGE_TYPES
+                             if entry[0] not in (TYPE_UINT16, TYPE_UINT32, TYPE_UINT64))
+# number of values of a range packed at a time
+__RANGE_CHUNK = 512
+
+# Exact types of values which an object can be typed by (see __typed_object_type)
+__TYPED_OBJECT_VALUE_TYPES = frozenset(INTEGER_TYPES + (float,)) - frozenset((bool,))
+# Integer types (and their struct format) which values of an object can be written as, narrowest first
+__TYPED_OBJECT_INT_TYPES = ((TYPE_UINT8, 'B', 0, 2 ** 8), (TYPE_INT8, 'b', -2 ** 7, 2 ** 7),
+                            (TYPE_UINT16, 'H', 0, 2 ** 16), (TYPE_INT16, 'h', -2 ** 15, 2 ** 15),
+                            (TYPE_UINT32, 'I', 0, 2 ** 32), (TYPE_INT32, 'i', -2 ** 31, 2 ** 31),
+                            (TYPE_UINT64, 'Q', 0, 2 ** 63), (TYPE_INT64, 'q', -2 ** 63, 2 ** 63))
+__TYPED_OBJECT_INT_TYPES_UBJSON = tuple(entry for entry in __TYPED_OBJECT_INT_TYPES
+                                        if entry[0] not in (TYPE_UINT16, TYPE_UINT32, TYPE_UINT64))
+
+# Placeholder for count of an iterator (with container_count), patched once exhausted (see __encode_array)
+__COUNT_SLOT = CONTAINER_COUNT + TYPE_INT64 + b'\x00' * 8
+
+# Payloads of at least this size are referenced rather than copied by dumpb_iov
+__SEGMENT_VIEW_MIN_SIZE = 1024
+
+# Numpy arrays with payloads of at least this size are passed out-of-band if buffer_callback is set (see dump)
+__OUT_OF_BAND_MIN_SIZE = 1024
+
 # Prefix applicable to specialised byte array container
 __BYTES_ARRAY_PREFIX = ARRAY_START + CONTAINER_TYPE + TYPE_UINT8 + CONTAINER_COUNT
 
+# Exact types which are never looked up in encoders (see dump), i.e. always encoded as per the type table
+__PLAIN_TYPES = frozenset((UNICODE_TYPE, float, list, dict, tuple, bool, type(None), bytes, bytearray) + INTEGER_TYPES)
+
 
 class EncoderException(TypeError):
     """Raised when encoding of an object fails."""
 
 
-def __encode_decimal(fp_write, item, le=1):
+def namedtuple_as_object(obj):
+    """Encoder (see dump()) for encoding a namedtuple as an object (rather than as an array), e.g.
+    encoders={Point: namedtuple_as_object}"""
+    return obj._asdict()
+
+
+def slots_as_object(obj):
+    """Encoder (see dump()) for encoding an instance of a class using __slots__ as an object of all its slots (including
+    those of base classes), e.g. encoders={Point: slots_as_object}. Unset slots are an error."""
+    return dict((name, getattr(obj, name)) for name in _field_names(type(obj), True))
+
+
+def _field_names(cls, slots=False):
+    """Returns tuple of the names of the fields of the given dataclass or attrs class (None if neither) or, if slots is
+    set, of all __slots__ of the class (and its bases)"""
+    if slots:
+        names = []
+        for base in reversed(cls.__mro__):
+            base_slots = base.__dict__.get('__slots__', ())
+            for name in (base_slots,) if isinstance(base_slots, TEXT_TYPES) else base_slots:
+                if name.startswith('__') and not name.endswith('__'):
+                    name = '_%s%s' % (base.__name__.lstrip('_'), name)
+                if name not in ('__dict__', '__weakref__') and name not in names:
+                    names.append(name)
+        return tuple(names)
+    if hasattr(cls, '__dataclass_fields__'):
+        from dataclasses import fields
+        return tuple(field.name for field in fields(cls))
+    if hasattr(cls, '__attrs_attrs__'):
+        return tuple(attr.name for attr in cls.__attrs_attrs__)
+    return None
+
+
+def __import_optional(module, name):
+    try:
+        return getattr(__import__(module), name)
+    except ImportError:
+        return None
+
+
+def __builtin_type_encoder(cls):
+    """Returns the built-in encoder (see dump()) for the given type, if any"""
+    names = _field_names(cls)
+    if names is not None:
+        return lambda obj: dict((name, getattr(obj, name)) for name in names)
+    enum_type = __import_optional('enum', 'Enum')
+    if enum_type is not None and issubclass(cls, enum_type):
+        return lambda obj: obj.value
+    for module, name in (('uuid', 'UUID'), ('pathlib', 'PurePath')):
+        str_type = __import_optional(module, name)
+        if str_type is not None and issubclass(cls, str_type):
+            return UNICODE_TYPE
+    return None
+
+
+def __type_encoders(encoders, builtin):
+    """Returns a function mapping a type to its encoder (or None), i.e. the one registered in encoders for it or its
+    closest base class, otherwise any built-in one (if builtin is set). Results are cached, i.e. each type is only
+    resolved once."""
+    resolved = {}
+
+    def type_encoder(cls):
+        try:
+            return resolved[cls]
+        except KeyError:
+            pass
+        for base in getattr(cls, '__mro__', (cls,)):
+            if base in encoders:
+                handler = encoders[base]
+                break
+        else:
+            handler = __builtin_type_encoder(cls) if builtin else None
+        resolved[cls] = handler
+        return handler
+
+    return type_encoder
+
+
+def __encode_decimal(fp_write, item, le=1, ubj=False):
     if item.is_finite():
         fp_write(TYPE_HIGH_PREC)
         encoded_val = str(item).encode('utf-8')
-        __encode_int(fp_write, len(encoded_val), le)
+        __encode_int(fp_write, len(encoded_val), le, ubj)
         fp_write(encoded_val)
     else:
         fp_write(TYPE_NULL)
 
 
-def __encode_int(fp_write, item, le=1):
+def __encode_int(fp_write, item, le=1, ubj=False):
     if item >= 0:
         if item < 2 ** 8:
             fp_write(__SMALL_UINTS_ENCODED[le][item])
+        elif ubj:
+            # UBJSON only has uint8, so larger values use the signed types
+            if item < 2 ** 15:
+                fp_write(TYPE_INT16)
+                fp_write(__PACK_INT16[le](item))
+            elif item < 2 ** 31:
+                fp_write(TYPE_INT32)
+                fp_write(__PACK_INT32[le](item))
+            elif item < 2 ** 63:
+                fp_write(TYPE_INT64)
+                fp_write(__PACK_INT64[le](item))
+            else:
+                __encode_decimal(fp_write, Decimal(item), le, ubj)
         elif item < 2 ** 16:
             fp_write(TYPE_UINT16)
             fp_write(__PACK_UINT16[le](item))
@@ -88,7 +217,7 @@ def __encode_int(fp_write, item, le=1):
             fp_write(TYPE_UINT64)
             fp_write(__PACK_UINT64[le](item))
         else:
-            __encode_decimal(fp_write, Decimal(item), le)
+            __encode_decimal(fp_write, Decimal(item), le, ubj)
     elif item >= -(2 ** 7):
         fp_write(__SMALL_INTS_ENCODED[le][item])
     elif item >= -(2 ** 15):
@@ -101,10 +230,10 @@ def __encode_int(fp_write, item, le=1):
         fp_write(TYPE_INT64)
         fp_write(__PACK_INT64[le](item))
     else:
-        __encode_decimal(fp_write, Decimal(item), le)
+        __encode_decimal(fp_write, Decimal(item), le, ubj)
 
 
-def __encode_float(fp_write, item, le=1):
+def __encode_float(fp_write, item, le=1, ubj=False):
     if 1.18e-38 <= abs(item) <= 3.4e38 or item == 0:
         fp_write(TYPE_FLOAT32)
         fp_write(__PACK_FLOAT32[le](item))
@@ -112,13 +241,17 @@ def __encode_float(fp_write, item, le=1):
         fp_write(TYPE_FLOAT64)
         fp_write(__PACK_FLOAT64[le](item))
     elif isinf(item) or isnan(item):
-        fp_write(TYPE_FLOAT32)
-        fp_write(__PACK_FLOAT32[le](item))
+        if ubj:
+            # UBJSON does not allow non-finite numbers
+            fp_write(TYPE_NULL)
+        else:
+            fp_write(TYPE_FLOAT32)
+            fp_write(__PACK_FLOAT32[le](item))
     else:
-        __encode_decimal(fp_write, Decimal(item), le)
+        __encode_decimal(fp_write, Decimal(item), le, ubj)
 
 
-def __encode_float64(fp_write, item, le=1):
+def __encode_float64(fp_write, item, le=1, ubj=False):
     if 2.23e-308 <= abs(item) < 1.8e308:
         fp_write(TYPE_FLOAT64)
         fp_write(__PACK_FLOAT64[le](item))
@@ -126,13 +259,16 @@ def __encode_float64(fp_write, item, le=1):
         fp_write(TYPE_FLOAT32)
         fp_write(__PACK_FLOAT32[le](item))
     elif isinf(item) or isnan(item):
-        fp_write(TYPE_FLOAT64)
-        fp_write(__PACK_FLOAT64[le](item))
+        if ubj:
+            fp_write(TYPE_NULL)
+        else:
+            fp_write(TYPE_FLOAT64)
+            fp_write(__PACK_FLOAT64[le](item))
     else:
-        __encode_decimal(fp_write, Decimal(item), le)
+        __encode_decimal(fp_write, Decimal(item), le, ubj)
 
 
-def __encode_string(fp_write, item, le=1):
+def __encode_string(fp_write, item, le=1, ubj=False):
     encoded_val = item.encode('utf-8')
     length = len(encoded_val)
     if length == 1:
@@ -142,26 +278,35 @@ def __encode_string(fp_write, item, le=1):
         if length < 2 ** 8:
             fp_write(__SMALL_UINTS_ENCODED[le][length])
         else:
-            __encode_int(fp_write, length, le)
+            __encode_int(fp_write, length, le, ubj)
     fp_write(encoded_val)
 
 
-def __encode_bytes(fp_write, item, le=1):
+def __encode_bytes(fp_write, item, le=1, ubj=False):
     fp_write(__BYTES_ARRAY_PREFIX)
     length = len(item)
     if length < 2 ** 8:
         fp_write(__SMALL_UINTS_ENCODED[le][length])
     else:
-        __encode_int(fp_write, length, le)
+        __encode_int(fp_write, length, le, ubj)
     fp_write(item)
     # no ARRAY_END since length was specified
 
 
-def __encode_value(fp_write, item, seen_containers, container_count, sort_keys, no_float32, islittle, default):
+def __encode_value(fp_write, item, seen_containers, container_count, sort_keys, no_float32, islittle, default, ubj,
+                   type_encoder, seekable_fp, typed_objects, align, out_of_band):
     le=islittle
 
+    # types with a registered or built-in encoder take precedence
+    if type(item) not in __PLAIN_TYPES:
+        handler = type_encoder(type(item))
+        if handler is not None:
+            __encode_value(fp_write, handler(item), seen_containers, container_count, sort_keys, no_float32, islittle,
+                           default, ubj, type_encoder, seekable_fp, typed_objects, align, out_of_band)
+            return
+
     if isinstance(item, UNICODE_TYPE):
-        __encode_string(fp_write, item, le)
+        __encode_string(fp_write, item, le, ubj)
 
     elif item is None:
         fp_write(TYPE_NULL)
@@ -173,59 +318,135 @@ def __encode_value(fp_write, item, seen_containers, container_count, sort_keys,
         fp_write(TYPE_BOOL_FALSE)
 
     elif isinstance(item, INTEGER_TYPES) and not (type(item).__module__ == "numpy"):
-        __encode_int(fp_write, item, le)
+        __encode_int(fp_write, item, le, ubj)
 
     elif isinstance(item, float):
         if no_float32:
-            __encode_float64(fp_write, item, le)
+            __encode_float64(fp_write, item, le, ubj)
         else:
-            __encode_float(fp_write, item, le)
+            __encode_float(fp_write, item, le, ubj)
 
     elif isinstance(item, Decimal):
-        __encode_decimal(fp_write, item, le)
+        __encode_decimal(fp_write, item, le, ubj)
 
     elif isinstance(item, BYTES_TYPES):
-        __encode_bytes(fp_write, item)
+        __encode_bytes(fp_write, item, le, ubj)
+
+    elif isinstance(item, RawBJData):
+        if item.dialect != (DIALECT_UBJSON if ubj else DIALECT_BJDATA) or item.islittle != (1 if islittle else 0):
+            raise EncoderException('RawBJData was encoded with a different dialect or byte order (islittle)')
+        fp_write(item.data)
 
     # order important since mappings could also be sequences
     elif isinstance(item, Mapping):
-        __encode_object(fp_write, item, seen_containers, container_count, sort_keys, no_float32, islittle, default)
+        __encode_object(fp_write, item, seen_containers, container_count, sort_keys, no_float32, islittle, default, ubj,
+                        type_encoder, seekable_fp, typed_objects, align, out_of_band)
 
-    elif isinstance(item, Sequence):
-        __encode_array(fp_write, item, seen_containers, container_count, sort_keys, no_float32, islittle, default)
+    # packed arrays are read as little-endian (as are ndarrays written), regardless of islittle
+    elif (isinstance(item, RANGE_TYPE) and islittle and len(item) and -2 ** 63 <= min(item) and
+          max(item) < 2 ** 63):
+        __encode_range(fp_write, item, ubj)
+
+    # iterators (e.g. generators) are only encoded directly if default is not given (which previously received them)
+    elif isinstance(item, Sequence) or (default is None and isinstance(item, Iterator)):
+        __encode_array(fp_write, item, seen_containers, container_count, sort_keys, no_float32, islittle, default, ubj,
+                       type_encoder, seekable_fp, typed_objects, align, out_of_band)
 
     elif default is not None:
-        __encode_value(fp_write, default(item), seen_containers, container_count, sort_keys, no_float32, islittle, default)
+        __encode_value(fp_write, default(item), seen_containers, container_count, sort_keys, no_float32, islittle,
+                       default, ubj, type_encoder, seekable_fp, typed_objects, align, out_of_band)
 
     elif type(item).__module__ == "numpy":
-        __encode_numpy(fp_write, item, islittle, default)
+        __encode_numpy(fp_write, item, seen_containers, container_count, sort_keys, no_float32, islittle, default, ubj,
+                       type_encoder, seekable_fp, typed_objects, align, out_of_band)
 
     else:
         raise EncoderException('Cannot encode item of type %s' % type(item))
 
 
-def __encode_array(fp_write, item, seen_containers, container_count, sort_keys, no_float32, islittle,  default):
+def __encode_array(fp_write, item, seen_containers, container_count, sort_keys, no_float32, islittle,  default, ubj,
+                   type_encoder, seekable_fp, typed_objects, align, out_of_band):
     # circular reference check
     container_id = id(item)
     if container_id in seen_containers:
         raise ValueError('Circular reference detected')
     seen_containers[container_id] = item
 
+    # count of an iterator (e.g. generator) only known once exhausted, i.e. patched afterwards if possible
+    slot = None
+    if container_count and not isinstance(item, Sequence) and seekable_fp is None:
+        item = list(item)
+
     fp_write(ARRAY_START)
     if container_count:
-        fp_write(CONTAINER_COUNT)
-        __encode_int(fp_write, len(item), islittle)
+        if isinstance(item, Sequence):
+            count = len(item)
+            fp_write(CONTAINER_COUNT)
+            __encode_int(fp_write, count, islittle, ubj)
+        else:
+            slot = seekable_fp.tell()
+            fp_write(__COUNT_SLOT)
 
+    written = 0
     for value in item:
-        __encode_value(fp_write, value, seen_containers, container_count, sort_keys, no_float32,  islittle, default)
+        if align is not None:
+            __align(fp_write, value, None, align, islittle, ubj, out_of_band)
+        __encode_value(fp_write, value, seen_containers, container_count, sort_keys, no_float32,  islittle, default,
+                       ubj, type_encoder, seekable_fp, typed_objects, align, out_of_band)
+        written += 1
 
     if not container_count:
         fp_write(ARRAY_END)
+    elif slot is not None:
+        end = seekable_fp.tell()
+        seekable_fp.seek(slot)
+        fp_write(CONTAINER_COUNT + TYPE_INT64 + pack('<q' if islittle else '>q', written))
+        seekable_fp.seek(end)
+    elif written != count:
+        raise RuntimeError('sequence changed size during encoding')
 
     del seen_containers[container_id]
 
 
-def __encode_object(fp_write, item, seen_containers, container_count, sort_keys, no_float32,  islittle, default):
+def __encode_range(fp_write, item, ubj=False):
+    """Writes (non-empty) range as packed array of the smallest integer type which fits all of its values"""
+    low, high = min(item), max(item)
+    for type_, fmt, min_value, max_value in (__RANGE_TYPES_UBJSON if ubj else __RANGE_TYPES):
+        if min_value <= low and high < max_value:
+            break
+    fp_write(ARRAY_START + CONTAINER_TYPE + type_ + CONTAINER_COUNT)
+    __encode_int(fp_write, len(item), 1, ubj)
+    values = iter(item)
+    for _ in range(0, len(item), __RANGE_CHUNK):
+        chunk = tuple(islice(values, __RANGE_CHUNK))
+        fp_write(pack('<%d%s' % (len(chunk), fmt), *chunk))
+    # no ARRAY_END since length was specified
+
+
+def __typed_object_type(items, no_float32, ubj):
+    """Returns (marker, struct format) of the fixed-length type which all values of the given (non-empty) list of
+    (key, value) tuples can be written as (see dump, typed_objects) or None if there is no such type"""
+    value_type = type(items[0][1])
+    if value_type not in __TYPED_OBJECT_VALUE_TYPES or any(type(value) is not value_type for _, value in items):
+        return None
+    if value_type is float:
+        if ubj and any(isinf(value) or isnan(value) for _, value in items):
+            # written as null
+            return None
+        # as for individual values, float32 only used if all values are in its range
+        if not no_float32 and all(value == 0 or 1.18e-38 <= abs(value) <= 3.4e38 for _, value in items):
+            return TYPE_FLOAT32, 'f'
+        return TYPE_FLOAT64, 'd'
+    low = min(value for _, value in items)
+    high = max(value for _, value in items)
+    for marker, fmt, min_value, max_value in (__TYPED_OBJECT_INT_TYPES_UBJSON if ubj else __TYPED_OBJECT_INT_TYPES):
+        if min_value <= low and high < max_value:
+            return marker, fmt
+    return None
+
+
+def __encode_object(fp_write, item, seen_containers, container_count, sort_keys, no_float32,  islittle, default, ubj,
+                    type_encoder, seekable_fp, typed_objects, align, out_of_band):
     le=islittle;
     # circular reference check
     container_id = id(item)
@@ -233,26 +454,42 @@ def __encode_object(fp_write, item, seen_containers, container_count, sort_keys,
         raise ValueError('Circular reference detected')
     seen_containers[container_id] = item
 
+    items = sorted(item.items()) if sort_keys else item.items()
+    value_type = None
+    if typed_objects and len(item):
+        items = list(items)
+        value_type = __typed_object_type(items, no_float32, ubj)
+
     fp_write(OBJECT_START)
-    if container_count:
+    if value_type is not None:
+        fp_write(CONTAINER_TYPE + value_type[0])
+    if container_count or value_type is not None:
         fp_write(CONTAINER_COUNT)
-        __encode_int(fp_write, len(item), le)
+        __encode_int(fp_write, len(item), le, ubj)
+    if value_type is not None:
+        pack_value = Struct(('<' if le else '>') + value_type[1]).pack
 
-    for key, value in sorted(item.items()) if sort_keys else item.items():
+    for key, value in items:
         # allow both str & unicode for Python 2
         if not isinstance(key, TEXT_TYPES):
             raise EncoderException('Mapping keys can only be strings')
         encoded_key = key.encode('utf-8')
         length = len(encoded_key)
+        if align is not None:
+            __align(fp_write, value, encoded_key, align, le, ubj, out_of_band)
         if length < 2 ** 8:
             fp_write(__SMALL_UINTS_ENCODED[le][length])
         else:
-            __encode_int(fp_write, length, le)
+            __encode_int(fp_write, length, le, ubj)
         fp_write(encoded_key)
 
-        __encode_value(fp_write, value, seen_containers, container_count, sort_keys, no_float32,  islittle, default)
+        if value_type is not None:
+            fp_write(pack_value(value))
+        else:
+            __encode_value(fp_write, value, seen_containers, container_count, sort_keys, no_float32,  islittle, default,
+                           ubj, type_encoder, seekable_fp, typed_objects, align, out_of_band)
 
-    if not container_count:
+    if not (container_count or value_type is not None):
         fp_write(OBJECT_END)
 
     del seen_containers[container_id]
@@ -263,12 +500,23 @@ def __map_dtype(dtypestr):
     else:
         raise Exception("bjdata", "numpy dtype {} is not supported".format(dtypestr))
 
-def __encode_numpy(fp_write, item, islittle, default):
+def __encode_numpy(fp_write, item, seen_containers, container_count, sort_keys, no_float32, islittle, default, ubj,
+                   type_encoder, seekable_fp, typed_objects, align, out_of_band):
     try:
         import numpy as np
     except ImportError:
         raise Exception("bjdata", "you must install 'numpy' to encode this data")
 
+    if out_of_band is not None and out_of_band.accepts(item):
+        __encode_out_of_band(fp_write, item, out_of_band, islittle, ubj)
+        return
+
+    # UBJSON has no ND-array syntax and lacks some of the BJData types, fall back to plain values/arrays
+    if ubj and (item.ndim > 1 or item.dtype.str[1:] in __DTYPES_NOT_UBJSON):
+        __encode_value(fp_write, item.tolist(), seen_containers, container_count, sort_keys, no_float32, islittle,
+                       default, ubj, type_encoder, seekable_fp, typed_objects, align, out_of_band)
+        return
+
     # TODO: need to detect big-endian data and swap bytes
     if(np.isscalar(item)):
         fp_write(__map_dtype(item.dtype.str))
@@ -280,26 +528,99 @@ def __encode_numpy(fp_write, item, islittle, default):
 
     if(item.dtype.str[1] == 'U' or item.dtype.str[1] == 'S') and item.ndim == 0:
         fp_write(TYPE_STRING)
-        __encode_int(fp_write, int(item.dtype.str[2:]) * (4 if item.dtype.str[1] == 'U' else 1), islittle)
+        __encode_int(fp_write, int(item.dtype.str[2:]) * (4 if item.dtype.str[1] == 'U' else 1), islittle, ubj)
         fp_write(item.data)
         return
 
-    if(np.isfortran(item)):
-        item = np.array( item, order = 'C')  # currently, BJData ND-array syntax only support row-major
+    if not item.flags.c_contiguous:
+        item = np.ascontiguousarray(item)  # currently, BJData ND-array syntax only support row-major
 
-    fp_write(ARRAY_START + CONTAINER_TYPE + __map_dtype(item.dtype.str) + CONTAINER_COUNT)
+    fp_write(__numpy_header(item, islittle, ubj))
+    fp_write(item.data)
+
+
+def __numpy_header(item, le, ubj):
+    """Returns the header (i.e. everything before the payload) of the packed array ndarray item is written as"""
+    parts = [ARRAY_START + CONTAINER_TYPE + __map_dtype(item.dtype.str) + CONTAINER_COUNT]
     if item.ndim == 1:
-        __encode_int(fp_write, len(item), islittle)
+        __encode_int(parts.append, len(item), le, ubj)
     else:
-        fp_write(ARRAY_START)
+        parts.append(ARRAY_START)
         for value in item.shape:
-            __encode_int(fp_write, value, islittle)
-        fp_write(ARRAY_END)
+            __encode_int(parts.append, value, le, ubj)
+        parts.append(ARRAY_END)
+    return b''.join(parts)
+
+
+class _OutOfBand(object):
+    """Passes payloads of large numpy arrays to buffer_callback (see dump), counting them"""
+
+    __slots__ = ('callback', 'min_size', 'count')
+
+    def __init__(self, callback, min_size):
+        self.callback = callback
+        self.min_size = min_size
+        self.count = 0
+
+    def accepts(self, item):
+        """Whether item is an ndarray to be passed out-of-band"""
+        return (type(item).__name__ == 'ndarray' and type(item).__module__ == 'numpy' and item.ndim > 0 and
+                not item.dtype.hasobject and item.nbytes >= self.min_size)
+
+    def pass_payload(self, item):
+        """Passes the payload of C-contiguous ndarray item to the callback, returning its index"""
+        view = memoryview(item)
+        # memoryview.cast not available in Python 2
+        self.callback(view.cast('B') if hasattr(view, 'cast') else view)
+        self.count += 1
+        return self.count - 1
+
+
+def __encode_out_of_band(fp_write, item, out_of_band, le, ubj):
+    """Passes the payload of ndarray item to buffer_callback (see dump) and writes an object referencing it instead"""
+    if not item.flags.c_contiguous:
+        item = item.copy(order='C')
+    record = {BUFFER_KEY_INDEX: out_of_band.pass_payload(item), BUFFER_KEY_DTYPE: UNICODE_TYPE(item.dtype.str),
+              BUFFER_KEY_SHAPE: list(item.shape)}
+    # members (plain types only) in sorted order, as written by the extension
+    __encode_object(fp_write, record, {}, False, True, True, le, None, ubj, None, None, False, None, None)
+
+
+def __align(fp_write, item, key, align, le, ubj, out_of_band):
+    """Writes no-op markers before item (preceded by its encoded key, if not None) if it is an ndarray written as a
+    (non-empty) packed array, such that its payload starts at a multiple of align[0]. align[1] returns the current
+    output offset."""
+    if not (type(item).__name__ == 'ndarray' and type(item).__module__ == 'numpy' and item.ndim and item.size):
+        return
+    if out_of_band is not None and out_of_band.accepts(item):
+        return
+    dtype = item.dtype.str[1:]
+    if dtype not in __DTYPE_TO_MARKER or (ubj and (item.ndim > 1 or dtype in __DTYPES_NOT_UBJSON)):
+        return
+    offset = align[1]() + len(__numpy_header(item, le, ubj))
+    if key is not None:
+        parts = [key]
+        __encode_int(parts.append, len(key), le, ubj)
+        offset += len(b''.join(parts))
+    pad = -offset % align[0]
+    if pad:
+        fp_write(TYPE_NOOP * pad)
 
-    fp_write(item.data)
+
+def __counting_writer(fp_write):
+    """Returns a wrapper of fp_write which counts the bytes written and a function returning said count"""
+    written = [0]
+
+    def write(data):
+        fp_write(data)
+        written[0] += memoryview(data).nbytes
+
+    return write, lambda: written[0]
 
 
-def dump(obj, fp, container_count=False, sort_keys=False, no_float32=True, islittle=True, default=None):
+def dump(obj, fp, container_count=False, sort_keys=False, no_float32=True, islittle=True, default=None,
+         dialect=DIALECT_BJDATA, encoders=None, typed_objects=False, align=0, buffer_callback=None,
+         background_write=False):  # pylint: disable=unused-argument
     """Writes the given object as BJData/UBJSON to the provided file-like object
 
     Args:
@@ -321,6 +642,54 @@ def dump(obj, fp, container_count=False, sort_keys=False, no_float32=True, islit
         default (callable): Called for objects which cannot be serialised.
                             Should return a UBJSON-encodable version of the
                             object or raise an EncoderException.
+        dialect (str): Wire format to produce, either 'bjdata' (default) or
+                       'ubjson'. The latter never emits uint16/32/64 or
+                       float16 markers or ND-array dimensions (numpy arrays
+                       needing them are written as nested arrays instead) and
+                       writes non-finite floats as null.
+        encoders (dict): Mapping of type to callable, the latter returning
+                         an encodable version of the given object. Unlike
+                         default, these are used before the type table
+                         below and also apply to subclasses (the closest
+                         registered base class being used). Types in the
+                         table cannot be registered themselves, but their
+                         subclasses can be. Use namedtuple_as_object or
+                         slots_as_object to encode a namedtuple or class
+                         using __slots__ as an object.
+        typed_objects (bool): Write mappings whose values are all ints or
+                              all floats as typed objects (i.e. with the
+                              type given once, after narrowing, rather than
+                              per value), also specifying their length.
+                              This saves space and decoding time for e.g.
+                              maps of metrics, at the cost of checking all
+                              values of every mapping first. This also
+                              applies to objects written from fields (e.g.
+                              dataclasses, see below).
+        align (int): If greater than one, No-Op markers are written before
+                     numpy arrays (which are written as packed arrays) in
+                     arrays & objects such that their payloads start at a
+                     multiple of align, e.g. to allow them to be accessed
+                     in place once mapped into memory. Offsets are relative
+                     to the start of fp if seekable, otherwise to the start
+                     of the output.
+        buffer_callback (callable): If set, numpy arrays (other than 0-d or
+                                    of object dtype) whose payload is at
+                                    least 1 KiB are not written. Instead
+                                    this is called with a memoryview (of
+                                    unsigned bytes) of each such payload and
+                                    a small object referencing it (by the
+                                    number of payloads passed before it) is
+                                    written in its place, i.e. the payloads
+                                    have to be transferred out-of-band and
+                                    passed to load() via buffers.
+        background_write (bool): When writing to a file opened via open()
+                                 (i.e. exactly io.FileIO or
+                                 io.BufferedWriter), write the output from a
+                                 separate thread while encoding continues,
+                                 such that slow writes (e.g. to a network
+                                 file system) overlap with encoding. Only
+                                 supported by the extension module (on
+                                 POSIX platforms), otherwise ignored.
 
     Raises:
         EncoderException: If an encoding failure occured.
@@ -351,9 +720,27 @@ def dump(obj, fp, container_count=False, sort_keys=False, no_float32=True, islit
     | (3) collections.abc.Mapping  | object                            |
     | (2) collections.Mapping      |                                   |
     +------------------------------+-----------------------------------+
+    | (3) range                    | array (type, smallest int type)   |
+    | (2) xrange                   |                                   |
+    +------------------------------+-----------------------------------+
     | (3) collections.abc.Sequence | array                             |
     | (2) collections.Sequence     |                                   |
     +------------------------------+-----------------------------------+
+    | (3) collections.abc.Iterator | array (unless default is given)   |
+    | (2) collections.Iterator     |                                   |
+    +------------------------------+-----------------------------------+
+
+    Unless registered in encoders, the following types are encoded by built-in
+    encoders (ahead of the table above), unless default is given (in which
+    case they are passed to it, as before these were added):
+
+    +------------------------------+-----------------------------------+
+    | dataclass, attrs class       | object (of its fields)            |
+    +------------------------------+-----------------------------------+
+    | Enum                         | its value                         |
+    +------------------------------+-----------------------------------+
+    | UUID, PurePath               | string                            |
+    +------------------------------+-----------------------------------+
 
     Notes:
     - Items are resolved in the order of this table, e.g. if the item implements
@@ -365,6 +752,15 @@ def dump(obj, fp, container_count=False, sort_keys=False, no_float32=True, islit
       will be interpreted as a byte array).
     - Mapping keys have to be strings: str for Python3 and unicode or str in
       Python 2.
+    - Sequences other than list and tuple are iterated over (i.e. not copied
+      first). With container_count, the count of an iterator (e.g. generator)
+      is written (as int64) once it has been exhausted, by seeking back if fp
+      is seekable. Otherwise it is materialised first.
+    - A (non-empty) range is written as a packed array of its values, unless
+      islittle is 0 or a value does not fit into int64. This is decoded as a
+      numpy array.
+    - With align, numpy arrays returned by default or encoders and ones
+      within RawBJData are not aligned (nor is a top-level array).
     - float conversion rules (depending on no_float32 setting):
         float32: 1.18e-38 <= abs(value) <= 3.4e38 or value == 0
         float64: 2.23e-308 <= abs(value) < 1.8e308
@@ -373,13 +769,86 @@ def dump(obj, fp, container_count=False, sort_keys=False, no_float32=True, islit
     if not callable(fp.write):
         raise TypeError('fp.write not callable')
     fp_write = fp.write
+    if dialect not in (DIALECT_BJDATA, DIALECT_UBJSON):
+        raise ValueError("Unsupported dialect '%s' (expected 'bjdata' or 'ubjson')" % dialect)
+    encoders = {} if encoders is None else dict(encoders)
+    for cls, handler in encoders.items():
+        if not isinstance(cls, type):
+            raise TypeError('encoders keys must be types')
+        if cls in __PLAIN_TYPES:
+            raise TypeError('Cannot register encoder for built-in type %s' % cls.__name__)
+        if not callable(handler):
+            raise TypeError('encoders values must be callable')
+
+    if align < 0:
+        raise ValueError('align must be non-negative')
+    if buffer_callback is not None and not callable(buffer_callback):
+        raise TypeError('buffer_callback must be callable')
+    out_of_band = None if buffer_callback is None else _OutOfBand(buffer_callback, __OUT_OF_BAND_MIN_SIZE)
+
+    seekable = (container_count or align > 1) and callable(getattr(fp, 'seekable', None)) and fp.seekable()
+    # allows counts of iterators to be written after their items (not when appending, where writes ignore seeking)
+    mode = getattr(fp, 'mode', None)
+    appends = isinstance(mode, TEXT_TYPES) and 'a' in mode
+    seekable_fp = fp if container_count and seekable and not appends else None
+    # alignment & function returning the current output offset
+    if align <= 1:
+        align = None
+    elif seekable:
+        align = (align, fp.tell)
+    else:
+        fp_write, tell = __counting_writer(fp_write)
+        align = (align, tell)
 
-    __encode_value(fp_write, obj, {}, container_count, sort_keys, no_float32, islittle, default)
+    __encode_value(fp_write, obj, {}, container_count, sort_keys, no_float32, islittle, default,
+                   dialect == DIALECT_UBJSON, __type_encoders(encoders, default is None), seekable_fp, typed_objects,
+                   align, out_of_band)
 
 
-def dumpb(obj, container_count=False, sort_keys=False, no_float32=True, islittle=True, default=None):
+def dumpb(obj, container_count=False, sort_keys=False, no_float32=True, islittle=True, default=None,
+          dialect=DIALECT_BJDATA, encoders=None, typed_objects=False, align=0, buffer_callback=None):
     """Returns the given object as BJData/UBJSON in a bytes instance. See dump() for
        available arguments."""
     with BytesIO() as fp:
-        dump(obj, fp, container_count=container_count, sort_keys=sort_keys, no_float32=no_float32, islittle=islittle, default=default)
+        dump(obj, fp, container_count=container_count, sort_keys=sort_keys, no_float32=no_float32, islittle=islittle, default=default,
+             dialect=dialect, encoders=encoders, typed_objects=typed_objects, align=align,
+             buffer_callback=buffer_callback)
         return fp.getvalue()
+
+
+class _SegmentWriter(object):
+    """File-like object collecting output as segments (see dumpb_iov)"""
+
+    def __init__(self, min_view_size):
+        self.min_view_size = min_view_size
+        self.segments = []
+        self.pending = []
+
+    def write(self, data):
+        view = memoryview(data)
+        # memoryview.cast not available in Python 2
+        if view.nbytes < self.min_view_size or not hasattr(view, 'cast'):
+            self.pending.append(view.tobytes())
+        else:
+            self.flush()
+            self.segments.append(view.cast('B'))
+
+    def flush(self):
+        if self.pending:
+            self.segments.append(b''.join(self.pending))
+            self.pending = []
+
+
+def dumpb_iov(obj, container_count=False, sort_keys=False, no_float32=True, islittle=True, default=None,
+              dialect=DIALECT_BJDATA, encoders=None, typed_objects=False, align=0, buffer_callback=None):
+    """Returns the given object as BJData/UBJSON in a list of bytes-like segments, e.g. for socket.sendmsg(). Payloads
+       of numpy arrays and bytes/bytearray instances (of at least 1 KiB) are not copied: these are memoryviews (of
+       unsigned bytes) of the original objects, which must not be modified until the output has been used. Other
+       output is returned as bytes instances. See dump() for available arguments. Unlike with dumpb(), with
+       container_count iterators are turned into lists first (see dump)."""
+    fp = _SegmentWriter(__SEGMENT_VIEW_MIN_SIZE)
+    dump(obj, fp, container_count=container_count, sort_keys=sort_keys, no_float32=no_float32, islittle=islittle,
+         default=default, dialect=dialect, encoders=encoders, typed_objects=typed_objects, align=align,
+         buffer_callback=buffer_callback)
+    fp.flush()
+    return fp.segments
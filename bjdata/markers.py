@@ -46,3 +46,12 @@ ARRAY_END = b']'
 # Optional container parameters
 CONTAINER_TYPE = b'$'
 CONTAINER_COUNT = b'#'
+
+# Keys of the object written in place of a numpy array passed out-of-band (see buffer_callback of dump)
+BUFFER_KEY_INDEX = '_BufferIndex_'
+BUFFER_KEY_DTYPE = '_BufferDtype_'
+BUFFER_KEY_SHAPE = '_BufferShape_'
+
+# Wire format dialects (dialect argument of dump/load functions)
+DIALECT_BJDATA = 'bjdata'
+DIALECT_UBJSON = 'ubjson'
@@ -0,0 +1,98 @@
+# Copyright (c) 2020-2022 Qianqian Fang <q.fang at neu.edu>. All rights reserved.
+# Copyright (c) 2016-2019 Iotic Labs Ltd. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     https://github.com/NeuroJSON/pybj/blob/master/LICENSE
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+"""Handle for an encoded (i.e. not decoded) BJData/UBJSON value"""
+
+
+class RawBJData(object):
+    """A single value in encoded form, written as-is (i.e. without being re-encoded) by dump()/dumpb(). Returned by
+    load()/loadb() in place of values beyond raw_depth or at one of raw_paths and by preencode(). The encoded form is
+    only valid within output of the same dialect and byte order as it was created with.
+
+    Args:
+        data: Bytes-like object holding exactly one encoded value. This is
+              validated (see validate()) here, i.e. once only, and copied
+              unless already bytes.
+        islittle (1 or 0): Byte order data was encoded with (see load())
+        dialect (str): Dialect data was encoded with (see load())
+
+    Raises:
+        ValueError: If data is not exactly one valid value
+
+    Attributes:
+        data: The encoded value (a bytes-like object). When decoded from a bytes-like object (i.e. via loadb()) this is
+              a memoryview of the input, otherwise bytes.
+        islittle (1 or 0): Byte order data was encoded with
+        dialect (str): Dialect data was encoded with. dump()/dumpb() raise EncoderException when writing an instance
+                       whose islittle or dialect differ from their own.
+    """
+
+    __slots__ = ('data', 'islittle', 'dialect')
+
+    def __init__(self, data, islittle=True, dialect='bjdata'):
+        from . import validate
+
+        if not isinstance(data, bytes):
+            data = memoryview(data).tobytes()
+        offset = validate(data, islittle=islittle, dialect=dialect)
+        if offset is not None:
+            raise ValueError('Invalid encoded value at offset %d' % offset)
+        # Every proper prefix of a single value is invalid, i.e. this rejects trailing data
+        if data and validate(memoryview(data)[:-1], islittle=islittle, dialect=dialect) is None:
+            raise ValueError('Trailing data after encoded value')
+        self.data = data
+        self.islittle = 1 if islittle else 0
+        self.dialect = dialect
+
+    @classmethod
+    def _from_valid(cls, data, islittle=True, dialect='bjdata'):
+        """Returns an instance for data known to be exactly one valid value, i.e. without validating it"""
+        raw = cls.__new__(cls)
+        raw.data = data
+        raw.islittle = 1 if islittle else 0
+        raw.dialect = dialect
+        return raw
+
+    def __bytes__(self):
+        return bytes(self.data)
+
+    def __len__(self):
+        return len(self.data)
+
+    def __eq__(self, other):
+        if not isinstance(other, RawBJData):
+            return NotImplemented
+        return self.data == other.data and self.islittle == other.islittle and self.dialect == other.dialect
+
+    def __ne__(self, other):
+        result = self.__eq__(other)
+        return result if result is NotImplemented else not result
+
+    __hash__ = None
+
+    def __repr__(self):
+        return '%s(%r)' % (type(self).__name__, bytes(self.data))
+
+
+def preencode(obj, **kwargs):
+    """Encodes obj once, returning it as RawBJData, e.g. for a static sub-object which is to be part of many encoded
+    values. Keyword arguments are as for dumpb() and must match those the result is later encoded with (in particular
+    islittle & dialect).
+    """
+    from . import dumpb
+
+    return RawBJData._from_valid(dumpb(obj, **kwargs), islittle=kwargs.get('islittle', True),
+                                 dialect=kwargs.get('dialect') or 'bjdata')
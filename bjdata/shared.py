@@ -0,0 +1,116 @@
+# Copyright (c) 2020-2022 Qianqian Fang <q.fang at neu.edu>. All rights reserved.
+# Copyright (c) 2016-2019 Iotic Labs Ltd. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     https://github.com/NeuroJSON/pybj/blob/master/LICENSE
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+"""Encoded values in shared memory (multiprocessing.shared_memory), decoded in other processes without copying"""
+
+from struct import Struct
+
+# Start of a shared memory block: offset & length of the encoded value (the block may be larger, e.g. page-aligned)
+__HEADER = Struct('<QQ')
+
+
+def dump_shared(obj, name=None, align=64, **kwargs):
+    """Encodes obj into a new shared memory block (of the encoded size) and returns it (as a
+    multiprocessing.shared_memory.SharedMemory instance). Payloads of numpy arrays are copied into the block directly,
+    i.e. without the encoded value being assembled in memory first. Other processes can open the block by its name
+    via load_shared(). The caller is responsible for unlinking the block once no longer needed.
+
+    Args:
+        obj: Object to encode
+        name (str): Name of the block to create (default: a random one)
+        align (int): As for dump() but relative to the block, so that array
+                     payloads are aligned in memory when decoded in place.
+        kwargs: As for dumpb() (except for buffer_callback)
+    """
+    from multiprocessing.shared_memory import SharedMemory
+    from . import dumpb_iov
+
+    segments = [memoryview(segment).cast('B') for segment in dumpb_iov(obj, align=align, **kwargs)]
+    length = sum(len(segment) for segment in segments)
+    offset = __HEADER.size
+    if align > 1:
+        offset = -(-offset // align) * align
+    shm = SharedMemory(name=name, create=True, size=offset + length)
+    try:
+        __HEADER.pack_into(shm.buf, 0, offset, length)
+        for segment in segments:
+            shm.buf[offset:offset + len(segment)] = segment
+            offset += len(segment)
+    except BaseException:
+        shm.close()
+        shm.unlink()
+        raise
+    return shm
+
+
+class SharedValue(object):
+    """A value decoded from a shared memory block (see load_shared), with numpy arrays (from packed arrays) viewing the
+    block rather than being copies. The block stays mapped until close() is called, which requires these arrays to no
+    longer be referenced. Can be used as a context manager (closing on exit).
+
+    Attributes:
+        value: The decoded value
+        shm: The shared memory block (multiprocessing.shared_memory.SharedMemory)
+    """
+
+    __slots__ = ('value', 'shm')
+
+    def __init__(self, value, shm):
+        self.value = value
+        self.shm = shm
+
+    def close(self):
+        """Releases the decoded value and unmaps the block. Raises BufferError if arrays viewing it still exist."""
+        self.value = None
+        self.shm.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+
+def load_shared(name, **kwargs):
+    """Opens the shared memory block written by dump_shared() and decodes its value, returning it as SharedValue.
+
+    Args:
+        name (str): Name of the block (or a SharedMemory instance, which is
+                    then closed by SharedValue.close())
+        kwargs: As for loadb(). zero_copy is set by default. E.g. with
+                raw_depth only the outermost containers are decoded.
+
+    Raises:
+        ValueError: If the block does not start with a valid header
+        DecoderException: If decoding failed
+    """
+    from multiprocessing.shared_memory import SharedMemory
+    from . import loadb
+
+    shm = SharedMemory(name=name) if isinstance(name, str) else name
+    try:
+        if shm.size < __HEADER.size:
+            raise ValueError('Shared memory block too small')
+        offset, length = __HEADER.unpack_from(shm.buf)
+        if offset < __HEADER.size or length > shm.size - offset:
+            raise ValueError('Invalid shared memory block header')
+        kwargs.setdefault('zero_copy', True)
+        # not released explicitly since arrays decoded from it (exporting its buffer) keep it in use
+        value = loadb(shm.buf[offset:offset + length], **kwargs)
+    except BaseException:
+        shm.close()
+        raise
+    return SharedValue(value, shm)
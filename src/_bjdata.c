@@ -16,10 +16,12 @@
  */
 
 #include <Python.h>
+#include <string.h>
 
 #include "common.h"
 #include "encoder.h"
 #include "decoder.h"
+#include "validator.h"
 
 #define PY_ARRAY_UNIQUE_SYMBOL bjdata_numpy_array
 #define NPY_NO_DEPRECATED_API 0
@@ -27,11 +29,325 @@
 
 /******************************************************************************/
 
-// container_count, sort_keys, no_float32, islittle
-static _bjdata_encoder_prefs_t _bjdata_encoder_prefs_defaults = { NULL, 0, 0, 1, 1 };
+// container_count, sort_keys, no_float32, islittle, dialect, typed_objects, align, buffer_callback, background_write
+static _bjdata_encoder_prefs_t _bjdata_encoder_prefs_defaults = { NULL, NULL, 0, 0, 1, 1, DIALECT_BJDATA, 0, 0, NULL,
+                                                                  0 };
 
-// no_bytes, object_pairs_hook, islittle
-static _bjdata_decoder_prefs_t _bjdata_decoder_prefs_defaults = { NULL, NULL, 0, 0, 1 };
+// no_bytes, object_pairs_hook, islittle, dialect, max_container_count, max_total_bytes, max_depth, max_string_length,
+// dict_class, array_as_tuple, records_rows, path_filter, path_filter_exclude, raw_depth, raw_paths, classes,
+// class_sizes, class_paths, buffers, zero_copy
+static _bjdata_decoder_prefs_t _bjdata_decoder_prefs_defaults = { NULL, NULL, 0, 0, 1, DIALECT_BJDATA, -1, -1, -1, -1,
+                                                                  NULL, 0, 0, NULL, 0, -1, NULL, NULL, 0, NULL, NULL, 0 };
+
+/******************************************************************************/
+
+// Converts dialect name (NULL meaning default) to one of DIALECT_*. Returns non-zero (exception set) on failure.
+static int _bjdata_parse_dialect(const char *name, int *dialect) {
+    if (NULL == name || 0 == strcmp(name, "bjdata")) {
+        *dialect = DIALECT_BJDATA;
+    } else if (0 == strcmp(name, "ubjson")) {
+        *dialect = DIALECT_UBJSON;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Unsupported dialect '%s' (expected 'bjdata' or 'ubjson')", name);
+        return 1;
+    }
+    return 0;
+}
+
+// Checks the given align value (see dump). Returns non-zero (exception set) if invalid.
+static int _bjdata_check_align(int align) {
+    if (align < 0) {
+        PyErr_SetString(PyExc_ValueError, "align must be non-negative");
+        return 1;
+    }
+    return 0;
+}
+
+// Checks the given buffer_callback (see dump), setting it to NULL if None. Returns non-zero (exception set) if invalid.
+static int _bjdata_check_buffer_callback(PyObject **buffer_callback) {
+    if (Py_None == *buffer_callback) {
+        *buffer_callback = NULL;
+    } else if (NULL != *buffer_callback && !PyCallable_Check(*buffer_callback)) {
+        PyErr_SetString(PyExc_TypeError, "buffer_callback must be callable");
+        return 1;
+    }
+    return 0;
+}
+
+/* Converts optional (None meaning not set) encoders mapping to a new dict (of type to callable), checking its items.
+ * Returns non-zero (exception set) on failure.
+ */
+static int _bjdata_parse_encoders(PyObject *obj, PyObject **encoders) {
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+
+    *encoders = NULL;
+    if (NULL == obj || Py_None == obj) {
+        return 0;
+    }
+    BAIL_ON_NULL(*encoders = PyDict_New());
+    BAIL_ON_NONZERO(PyDict_Update(*encoders, obj));
+    while (PyDict_Next(*encoders, &pos, &key, &value)) {
+        if (!PyType_Check(key)) {
+            PyErr_SetString(PyExc_TypeError, "encoders keys must be types");
+            goto bail;
+        }
+        if (ENCODER_TYPE_IS_PLAIN((PyTypeObject*)key)) {
+            PyErr_Format(PyExc_TypeError, "Cannot register encoder for built-in type %s", ((PyTypeObject*)key)->tp_name);
+            goto bail;
+        }
+        if (!PyCallable_Check(value)) {
+            PyErr_SetString(PyExc_TypeError, "encoders values must be callable");
+            goto bail;
+        }
+    }
+    return 0;
+
+bail:
+    Py_CLEAR(*encoders);
+    return 1;
+}
+
+// Converts optional (i.e. None meaning no limit) size/depth limit, setting it to -1 if None. Returns non-zero on failure.
+static int _bjdata_parse_limit(PyObject *obj, const char *name, Py_ssize_t *limit) {
+    if (NULL == obj || Py_None == obj) {
+        *limit = -1;
+        return 0;
+    }
+    if (-1 == (*limit = PyNumber_AsSsize_t(obj, PyExc_OverflowError)) && PyErr_Occurred()) {
+        return 1;
+    }
+    if (*limit < 0) {
+        PyErr_Format(PyExc_ValueError, "%s must be non-negative", name);
+        return 1;
+    }
+    return 0;
+}
+
+// Applies (optional) decoder resource limits. Returns non-zero on failure.
+static int _bjdata_parse_decoder_limits(_bjdata_decoder_prefs_t *prefs, PyObject *max_container_count,
+                                        PyObject *max_total_bytes, PyObject *max_depth, PyObject *max_string_length) {
+    return (_bjdata_parse_limit(max_container_count, "max_container_count", &prefs->max_container_count) ||
+            _bjdata_parse_limit(max_total_bytes, "max_total_bytes", &prefs->max_total_bytes) ||
+            _bjdata_parse_limit(max_depth, "max_depth", &prefs->max_depth) ||
+            _bjdata_parse_limit(max_string_length, "max_string_length", &prefs->max_string_length));
+}
+
+// Applies (optional) dict_class, array_as & records decoder arguments. Returns non-zero on failure.
+static int _bjdata_parse_decoder_containers(_bjdata_decoder_prefs_t *prefs, PyObject *dict_class,
+                                            const char *array_as, const char *records) {
+    // dict itself is the same as not specifying a class
+    if (NULL != dict_class && Py_None != dict_class && (PyObject*)&PyDict_Type != dict_class) {
+        if (!PyCallable_Check(dict_class)) {
+            PyErr_SetString(PyExc_TypeError, "dict_class must be callable");
+            return 1;
+        }
+        if (NULL != prefs->object_pairs_hook && Py_None != prefs->object_pairs_hook) {
+            PyErr_SetString(PyExc_ValueError, "dict_class and object_pairs_hook are mutually exclusive");
+            return 1;
+        }
+        prefs->dict_class = dict_class;
+    }
+    if (NULL == array_as || 0 == strcmp(array_as, "list")) {
+        prefs->array_as_tuple = 0;
+    } else if (0 == strcmp(array_as, "tuple")) {
+        prefs->array_as_tuple = 1;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Unsupported array_as '%s' (expected 'list' or 'tuple')", array_as);
+        return 1;
+    }
+    if (NULL == records) {
+        prefs->records_rows = 0;
+    } else if (0 == strcmp(records, "rows")) {
+        prefs->records_rows = 1;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Unsupported records '%s' (expected None or 'rows')", records);
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns new trie (nested dicts, with None marking the end of a path) of the given paths, each either a str of
+ * '.'-separated keys or a sequence of (str) keys. A single str is treated as one path. Returns NULL on failure.
+ */
+static PyObject* _bjdata_compile_paths(PyObject *paths, const char *name) {
+    PyObject *trie = NULL;
+    PyObject *iter = NULL;
+    PyObject *path = NULL;
+    PyObject *keys = NULL;
+    PyObject *sep = NULL;
+    PyObject *node, *child, *key;
+    Py_ssize_t i, len;
+
+    BAIL_ON_NULL(trie = PyDict_New());
+    BAIL_ON_NULL(sep = PyUnicode_FromString("."));
+    if (PyUnicode_Check(paths)) {
+        BAIL_ON_NULL(keys = PyTuple_Pack(1, paths));
+        BAIL_ON_NULL(iter = PyObject_GetIter(keys));
+        Py_CLEAR(keys);
+    } else {
+        BAIL_ON_NULL(iter = PyObject_GetIter(paths));
+    }
+
+    while (NULL != (path = PyIter_Next(iter))) {
+        if (PyUnicode_Check(path)) {
+            BAIL_ON_NULL(keys = PyUnicode_Split(path, sep, -1));
+        } else {
+            BAIL_ON_NULL(keys = PySequence_Fast(path, "paths must be str or sequences of str"));
+        }
+        if (0 == (len = PySequence_Fast_GET_SIZE(keys))) {
+            PyErr_Format(PyExc_ValueError, "%s paths must not be empty", name);
+            goto bail;
+        }
+        node = trie;
+        for (i = 0; i < len; i++) {
+            key = PySequence_Fast_GET_ITEM(keys, i);
+            if (!PyUnicode_Check(key)) {
+                PyErr_Format(PyExc_TypeError, "%s path keys must be str", name);
+                goto bail;
+            }
+            if (NULL == (child = PyDict_GetItemWithError(node, key))) {
+                BAIL_ON_NONZERO(PyErr_Occurred());
+            } else if (Py_None == child) {
+                // a prefix of this path has already been given
+                break;
+            }
+            if (i == len - 1) {
+                BAIL_ON_NONZERO(PyDict_SetItem(node, key, Py_None));
+            } else {
+                if (NULL == child) {
+                    BAIL_ON_NULL(child = PyDict_New());
+                    if (PyDict_SetItem(node, key, child)) {
+                        Py_DECREF(child);
+                        goto bail;
+                    }
+                    // node holds reference
+                    Py_DECREF(child);
+                }
+                node = child;
+            }
+        }
+        Py_CLEAR(keys);
+        Py_CLEAR(path);
+    }
+    BAIL_ON_NONZERO(PyErr_Occurred());
+    Py_DECREF(iter);
+    Py_DECREF(sep);
+    return trie;
+
+bail:
+    Py_XDECREF(sep);
+    Py_XDECREF(keys);
+    Py_XDECREF(path);
+    Py_XDECREF(iter);
+    Py_XDECREF(trie);
+    return NULL;
+}
+
+/* Applies (optional) include, exclude, raw_depth & raw_paths decoder arguments, setting prefs->path_filter &
+ * prefs->raw_paths to new references (to be released by the caller, also on failure). Returns non-zero on failure.
+ */
+static int _bjdata_parse_decoder_paths(_bjdata_decoder_prefs_t *prefs, PyObject *include, PyObject *exclude,
+                                       PyObject *raw_depth, PyObject *raw_paths) {
+    if (_bjdata_parse_limit(raw_depth, "raw_depth", &prefs->raw_depth)) {
+        return 1;
+    }
+    if (NULL != raw_paths && Py_None != raw_paths &&
+        NULL == (prefs->raw_paths = _bjdata_compile_paths(raw_paths, "raw_paths"))) {
+        return 1;
+    }
+    if (NULL != include && Py_None != include) {
+        if (NULL != exclude && Py_None != exclude) {
+            PyErr_SetString(PyExc_ValueError, "include and exclude are mutually exclusive");
+            return 1;
+        }
+        prefs->path_filter_exclude = 0;
+        return (NULL == (prefs->path_filter = _bjdata_compile_paths(include, "include")));
+    }
+    if (NULL != exclude && Py_None != exclude) {
+        prefs->path_filter_exclude = 1;
+        return (NULL == (prefs->path_filter = _bjdata_compile_paths(exclude, "exclude")));
+    }
+    return 0;
+}
+
+/* Applies (optional) classes & class_paths decoder arguments, setting prefs->classes & prefs->class_paths to new
+ * references (to be released by the caller, also on failure). Returns non-zero on failure.
+ */
+static int _bjdata_parse_decoder_classes(_bjdata_decoder_prefs_t *prefs, PyObject *classes, PyObject *class_paths) {
+    PyObject *tmp_module = NULL;
+    PyObject *compiled = NULL;
+    PyObject *key;
+    Py_ssize_t pos = 0;
+
+    if ((NULL == classes || Py_None == classes) && (NULL == class_paths || Py_None == class_paths)) {
+        return 0;
+    }
+    if (NULL != classes && Py_None != classes &&
+        ((NULL != prefs->object_pairs_hook && Py_None != prefs->object_pairs_hook) || NULL != prefs->dict_class)) {
+        PyErr_SetString(PyExc_ValueError, "classes cannot be combined with object_pairs_hook or dict_class");
+        goto bail;
+    }
+    // same resolution of classes (and errors) as pure Python version
+    BAIL_ON_NULL(tmp_module = PyImport_ImportModule("bjdata.decoder"));
+    BAIL_ON_NULL(compiled = PyObject_CallMethod(tmp_module, "_compile_classes", "OO",
+                                                (NULL == classes) ? Py_None : classes,
+                                                (NULL == class_paths) ? Py_None : class_paths));
+    if (Py_None != PyTuple_GET_ITEM(compiled, 0)) {
+        prefs->classes = PyTuple_GET_ITEM(compiled, 0);
+        Py_INCREF(prefs->classes);
+        while (PyDict_Next(prefs->classes, &pos, &key, NULL)) {
+            prefs->class_sizes |= 1ULL << (MIN(PySet_GET_SIZE(key), 63));
+        }
+    }
+    if (Py_None != PyTuple_GET_ITEM(compiled, 1)) {
+        prefs->class_paths = PyTuple_GET_ITEM(compiled, 1);
+        Py_INCREF(prefs->class_paths);
+    }
+    Py_DECREF(compiled);
+    Py_DECREF(tmp_module);
+    return 0;
+
+bail:
+    Py_XDECREF(tmp_module);
+    return 1;
+}
+
+/* Applies (optional) buffers decoder argument (see load), setting prefs->buffers to a new reference (to be released by
+ * the caller, also on failure). Returns non-zero on failure.
+ */
+static int _bjdata_parse_decoder_buffers(_bjdata_decoder_prefs_t *prefs, PyObject *buffers) {
+    if (NULL == buffers || Py_None == buffers) {
+        return 0;
+    }
+    return (NULL == (prefs->buffers = PySequence_Tuple(buffers)));
+}
+
+/* Returns fp.readinto (new reference) if it can be used to read fp instead of fp.read, i.e. unless read is overridden
+ * by a class preceding the one defining readinto (in the MRO of fp's type). Otherwise returns NULL (no exception set).
+ */
+static PyObject* _bjdata_get_readinto(PyObject *fp) {
+    PyObject *mro = Py_TYPE(fp)->tp_mro;
+    PyObject *dict;
+    PyObject *readinto;
+    Py_ssize_t i;
+
+    for (i = 0; NULL != mro && i < PyTuple_GET_SIZE(mro); i++) {
+        dict = ((PyTypeObject *)PyTuple_GET_ITEM(mro, i))->tp_dict;
+        if (NULL != PyDict_GetItemString(dict, "readinto")) {
+            if (NULL != (readinto = PyObject_GetAttrString(fp, "readinto")) && PyCallable_Check(readinto)) {
+                return readinto;
+            }
+            Py_XDECREF(readinto);
+            PyErr_Clear();
+            return NULL;
+        }
+        if (NULL != PyDict_GetItemString(dict, "read")) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
 
 /******************************************************************************/
 
@@ -39,33 +355,51 @@ PyDoc_STRVAR(_bjdata_dump__doc__, "See pure Python version (encoder.dump) for do
 #define FUNC_DEF_DUMP {"dump", (PyCFunction)_bjdata_dump, METH_VARARGS | METH_KEYWORDS, _bjdata_dump__doc__}
 static PyObject*
 _bjdata_dump(PyObject *self, PyObject *args, PyObject *kwargs) {
-    static const char *format = "OO|iiiiO:dump";
-    static char *keywords[] = {"obj", "fp", "container_count", "sort_keys", "no_float32", "islittle", "default", NULL};
+    static const char *format = "OO|iiiiOzOiiOi:dump";
+    static char *keywords[] = {"obj", "fp", "container_count", "sort_keys", "no_float32", "islittle", "default",
+                               "dialect", "encoders", "typed_objects", "align", "buffer_callback", "background_write",
+                               NULL};
 
     _bjdata_encoder_buffer_t *buffer = NULL;
     _bjdata_encoder_prefs_t prefs = _bjdata_encoder_prefs_defaults;
     PyObject *obj;
     PyObject *fp;
     PyObject *fp_write = NULL;
+    PyObject *encoders = NULL;
+    const char *dialect = NULL;
     UNUSED(self);
 
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, keywords, &obj, &fp, &prefs.container_count,
-                                     &prefs.sort_keys, &prefs.no_float32, &prefs.islittle, &prefs.default_func)) {
+                                     &prefs.sort_keys, &prefs.no_float32, &prefs.islittle, &prefs.default_func,
+                                     &dialect, &encoders, &prefs.typed_objects, &prefs.align,
+                                     &prefs.buffer_callback, &prefs.background_write)) {
         goto bail;
     }
+    BAIL_ON_NONZERO(_bjdata_check_align(prefs.align));
+    BAIL_ON_NONZERO(_bjdata_check_buffer_callback(&prefs.buffer_callback));
+    BAIL_ON_NONZERO(_bjdata_parse_dialect(dialect, &prefs.dialect));
+    BAIL_ON_NONZERO(_bjdata_parse_encoders(encoders, &prefs.encoders));
     BAIL_ON_NULL(fp_write = PyObject_GetAttrString(fp, "write"));
     BAIL_ON_NULL(buffer = _bjdata_encoder_buffer_create(&prefs, fp_write));
     // buffer creation has added reference
     Py_CLEAR(fp_write);
+    // files are written via their file descriptor directly
+    BAIL_ON_NONZERO(_bjdata_encoder_buffer_set_fd(buffer, fp));
+    // offsets of counts to patch & aligned payloads are relative to the start of the file (if seekable)
+    if (prefs.container_count || prefs.align > 1) {
+        BAIL_ON_NONZERO(_bjdata_encoder_buffer_set_fp(buffer, fp));
+    }
 
     BAIL_ON_NONZERO(_bjdata_encode_value(obj, buffer));
     BAIL_ON_NULL(obj = _bjdata_encoder_buffer_finalise(buffer));
     _bjdata_encoder_buffer_free(&buffer);
+    Py_XDECREF(prefs.encoders);
     return obj;
 
 bail:
     Py_XDECREF(fp_write);
     _bjdata_encoder_buffer_free(&buffer);
+    Py_XDECREF(prefs.encoders);
     return NULL;
 }
 
@@ -73,27 +407,77 @@ PyDoc_STRVAR(_bjdata_dumpb__doc__, "See pure Python version (encoder.dumpb) for
 #define FUNC_DEF_DUMPB {"dumpb", (PyCFunction)_bjdata_dumpb, METH_VARARGS | METH_KEYWORDS, _bjdata_dumpb__doc__}
 static PyObject*
 _bjdata_dumpb(PyObject *self, PyObject *args, PyObject *kwargs) {
-    static const char *format = "O|iiiiO:dumpb";
-    static char *keywords[] = {"obj", "container_count", "sort_keys", "no_float32", "islittle", "default", NULL};
+    static const char *format = "O|iiiiOzOiiO:dumpb";
+    static char *keywords[] = {"obj", "container_count", "sort_keys", "no_float32", "islittle", "default", "dialect",
+                               "encoders", "typed_objects", "align", "buffer_callback", NULL};
 
     _bjdata_encoder_buffer_t *buffer = NULL;
     _bjdata_encoder_prefs_t prefs = _bjdata_encoder_prefs_defaults;
     PyObject *obj;
+    PyObject *encoders = NULL;
+    const char *dialect = NULL;
     UNUSED(self);
 
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, keywords, &obj, &prefs.container_count, &prefs.sort_keys,
-                                     &prefs.no_float32, &prefs.islittle, &prefs.default_func)) {
+                                     &prefs.no_float32, &prefs.islittle, &prefs.default_func, &dialect, &encoders,
+                                     &prefs.typed_objects, &prefs.align, &prefs.buffer_callback)) {
         goto bail;
     }
+    BAIL_ON_NONZERO(_bjdata_check_align(prefs.align));
+    BAIL_ON_NONZERO(_bjdata_check_buffer_callback(&prefs.buffer_callback));
+    BAIL_ON_NONZERO(_bjdata_parse_dialect(dialect, &prefs.dialect));
+    BAIL_ON_NONZERO(_bjdata_parse_encoders(encoders, &prefs.encoders));
 
     BAIL_ON_NULL(buffer = _bjdata_encoder_buffer_create(&prefs, NULL));
     BAIL_ON_NONZERO(_bjdata_encode_value(obj, buffer));
     BAIL_ON_NULL(obj = _bjdata_encoder_buffer_finalise(buffer));
     _bjdata_encoder_buffer_free(&buffer);
+    Py_XDECREF(prefs.encoders);
     return obj;
 
 bail:
     _bjdata_encoder_buffer_free(&buffer);
+    Py_XDECREF(prefs.encoders);
+    return NULL;
+}
+
+PyDoc_STRVAR(_bjdata_dumpb_iov__doc__, "See pure Python version (encoder.dumpb_iov) for documentation.");
+#define FUNC_DEF_DUMPB_IOV {"dumpb_iov", (PyCFunction)_bjdata_dumpb_iov, METH_VARARGS | METH_KEYWORDS,\
+                            _bjdata_dumpb_iov__doc__}
+static PyObject*
+_bjdata_dumpb_iov(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static const char *format = "O|iiiiOzOiiO:dumpb_iov";
+    static char *keywords[] = {"obj", "container_count", "sort_keys", "no_float32", "islittle", "default", "dialect",
+                               "encoders", "typed_objects", "align", "buffer_callback", NULL};
+
+    _bjdata_encoder_buffer_t *buffer = NULL;
+    _bjdata_encoder_prefs_t prefs = _bjdata_encoder_prefs_defaults;
+    PyObject *obj;
+    PyObject *encoders = NULL;
+    const char *dialect = NULL;
+    UNUSED(self);
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, keywords, &obj, &prefs.container_count, &prefs.sort_keys,
+                                     &prefs.no_float32, &prefs.islittle, &prefs.default_func, &dialect, &encoders,
+                                     &prefs.typed_objects, &prefs.align, &prefs.buffer_callback)) {
+        goto bail;
+    }
+    BAIL_ON_NONZERO(_bjdata_check_align(prefs.align));
+    BAIL_ON_NONZERO(_bjdata_check_buffer_callback(&prefs.buffer_callback));
+    BAIL_ON_NONZERO(_bjdata_parse_dialect(dialect, &prefs.dialect));
+    BAIL_ON_NONZERO(_bjdata_parse_encoders(encoders, &prefs.encoders));
+
+    BAIL_ON_NULL(buffer = _bjdata_encoder_buffer_create(&prefs, NULL));
+    BAIL_ON_NONZERO(_bjdata_encoder_buffer_set_segments(buffer));
+    BAIL_ON_NONZERO(_bjdata_encode_value(obj, buffer));
+    BAIL_ON_NULL(obj = _bjdata_encoder_buffer_finalise(buffer));
+    _bjdata_encoder_buffer_free(&buffer);
+    Py_XDECREF(prefs.encoders);
+    return obj;
+
+bail:
+    _bjdata_encoder_buffer_free(&buffer);
+    Py_XDECREF(prefs.encoders);
     return NULL;
 }
 
@@ -103,22 +487,44 @@ PyDoc_STRVAR(_bjdata_load__doc__, "See pure Python version (encoder.load) for do
 #define FUNC_DEF_LOAD {"load", (PyCFunction)_bjdata_load, METH_VARARGS | METH_KEYWORDS, _bjdata_load__doc__}
 static PyObject*
 _bjdata_load(PyObject *self, PyObject *args, PyObject *kwargs) {
-    static const char *format = "O|iOOii:load";
-    static char *keywords[] = {"fp", "no_bytes", "object_hook", "object_pairs_hook", "intern_object_keys", "islittle", NULL};
+    static const char *format = "O|iOOiizOOOOOzzOOOOOOOi:load";
+    static char *keywords[] = {"fp", "no_bytes", "object_hook", "object_pairs_hook", "intern_object_keys", "islittle",
+                               "dialect", "max_container_count", "max_total_bytes", "max_depth", "max_string_length",
+                               "dict_class", "array_as", "records", "include", "exclude", "raw_depth", "raw_paths",
+                               "classes", "class_paths", "buffers", "zero_copy", NULL};
 
     _bjdata_decoder_buffer_t *buffer = NULL;
     _bjdata_decoder_prefs_t prefs = _bjdata_decoder_prefs_defaults;
     PyObject *fp;
     PyObject *fp_read = NULL;
     PyObject *fp_seek = NULL;
+    PyObject *fp_readinto = NULL;
     PyObject *seekable = NULL;
     PyObject *obj = NULL;
+    const char *dialect = NULL;
+    PyObject *max_container_count = NULL, *max_total_bytes = NULL, *max_depth = NULL, *max_string_length = NULL;
+    PyObject *dict_class = NULL;
+    const char *array_as = NULL;
+    const char *records = NULL;
+    PyObject *include = NULL, *exclude = NULL, *raw_depth = NULL, *raw_paths = NULL;
+    PyObject *classes = NULL, *class_paths = NULL;
+    PyObject *buffers = NULL;
     UNUSED(self);
 
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, keywords, &fp, &prefs.no_bytes,  &prefs.object_hook,
-                                     &prefs.object_pairs_hook, &prefs.intern_object_keys, &prefs.islittle)) {
+                                     &prefs.object_pairs_hook, &prefs.intern_object_keys, &prefs.islittle, &dialect,
+                                     &max_container_count, &max_total_bytes, &max_depth, &max_string_length, &dict_class,
+                                     &array_as, &records, &include, &exclude, &raw_depth, &raw_paths, &classes,
+                                     &class_paths, &buffers, &prefs.zero_copy)) {
         goto bail;
     }
+    BAIL_ON_NONZERO(_bjdata_parse_dialect(dialect, &prefs.dialect));
+    BAIL_ON_NONZERO(_bjdata_parse_decoder_limits(&prefs, max_container_count, max_total_bytes, max_depth,
+                                                 max_string_length));
+    BAIL_ON_NONZERO(_bjdata_parse_decoder_containers(&prefs, dict_class, array_as, records));
+    BAIL_ON_NONZERO(_bjdata_parse_decoder_paths(&prefs, include, exclude, raw_depth, raw_paths));
+    BAIL_ON_NONZERO(_bjdata_parse_decoder_classes(&prefs, classes, class_paths));
+    BAIL_ON_NONZERO(_bjdata_parse_decoder_buffers(&prefs, buffers));
 
     BAIL_ON_NULL(fp_read = PyObject_GetAttrString(fp, "read"));
     if (!PyCallable_Check(fp_read)) {
@@ -137,20 +543,37 @@ _bjdata_load(PyObject *self, PyObject *args, PyObject *kwargs) {
     // ignore seekable() / seek get errors
     PyErr_Clear();
 
-    BAIL_ON_NULL(buffer = _bjdata_decoder_buffer_create(&prefs, fp_read, fp_seek));
+    // read into persistent (or destination) buffers rather than creating a bytes instance per read, if possible
+    fp_readinto = _bjdata_get_readinto(fp);
+
+    BAIL_ON_NULL(buffer = _bjdata_decoder_buffer_create(&prefs, fp_read, fp_seek, fp_readinto));
     // buffer creation has added references
     Py_CLEAR(fp_read);
     Py_CLEAR(fp_seek);
+    Py_CLEAR(fp_readinto);
+    // (seekable) files are read via their file descriptor directly
+    BAIL_ON_NONZERO(_bjdata_decoder_buffer_set_fd(buffer, fp));
 
     BAIL_ON_NULL(obj = _bjdata_decode_value(buffer, NULL));
     BAIL_ON_NONZERO(_bjdata_decoder_buffer_free(&buffer));
+    Py_XDECREF(prefs.path_filter);
+    Py_XDECREF(prefs.raw_paths);
+    Py_XDECREF(prefs.classes);
+    Py_XDECREF(prefs.class_paths);
+    Py_XDECREF(prefs.buffers);
     return obj;
 
 bail:
     Py_XDECREF(fp_read);
     Py_XDECREF(fp_seek);
+    Py_XDECREF(fp_readinto);
     Py_XDECREF(obj);
     _bjdata_decoder_buffer_free(&buffer);
+    Py_XDECREF(prefs.path_filter);
+    Py_XDECREF(prefs.raw_paths);
+    Py_XDECREF(prefs.classes);
+    Py_XDECREF(prefs.class_paths);
+    Py_XDECREF(prefs.buffers);
     return NULL;
 }
 
@@ -158,45 +581,130 @@ PyDoc_STRVAR(_bjdata_loadb__doc__, "See pure Python version (encoder.loadb) for
 #define FUNC_DEF_LOADB {"loadb", (PyCFunction)_bjdata_loadb, METH_VARARGS | METH_KEYWORDS, _bjdata_loadb__doc__}
 static PyObject*
 _bjdata_loadb(PyObject *self, PyObject *args, PyObject *kwargs) {
-    static const char *format = "O|iOOii:loadb";
-    static char *keywords[] = {"chars", "no_bytes", "object_hook", "object_pairs_hook", "intern_object_keys", "islittle", NULL};
+    static const char *format = "O|iOOiizOOOOOzzOOOOOOOi:loadb";
+    static char *keywords[] = {"chars", "no_bytes", "object_hook", "object_pairs_hook", "intern_object_keys", "islittle",
+                               "dialect", "max_container_count", "max_total_bytes", "max_depth", "max_string_length",
+                               "dict_class", "array_as", "records", "include", "exclude", "raw_depth", "raw_paths",
+                               "classes", "class_paths", "buffers", "zero_copy", NULL};
 
     _bjdata_decoder_buffer_t *buffer = NULL;
     _bjdata_decoder_prefs_t prefs = _bjdata_decoder_prefs_defaults;
     PyObject *chars;
     PyObject *obj = NULL;
+    const char *dialect = NULL;
+    PyObject *max_container_count = NULL, *max_total_bytes = NULL, *max_depth = NULL, *max_string_length = NULL;
+    PyObject *dict_class = NULL;
+    const char *array_as = NULL;
+    const char *records = NULL;
+    PyObject *include = NULL, *exclude = NULL, *raw_depth = NULL, *raw_paths = NULL;
+    PyObject *classes = NULL, *class_paths = NULL;
+    PyObject *buffers = NULL;
     UNUSED(self);
 
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, keywords, &chars, &prefs.no_bytes, &prefs.object_hook,
-                                     &prefs.object_pairs_hook, &prefs.intern_object_keys, &prefs.islittle)) {
+                                     &prefs.object_pairs_hook, &prefs.intern_object_keys, &prefs.islittle, &dialect,
+                                     &max_container_count, &max_total_bytes, &max_depth, &max_string_length, &dict_class,
+                                     &array_as, &records, &include, &exclude, &raw_depth, &raw_paths, &classes,
+                                     &class_paths, &buffers, &prefs.zero_copy)) {
         goto bail;
     }
+    BAIL_ON_NONZERO(_bjdata_parse_dialect(dialect, &prefs.dialect));
+    BAIL_ON_NONZERO(_bjdata_parse_decoder_limits(&prefs, max_container_count, max_total_bytes, max_depth,
+                                                 max_string_length));
+    BAIL_ON_NONZERO(_bjdata_parse_decoder_containers(&prefs, dict_class, array_as, records));
+    BAIL_ON_NONZERO(_bjdata_parse_decoder_paths(&prefs, include, exclude, raw_depth, raw_paths));
+    BAIL_ON_NONZERO(_bjdata_parse_decoder_classes(&prefs, classes, class_paths));
+    BAIL_ON_NONZERO(_bjdata_parse_decoder_buffers(&prefs, buffers));
     if (PyUnicode_Check(chars)) {
         PyErr_SetString(PyExc_TypeError, "chars must be a bytes-like object, not str");
         goto bail;
     }
-    if (!PyObject_CheckBuffer(chars)) {
+    // a list/tuple of segments is checked (item by item) when creating the buffer
+    if (!PyObject_CheckBuffer(chars) && !PyList_Check(chars) && !PyTuple_Check(chars)) {
         PyErr_SetString(PyExc_TypeError, "chars does not support buffer interface");
         goto bail;
     }
 
-    BAIL_ON_NULL(buffer = _bjdata_decoder_buffer_create(&prefs, chars, NULL));
+    BAIL_ON_NULL(buffer = _bjdata_decoder_buffer_create(&prefs, chars, NULL, NULL));
 
     BAIL_ON_NULL(obj = _bjdata_decode_value(buffer, NULL));
     BAIL_ON_NONZERO(_bjdata_decoder_buffer_free(&buffer));
+    Py_XDECREF(prefs.path_filter);
+    Py_XDECREF(prefs.raw_paths);
+    Py_XDECREF(prefs.classes);
+    Py_XDECREF(prefs.class_paths);
+    Py_XDECREF(prefs.buffers);
     return obj;
 
 bail:
     Py_XDECREF(obj);
     _bjdata_decoder_buffer_free(&buffer);
+    Py_XDECREF(prefs.path_filter);
+    Py_XDECREF(prefs.raw_paths);
+    Py_XDECREF(prefs.classes);
+    Py_XDECREF(prefs.class_paths);
+    Py_XDECREF(prefs.buffers);
     return NULL;
 }
 
 /******************************************************************************/
 
+PyDoc_STRVAR(_bjdata_validate__doc__, "See pure Python version (decoder.validate) for documentation.");
+#define FUNC_DEF_VALIDATE {"validate", (PyCFunction)_bjdata_validate, METH_VARARGS | METH_KEYWORDS,\
+                           _bjdata_validate__doc__}
+static PyObject*
+_bjdata_validate(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static const char *format = "O|OOiz:validate";
+    static char *keywords[] = {"chars", "max_depth", "max_size", "islittle", "dialect", NULL};
+
+    PyObject *chars;
+    PyObject *max_depth_obj = NULL;
+    PyObject *max_size_obj = NULL;
+    Py_ssize_t max_depth, max_size, result;
+    int islittle = 1;
+    int dialect_id;
+    const char *dialect = NULL;
+    Py_buffer view;
+    UNUSED(self);
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, keywords, &chars, &max_depth_obj, &max_size_obj, &islittle,
+                                     &dialect)) {
+        return NULL;
+    }
+    if (_bjdata_parse_dialect(dialect, &dialect_id) ||
+        _bjdata_parse_limit(max_depth_obj, "max_depth", &max_depth) ||
+        _bjdata_parse_limit(max_size_obj, "max_size", &max_size)) {
+        return NULL;
+    }
+    if (PyUnicode_Check(chars)) {
+        PyErr_SetString(PyExc_TypeError, "chars must be a bytes-like object, not str");
+        return NULL;
+    }
+    if (0 != PyObject_GetBuffer(chars, &view, PyBUF_SIMPLE)) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    result = _bjdata_validate_buffer(view.buf, view.len, islittle, dialect_id, max_depth, max_size);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+
+    switch (result) {
+        case VALIDATE_OK:
+            Py_RETURN_NONE;
+        case VALIDATE_FAILED:
+            return PyErr_NoMemory();
+        default:
+            return PyLong_FromSsize_t(result);
+    }
+}
+
+/******************************************************************************/
+
 static PyMethodDef UbjsonMethods[] = {
-    FUNC_DEF_DUMP, FUNC_DEF_DUMPB,
+    FUNC_DEF_DUMP, FUNC_DEF_DUMPB, FUNC_DEF_DUMPB_IOV,
     FUNC_DEF_LOAD, FUNC_DEF_LOADB,
+    FUNC_DEF_VALIDATE,
     {NULL, NULL, 0, NULL}
 };
 
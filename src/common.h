@@ -43,6 +43,22 @@ if ((result) < 0) {\
     goto bail;\
 }
 
+// Whether files (io.FileIO and io.Buffered{Reader,Writer}) can be read/written via their file descriptor directly
+#if defined(HAVE_PREAD) && !defined(MS_WINDOWS)
+#define FD_IO_SUPPORTED
+#endif
+
+// Wire format dialects (dialect argument of dump/load functions)
+#define DIALECT_BJDATA 0
+#define DIALECT_UBJSON 1
+
+/* Name mangling for code compiled once per dialect (see encoder_dialect.h / decoder_dialect.h), e.g.
+ * DIALECT_FUNC(_encode_value) becomes _encode_value_bjd if DIALECT_SUFFIX is defined as bjd.
+ */
+#define DIALECT_FUNC(name) DIALECT_FUNC_(name, DIALECT_SUFFIX)
+#define DIALECT_FUNC_(name, suffix) DIALECT_FUNC__(name, suffix)
+#define DIALECT_FUNC__(name, suffix) name ## _ ## suffix
+
 #if defined (__cplusplus)
 }
 #endif
@@ -28,15 +28,12 @@
 #include "decoder.h"
 #include "python_funcs.h"
 
-/******************************************************************************/
+#ifdef FD_IO_SUPPORTED
+#include <errno.h>
+#include <unistd.h>
+#endif
 
-#define RECURSE_AND_RETURN_OR_BAIL(action, recurse_msg) {\
-    PyObject *ret;\
-    BAIL_ON_NONZERO(Py_EnterRecursiveCall(recurse_msg));\
-    ret = (action);\
-    Py_LeaveRecursiveCall();\
-    return ret;\
-}
+/******************************************************************************/
 
 #define RAISE_DECODER_EXCEPTION(msg) {\
     PyObject *num = NULL, *str = NULL, *tuple = NULL;\
@@ -67,8 +64,10 @@
     }\
 }
 
+// reads via buffer's read_func unless doing so would exceed max_total_bytes
 #define READ_VIA_FUNC(buffer, readptr, dst) \
-    buffer->read_func(buffer, readptr, dst)
+    (((buffer)->prefs.max_total_bytes >= 0 && *(readptr) > (buffer)->prefs.max_total_bytes - (buffer)->total_read) ?\
+     _decoder_buffer_read_over_limit(buffer, readptr) : (buffer)->read_func(buffer, readptr, dst))
 
 #define READ_INTO_OR_BAIL(len, dst_buffer, item_str) {\
     Py_ssize_t read = len;\
@@ -102,17 +101,64 @@
 #define DECODE_LENGTH_OR_BAIL_MARKER(length, marker) \
     BAIL_ON_NEGATIVE((length) = _decode_int_non_negative(buffer, &(marker)))
 
+#define CHECK_STRING_LENGTH_OR_BAIL(length) {\
+    if (buffer->prefs.max_string_length >= 0 && (length) > buffer->prefs.max_string_length) {\
+        RAISE_DECODER_EXCEPTION("String length exceeds max_string_length");\
+    }\
+}
+
+// size is the number of values decoded so far (for containers without a count)
+#define CHECK_CONTAINER_SIZE_OR_BAIL(size) {\
+    if (buffer->prefs.max_container_count >= 0 && (size) >= buffer->prefs.max_container_count) {\
+        RAISE_DECODER_EXCEPTION("Container count exceeds max_container_count");\
+    }\
+}
+
 
 // decoder buffer size when using fp (i.e. minimum number of bytes to read in one go)
 #define BUFFER_FP_SIZE 256
+// decoder buffer size when reading from a file descriptor directly (larger reads bypass the buffer)
+#define BUFFER_FD_SIZE (1 << 16)
+// packed arrays larger than this are read in (growing) chunks unless input is a fixed buffer
+#define PACKED_READ_CHUNK_SIZE (1 << 20)
+// initial number of container frames allocated for the decoder stack (grows as required)
+#define DECODER_STACK_INITIAL_SIZE 16
+// number of slots in object key cache (must be a power of two)
+#define KEY_CACHE_SIZE 256
+// longest object key (in bytes) to store in the key cache
+#define KEY_CACHE_MAX_LEN 32
+// dicts of counted objects are created with space for (up to) this many items
+#define DICT_PRESIZE_MAX (1 << 16)
+// number of container frames _skip_value can track without allocating (grows on the heap as required)
+#define SKIP_STACK_LOCAL_SIZE 32
+// skipped values are read in chunks of at most this size unless input is a fixed buffer
+#define SKIP_CHUNK_SIZE (1 << 16)
 // io.SEEK_CUR constant (for seek() function)
+#define IO_SEEK_SET 0
 #define IO_SEEK_CUR 1
+// items of a class spec tuple (see decoder._class_spec)
+#define CLASS_SPEC_TYPE(spec) PyTuple_GET_ITEM(spec, 0)
+#define CLASS_SPEC_NAMES(spec) PyTuple_GET_ITEM(spec, 1)
+#define CLASS_SPEC_INDEX(spec) PyTuple_GET_ITEM(spec, 2)
+#define CLASS_SPEC_SETATTRS(spec) (Py_True == PyTuple_GET_ITEM(spec, 3))
 
 
 static PyObject *DecoderException = NULL;
+// files which can be read via their file descriptor (see _bjdata_decoder_buffer_set_fd)
+static PyObject *FileIOType = NULL;
+static PyObject *BufferedReaderType = NULL;
+// RawBJData._from_valid
+static PyObject *RawBJData_from_valid = NULL;
 static PyTypeObject *PyDec_Type = NULL;
 #define PyDec_Check(v) PyObject_TypeCheck(v, PyDec_Type)
 
+// Creates a dict with space for the given number of items (falling back to an empty one if not supported)
+#if PY_VERSION_HEX < 0x030D0000
+#   define DICT_NEW_PRESIZED(size) _PyDict_NewPresized(size)
+#else
+#   define DICT_NEW_PRESIZED(size) PyDict_New()
+#endif
+
 /******************************************************************************/
 
 typedef struct {
@@ -128,9 +174,78 @@ typedef struct {
     int invalid;
 } _container_params_t;
 
+// A container which is being decoded (see _decode_value in decoder_dialect.h)
+typedef struct {
+    // ARRAY_START or OBJECT_START
+    char kind;
+    // count, type & next marker (the latter being updated as values are decoded)
+    _container_params_t params;
+    // list (array or object with object_pairs_hook) or dict being populated
+    PyObject *container;
+    // key for value currently being decoded (objects only)
+    PyObject *key;
+    // number of values stored so far, i.e. also next position in list/tuple if count known (created with full size)
+    Py_ssize_t list_pos;
+    // for arrays in records='rows' mode: 1 if all values so far were objects with row_keys (and have been stored as
+    // tuples of their values), 0 if no values yet, -1 otherwise (or not in rows mode)
+    int rows;
+    // keys (tuple) of first object in array (rows mode only)
+    PyObject *row_keys;
+    // (borrowed) include/exclude trie node applying to members of this container or NULL if not filtering
+    PyObject *filter;
+    // (borrowed) trie node for the nested container about to be decoded (same as filter for arrays)
+    PyObject *next_filter;
+    // (borrowed) raw_paths trie node applying to members of this container or NULL
+    PyObject *raw_node;
+    // (borrowed) raw_paths trie node for the nested container about to be decoded (same as raw_node for arrays)
+    PyObject *next_raw_node;
+    // (borrowed) class_paths trie node applying to members of this container or NULL
+    PyObject *class_node;
+    // (borrowed) class_paths trie node for the nested container about to be decoded (same as class_node for arrays)
+    PyObject *next_class_node;
+    // (borrowed) spec of the class this object is decoded into (container then being a tuple of field values, unset
+    // ones being NULL) or NULL. Once complete, that of the resulting instance (if any).
+    PyObject *spec;
+    // whether spec was guessed (from the previous object in the same array), i.e. the object reverts to a dict unless
+    // its keys are exactly the fields of the class
+    int spec_guessed;
+    // (borrowed) spec of the last object of this array which was decoded into a class instance (classes only)
+    PyObject *last_spec;
+    // nesting depth of this container (1 for the outermost one)
+    Py_ssize_t depth;
+} _decoder_frame_t;
+
+// Stack of containers being decoded, allocated on the heap so that nesting depth is not limited by the C stack
+typedef struct {
+    _decoder_frame_t *frames;
+    Py_ssize_t size;
+    Py_ssize_t capacity;
+} _decoder_stack_t;
+
+// A container which is being skipped (see _skip_value in decoder_dialect.h)
+typedef struct {
+    // ARRAY_START or OBJECT_START
+    char kind;
+    _container_params_t params;
+    // number of values skipped so far (for containers without a count)
+    Py_ssize_t size;
+    // whether a value of this container has just been skipped (i.e. is followed by the next value marker)
+    int pending;
+} _skip_frame_t;
+
 static const char* _decoder_buffer_read_fixed(_bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer);
+static int _decoder_buffer_set_fp_buffer(_bjdata_decoder_buffer_t *buffer, Py_ssize_t size);
+static Py_ssize_t _decoder_buffer_readinto(_bjdata_decoder_buffer_t *buffer, char *dst, Py_ssize_t len);
+static Py_ssize_t _decoder_buffer_pread(_bjdata_decoder_buffer_t *buffer, char *dst, Py_ssize_t len);
 static const char* _decoder_buffer_read_callable(_bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer);
 static const char* _decoder_buffer_read_buffered(_bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer);
+static const char* _decoder_buffer_read_segments(_bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer);
+static const char* _decoder_buffer_read_over_limit(_bjdata_decoder_buffer_t *buffer, Py_ssize_t *len);
+static int _decoder_buffer_check_available(_bjdata_decoder_buffer_t *buffer, long long len);
+static PyObject* _decoder_buffer_read_view(_bjdata_decoder_buffer_t *buffer, Py_ssize_t len, Py_ssize_t *offset);
+static int _decoder_buffer_skip(_bjdata_decoder_buffer_t *buffer, long long len);
+static int _decoder_skip_noops(_bjdata_decoder_buffer_t *buffer);
+static const char* _decoder_buffer_read_capture(_bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer);
 
 //These functions return NULL on failure (an exception will have been set). Note that no type checking is performed!
 
@@ -141,27 +256,41 @@ static PyObject* _decode_int64(_bjdata_decoder_buffer_t *buffer);
 static PyObject* _decode_uint64(_bjdata_decoder_buffer_t *buffer);
 static PyObject* _decode_float32(_bjdata_decoder_buffer_t *buffer);
 static PyObject* _decode_float64(_bjdata_decoder_buffer_t *buffer);
-static PyObject* _decode_high_prec(_bjdata_decoder_buffer_t *buffer);
-static long long _decode_int_non_negative(_bjdata_decoder_buffer_t *buffer, char *given_marker);
 static PyObject* _decode_char(_bjdata_decoder_buffer_t *buffer);
-static PyObject* _decode_string(_bjdata_decoder_buffer_t *buffer);
-static _container_params_t _get_container_params(_bjdata_decoder_buffer_t *buffer, int in_mapping, unsigned int *ndim, long long **dims);
+static PyObject* _decode_packed_array(_bjdata_decoder_buffer_t *buffer, char type, int ndim, npy_intp *dims,
+                                      long long count);
 static int _is_no_data_type(char type);
 static int _is_fixed_len_type(char type);
 static int _get_type_info(char type, int *bytelen);
 static PyObject* _no_data_type(char type);
-static PyObject* _decode_array(_bjdata_decoder_buffer_t *buffer);
-static PyObject* _decode_object_with_pairs_hook(_bjdata_decoder_buffer_t *buffer);
-static PyObject* _decode_object(_bjdata_decoder_buffer_t *buffer);
+static _decoder_frame_t* _decoder_stack_push(_bjdata_decoder_buffer_t *buffer, _decoder_stack_t *stack, char kind);
+static void _decoder_stack_pop(_decoder_stack_t *stack);
+static void _decoder_stack_free(_decoder_stack_t *stack);
+static PyObject* _decoder_key_from_cache(_bjdata_decoder_buffer_t *buffer, const char *raw, Py_ssize_t len, int intern);
+static int _decoder_rows_add(_decoder_frame_t *frame, Py_ssize_t stored, PyObject **value);
+static int _decoder_rows_reject(_decoder_frame_t *frame, Py_ssize_t stored);
+static PyObject* _decoder_rows_finish(_decoder_frame_t *frame, PyObject *rows);
+static int _decoder_filter_member(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, PyObject *key);
+static int _decoder_raw_member(_decoder_frame_t *frame, PyObject *key);
+static PyObject* _decoder_raw_slice(_bjdata_decoder_buffer_t *buffer, char marker, int typed, Py_ssize_t start);
+static int _decoder_class_member(_decoder_frame_t *frame, PyObject *key);
+static PyObject* _decoder_class_values_dict(PyObject *spec, PyObject *values);
+static PyObject* _decoder_class_new(PyObject *spec, PyObject *values);
+static int _decoder_class_set(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, PyObject *key,
+                              PyObject *value);
+static PyObject* _decoder_class_end(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, PyObject *obj);
+static PyObject* _decoder_out_of_band(_bjdata_decoder_buffer_t *buffer, PyObject *obj);
 
 /******************************************************************************/
 
-/* Returns new decoder buffer or NULL on failure (an exception will be set). Input must either support buffer interface
- * or be callable. Currently only increases reference count for input parameter.
+/* Returns new decoder buffer or NULL on failure (an exception will be set). Input must either support buffer interface,
+ * be a list or tuple of objects which do (segments, read without joining them) or be callable. If callable, readinto
+ * (if not NULL) is used to read the same stream instead. Currently only increases reference count for input parameter.
  */
 _bjdata_decoder_buffer_t* _bjdata_decoder_buffer_create(_bjdata_decoder_prefs_t* prefs, PyObject *input,
-                                                        PyObject *seek) {
+                                                        PyObject *seek, PyObject *readinto) {
     _bjdata_decoder_buffer_t *buffer;
+    Py_ssize_t count;
 
     if (NULL == (buffer = calloc(1, sizeof(_bjdata_decoder_buffer_t)))) {
         PyErr_NoMemory();
@@ -171,11 +300,28 @@ _bjdata_decoder_buffer_t* _bjdata_decoder_buffer_create(_bjdata_decoder_prefs_t*
     buffer->prefs = *prefs;
     buffer->input = input;
     Py_XINCREF(input);
+    buffer->fd = -1;
 
     if (PyObject_CheckBuffer(input)) {
         BAIL_ON_NONZERO(PyObject_GetBuffer(input, &buffer->view, PyBUF_SIMPLE));
         buffer->read_func = _decoder_buffer_read_fixed;
         buffer->view_set = 1;
+    } else if (PyList_Check(input) || PyTuple_Check(input)) {
+        // copied so that segments remain referenced even if the list is modified while decoding (e.g. by a hook)
+        BAIL_ON_NULL(input = PySequence_Tuple(input));
+        Py_DECREF(buffer->input);
+        buffer->input = input;
+        count = PyTuple_GET_SIZE(input);
+        if (NULL == (buffer->segments = calloc((size_t)(MAX(count, 1)), sizeof(Py_buffer)))) {
+            PyErr_NoMemory();
+            goto bail;
+        }
+        for (; buffer->segment_count < count; buffer->segment_count++) {
+            BAIL_ON_NONZERO(PyObject_GetBuffer(PyTuple_GET_ITEM(input, buffer->segment_count),
+                                               &buffer->segments[buffer->segment_count], PyBUF_SIMPLE));
+            buffer->segments_len += buffer->segments[buffer->segment_count].len;
+        }
+        buffer->read_func = _decoder_buffer_read_segments;
     } else if (PyCallable_Check(input)) {
         if (NULL == seek) {
             buffer->read_func = _decoder_buffer_read_callable;
@@ -184,6 +330,11 @@ _bjdata_decoder_buffer_t* _bjdata_decoder_buffer_create(_bjdata_decoder_prefs_t*
             buffer->seek = seek;
             Py_INCREF(seek);
         }
+        if (NULL != readinto) {
+            BAIL_ON_NONZERO(_decoder_buffer_set_fp_buffer(buffer, BUFFER_FP_SIZE));
+            buffer->readinto = readinto;
+            Py_INCREF(readinto);
+        }
     } else {
         // Should have been checked a level above
         PyErr_SetString(PyExc_TypeError, "Input neither support buffer interface nor is callable");
@@ -204,42 +355,130 @@ bail:
     return NULL;
 }
 
+/* Makes the (seekable) stream be read from the file descriptor of fp directly (via pread, in large chunks, without
+ * holding the GIL while doing so) if fp is exactly io.FileIO or io.BufferedReader. Otherwise (or if not supported on
+ * this platform) does nothing. Since the position of the file descriptor is not changed, neither is the state of a
+ * BufferedReader: fp is only seeked (to the end of the decoded value) when the buffer is freed. Must be called before
+ * anything has been read. Returns non-zero on failure (exception set).
+ */
+int _bjdata_decoder_buffer_set_fd(_bjdata_decoder_buffer_t *buffer, PyObject *fp) {
+#ifdef FD_IO_SUPPORTED
+    PyObject *ret = NULL;
+    int fd;
+
+    if (_decoder_buffer_read_buffered != buffer->read_func ||
+        ((PyObject *)Py_TYPE(fp) != FileIOType && (PyObject *)Py_TYPE(fp) != BufferedReaderType)) {
+        return 0;
+    }
+    // e.g. if closed, in which case reading via fp raises the appropriate error instead
+    if (NULL == (ret = PyObject_CallMethod(fp, "fileno", NULL)) || -1 == (fd = (int)PyLong_AsLong(ret))) {
+        Py_XDECREF(ret);
+        PyErr_Clear();
+        return 0;
+    }
+    Py_CLEAR(ret);
+    BAIL_ON_NULL(ret = PyObject_CallMethod(fp, "tell", NULL));
+    BAIL_ON_NONZERO(-1 == (buffer->fd_start = PyLong_AsLongLong(ret)) && PyErr_Occurred());
+    Py_CLEAR(ret);
+    BAIL_ON_NONZERO(_decoder_buffer_set_fp_buffer(buffer, BUFFER_FD_SIZE));
+    buffer->fd_pos = buffer->fd_start;
+    buffer->fd = fd;
+    return 0;
+
+bail:
+    Py_XDECREF(ret);
+    return 1;
+#else
+    UNUSED(buffer);
+    UNUSED(fp);
+    return 0;
+#endif
+}
+
+// (Re)creates fp_buffer (and its view) with the given size. Returns non-zero on failure (exception set).
+static int _decoder_buffer_set_fp_buffer(_bjdata_decoder_buffer_t *buffer, Py_ssize_t size) {
+    Py_CLEAR(buffer->fp_buffer_view);
+    Py_CLEAR(buffer->fp_buffer);
+    BAIL_ON_NULL(buffer->fp_buffer = PyByteArray_FromStringAndSize(NULL, size));
+    // also prevents fp_buffer from being resized (i.e. its storage from moving)
+    BAIL_ON_NULL(buffer->fp_buffer_view = PyMemoryView_FromObject(buffer->fp_buffer));
+    buffer->fp_buffer_size = size;
+    return 0;
+
+bail:
+    return 1;
+}
+
 // Returns non-zero if buffer cleanup/finalisation failed and no other exception was set already
 int _bjdata_decoder_buffer_free(_bjdata_decoder_buffer_t **buffer) {
     int failed = 0;
 
     if (NULL != buffer && NULL != *buffer) {
-        if ((*buffer)->view_set) {
-            // In buffered mode, rewind to position in stream up to which actually read (rather than buffered)
-            if (NULL != (*buffer)->seek && (*buffer)->view.len > (*buffer)->pos) {
-                PyObject *type, *value, *traceback, *seek_result;
-
-                // preserve the previous exception, if set
-                PyErr_Fetch(&type, &value, &traceback);
-
+        /* In buffered mode, rewind to position in stream up to which actually read (rather than buffered). When
+         * reading via the file descriptor, the stream's position has not changed at all.
+         */
+        if (NULL != (*buffer)->seek &&
+            ((*buffer)->fd >= 0 || ((*buffer)->view_set && (*buffer)->view.len > (*buffer)->pos))) {
+            PyObject *type, *value, *traceback, *seek_result;
+
+            // preserve the previous exception, if set
+            PyErr_Fetch(&type, &value, &traceback);
+
+            if ((*buffer)->fd >= 0) {
+                seek_result = PyObject_CallFunction((*buffer)->seek, "Li", (*buffer)->fd_start + (*buffer)->total_read,
+                                                    IO_SEEK_SET);
+            } else {
                 seek_result = PyObject_CallFunction((*buffer)->seek, "nn", ((*buffer)->pos - (*buffer)->view.len),
                                                     IO_SEEK_CUR);
-                Py_XDECREF(seek_result);
-
-                /* Blindly calling PyErr_Restore would clear any exception raised by seek call. If however already had
-                 * an error before freeing buffer (this function), propagate that instead. (I.e. this behaves like a
-                 * nested try-except block.
-                 */
-                if (NULL != type) {
-                    PyErr_Restore(type, value, traceback);
-                } else if (NULL == seek_result) {
-                    failed = 1;
-                }
             }
+            Py_XDECREF(seek_result);
+
+            /* Blindly calling PyErr_Restore would clear any exception raised by seek call. If however already had
+             * an error before freeing buffer (this function), propagate that instead. (I.e. this behaves like a
+             * nested try-except block.
+             */
+            if (NULL != type) {
+                PyErr_Restore(type, value, traceback);
+            } else if (NULL == seek_result) {
+                failed = 1;
+            }
+        }
+        if ((*buffer)->view_set) {
             PyBuffer_Release(&((*buffer)->view));
             (*buffer)->view_set = 0;
         }
+        if (NULL != (*buffer)->segments) {
+            Py_ssize_t i;
+
+            for (i = 0; i < (*buffer)->segment_count; i++) {
+                PyBuffer_Release(&(*buffer)->segments[i]);
+            }
+            free((*buffer)->segments);
+            (*buffer)->segments = NULL;
+        }
         if (NULL != (*buffer)->tmp_dst) {
             free((*buffer)->tmp_dst);
             (*buffer)->tmp_dst = NULL;
         }
+        if (NULL != (*buffer)->key_cache) {
+            Py_ssize_t i;
+
+            for (i = 0; i < KEY_CACHE_SIZE; i++) {
+                Py_XDECREF((*buffer)->key_cache[i]);
+            }
+            free((*buffer)->key_cache);
+            (*buffer)->key_cache = NULL;
+        }
+        if (NULL != (*buffer)->capture) {
+            PyMem_Free((*buffer)->capture);
+            (*buffer)->capture = NULL;
+        }
+        Py_CLEAR((*buffer)->raw_view);
         Py_CLEAR((*buffer)->input);
         Py_CLEAR((*buffer)->seek);
+        Py_CLEAR((*buffer)->readinto);
+        Py_CLEAR((*buffer)->fp_buffer_view);
+        Py_CLEAR((*buffer)->fp_buffer);
         free(*buffer);
         *buffer = NULL;
     }
@@ -278,6 +517,105 @@ static const char* _decoder_buffer_read_fixed(_bjdata_decoder_buffer_t *buffer,
     }
 }
 
+/* Reads up to len bytes from the stream into dst via readinto (or the file descriptor, if set), repeating until either
+ * len bytes have been read or the stream has ended. Returns the number of bytes read or -1 on failure (with an
+ * exception set).
+ */
+static Py_ssize_t _decoder_buffer_readinto(_bjdata_decoder_buffer_t *buffer, char *dst, Py_ssize_t len) {
+    Py_buffer info;
+    PyObject *view = NULL;
+    PyObject *result = NULL;
+    char *fp_buffer = PyByteArray_AS_STRING(buffer->fp_buffer);
+    Py_ssize_t total = 0;
+    Py_ssize_t count;
+    int temporary;
+
+    if (buffer->fd >= 0) {
+        return _decoder_buffer_pread(buffer, dst, len);
+    }
+    while (total < len) {
+        // slice of fp_buffer_view (which keeps fp_buffer alive) or, for any other destination, a temporary view
+        temporary = (dst < fp_buffer || dst >= fp_buffer + buffer->fp_buffer_size);
+        if (!temporary) {
+            BAIL_ON_NULL(view = PySequence_GetSlice(buffer->fp_buffer_view, dst - fp_buffer + total,
+                                                    dst - fp_buffer + len));
+        } else {
+            BAIL_ON_NONZERO(PyBuffer_FillInfo(&info, NULL, &dst[total], len - total, 0, PyBUF_CONTIG));
+            BAIL_ON_NULL(view = PyMemoryView_FromBuffer(&info));
+        }
+        result = PyObject_CallFunctionObjArgs(buffer->readinto, view, NULL);
+#if PY_MAJOR_VERSION >= 3
+        // a temporary view must not remain usable (should readinto have kept a reference to it)
+        if (temporary) {
+            PyObject *released = PyObject_CallMethod(view, "release", NULL);
+
+            if (NULL == released) {
+                Py_XDECREF(result);
+                goto bail;
+            }
+            Py_DECREF(released);
+        }
+#endif
+        Py_CLEAR(view);
+        BAIL_ON_NULL(result);
+        if (Py_None == result) {
+            // non-blocking stream without data available
+            count = 0;
+        } else if (-1 == (count = PyNumber_AsSsize_t(result, PyExc_OverflowError)) && PyErr_Occurred()) {
+            goto bail;
+        } else if (count < 0 || count > len - total) {
+            PyErr_Format(PyExc_ValueError, "readinto returned %zd outside requested range", count);
+            goto bail;
+        }
+        Py_CLEAR(result);
+        if (0 == count) {
+            break;
+        }
+        total += count;
+    }
+    return total;
+
+bail:
+    Py_XDECREF(view);
+    Py_XDECREF(result);
+    return -1;
+}
+
+// As _decoder_buffer_readinto but reads from the file descriptor (at fd_pos), without holding the GIL
+static Py_ssize_t _decoder_buffer_pread(_bjdata_decoder_buffer_t *buffer, char *dst, Py_ssize_t len) {
+#ifdef FD_IO_SUPPORTED
+    Py_ssize_t total = 0;
+    ssize_t count;
+
+    while (total < len) {
+        Py_BEGIN_ALLOW_THREADS
+        count = pread(buffer->fd, &dst[total], (size_t)(len - total), (off_t)buffer->fd_pos);
+        Py_END_ALLOW_THREADS
+        if (count < 0 && EINTR == errno) {
+            BAIL_ON_NONZERO(PyErr_CheckSignals());
+        } else if (count < 0) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            goto bail;
+        } else if (0 == count) {
+            break;
+        } else {
+            total += count;
+            buffer->fd_pos += count;
+        }
+    }
+    return total;
+
+bail:
+    return -1;
+#else
+    UNUSED(buffer);
+    UNUSED(dst);
+    UNUSED(len);
+    PyErr_SetString(PyExc_NotImplementedError, "File descriptor input not supported");
+    return -1;
+#endif
+}
+
 // See _decoder_buffer_read_fixed for behaviour details. This function is used to read from a stream
 static const char* _decoder_buffer_read_callable(_bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer) {
     PyObject* read_result = NULL;
@@ -291,6 +629,28 @@ static const char* _decoder_buffer_read_callable(_bjdata_decoder_buffer_t *buffe
         buffer->view_set = 0;
     }
 
+    // read directly into the destination or else fp_buffer (or a temporary buffer if too small)
+    if (NULL != buffer->fp_buffer) {
+        if (NULL == dst_buffer) {
+            if (*len <= buffer->fp_buffer_size) {
+                dst_buffer = PyByteArray_AS_STRING(buffer->fp_buffer);
+            } else {
+                free(buffer->tmp_dst);
+                if (NULL == (dst_buffer = buffer->tmp_dst = malloc(sizeof(char) * (size_t)*len))) {
+                    PyErr_NoMemory();
+                    goto bail;
+                }
+            }
+        }
+        BAIL_ON_NEGATIVE(*len = _decoder_buffer_readinto(buffer, dst_buffer, *len));
+        // no input remaining
+        if (0 == *len) {
+            return NULL;
+        }
+        buffer->total_read += *len;
+        return dst_buffer;
+    }
+
     // read input and get buffer view
     BAIL_ON_NULL(read_result = PyObject_CallFunction(buffer->input, "n", *len));
     BAIL_ON_NONZERO(PyObject_GetBuffer(read_result, &buffer->view, PyBUF_SIMPLE));
@@ -324,6 +684,7 @@ static const char* _decoder_buffer_read_buffered(_bjdata_decoder_buffer_t *buffe
     Py_ssize_t old_pos;
     char *tmp_dst;
     Py_ssize_t remaining_old = 0; // how many bytes remaining to be read (from old view)
+    Py_ssize_t read;
     PyObject* read_result = NULL;
 
     if (0 == *len) {
@@ -360,13 +721,33 @@ static const char* _decoder_buffer_read_buffered(_bjdata_decoder_buffer_t *buffe
             buffer->pos = 0;
         }
 
-        // read input and get buffer view
-        BAIL_ON_NULL(read_result = PyObject_CallFunction(buffer->input, "n",
-                                                         MAX(BUFFER_FP_SIZE, (*len - remaining_old))));
-        BAIL_ON_NONZERO(PyObject_GetBuffer(read_result, &buffer->view, PyBUF_SIMPLE));
-        buffer->view_set = 1;
-        // don't need reference since view reserves one already
-        Py_CLEAR(read_result);
+        if (NULL == buffer->fp_buffer) {
+            // read input and get buffer view
+            BAIL_ON_NULL(read_result = PyObject_CallFunction(buffer->input, "n",
+                                                             MAX(BUFFER_FP_SIZE, (*len - remaining_old))));
+            BAIL_ON_NONZERO(PyObject_GetBuffer(read_result, &buffer->view, PyBUF_SIMPLE));
+            buffer->view_set = 1;
+            // don't need reference since view reserves one already
+            Py_CLEAR(read_result);
+        } else if (*len - remaining_old > buffer->fp_buffer_size) {
+            // larger reads (e.g. of packed array data) go straight to their destination, bypassing fp_buffer
+            BAIL_ON_NEGATIVE(read = _decoder_buffer_readinto(buffer, &tmp_dst[remaining_old], *len - remaining_old));
+            // no input remaining
+            if (0 == remaining_old && 0 == read) {
+                *len = 0;
+                return NULL;
+            }
+            *len = remaining_old + read;
+            buffer->total_read += read;
+            return tmp_dst;
+        } else {
+            BAIL_ON_NEGATIVE(read = _decoder_buffer_readinto(buffer, PyByteArray_AS_STRING(buffer->fp_buffer),
+                                                             buffer->fp_buffer_size));
+            BAIL_ON_NONZERO(PyObject_GetBuffer(buffer->fp_buffer, &buffer->view, PyBUF_SIMPLE));
+            buffer->view_set = 1;
+            // only the part of fp_buffer read into is input
+            buffer->view.len = read;
+        }
 
         // no input remaining
         if (0 == remaining_old && buffer->view.len == 0) {
@@ -400,6 +781,228 @@ bail:
     return NULL;
 }
 
+/* See _decoder_buffer_read_fixed for behaviour details. This function reads from a list of segments (byte arrays),
+ * only copying input (into dst_buffer or a temporary buffer) if a read spans more than one segment.
+ */
+static const char* _decoder_buffer_read_segments(_bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer) {
+    Py_buffer *segment;
+    Py_ssize_t old_pos;
+    Py_ssize_t copied;
+    Py_ssize_t chunk;
+
+    if (0 == *len) {
+        return NULL;
+    }
+    // move past exhausted (or empty) segments
+    while (buffer->segment < buffer->segment_count && buffer->pos >= buffer->segments[buffer->segment].len) {
+        buffer->segment++;
+        buffer->pos = 0;
+    }
+    // no input remaining
+    if (buffer->segment >= buffer->segment_count) {
+        *len = 0;
+        return NULL;
+    }
+
+    segment = &buffer->segments[buffer->segment];
+    // within current segment
+    if (*len <= segment->len - buffer->pos) {
+        old_pos = buffer->pos;
+        buffer->pos += *len;
+        buffer->total_read += *len;
+        // caller has provided own destination
+        if (NULL != dst_buffer) {
+            return memcpy(dst_buffer, &((char*)segment->buf)[old_pos], *len);
+        } else {
+            return &((char*)segment->buf)[old_pos];
+        }
+    }
+
+    // spans segments (adjusting total length if not all available)
+    *len = MIN(*len, (buffer->segments_len - buffer->total_read));
+    if (NULL == dst_buffer) {
+        // previously used temporary output no longer needed
+        free(buffer->tmp_dst);
+        if (NULL == (dst_buffer = buffer->tmp_dst = malloc(sizeof(char) * (size_t)*len))) {
+            PyErr_NoMemory();
+            // indicate error (rather than end of input) to caller
+            *len = 1;
+            return NULL;
+        }
+    }
+    for (copied = 0; copied < *len; copied += chunk) {
+        segment = &buffer->segments[buffer->segment];
+        chunk = (MIN(*len - copied, segment->len - buffer->pos));
+        memcpy(&dst_buffer[copied], &((char*)segment->buf)[buffer->pos], chunk);
+        buffer->pos += chunk;
+        if (buffer->pos >= segment->len && copied + chunk < *len) {
+            buffer->segment++;
+            buffer->pos = 0;
+        }
+    }
+    buffer->total_read += *len;
+    return dst_buffer;
+}
+
+// Used by READ_VIA_FUNC instead of the buffer's read function if a read would exceed max_total_bytes
+static const char* _decoder_buffer_read_over_limit(_bjdata_decoder_buffer_t *buffer, Py_ssize_t *len) {
+    // indicate error (rather than end of input) to caller
+    *len = 1;
+    RAISE_DECODER_EXCEPTION("Input exceeds max_total_bytes");
+
+bail:
+    return NULL;
+}
+
+/* Returns non-zero (DecoderException set) if fewer than len bytes can still be read, i.e. if len exceeds either
+ * max_total_bytes or (in case of a fixed input buffer) the remaining input. Used to check sizes read from the input
+ * BEFORE allocating anything based on them.
+ */
+static int _decoder_buffer_check_available(_bjdata_decoder_buffer_t *buffer, long long len) {
+    if (buffer->prefs.max_total_bytes >= 0 && len > buffer->prefs.max_total_bytes - buffer->total_read) {
+        RAISE_DECODER_EXCEPTION("Input exceeds max_total_bytes");
+    }
+    if ((_decoder_buffer_read_fixed == buffer->read_func && len > buffer->view.len - buffer->total_read) ||
+        (_decoder_buffer_read_segments == buffer->read_func && len > buffer->segments_len - buffer->total_read)) {
+        RAISE_DECODER_EXCEPTION("Insufficient input (container)");
+    }
+    return 0;
+
+bail:
+    return 1;
+}
+
+/* Consumes len bytes if they are available as one contiguous part of a bytes-like object (i.e. of fixed input or within
+ * a single segment), returning said object (borrowed) and setting offset to that of the bytes within it. Otherwise
+ * returns NULL without consuming any input (and without setting an exception). Availability must have been checked
+ * (see _decoder_buffer_check_available) beforehand.
+ */
+static PyObject* _decoder_buffer_read_view(_bjdata_decoder_buffer_t *buffer, Py_ssize_t len, Py_ssize_t *offset) {
+    if (_decoder_buffer_read_fixed == buffer->read_func) {
+        *offset = buffer->total_read;
+        buffer->total_read += len;
+        return buffer->input;
+    }
+    if (_decoder_buffer_read_segments == buffer->read_func) {
+        // move past exhausted (or empty) segments
+        while (buffer->segment < buffer->segment_count && buffer->pos >= buffer->segments[buffer->segment].len) {
+            buffer->segment++;
+            buffer->pos = 0;
+        }
+        if (buffer->segment < buffer->segment_count && len <= buffer->segments[buffer->segment].len - buffer->pos) {
+            *offset = buffer->pos;
+            buffer->pos += len;
+            buffer->total_read += len;
+            return PyTuple_GET_ITEM(buffer->input, buffer->segment);
+        }
+    }
+    return NULL;
+}
+
+/* Used instead of the buffer's read function while capturing input for a RawBJData value (see _decode_raw in
+ * decoder_dialect.h): reads via capture_read_func and appends the result to buffer->capture.
+ */
+static const char* _decoder_buffer_read_capture(_bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer) {
+    const char *raw = buffer->capture_read_func(buffer, len, dst_buffer);
+    char *capture;
+    Py_ssize_t capacity;
+
+    if (NULL != raw) {
+        if (buffer->capture_len + *len > buffer->capture_capacity) {
+            capacity = MAX(2 * buffer->capture_capacity, buffer->capture_len + *len);
+            if (NULL == (capture = PyMem_Realloc(buffer->capture, (size_t)capacity))) {
+                PyErr_NoMemory();
+                // indicate error (rather than end of input) to caller
+                *len = 1;
+                return NULL;
+            }
+            buffer->capture = capture;
+            buffer->capture_capacity = capacity;
+        }
+        memcpy(&buffer->capture[buffer->capture_len], raw, *len);
+        buffer->capture_len += *len;
+    }
+    return raw;
+}
+
+/* Consumes len bytes of input without decoding them. Unless reading from a fixed buffer (or segments), input is read in
+ * chunks of at most SKIP_CHUNK_SIZE so that skipping a large value does not require a large buffer. Returns non-zero on
+ * failure.
+ */
+static int _decoder_buffer_skip(_bjdata_decoder_buffer_t *buffer, long long len) {
+    const char *raw;
+    Py_ssize_t chunk;
+
+    if (_decoder_buffer_read_fixed == buffer->read_func || _decoder_buffer_read_segments == buffer->read_func) {
+        if (buffer->prefs.max_total_bytes >= 0 && len > buffer->prefs.max_total_bytes - buffer->total_read) {
+            RAISE_DECODER_EXCEPTION("Input exceeds max_total_bytes");
+        }
+        if (len > ((_decoder_buffer_read_fixed == buffer->read_func) ? buffer->view.len : buffer->segments_len) -
+                  buffer->total_read) {
+            RAISE_DECODER_EXCEPTION("Insufficient input (skipped value)");
+        }
+        buffer->total_read += (Py_ssize_t)len;
+        // advance within (and past) segments without copying anything
+        if (_decoder_buffer_read_segments == buffer->read_func) {
+            for (; len > 0; len -= chunk) {
+                while (buffer->pos >= buffer->segments[buffer->segment].len) {
+                    buffer->segment++;
+                    buffer->pos = 0;
+                }
+                chunk = (Py_ssize_t)(MIN(len, buffer->segments[buffer->segment].len - buffer->pos));
+                buffer->pos += chunk;
+            }
+        }
+        return 0;
+    }
+    while (len > 0) {
+        chunk = (Py_ssize_t)(MIN(len, SKIP_CHUNK_SIZE));
+        READ_OR_BAIL(chunk, raw, "skipped value");
+        len -= chunk;
+    }
+    UNUSED(raw);
+    return 0;
+
+bail:
+    return 1;
+}
+
+/* Consumes the no-op markers (e.g. alignment padding) immediately following one which has just been read, in a single
+ * read rather than one per marker. Only input already available (i.e. not requiring a read from a stream) is checked,
+ * so callers still have to handle a no-op marker being read next. Returns non-zero on failure.
+ */
+static int _decoder_skip_noops(_bjdata_decoder_buffer_t *buffer) {
+    const char* (*read_func)(struct _bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer);
+    const char *raw;
+    const char *start;
+    const char *end;
+    const char *pos;
+
+    // when capturing (see _decoder_raw_slice), input is read via the wrapped function
+    read_func = (_decoder_buffer_read_capture == buffer->read_func) ? buffer->capture_read_func : buffer->read_func;
+    if (_decoder_buffer_read_fixed == read_func) {
+        start = &((char*)buffer->view.buf)[buffer->total_read];
+        end = &((char*)buffer->view.buf)[buffer->view.len];
+    } else if (_decoder_buffer_read_buffered == read_func && buffer->view_set) {
+        start = &((char*)buffer->view.buf)[buffer->pos];
+        end = &((char*)buffer->view.buf)[buffer->view.len];
+    } else if (_decoder_buffer_read_segments == read_func && buffer->segment < buffer->segment_count) {
+        start = &((char*)buffer->segments[buffer->segment].buf)[buffer->pos];
+        end = &((char*)buffer->segments[buffer->segment].buf)[buffer->segments[buffer->segment].len];
+    } else {
+        return 0;
+    }
+    for (pos = start; pos < end && TYPE_NOOP == *pos; pos++) {}
+
+    if (pos > start) {
+        READ_OR_BAIL((Py_ssize_t)(pos - start), raw, "no-op");
+        UNUSED(raw);
+    }
+    return 0;
+
+bail:
+    return 1;
+}
 
 /******************************************************************************/
 
@@ -556,71 +1159,6 @@ bail:
     return NULL;
 }
 
-// returns negative on error (exception set)
-static long long _decode_int_non_negative(_bjdata_decoder_buffer_t *buffer, char *given_marker) {
-    char marker;
-    PyObject *int_obj = NULL;
-    long long value;
-
-    if (NULL == given_marker) {
-        READ_CHAR_OR_BAIL(marker, "Length marker");
-    } else {
-        marker = *given_marker;
-    }
-
-    switch (marker) {
-        case TYPE_UINT8:
-            BAIL_ON_NULL(int_obj = _decode_uint8(buffer));
-            break;
-        case TYPE_INT8:
-            BAIL_ON_NULL(int_obj = _decode_int8(buffer));
-            break;
-        case TYPE_UINT16:
-            BAIL_ON_NULL(int_obj = _decode_uint16_32(buffer, 2));
-            break;
-        case TYPE_INT16:
-            BAIL_ON_NULL(int_obj = _decode_int16_32(buffer, 2));
-            break;
-        case TYPE_UINT32:
-            BAIL_ON_NULL(int_obj = _decode_uint16_32(buffer, 4));
-            break;
-        case TYPE_INT32:
-            BAIL_ON_NULL(int_obj = _decode_int16_32(buffer, 4));
-            break;
-        case TYPE_UINT64:
-            BAIL_ON_NULL(int_obj = _decode_uint64(buffer));
-            break;
-        case TYPE_INT64:
-            BAIL_ON_NULL(int_obj = _decode_int64(buffer));
-            break;
-        default:
-            RAISE_DECODER_EXCEPTION("Integer marker expected");
-    }
-#if PY_MAJOR_VERSION < 3
-    if (PyInt_Check(int_obj)) {
-        value = PyInt_AsLong(int_obj);
-    } else
-#endif
-    {
-        // not expecting this to occur unless LONG_MAX (sys.maxint in Python 2) < 2^63-1
-        value = PyLong_AsLongLong(int_obj);
-    }
-    if (PyErr_Occurred()) {
-        goto bail;
-    }
-    if (value < 0) {
-        RAISE_DECODER_EXCEPTION("Negative count/length unexpected");
-    }
-    Py_XDECREF(int_obj);
-
-    return value;
-
-bail:
-    Py_XDECREF(int_obj);
-    return -1;
-}
-
-
 static PyObject* _decode_float32(_bjdata_decoder_buffer_t *buffer) {
     const char *raw;
     double value;
@@ -651,26 +1189,6 @@ bail:
     return NULL;
 }
 
-static PyObject* _decode_high_prec(_bjdata_decoder_buffer_t *buffer) {
-    const char *raw;
-    PyObject *num_str = NULL;
-    PyObject *decimal;
-    long long length;
-
-    DECODE_LENGTH_OR_BAIL(length);
-    READ_OR_BAIL((Py_ssize_t)length, raw, "highprec");
-
-    DECODE_UNICODE_OR_BAIL(num_str, raw, (Py_ssize_t)length, "highprec");
-
-    BAIL_ON_NULL(decimal = PyObject_CallFunctionObjArgs((PyObject*)PyDec_Type, num_str, NULL));
-    Py_XDECREF(num_str);
-    return decimal;
-
-bail:
-    Py_XDECREF(num_str);
-    return NULL;
-}
-
 static PyObject* _decode_char(_bjdata_decoder_buffer_t *buffer) {
     char value;
     PyObject *obj = NULL;
@@ -684,115 +1202,77 @@ bail:
     return NULL;
 }
 
-static PyObject* _decode_string(_bjdata_decoder_buffer_t *buffer) {
-    long long length;
-    const char *raw;
-    PyObject *obj = NULL;
-
-    DECODE_LENGTH_OR_BAIL(length);
-
-    if (length > 0) {
-        READ_OR_BAIL((Py_ssize_t)length, raw, "string");
-        DECODE_UNICODE_OR_BAIL(obj, raw, (Py_ssize_t)length, "string");
-    } else {
-        BAIL_ON_NULL(obj = PyUnicode_FromStringAndSize(NULL, 0));
+/* Returns new numpy array with the given dimensions (holding count elements) read from packed data of fixed length
+ * type. Unless reading from a fixed buffer (where the available input is known), large arrays are read in chunks with
+ * the array growing as data arrives, so that a (bogus) large count cannot cause a large allocation up front.
+ */
+static PyObject* _decode_packed_array(_bjdata_decoder_buffer_t *buffer, char type, int ndim, npy_intp *dims,
+                                      long long count) {
+    PyArrayObject *array = NULL;
+    PyObject *reshaped = NULL;
+    PyObject *flat = NULL;
+    PyObject *source;
+    PyArray_Dims shape;
+    npy_intp allocated, read_count;
+    Py_ssize_t offset;
+    int bytelen = 0;
+    int pytype = _get_type_info(type, &bytelen);
+
+    if (0 == bytelen) {
+        goto bail;
+    }
+    if (count > LLONG_MAX / bytelen || count * bytelen > PY_SSIZE_T_MAX) {
+        RAISE_DECODER_EXCEPTION("Packed array too large");
+    }
+    BAIL_ON_NONZERO(_decoder_buffer_check_available(buffer, count * bytelen));
+
+    // view of the input (holding a buffer export of it) rather than a copy. TYPE_CHAR items need an explicit size.
+    if (buffer->prefs.zero_copy && TYPE_CHAR != type && count > 0 &&
+        NULL != (source = _decoder_buffer_read_view(buffer, (Py_ssize_t)(count * bytelen), &offset))) {
+        // reference stolen (also on failure)
+        BAIL_ON_NULL(flat = PyArray_FromBuffer(source, PyArray_DescrFromType(pytype), (npy_intp)count, offset));
+        shape.ptr = dims;
+        shape.len = ndim;
+        BAIL_ON_NULL(reshaped = PyArray_Newshape((PyArrayObject *)flat, &shape, NPY_CORDER));
+        Py_DECREF(flat);
+        return PyArray_Return((PyArrayObject *)reshaped);
     }
-    return obj;
-
-bail:
-    Py_XDECREF(obj);
-    return NULL;
-}
 
-static _container_params_t _get_container_params(_bjdata_decoder_buffer_t *buffer, int in_mapping, unsigned int *nd_ndim, long long **nd_dims) {
-    _container_params_t params={0};
-    char marker;
+    // size already checked against remaining input if fixed (or segments)
+    if (_decoder_buffer_read_fixed == buffer->read_func || _decoder_buffer_read_segments == buffer->read_func ||
+        count * bytelen <= PACKED_READ_CHUNK_SIZE) {
+        // itemsize only applies to (and is required for) TYPE_CHAR
+        BAIL_ON_NULL(array = (PyArrayObject *)PyArray_New(&PyArray_Type, ndim, dims, pytype, NULL, NULL, bytelen, 0,
+                                                           NULL));
+        READ_INTO_OR_BAIL((Py_ssize_t)(count * bytelen), (char *)PyArray_DATA(array), "packed array");
+        return PyArray_Return(array);
+    }
 
-    // fixed type for all values
-    READ_CHAR_OR_BAIL(marker, "container type, count or 1st key/value type");
-    if (CONTAINER_TYPE == marker) {
-        READ_CHAR_OR_BAIL(marker, "container type");
-        switch (marker) {
-            case TYPE_NULL: case TYPE_BOOL_TRUE: case TYPE_BOOL_FALSE: case TYPE_CHAR: case TYPE_STRING: case TYPE_INT8:
-            case TYPE_UINT8: case TYPE_INT16: case TYPE_INT32: case TYPE_INT64: case TYPE_FLOAT32: case TYPE_FLOAT64:
-#ifdef USE__BJDATA
-            case TYPE_UINT16: case TYPE_UINT32: case TYPE_UINT64: case TYPE_FLOAT16:
-#endif
-            case TYPE_HIGH_PREC: case ARRAY_START: case OBJECT_START:
-                params.type = marker;
-                break;
-            default:
-                RAISE_DECODER_EXCEPTION("Invalid container type");
+    allocated = PACKED_READ_CHUNK_SIZE / bytelen;
+    BAIL_ON_NULL(array = (PyArrayObject *)PyArray_New(&PyArray_Type, 1, &allocated, pytype, NULL, NULL, bytelen, 0,
+                                                       NULL));
+    shape.ptr = &allocated;
+    shape.len = 1;
+    for (read_count = 0; read_count < count; read_count = allocated) {
+        if (read_count == allocated) {
+            allocated = (npy_intp)(MIN(count, 2 * (long long)allocated));
+            BAIL_ON_NULL(PyArray_Resize(array, &shape, 0, NPY_CORDER));
+            // PyArray_Resize returns None (new reference)
+            Py_DECREF(Py_None);
         }
-        READ_CHAR_OR_BAIL(marker, "container count or 1st key/value type");
-    } else {
-        // container type not fixed
-        params.type = TYPE_NONE;
-    }
-
-    // container value count
-    if (CONTAINER_COUNT == marker) {
-        params.counting = 1;
-#ifdef USE__BJDATA
-	READ_CHAR_OR_BAIL(marker, "container count marker or optimized ND-array dimension array marker");
-	// obtain the total number of elements of an optimized ND array header
-
-	if(ARRAY_START == marker && nd_ndim!=NULL){
-	    long long length=0, i;
-	    _container_params_t dims=_get_container_params(buffer,0,NULL,NULL);
-	    params.count=1;
-	    if(dims.counting){
-	        *nd_ndim=dims.count;
-		if(dims.count && *nd_dims==NULL)
-		    *nd_dims=(long long *)malloc(sizeof(long long)*(*nd_ndim));
-                for(i=0;i<dims.count;i++){
-    	            DECODE_LENGTH_OR_BAIL_MARKER(length,dims.type);
-    		    params.count*=length;
-		    (*nd_dims)[i]=length;
-    	        }
-	    }else{
-		unsigned int i=0;
-                long long length=0;
-	        *nd_ndim=32;
-		*nd_dims=(long long *)malloc(sizeof(long long)*(*nd_ndim));
-		marker=dims.marker;
-    	        while (ARRAY_END != marker) {
-		    DECODE_LENGTH_OR_BAIL_MARKER(length,marker);
-    		    params.count*=length;
-		    (*nd_dims)[i++]=length;
-		    if(i>=*nd_ndim){
-		        *nd_ndim+=32;
-		        *nd_dims=(long long *)realloc(*nd_dims, sizeof(long long)*(*nd_ndim));
-		    }
-    		    READ_CHAR_OR_BAIL(marker, "Length marker");
-    	        }
-		*nd_ndim=i;
-		*nd_dims=(long long *)realloc(*nd_dims, sizeof(long long)*(i));
-	    }
-	}else
-#endif
-            DECODE_LENGTH_OR_BAIL_MARKER(params.count, marker);
-        // reading ahead just to capture type, which will not exist if type is fixed
-        if ((params.count > 0) && (in_mapping || (TYPE_NONE == params.type))) {
-            READ_CHAR_OR_BAIL(marker, "1st key/value type");
-        } else {
-            marker = params.type;
-        }
-    } else if (TYPE_NONE == params.type) {
-        // count not provided but indicate that
-        params.count = 1;
-        params.counting = 0;
-    } else {
-        RAISE_DECODER_EXCEPTION("Container type without count");
+        READ_INTO_OR_BAIL((Py_ssize_t)((allocated - read_count) * bytelen),
+                          (char *)PyArray_DATA(array) + read_count * bytelen, "packed array");
     }
-
-    params.marker = marker;
-    params.invalid = 0;
-    return params;
+    shape.ptr = dims;
+    shape.len = ndim;
+    BAIL_ON_NULL(reshaped = PyArray_Newshape(array, &shape, NPY_CORDER));
+    Py_DECREF(array);
+    return PyArray_Return((PyArrayObject *)reshaped);
 
 bail:
-    params.invalid = 1;
-    return params;
+    Py_XDECREF(array);
+    Py_XDECREF(flat);
+    return NULL;
 }
 
 static int _is_no_data_type(char type) {
@@ -867,123 +1347,124 @@ static PyObject* _no_data_type(char type) {
     }
 }
 
-static PyObject* _decode_array(_bjdata_decoder_buffer_t *buffer) {
-    unsigned int ndims=0;
-    long long *dims=NULL;
-    _container_params_t params = _get_container_params(buffer, 0, &ndims, &dims);
-    PyObject *list = NULL;
-    PyObject *value = NULL;
-    char marker;
+/* Returns new top frame of the given kind (with params not set) or NULL on failure (exception set). Pointers to previously returned
+ * frames are invalidated by this call.
+ */
+static inline _decoder_frame_t* _decoder_stack_push(_bjdata_decoder_buffer_t *buffer, _decoder_stack_t *stack, char kind) {
+    _decoder_frame_t *frame, *frames;
+    Py_ssize_t capacity;
 
-    if (params.invalid) {
-        goto bail;
+    if (buffer->prefs.max_depth >= 0 && stack->size >= buffer->prefs.max_depth) {
+        RAISE_DECODER_EXCEPTION("Container nesting exceeds max_depth");
     }
-    marker = params.marker;
-    if (params.counting) {
-        // special case - byte array
-        if ((TYPE_UINT8 == params.type) && !buffer->prefs.no_bytes && ndims==0) {
-            BAIL_ON_NULL(list = PyBytes_FromStringAndSize(NULL, params.count));
-            READ_INTO_OR_BAIL(params.count, PyBytes_AS_STRING(list), "bytes array");
-            return list;
-        // special case - nd-array
-        } else if (ndims && params.type) {
-	    unsigned int i;
-            int bytelen=0;
-	    npy_intp *arraydim=calloc(sizeof(npy_intp),ndims);
-	    int pytype=_get_type_info(params.type,&bytelen);
-	    PyArrayObject *jdarray=NULL;
-	    for(i=0;i<ndims;i++){
-	        arraydim[i]=dims[i];
-            }
-            BAIL_ON_NULL(jdarray = (PyArrayObject *) PyArray_SimpleNew(ndims, arraydim, pytype));
-            READ_INTO_OR_BAIL(bytelen*params.count, (char *)PyArray_DATA(jdarray), "ND array");
-	    free(arraydim);
-            return PyArray_Return(jdarray);
-        // special case - no data types
-        } else if (_is_no_data_type(params.type)) {
-            BAIL_ON_NULL(list = PyList_New(params.count));
-            BAIL_ON_NULL(value = _no_data_type(params.type));
-
-            while (params.count > 0) {
-                PyList_SET_ITEM(list, --params.count, value);
-                // reference stolen each time
-                Py_INCREF(value);
-            }
-            value = NULL;
-        } else if (_is_fixed_len_type(params.type) && params.count > 0) { // 1d packed array
-            int bytelen=0;
-	    npy_intp *arraydim=calloc(sizeof(npy_intp),1);
-	    int pytype=_get_type_info(params.type,&bytelen);
-	    PyArrayObject *jdarray=NULL;
-            arraydim[0]=params.count;
-            BAIL_ON_NULL(jdarray = (PyArrayObject *) PyArray_SimpleNew(1, arraydim, pytype));
-            READ_INTO_OR_BAIL(bytelen*params.count, (char *)PyArray_DATA(jdarray), "1D packed array");
-	    free(arraydim);
-            return PyArray_Return(jdarray);
-        // take advantage of faster creation/setting of list since count known
-        } else {
-            Py_ssize_t list_pos = 0; // position in list for far fast setting via PyList_SET_ITEM
-            BAIL_ON_NULL(list = PyList_New(params.count));
-
-            while (params.count > 0) {
-                if (TYPE_NOOP == marker) {
-                    READ_CHAR_OR_BAIL(marker, "array value type marker (sized, after no-op)");
-                    continue;
-                }
-                BAIL_ON_NULL(value = _bjdata_decode_value(buffer, &marker));
-                PyList_SET_ITEM(list, list_pos++, value);
-                // reference stolen by list so no longer want to decrement on failure
-                value = NULL;
-                params.count--;
-                if (params.count > 0 && TYPE_NONE == params.type) {
-                    READ_CHAR_OR_BAIL(marker, "array value type marker (sized)");
-                }
-            }
+    if (stack->size == stack->capacity) {
+        capacity = (0 == stack->capacity) ? DECODER_STACK_INITIAL_SIZE : 2 * stack->capacity;
+        if (NULL == (frames = PyMem_Resize(stack->frames, _decoder_frame_t, capacity))) {
+            PyErr_NoMemory();
+            goto bail;
         }
-    } else {
-        BAIL_ON_NULL(list = PyList_New(0));
-
-        while (ARRAY_END != marker) {
-            if (TYPE_NOOP == marker) {
-                READ_CHAR_OR_BAIL(marker, "array value type marker (after no-op)");
-                continue;
-            }
-            BAIL_ON_NULL(value = _bjdata_decode_value(buffer, &marker));
-            BAIL_ON_NONZERO(PyList_Append(list, value));
-            Py_CLEAR(value);
-
-            if (TYPE_NONE == params.type) {
-                READ_CHAR_OR_BAIL(marker, "array value type marker");
-            }
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+    frame = &stack->frames[stack->size++];
+    frame->kind = kind;
+    frame->container = NULL;
+    frame->key = NULL;
+    frame->list_pos = 0;
+    frame->rows = -1;
+    frame->row_keys = NULL;
+    // nested containers inherit the trie node chosen by their parent (array members all share that of the array)
+    frame->filter = (stack->size > 1) ? stack->frames[stack->size - 2].next_filter : buffer->prefs.path_filter;
+    frame->next_filter = frame->filter;
+    frame->raw_node = (stack->size > 1) ? stack->frames[stack->size - 2].next_raw_node : buffer->prefs.raw_paths;
+    frame->next_raw_node = frame->raw_node;
+    frame->class_node = (stack->size > 1) ? stack->frames[stack->size - 2].next_class_node : buffer->prefs.class_paths;
+    frame->next_class_node = frame->class_node;
+    frame->spec = NULL;
+    frame->spec_guessed = 0;
+    frame->last_spec = NULL;
+    frame->depth = stack->size;
+    if (OBJECT_START == kind) {
+        // end of a class_paths path, otherwise guessed to be of the same class as the previous object in the array
+        if (NULL != frame->class_node && NULL == (frame->spec = PyDict_GetItemWithError(frame->class_node, Py_None)) &&
+            PyErr_Occurred()) {
+            goto bail;
+        }
+        if (NULL == frame->spec && stack->size > 1 && NULL != stack->frames[stack->size - 2].last_spec) {
+            frame->spec = stack->frames[stack->size - 2].last_spec;
+            frame->spec_guessed = 1;
         }
     }
-    if(dims)
-        free(dims);
-    return list;
+    return frame;
 
 bail:
-    Py_XDECREF(value);
-    Py_XDECREF(list);
     return NULL;
 }
 
-// same as string, except there is no 'S' marker
-static PyObject* _decode_object_key(_bjdata_decoder_buffer_t *buffer, char marker, int intern) {
-    long long length;
-    const char *raw;
+// Removes top frame, releasing any references it holds
+static void _decoder_stack_pop(_decoder_stack_t *stack) {
+    _decoder_frame_t *frame = &stack->frames[--stack->size];
+
+    Py_CLEAR(frame->container);
+    Py_CLEAR(frame->key);
+    Py_CLEAR(frame->row_keys);
+}
+
+static void _decoder_stack_free(_decoder_stack_t *stack) {
+    while (stack->size > 0) {
+        _decoder_stack_pop(stack);
+    }
+    PyMem_Free(stack->frames);
+    stack->frames = NULL;
+    stack->capacity = 0;
+}
+
+/* Returns new reference to str for the given UTF-8 encoded object key (interning it if requested) or NULL on failure.
+ * Short ASCII keys are kept in a small cache so that keys repeated across objects (e.g. in an array of records) are
+ * decoded to the same str instance. Since a str caches its hash, this also means that a repeated key is only hashed
+ * once when inserted into dicts.
+ */
+static PyObject* _decoder_key_from_cache(_bjdata_decoder_buffer_t *buffer, const char *raw, Py_ssize_t len, int intern) {
     PyObject *key;
+#if PY_MAJOR_VERSION >= 3
+    PyObject **slot = NULL;
+    Py_ssize_t i;
+    unsigned int hash;
 
-    DECODE_LENGTH_OR_BAIL_MARKER(length, marker);
-    READ_OR_BAIL((Py_ssize_t)length, raw, "string");
+    if (len <= KEY_CACHE_MAX_LEN) {
+        if (NULL == buffer->key_cache) {
+            if (NULL == (buffer->key_cache = calloc(KEY_CACHE_SIZE, sizeof(PyObject*)))) {
+                return PyErr_NoMemory();
+            }
+        }
+        // FNV-1a
+        hash = 2166136261u;
+        for (i = 0; i < len; i++) {
+            hash = (hash ^ (unsigned char)raw[i]) * 16777619u;
+        }
+        slot = &buffer->key_cache[hash & (KEY_CACHE_SIZE - 1)];
+        // only ASCII keys are cached, i.e. str length equals number of bytes
+        if (NULL != *slot && PyUnicode_GET_LENGTH(*slot) == len && 0 == memcmp(PyUnicode_1BYTE_DATA(*slot), raw, len)) {
+            Py_INCREF(*slot);
+            return *slot;
+        }
+    }
+#endif
 
-    BAIL_ON_NULL(key = PyUnicode_FromStringAndSize(raw, (Py_ssize_t)length));
+    BAIL_ON_NULL(key = PyUnicode_FromStringAndSize(raw, len));
 // unicode string interning not supported in v2
 #if PY_MAJOR_VERSION < 3
+    UNUSED(buffer);
     UNUSED(intern);
 #else
     if (intern) {
         PyUnicode_InternInPlace(&key);
     }
+    if (NULL != slot && PyUnicode_IS_ASCII(key)) {
+        Py_XDECREF(*slot);
+        Py_INCREF(key);
+        *slot = key;
+    }
 #endif
     return key;
 
@@ -991,185 +1472,396 @@ bail:
     return NULL;
 }
 
-// used by _decode_object* functions
-#define DECODE_OBJECT_KEY_OR_RAISE_ENCODER_EXCEPTION(context_str, intern) {\
-    key = _decode_object_key(buffer, marker, intern);\
-    if (NULL == key) {\
-        RAISE_DECODER_EXCEPTION("Failed to decode object key (" context_str ")");\
-    }\
+/* Called (in records='rows' mode) with a value about to be stored in the array of frame, after stored values. If value
+ * is a dict with the same keys (in the same order) as the first one in the array, it is replaced by a tuple of its
+ * values. Otherwise any previous values are turned back into dicts (and the array stops being treated as rows).
+ * Returns non-zero on failure (exception set), with value left unchanged.
+ */
+static int _decoder_rows_add(_decoder_frame_t *frame, Py_ssize_t stored, PyObject **value) {
+    PyObject *dict = *value;
+    PyObject *row = NULL;
+    PyObject *key, *item, *expected;
+    Py_ssize_t pos = 0;
+    Py_ssize_t i = 0;
+    int equal;
+
+    if (!PyDict_CheckExact(dict) || 0 == PyDict_GET_SIZE(dict)) {
+        return _decoder_rows_reject(frame, stored);
+    }
+    if (0 == frame->rows) {
+        // first value determines keys
+        BAIL_ON_NULL(frame->row_keys = PyTuple_New(PyDict_GET_SIZE(dict)));
+        while (PyDict_Next(dict, &pos, &key, NULL)) {
+            Py_INCREF(key);
+            PyTuple_SET_ITEM(frame->row_keys, i++, key);
+        }
+    } else if (PyDict_GET_SIZE(dict) != PyTuple_GET_SIZE(frame->row_keys)) {
+        return _decoder_rows_reject(frame, stored);
+    }
+
+    BAIL_ON_NULL(row = PyTuple_New(PyDict_GET_SIZE(dict)));
+    for (i = 0, pos = 0; PyDict_Next(dict, &pos, &key, &item); i++) {
+        expected = PyTuple_GET_ITEM(frame->row_keys, i);
+        if (key != expected) {
+            BAIL_ON_NEGATIVE(equal = PyObject_RichCompareBool(key, expected, Py_EQ));
+            if (!equal) {
+                Py_DECREF(row);
+                return _decoder_rows_reject(frame, stored);
+            }
+        }
+        Py_INCREF(item);
+        PyTuple_SET_ITEM(row, i, item);
+    }
+    frame->rows = 1;
+    Py_DECREF(dict);
+    *value = row;
+    return 0;
+
+bail:
+    Py_XDECREF(row);
+    return 1;
 }
 
-static PyObject* _decode_object_with_pairs_hook(_bjdata_decoder_buffer_t *buffer) {
-    _container_params_t params = _get_container_params(buffer, 1, NULL, NULL);
-    PyObject *obj = NULL;
-    PyObject *list = NULL;
-    PyObject *key = NULL;
-    PyObject *value = NULL;
-    PyObject *item = NULL;
-    char *fixed_type;
-    char marker;
-    int intern = buffer->prefs.intern_object_keys;
+/* Called (in records='rows' mode) when a value which does not fit the rows of the array of frame is about to be stored
+ * after stored values. Turns any previous values back into dicts. Returns non-zero on failure (exception set).
+ */
+static int _decoder_rows_reject(_decoder_frame_t *frame, Py_ssize_t stored) {
+    PyObject **items;
+    PyObject *dict = NULL;
+    Py_ssize_t i, j;
+
+    if (frame->rows > 0) {
+        // list or tuple (array_as='tuple')
+        items = PySequence_Fast_ITEMS(frame->container);
+        for (i = 0; i < stored; i++) {
+            BAIL_ON_NULL(dict = PyDict_New());
+            for (j = 0; j < PyTuple_GET_SIZE(frame->row_keys); j++) {
+                BAIL_ON_NONZERO(PyDict_SetItem(dict, PyTuple_GET_ITEM(frame->row_keys, j),
+                                               PyTuple_GET_ITEM(items[i], j)));
+            }
+            Py_DECREF(items[i]);
+            items[i] = dict;
+            dict = NULL;
+        }
+    }
+    frame->rows = -1;
+    Py_CLEAR(frame->row_keys);
+    return 0;
 
-    if (params.invalid) {
-        goto bail;
+bail:
+    Py_XDECREF(dict);
+    return 1;
+}
+
+/* Returns (keys, rows) for a complete array which was decoded as rows, otherwise rows (the array itself). Reference to
+ * rows is stolen. Returns NULL on failure.
+ */
+static PyObject* _decoder_rows_finish(_decoder_frame_t *frame, PyObject *rows) {
+    PyObject *result;
+
+    if (frame->rows <= 0 || NULL == rows) {
+        return rows;
     }
-    marker = params.marker;
+    result = PyTuple_Pack(2, frame->row_keys, rows);
+    Py_DECREF(rows);
+    return result;
+}
 
-    // take advantage of faster creation/setting of list since count known
-    if (params.counting) {
-        Py_ssize_t list_pos = 0; // position in list for far fast setting via PyList_SET_ITEM
+/* Looks up key (of an object member) in the include/exclude trie node of frame. Returns 1 if the member is to be
+ * decoded (setting frame->next_filter to the node applying to its value), 0 if it is to be skipped or -1 on failure.
+ */
+static int _decoder_filter_member(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, PyObject *key) {
+    PyObject *child = PyDict_GetItemWithError(frame->filter, key);
 
-        BAIL_ON_NULL(list = PyList_New(params.count));
+    if (NULL == child) {
+        if (PyErr_Occurred()) {
+            return -1;
+        }
+        // not on any path
+        frame->next_filter = NULL;
+        return buffer->prefs.path_filter_exclude;
+    } else if (Py_None == child) {
+        // end of a path
+        frame->next_filter = NULL;
+        return !buffer->prefs.path_filter_exclude;
+    }
+    // on a path which continues inside this member
+    frame->next_filter = child;
+    return 1;
+}
 
-        // special case: no data values (keys only)
-        if (_is_no_data_type(params.type)) {
-            value = _no_data_type(params.type);
-            Py_INCREF(value);
+/* Looks up key (of an object member) in the raw_paths trie node of frame. Returns 1 if the member is to be returned as
+ * RawBJData, 0 if it is to be decoded (setting frame->next_raw_node to the node applying to its value) or -1 on failure.
+ */
+static int _decoder_raw_member(_decoder_frame_t *frame, PyObject *key) {
+    PyObject *child = PyDict_GetItemWithError(frame->raw_node, key);
+
+    if (NULL == child) {
+        frame->next_raw_node = NULL;
+        return PyErr_Occurred() ? -1 : 0;
+    }
+    frame->next_raw_node = (Py_None == child) ? NULL : child;
+    return (Py_None == child);
+}
 
-            while (params.count > 0) {
-                DECODE_OBJECT_KEY_OR_RAISE_ENCODER_EXCEPTION("sized, no data", intern);
-                BAIL_ON_NULL(item = PyTuple_Pack(2, key, value));
-                Py_CLEAR(key);
-                PyList_SET_ITEM(list, list_pos++, item);
-                // reference stolen
-                item = NULL;
+/* Returns the encoded form of a value which has just been skipped in a fixed input buffer, from start up to the current
+ * position, prefixed with its marker. Unless typed is set (i.e. the value belongs to a typed container, so that its
+ * marker is not part of the input), this is a memoryview of the input. Returns NULL on failure.
+ */
+static PyObject* _decoder_raw_slice(_bjdata_decoder_buffer_t *buffer, char marker, int typed, Py_ssize_t start) {
+    PyObject *view = NULL;
+    PyObject *slice = NULL;
+    PyObject *begin = NULL;
+    PyObject *end = NULL;
+    PyObject *data;
+
+    if (typed || start < 1 || marker != ((char*)buffer->view.buf)[start - 1]) {
+        BAIL_ON_NULL(data = PyBytes_FromStringAndSize(NULL, 1 + buffer->total_read - start));
+        PyBytes_AS_STRING(data)[0] = marker;
+        memcpy(&PyBytes_AS_STRING(data)[1], &((char*)buffer->view.buf)[start], buffer->total_read - start);
+        return data;
+    }
+    if (NULL == buffer->raw_view) {
+        // byte-wise view regardless of the input's item format
+        BAIL_ON_NULL(view = PyMemoryView_FromObject(buffer->input));
+        BAIL_ON_NULL(buffer->raw_view = PyObject_CallMethod(view, "cast", "s", "B"));
+        Py_CLEAR(view);
+    }
+    BAIL_ON_NULL(begin = PyLong_FromSsize_t(start - 1));
+    BAIL_ON_NULL(end = PyLong_FromSsize_t(buffer->total_read));
+    BAIL_ON_NULL(slice = PySlice_New(begin, end, NULL));
+    data = PyObject_GetItem(buffer->raw_view, slice);
+    Py_DECREF(slice);
+    Py_DECREF(end);
+    Py_DECREF(begin);
+    return data;
 
-                params.count--;
-                if (params.count > 0) {
-                    READ_CHAR_OR_BAIL(marker, "object key length");
-                }
+bail:
+    Py_XDECREF(end);
+    Py_XDECREF(begin);
+    Py_XDECREF(view);
+    return NULL;
+}
+
+/* Looks up key (of an object member) in the class_paths trie node of frame, setting frame->next_class_node to the node
+ * applying to its value. Returns non-zero on failure.
+ */
+static int _decoder_class_member(_decoder_frame_t *frame, PyObject *key) {
+    frame->next_class_node = PyDict_GetItemWithError(frame->class_node, key);
+    return (NULL == frame->next_class_node && PyErr_Occurred());
+}
+
+// Returns new dict of the set field values (tuple) of an object being decoded into the class of spec or NULL on failure
+static PyObject* _decoder_class_values_dict(PyObject *spec, PyObject *values) {
+    PyObject *dict;
+    PyObject *names = CLASS_SPEC_NAMES(spec);
+    Py_ssize_t i;
+
+    BAIL_ON_NULL(dict = PyDict_New());
+    for (i = 0; i < PyTuple_GET_SIZE(values); i++) {
+        if (NULL != PyTuple_GET_ITEM(values, i) &&
+            PyDict_SetItem(dict, PyTuple_GET_ITEM(names, i), PyTuple_GET_ITEM(values, i))) {
+            Py_DECREF(dict);
+            goto bail;
+        }
+    }
+    return dict;
+
+bail:
+    return NULL;
+}
+
+/* Returns new instance of the class of spec with the given field values (tuple, unset ones being NULL) or, if values is
+ * a dict, members. Returns NULL on failure.
+ */
+static PyObject* _decoder_class_new(PyObject *spec, PyObject *values) {
+    PyObject *cls = CLASS_SPEC_TYPE(spec);
+    PyObject *args = NULL;
+    PyObject *kwargs = NULL;
+    PyObject *obj = NULL;
+    PyObject *key, *value;
+    Py_ssize_t i, pos = 0;
+    int is_dict = PyDict_CheckExact(values);
+
+    BAIL_ON_NULL(args = PyTuple_New(0));
+    if (CLASS_SPEC_SETATTRS(spec)) {
+        // as object.__reduce_ex__, i.e. without calling __init__
+        BAIL_ON_NULL(obj = ((PyTypeObject*)cls)->tp_new((PyTypeObject*)cls, args, NULL));
+        if (is_dict) {
+            while (PyDict_Next(values, &pos, &key, &value)) {
+                BAIL_ON_NONZERO(PyObject_SetAttr(obj, key, value));
             }
         } else {
-            fixed_type = (TYPE_NONE == params.type) ? NULL : &params.type;
-
-            while (params.count > 0) {
-                if (TYPE_NOOP == marker) {
-                    READ_CHAR_OR_BAIL(marker, "object key length (sized, after no-op)");
-                    continue;
-                }
-                DECODE_OBJECT_KEY_OR_RAISE_ENCODER_EXCEPTION("sized", intern);
-                BAIL_ON_NULL(value = _bjdata_decode_value(buffer, fixed_type));
-                BAIL_ON_NULL(item = PyTuple_Pack(2, key, value));
-                Py_CLEAR(key);
-                Py_CLEAR(value);
-                PyList_SET_ITEM(list, list_pos++, item);
-                // reference stolen
-                item = NULL;
-
-                params.count--;
-                if (params.count > 0) {
-                    READ_CHAR_OR_BAIL(marker, "object key length (sized)");
+            for (i = 0; i < PyTuple_GET_SIZE(values); i++) {
+                if (NULL != (value = PyTuple_GET_ITEM(values, i))) {
+                    BAIL_ON_NONZERO(PyObject_SetAttr(obj, PyTuple_GET_ITEM(CLASS_SPEC_NAMES(spec), i), value));
                 }
             }
         }
+    } else if (is_dict) {
+        BAIL_ON_NULL(obj = PyObject_Call(cls, args, values));
     } else {
-        BAIL_ON_NULL(list = PyList_New(0));
-        fixed_type = (TYPE_NONE == params.type) ? NULL : &params.type;
-
-        while (OBJECT_END != marker) {
-            if (TYPE_NOOP == marker) {
-                READ_CHAR_OR_BAIL(marker, "object key length (after no-op)");
-                continue;
-            }
-            DECODE_OBJECT_KEY_OR_RAISE_ENCODER_EXCEPTION("unsized", intern);
-            BAIL_ON_NULL(value = _bjdata_decode_value(buffer, fixed_type));
-            BAIL_ON_NULL(item = PyTuple_Pack(2, key, value));
-            Py_CLEAR(key);
-            Py_CLEAR(value);
-            BAIL_ON_NONZERO(PyList_Append(list, item));
-            Py_CLEAR(item);
-
-            READ_CHAR_OR_BAIL(marker, "object key length");
+        for (i = 0; i < PyTuple_GET_SIZE(values) && NULL != PyTuple_GET_ITEM(values, i); i++) {}
+        if (i == PyTuple_GET_SIZE(values)) {
+            // all fields set, i.e. can pass them positionally (in field order)
+            BAIL_ON_NULL(obj = PyObject_Call(cls, values, NULL));
+        } else {
+            BAIL_ON_NULL(kwargs = _decoder_class_values_dict(spec, values));
+            BAIL_ON_NULL(obj = PyObject_Call(cls, args, kwargs));
+            Py_DECREF(kwargs);
         }
     }
-
-    BAIL_ON_NULL(obj = PyObject_CallFunctionObjArgs(buffer->prefs.object_pairs_hook, list, NULL));
-    Py_XDECREF(list);
+    Py_DECREF(args);
     return obj;
 
 bail:
     Py_XDECREF(obj);
-    Py_XDECREF(list);
-    Py_XDECREF(key);
-    Py_XDECREF(value);
-    Py_XDECREF(item);
+    Py_XDECREF(kwargs);
+    Py_XDECREF(args);
     return NULL;
 }
 
-static PyObject* _decode_object(_bjdata_decoder_buffer_t *buffer) {
-    _container_params_t params = _get_container_params(buffer, 1, NULL, NULL);
-    PyObject *obj = NULL;
-    PyObject *newobj = NULL; // result of object_hook (if applicable)
-    PyObject *key = NULL;
-    PyObject *value = NULL;
-    char *fixed_type;
-    char marker;
-    int intern = buffer->prefs.intern_object_keys;
-
-    if (params.invalid) {
-        goto bail;
+/* Stores value (reference stolen, even on failure) for key in the object of frame, which is being decoded into the
+ * class of frame->spec. If key is not a field of the latter, the object reverts to a dict if its class was only guessed
+ * (otherwise this is an error). Returns non-zero on failure.
+ */
+static int _decoder_class_set(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, PyObject *key,
+                              PyObject *value) {
+    PyObject *index = PyDict_GetItemWithError(CLASS_SPEC_INDEX(frame->spec), key);
+    PyObject *dict;
+    Py_ssize_t i;
+    int failed;
+
+    if (NULL != index) {
+        i = PyLong_AsSsize_t(index);
+        // a repeated key replaces the earlier value (as for a dict)
+        Py_XDECREF(PyTuple_GET_ITEM(frame->container, i));
+        PyTuple_SET_ITEM(frame->container, i, value);
+        return 0;
     }
-    marker = params.marker;
-
-    BAIL_ON_NULL(obj = PyDict_New());
-
-    // special case: no data values (keys only)
-    if (params.counting && _is_no_data_type(params.type)) {
-        value = _no_data_type(params.type);
+    BAIL_ON_NONZERO(PyErr_Occurred());
+    if (!frame->spec_guessed) {
+        RAISE_DECODER_EXCEPTION("Object key is not a field of the class decoded into");
+    }
+    BAIL_ON_NULL(dict = _decoder_class_values_dict(frame->spec, frame->container));
+    Py_DECREF(frame->container);
+    frame->container = dict;
+    frame->spec = NULL;
+    failed = PyDict_SetItem(dict, key, value);
+    Py_DECREF(value);
+    return failed;
 
-        while (params.count > 0) {
-            DECODE_OBJECT_KEY_OR_RAISE_ENCODER_EXCEPTION("sized, no data", intern);
-            BAIL_ON_NONZERO(PyDict_SetItem(obj, key, value));
-            // reference stolen in above call, but only for value!
-            Py_CLEAR(key);
-            Py_INCREF(value);
+bail:
+    Py_DECREF(value);
+    return 1;
+}
 
-            params.count--;
-            if (params.count > 0) {
-                READ_CHAR_OR_BAIL(marker, "object key length");
-            }
+/* Returns obj (reference stolen), the members of the complete object of frame, as an instance of the class of
+ * frame->spec or that matching its keys (see classes), setting frame->spec to the spec of the class used. If there is
+ * none, obj itself is returned (with frame->spec NULL). Returns NULL on failure.
+ */
+static PyObject* _decoder_class_end(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, PyObject *obj) {
+    PyObject *keys = NULL;
+    PyObject *spec = frame->spec;
+    PyObject *dict, *result;
+    Py_ssize_t i, size;
+
+    if (NULL != spec) {
+        for (i = 0; i < PyTuple_GET_SIZE(obj) && NULL != PyTuple_GET_ITEM(obj, i); i++) {}
+        if (!frame->spec_guessed || i == PyTuple_GET_SIZE(obj)) {
+            result = _decoder_class_new(spec, obj);
+            Py_DECREF(obj);
+            return result;
         }
-    } else {
-        fixed_type = (TYPE_NONE == params.type) ? NULL : &params.type;
-
-        while (params.count > 0 && (params.counting || (OBJECT_END != marker))) {
-            if (TYPE_NOOP == marker) {
-                READ_CHAR_OR_BAIL(marker, "object key length");
-                continue;
-            }
-	    DECODE_OBJECT_KEY_OR_RAISE_ENCODER_EXCEPTION("sized/unsized", intern);
-            BAIL_ON_NULL(value = _bjdata_decode_value(buffer, fixed_type));
-            BAIL_ON_NONZERO(PyDict_SetItem(obj, key, value));
-            Py_CLEAR(key);
-            Py_CLEAR(value);
-
-            if (params.counting) {
-                params.count--;
-            }
-            if (params.count > 0) {
-                READ_CHAR_OR_BAIL(marker, "object key length");
+        // guessed class lacks some fields, i.e. the keys might match another one
+        dict = _decoder_class_values_dict(spec, obj);
+        frame->spec = spec = NULL;
+        Py_DECREF(obj);
+        BAIL_ON_NULL(obj = dict);
+    }
+    if (NULL != buffer->prefs.classes && PyDict_CheckExact(obj)) {
+        size = PyDict_GET_SIZE(obj);
+        if (buffer->prefs.class_sizes & (1ULL << (MIN(size, 63)))) {
+            BAIL_ON_NULL(keys = PyFrozenSet_New(obj));
+            if (NULL == (spec = PyDict_GetItemWithError(buffer->prefs.classes, keys))) {
+                BAIL_ON_NONZERO(PyErr_Occurred());
             }
+            Py_CLEAR(keys);
+        }
+        if (NULL != spec) {
+            BAIL_ON_NULL(result = _decoder_class_new(spec, obj));
+            Py_DECREF(obj);
+            frame->spec = spec;
+            return result;
         }
-    }
-
-    if (NULL != buffer->prefs.object_hook) {
-        BAIL_ON_NULL(newobj = PyObject_CallFunctionObjArgs(buffer->prefs.object_hook, obj, NULL));
-        Py_CLEAR(obj);
-        return newobj;
     }
     return obj;
 
 bail:
-    Py_XDECREF(key);
-    Py_XDECREF(value);
+    Py_XDECREF(keys);
     Py_XDECREF(obj);
-    Py_XDECREF(newobj);
     return NULL;
 }
 
 /******************************************************************************/
 
-// only used by _bjdata_decode_value
+/* Returns obj (reference stolen), a complete object decoded while buffers is set, or if it refers to an out-of-band
+ * buffer (see _encode_out_of_band in encoder_dialect.h) a numpy array viewing said buffer instead. Returns NULL on
+ * failure.
+ */
+static PyObject* _decoder_out_of_band(_bjdata_decoder_buffer_t *buffer, PyObject *obj) {
+    PyObject *index, *dtype, *shape;
+    PyArray_Descr *descr = NULL;
+    PyArray_Dims dims = {NULL, 0};
+    PyObject *flat = NULL;
+    PyObject *array = NULL;
+    Py_ssize_t pos;
+
+    if (!PyDict_Check(obj) || 3 != PyDict_Size(obj) ||
+        NULL == (index = PyDict_GetItemString(obj, BUFFER_KEY_INDEX)) ||
+        NULL == (dtype = PyDict_GetItemString(obj, BUFFER_KEY_DTYPE)) ||
+        NULL == (shape = PyDict_GetItemString(obj, BUFFER_KEY_SHAPE))) {
+        return obj;
+    }
+    if (!PyIndex_Check(index) || !PyUnicode_Check(dtype) || !PyList_Check(shape)) {
+        RAISE_DECODER_EXCEPTION("Invalid out-of-band buffer reference");
+    }
+    pos = PyNumber_AsSsize_t(index, NULL);
+    if (pos < 0 || pos >= PyTuple_GET_SIZE(buffer->prefs.buffers)) {
+        RAISE_DECODER_EXCEPTION("Out-of-band buffer index out of range");
+    }
+    // numpy's errors for an unsuitable dtype, shape or buffer are raised as DecoderException
+    if (PyArray_DescrConverter(dtype, &descr) && PyArray_IntpConverter(shape, &dims)) {
+        flat = PyArray_FromBuffer(PyTuple_GET_ITEM(buffer->prefs.buffers, pos), descr, -1, 0);
+        // reference stolen (also on failure)
+        descr = NULL;
+        if (NULL != flat && PyArray_SIZE((PyArrayObject *)flat) == PyArray_MultiplyList(dims.ptr, dims.len)) {
+            array = PyArray_Newshape((PyArrayObject *)flat, &dims, NPY_CORDER);
+        } else if (NULL != flat) {
+            RAISE_DECODER_EXCEPTION("Out-of-band buffer size does not match reference");
+        }
+    }
+    if (NULL == array) {
+        if (PyErr_ExceptionMatches(PyExc_ValueError) || PyErr_ExceptionMatches(PyExc_TypeError)) {
+            PyErr_Clear();
+            RAISE_DECODER_EXCEPTION("Invalid out-of-band buffer reference");
+        }
+        goto bail;
+    }
+    PyDimMem_FREE(dims.ptr);
+    Py_DECREF(flat);
+    Py_DECREF(obj);
+    return array;
+
+bail:
+    Py_XDECREF(descr);
+    PyDimMem_FREE(dims.ptr);
+    Py_XDECREF(flat);
+    Py_DECREF(obj);
+    return NULL;
+}
+
+// only used by _decode_value (see decoder_dialect.h)
 #define RETURN_OR_RAISE_DECODER_EXCEPTION(item, item_str) {\
     obj = (item);\
     if (NULL != obj) {\
@@ -1181,66 +1873,26 @@ bail:
     }\
 }
 
-PyObject* _bjdata_decode_value(_bjdata_decoder_buffer_t *buffer, char *given_marker) {
-    char marker;
-    PyObject *obj;
-
-    if (NULL == given_marker) {
-        READ_CHAR_OR_BAIL(marker, "Type marker");
-    } else {
-        marker = *given_marker;
-    }
+/* The container and value decoding functions are compiled once per dialect from decoder_dialect.h, i.e. dialect
+ * differences are resolved at compile time rather than for every decoded value.
+ */
+#define DIALECT DIALECT_BJDATA
+#define DIALECT_SUFFIX bjd
+#include "decoder_dialect.h"
+#undef DIALECT
+#undef DIALECT_SUFFIX
+
+#define DIALECT DIALECT_UBJSON
+#define DIALECT_SUFFIX ubj
+#include "decoder_dialect.h"
+#undef DIALECT
+#undef DIALECT_SUFFIX
 
-    switch (marker) {
-        case TYPE_NULL:
-            Py_RETURN_NONE;
-        case TYPE_BOOL_TRUE:
-            Py_RETURN_TRUE;
-        case TYPE_BOOL_FALSE:
-            Py_RETURN_FALSE;
-        case TYPE_CHAR:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_char(buffer), "char");
-        case TYPE_STRING:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_string(buffer), "string");
-        case TYPE_INT8:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_int8(buffer), "int8");
-        case TYPE_INT16:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_int16_32(buffer, 2), "int16");
-        case TYPE_INT32:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_int16_32(buffer, 4), "int32");
-        case TYPE_INT64:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_int64(buffer), "int64");
-#ifdef USE__BJDATA
-        case TYPE_UINT8:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_uint8(buffer), "uint8");
-        case TYPE_FLOAT16:
-        case TYPE_UINT16:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_uint16_32(buffer, 2), "uint16");
-        case TYPE_UINT32:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_uint16_32(buffer, 4), "uint32");
-        case TYPE_UINT64:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_uint64(buffer), "uint64");
-#endif
-        case TYPE_FLOAT32:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_float32(buffer), "float32");
-        case TYPE_FLOAT64:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_float64(buffer), "float64");
-        case TYPE_HIGH_PREC:
-            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_high_prec(buffer), "highprec");
-        case ARRAY_START:
-            RECURSE_AND_RETURN_OR_BAIL(_decode_array(buffer), "whilst decoding a BJData array");
-        case OBJECT_START:
-            if (NULL == buffer->prefs.object_pairs_hook) {
-                RECURSE_AND_RETURN_OR_BAIL(_decode_object(buffer), "whilst decoding a BJData object");
-            } else {
-                RECURSE_AND_RETURN_OR_BAIL(_decode_object_with_pairs_hook(buffer), "whilst decoding a BJData object");
-            }
-        default:
-            RAISE_DECODER_EXCEPTION("Invalid marker");
+PyObject* _bjdata_decode_value(_bjdata_decoder_buffer_t *buffer, char *given_marker) {
+    if (DIALECT_UBJSON == buffer->prefs.dialect) {
+        return _decode_value_ubj(buffer, given_marker);
     }
-
-bail:
-    return NULL;
+    return _decode_value_bjd(buffer, given_marker);
 }
 
 /******************************************************************************/
@@ -1252,11 +1904,17 @@ int _bjdata_decoder_init(void) {
     // try to determine floating point format / endianess
     _pyfuncs_ubj_detect_formats();
 
-    // allow decoder to access DecoderException & Decimal class
+    // allow decoder to access DecoderException, RawBJData & Decimal class
     BAIL_ON_NULL(tmp_module = PyImport_ImportModule("bjdata.decoder"));
     BAIL_ON_NULL(DecoderException = PyObject_GetAttrString(tmp_module, "DecoderException"));
     Py_CLEAR(tmp_module);
 
+    BAIL_ON_NULL(tmp_module = PyImport_ImportModule("bjdata.raw"));
+    BAIL_ON_NULL(tmp_obj = PyObject_GetAttrString(tmp_module, "RawBJData"));
+    BAIL_ON_NULL(RawBJData_from_valid = PyObject_GetAttrString(tmp_obj, "_from_valid"));
+    Py_CLEAR(tmp_obj);
+    Py_CLEAR(tmp_module);
+
     BAIL_ON_NULL(tmp_module = PyImport_ImportModule("decimal"));
     BAIL_ON_NULL(tmp_obj = PyObject_GetAttrString(tmp_module, "Decimal"));
     if (!PyType_Check(tmp_obj)) {
@@ -1264,13 +1922,22 @@ int _bjdata_decoder_init(void) {
         goto bail;
     }
     PyDec_Type = (PyTypeObject*) tmp_obj;
+    tmp_obj = NULL;
+    Py_CLEAR(tmp_module);
+
+    BAIL_ON_NULL(tmp_module = PyImport_ImportModule("io"));
+    BAIL_ON_NULL(FileIOType = PyObject_GetAttrString(tmp_module, "FileIO"));
+    BAIL_ON_NULL(BufferedReaderType = PyObject_GetAttrString(tmp_module, "BufferedReader"));
     Py_CLEAR(tmp_module);
 
     return 0;
 
 bail:
     Py_CLEAR(DecoderException);
+    Py_CLEAR(RawBJData_from_valid);
     Py_CLEAR(PyDec_Type);
+    Py_CLEAR(FileIOType);
+    Py_CLEAR(BufferedReaderType);
     Py_XDECREF(tmp_obj);
     Py_XDECREF(tmp_module);
     return 1;
@@ -1279,5 +1946,8 @@ bail:
 
 void _bjdata_decoder_cleanup(void) {
     Py_CLEAR(DecoderException);
+    Py_CLEAR(RawBJData_from_valid);
     Py_CLEAR(PyDec_Type);
+    Py_CLEAR(FileIOType);
+    Py_CLEAR(BufferedReaderType);
 }
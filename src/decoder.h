@@ -32,32 +32,90 @@ typedef struct {
     int no_bytes;
     int intern_object_keys;
     int islittle;
+    // one of DIALECT_*
+    int dialect;
+    // resource limits for untrusted input (negative meaning unlimited)
+    Py_ssize_t max_container_count;
+    Py_ssize_t max_total_bytes;
+    Py_ssize_t max_depth;
+    Py_ssize_t max_string_length;
+    // type (callable) to create objects with instead of dict (NULL meaning dict)
+    PyObject *dict_class;
+    // decode arrays as tuples rather than lists
+    int array_as_tuple;
+    // decode arrays of objects with the same keys as (keys, rows) tuple (records='rows')
+    int records_rows;
+    // trie of include/exclude paths (nested dicts, Py_None marking the end of a path) or NULL if not filtering
+    PyObject *path_filter;
+    // whether path_filter lists paths to exclude (rather than include)
+    int path_filter_exclude;
+    // containers nested deeper than this are returned as RawBJData (negative meaning never)
+    Py_ssize_t raw_depth;
+    // trie (see path_filter) of paths of object members to return as RawBJData or NULL if none
+    PyObject *raw_paths;
+    // dict of frozenset of field names to class spec (see decoder._class_spec) or NULL if none
+    PyObject *classes;
+    // bit n set if classes has a class with n fields (bit 63: 63 or more)
+    unsigned long long class_sizes;
+    // trie (see path_filter) of class_paths, with the end of a path having the class spec as its Py_None item, or NULL
+    PyObject *class_paths;
+    // tuple of out-of-band buffers objects written by buffer_callback (see dump) refer to, or NULL if none
+    PyObject *buffers;
+    // decode packed arrays as views of the input (if a bytes-like object or segments) rather than copying them
+    int zero_copy;
 } _bjdata_decoder_prefs_t;
 
 typedef struct _bjdata_decoder_buffer_t {
-    // either supports buffer interface or is callable returning bytes
+    // either supports buffer interface, is a list/tuple of such (segments) or is callable returning bytes
     PyObject *input;
     // NULL unless input supports seeking in which case expecting callable with signature of io.IOBase.seek()
     PyObject *seek;
+    // NULL unless the stream can be read via readinto (signature of io.RawIOBase.readinto), used instead of input
+    PyObject *readinto;
+    // persistent bytearray (and a memoryview of it) which readinto reads into, unless reading into the destination
+    PyObject *fp_buffer;
+    PyObject *fp_buffer_view;
+    Py_ssize_t fp_buffer_size;
+    // file descriptor read (via pread) instead of via readinto (see _bjdata_decoder_buffer_set_fd), otherwise -1
+    int fd;
+    // position of the file object when decoding started & offset in the file of the next pread
+    long long fd_start;
+    long long fd_pos;
     // function used to read data from this buffer with (depending on whether fixed, callable or seekable)
     const char* (*read_func)(struct _bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer);
     // buffer protocol access to raw bytes of input
     Py_buffer view;
     // whether view will need to be released
     int view_set;
-    // current position in view
+    // views of segments (if input is a list/tuple), their number, total length & the one currently being read from
+    Py_buffer *segments;
+    Py_ssize_t segment_count;
+    Py_ssize_t segments_len;
+    Py_ssize_t segment;
+    // current position in view (or current segment)
     Py_ssize_t pos;
     // total bytes supplied to user (same as pos in case where callable not used)
     Py_ssize_t total_read;
     // temporary destination buffer if required read larger than currently available input
     char *tmp_dst;
+    // recently decoded (ASCII) object keys, indexed by hash of their raw bytes (allocated on first use)
+    PyObject **key_cache;
+    // memoryview of (fixed buffer) input, for RawBJData values to be slices of (created on first use)
+    PyObject *raw_view;
+    // read_func to use while capturing the input read for a RawBJData value (from a stream), NULL otherwise
+    const char* (*capture_read_func)(struct _bjdata_decoder_buffer_t *buffer, Py_ssize_t *len, char *dst_buffer);
+    // input captured so far, its length & allocated size (kept allocated between values)
+    char *capture;
+    Py_ssize_t capture_len;
+    Py_ssize_t capture_capacity;
     _bjdata_decoder_prefs_t prefs;
 } _bjdata_decoder_buffer_t;
 
 /******************************************************************************/
 
 extern _bjdata_decoder_buffer_t* _bjdata_decoder_buffer_create(_bjdata_decoder_prefs_t* prefs,
-                                                               PyObject *input, PyObject *seek);
+                                                               PyObject *input, PyObject *seek, PyObject *readinto);
+extern int _bjdata_decoder_buffer_set_fd(_bjdata_decoder_buffer_t *buffer, PyObject *fp);
 extern int _bjdata_decoder_buffer_free(_bjdata_decoder_buffer_t **buffer);
 extern int _bjdata_decoder_init(void);
 // note: marker argument only used internally - supply NULL
@@ -0,0 +1,1025 @@
+/*
+ * Copyright (c) 2020-2022 Qianqian Fang <q.fang at neu.edu>. All rights reserved.
+ * Copyright (c) 2016-2019 Iotic Labs Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://github.com/NeuroJSON/pybj/blob/master/LICENSE
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Dialect-specific part of the decoder. NOT a regular header: decoder.c includes this file once per dialect with
+ * DIALECT (DIALECT_BJDATA or DIALECT_UBJSON) and DIALECT_SUFFIX defined, so that each dialect gets its own copy of the
+ * decoding functions. See also encoder_dialect.h.
+ */
+
+#if !defined(DIALECT) || !defined(DIALECT_SUFFIX)
+#   error "DIALECT and DIALECT_SUFFIX must be defined before including decoder_dialect.h"
+#endif
+
+#define _decode_int_non_negative DIALECT_FUNC(_decode_int_non_negative)
+#define _decode_high_prec DIALECT_FUNC(_decode_high_prec)
+#define _decode_string DIALECT_FUNC(_decode_string)
+#define _get_container_params DIALECT_FUNC(_get_container_params)
+#define _decode_nd_dims DIALECT_FUNC(_decode_nd_dims)
+#define _begin_array DIALECT_FUNC(_begin_array)
+#define _begin_object DIALECT_FUNC(_begin_object)
+#define _decode_object_key DIALECT_FUNC(_decode_object_key)
+#define _fill_array DIALECT_FUNC(_fill_array)
+#define _fill_object DIALECT_FUNC(_fill_object)
+#define _end_container DIALECT_FUNC(_end_container)
+#define _decode_scalar DIALECT_FUNC(_decode_scalar)
+#define _decode_value DIALECT_FUNC(_decode_value)
+#define _skip_scalar DIALECT_FUNC(_skip_scalar)
+#define _skip_value DIALECT_FUNC(_skip_value)
+#define _decode_raw DIALECT_FUNC(_decode_raw)
+
+//These functions return NULL on failure (an exception will have been set). Note that no type checking is performed!
+
+static long long _decode_int_non_negative(_bjdata_decoder_buffer_t *buffer, char *given_marker);
+static PyObject* _decode_high_prec(_bjdata_decoder_buffer_t *buffer);
+static PyObject* _decode_string(_bjdata_decoder_buffer_t *buffer);
+static _container_params_t _get_container_params(_bjdata_decoder_buffer_t *buffer, int in_mapping, int *nd_ndim,
+                                                 npy_intp *nd_dims);
+#if DIALECT == DIALECT_BJDATA
+static int _decode_nd_dims(_bjdata_decoder_buffer_t *buffer, int *ndim, npy_intp *dims, long long *count);
+#endif
+static int _begin_array(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, PyObject **value);
+static int _begin_object(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame);
+static PyObject* _decode_object_key(_bjdata_decoder_buffer_t *buffer, char marker, int intern);
+static int _fill_array(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, char *marker, PyObject *value);
+static int _fill_object(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, char *value_marker,
+                        PyObject *value);
+static PyObject* _end_container(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame);
+static PyObject* _decode_scalar(_bjdata_decoder_buffer_t *buffer, char marker);
+static PyObject* _decode_value(_bjdata_decoder_buffer_t *buffer, char *given_marker);
+static int _skip_scalar(_bjdata_decoder_buffer_t *buffer, char marker);
+static int _skip_value(_bjdata_decoder_buffer_t *buffer, char marker, Py_ssize_t depth);
+static PyObject* _decode_raw(_bjdata_decoder_buffer_t *buffer, char marker, int typed, Py_ssize_t depth);
+
+/******************************************************************************/
+
+// returns negative on error (exception set)
+static long long _decode_int_non_negative(_bjdata_decoder_buffer_t *buffer, char *given_marker) {
+    char marker;
+    PyObject *int_obj = NULL;
+    long long value;
+
+    if (NULL == given_marker) {
+        READ_CHAR_OR_BAIL(marker, "Length marker");
+    } else {
+        marker = *given_marker;
+    }
+
+    switch (marker) {
+        case TYPE_UINT8:
+            BAIL_ON_NULL(int_obj = _decode_uint8(buffer));
+            break;
+        case TYPE_INT8:
+            BAIL_ON_NULL(int_obj = _decode_int8(buffer));
+            break;
+        case TYPE_INT16:
+            BAIL_ON_NULL(int_obj = _decode_int16_32(buffer, 2));
+            break;
+        case TYPE_INT32:
+            BAIL_ON_NULL(int_obj = _decode_int16_32(buffer, 4));
+            break;
+#if DIALECT == DIALECT_BJDATA
+        case TYPE_UINT16:
+            BAIL_ON_NULL(int_obj = _decode_uint16_32(buffer, 2));
+            break;
+        case TYPE_UINT32:
+            BAIL_ON_NULL(int_obj = _decode_uint16_32(buffer, 4));
+            break;
+        case TYPE_UINT64:
+            BAIL_ON_NULL(int_obj = _decode_uint64(buffer));
+            break;
+#endif
+        case TYPE_INT64:
+            BAIL_ON_NULL(int_obj = _decode_int64(buffer));
+            break;
+        default:
+            RAISE_DECODER_EXCEPTION("Integer marker expected");
+    }
+#if PY_MAJOR_VERSION < 3
+    if (PyInt_Check(int_obj)) {
+        value = PyInt_AsLong(int_obj);
+    } else
+#endif
+    {
+        // not expecting this to occur unless LONG_MAX (sys.maxint in Python 2) < 2^63-1
+        value = PyLong_AsLongLong(int_obj);
+    }
+    if (PyErr_Occurred()) {
+        goto bail;
+    }
+    if (value < 0) {
+        RAISE_DECODER_EXCEPTION("Negative count/length unexpected");
+    }
+    Py_XDECREF(int_obj);
+
+    return value;
+
+bail:
+    Py_XDECREF(int_obj);
+    return -1;
+}
+
+
+
+static PyObject* _decode_high_prec(_bjdata_decoder_buffer_t *buffer) {
+    const char *raw;
+    PyObject *num_str = NULL;
+    PyObject *decimal;
+    long long length;
+
+    DECODE_LENGTH_OR_BAIL(length);
+    CHECK_STRING_LENGTH_OR_BAIL(length);
+    READ_OR_BAIL((Py_ssize_t)length, raw, "highprec");
+
+    DECODE_UNICODE_OR_BAIL(num_str, raw, (Py_ssize_t)length, "highprec");
+
+    BAIL_ON_NULL(decimal = PyObject_CallFunctionObjArgs((PyObject*)PyDec_Type, num_str, NULL));
+    Py_XDECREF(num_str);
+    return decimal;
+
+bail:
+    Py_XDECREF(num_str);
+    return NULL;
+}
+
+
+static PyObject* _decode_string(_bjdata_decoder_buffer_t *buffer) {
+    long long length;
+    const char *raw;
+    PyObject *obj = NULL;
+
+    DECODE_LENGTH_OR_BAIL(length);
+    CHECK_STRING_LENGTH_OR_BAIL(length);
+
+    if (length > 0) {
+        READ_OR_BAIL((Py_ssize_t)length, raw, "string");
+        DECODE_UNICODE_OR_BAIL(obj, raw, (Py_ssize_t)length, "string");
+    } else {
+        BAIL_ON_NULL(obj = PyUnicode_FromStringAndSize(NULL, 0));
+    }
+    return obj;
+
+bail:
+    Py_XDECREF(obj);
+    return NULL;
+}
+
+/* Reads container type & count (if present). For arrays nd_ndim & nd_dims (capable of holding NPY_MAXDIMS values) must
+ * be supplied to receive optimized ND-array dimensions (BJData only), with nd_ndim set to zero if none present. The
+ * count returned for ND-arrays is the product of all dimensions.
+ */
+static _container_params_t _get_container_params(_bjdata_decoder_buffer_t *buffer, int in_mapping, int *nd_ndim,
+                                                 npy_intp *nd_dims) {
+    _container_params_t params={0};
+    char marker;
+
+    if (NULL != nd_ndim) {
+        *nd_ndim = 0;
+    }
+    // fixed type for all values
+    READ_CHAR_OR_BAIL(marker, "container type, count or 1st key/value type");
+    if (CONTAINER_TYPE == marker) {
+        READ_CHAR_OR_BAIL(marker, "container type");
+        switch (marker) {
+            case TYPE_NULL: case TYPE_BOOL_TRUE: case TYPE_BOOL_FALSE: case TYPE_CHAR: case TYPE_STRING: case TYPE_INT8:
+            case TYPE_UINT8: case TYPE_INT16: case TYPE_INT32: case TYPE_INT64: case TYPE_FLOAT32: case TYPE_FLOAT64:
+#if DIALECT == DIALECT_BJDATA
+            case TYPE_UINT16: case TYPE_UINT32: case TYPE_UINT64: case TYPE_FLOAT16:
+#endif
+            case TYPE_HIGH_PREC: case ARRAY_START: case OBJECT_START:
+                params.type = marker;
+                break;
+            default:
+                RAISE_DECODER_EXCEPTION("Invalid container type");
+        }
+        READ_CHAR_OR_BAIL(marker, "container count or 1st key/value type");
+    } else {
+        // container type not fixed
+        params.type = TYPE_NONE;
+    }
+
+    // container value count
+    if (CONTAINER_COUNT == marker) {
+        params.counting = 1;
+        READ_CHAR_OR_BAIL(marker, "container count marker or optimized ND-array dimension array marker");
+#if DIALECT == DIALECT_BJDATA
+        // obtain the total number of elements of an optimized ND array header
+        if (ARRAY_START == marker && NULL != nd_ndim) {
+            BAIL_ON_NONZERO(_decode_nd_dims(buffer, nd_ndim, nd_dims, &params.count));
+            if (*nd_ndim > 0 && !_is_fixed_len_type(params.type) && TYPE_NONE != params.type) {
+                RAISE_DECODER_EXCEPTION("Invalid ND-array type");
+            }
+        } else
+#endif
+        {
+            DECODE_LENGTH_OR_BAIL_MARKER(params.count, marker);
+        }
+        if (buffer->prefs.max_container_count >= 0 && params.count > buffer->prefs.max_container_count) {
+            RAISE_DECODER_EXCEPTION("Container count exceeds max_container_count");
+        }
+        // reading ahead just to capture type, which will not exist if type is fixed
+        if ((params.count > 0) && (in_mapping || (TYPE_NONE == params.type))) {
+            READ_CHAR_OR_BAIL(marker, "1st key/value type");
+        } else {
+            marker = params.type;
+        }
+    } else if (TYPE_NONE == params.type) {
+        // count not provided but indicate that
+        params.count = 1;
+        params.counting = 0;
+    } else {
+        RAISE_DECODER_EXCEPTION("Container type without count");
+    }
+
+    params.marker = marker;
+    params.invalid = 0;
+    return params;
+
+bail:
+    params.invalid = 1;
+    return params;
+}
+
+#if DIALECT == DIALECT_BJDATA
+/* Decodes optimized ND-array dimensions (following "#[", i.e. in the form of an array of integers) into dims (of size
+ * NPY_MAXDIMS), setting count to their product. Returns non-zero on failure (exception set).
+ */
+static int _decode_nd_dims(_bjdata_decoder_buffer_t *buffer, int *ndim, npy_intp *dims, long long *count) {
+    _container_params_t params = _get_container_params(buffer, 0, NULL, NULL);
+    long long length;
+    char marker;
+
+    *ndim = 0;
+    *count = 1;
+    if (params.invalid) {
+        goto bail;
+    }
+    marker = params.marker;
+
+    while (params.counting ? (params.count > 0) : (ARRAY_END != marker)) {
+        if (*ndim >= NPY_MAXDIMS) {
+            RAISE_DECODER_EXCEPTION("Too many ND-array dimensions");
+        }
+        DECODE_LENGTH_OR_BAIL_MARKER(length, marker);
+        if (length > 0 && *count > LLONG_MAX / length) {
+            RAISE_DECODER_EXCEPTION("ND-array dimensions too large");
+        }
+        *count *= length;
+        dims[(*ndim)++] = (npy_intp)length;
+
+        if (params.counting) {
+            params.count--;
+        }
+        if (TYPE_NONE == params.type && (!params.counting || params.count > 0)) {
+            READ_CHAR_OR_BAIL(marker, "ND-array dimension");
+        }
+    }
+    return 0;
+
+bail:
+    return 1;
+}
+#endif
+
+/* Reads array parameters, either setting *value to the complete array for special cases which are decoded in one go
+ * (bytes, packed & no data arrays) or otherwise creating the list (or tuple if count known and array_as_tuple set) for
+ * frame to be populated by _decode_value. Returns non-zero on failure (exception set).
+ */
+static int _begin_array(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, PyObject **value) {
+    int ndim = 0;
+    npy_intp dims[NPY_MAXDIMS];
+    _container_params_t params = _get_container_params(buffer, 0, &ndim, dims);
+    PyObject *list = NULL;
+    PyObject *item;
+
+    *value = NULL;
+    if (params.invalid) {
+        goto bail;
+    }
+    frame->params = params;
+    if (params.counting) {
+        // special case - byte array
+        if ((TYPE_UINT8 == params.type) && !buffer->prefs.no_bytes && 0 == ndim) {
+            BAIL_ON_NONZERO(_decoder_buffer_check_available(buffer, params.count));
+            BAIL_ON_NULL(list = PyBytes_FromStringAndSize(NULL, params.count));
+            READ_INTO_OR_BAIL(params.count, PyBytes_AS_STRING(list), "bytes array");
+            *value = list;
+            return 0;
+        // special case - nd-array
+        } else if (ndim > 0 && TYPE_NONE != params.type) {
+            BAIL_ON_NULL(*value = _decode_packed_array(buffer, params.type, ndim, dims, params.count));
+            return 0;
+        // special case - no data types
+        } else if (_is_no_data_type(params.type)) {
+            BAIL_ON_NULL(item = _no_data_type(params.type));
+            if (buffer->prefs.array_as_tuple) {
+                BAIL_ON_NULL(list = PyTuple_New(params.count));
+                while (params.count > 0) {
+                    PyTuple_SET_ITEM(list, --params.count, item);
+                    // reference stolen each time
+                    Py_INCREF(item);
+                }
+            } else {
+                BAIL_ON_NULL(list = PyList_New(params.count));
+                while (params.count > 0) {
+                    PyList_SET_ITEM(list, --params.count, item);
+                    // reference stolen each time
+                    Py_INCREF(item);
+                }
+            }
+            *value = list;
+            return 0;
+        } else if (_is_fixed_len_type(params.type) && params.count > 0) { // 1d packed array
+            dims[0] = (npy_intp)params.count;
+            BAIL_ON_NULL(*value = _decode_packed_array(buffer, params.type, 1, dims, params.count));
+            return 0;
+        }
+        // take advantage of faster creation/setting of list since count known. Every value takes up at least one
+        // byte (first marker already read, unless typed).
+        BAIL_ON_NONZERO(_decoder_buffer_check_available(buffer, params.count - (TYPE_NONE == params.type)));
+        if (buffer->prefs.array_as_tuple) {
+            BAIL_ON_NULL(frame->container = PyTuple_New(params.count));
+        } else {
+            BAIL_ON_NULL(frame->container = PyList_New(params.count));
+        }
+    } else {
+        BAIL_ON_NULL(frame->container = PyList_New(0));
+    }
+    frame->rows = buffer->prefs.records_rows ? 0 : -1;
+    return 0;
+
+bail:
+    Py_XDECREF(list);
+    return 1;
+}
+
+/* Reads object parameters and creates the dict (or instance of dict_class, list of pairs if object_pairs_hook is set or
+ * tuple of field values if decoding into a class) for frame to be populated by _decode_value. Returns non-zero on
+ * failure (exception set).
+ */
+static int _begin_object(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame) {
+    _container_params_t params = _get_container_params(buffer, 1, NULL, NULL);
+
+    if (params.invalid) {
+        goto bail;
+    }
+    frame->params = params;
+    if (NULL != frame->spec) {
+        BAIL_ON_NULL(frame->container = PyTuple_New(PyTuple_GET_SIZE(CLASS_SPEC_NAMES(frame->spec))));
+    } else if (NULL != buffer->prefs.dict_class) {
+        BAIL_ON_NULL(frame->container = PyObject_CallObject(buffer->prefs.dict_class, NULL));
+    } else if (NULL == buffer->prefs.object_pairs_hook) {
+        if (params.counting) {
+            // every key takes up at least one byte (first one already read)
+            BAIL_ON_NONZERO(_decoder_buffer_check_available(buffer, params.count - 1));
+            // limited since (for streamed input) count cannot be checked against remaining input
+            BAIL_ON_NULL(frame->container = DICT_NEW_PRESIZED((Py_ssize_t)(MIN(params.count, DICT_PRESIZE_MAX))));
+        } else {
+            BAIL_ON_NULL(frame->container = PyDict_New());
+        }
+    } else if (params.counting) {
+        // every key takes up at least one byte (first one already read)
+        BAIL_ON_NONZERO(_decoder_buffer_check_available(buffer, params.count - 1));
+        BAIL_ON_NULL(frame->container = PyList_New(params.count));
+    } else {
+        BAIL_ON_NULL(frame->container = PyList_New(0));
+    }
+    return 0;
+
+bail:
+    return 1;
+}
+
+// same as string, except there is no 'S' marker
+static PyObject* _decode_object_key(_bjdata_decoder_buffer_t *buffer, char marker, int intern) {
+    long long length;
+    const char *raw;
+
+    DECODE_LENGTH_OR_BAIL_MARKER(length, marker);
+    CHECK_STRING_LENGTH_OR_BAIL(length);
+    READ_OR_BAIL((Py_ssize_t)length, raw, "string");
+
+    return _decoder_key_from_cache(buffer, raw, (Py_ssize_t)length, intern);
+
+bail:
+    return NULL;
+}
+
+// used by _fill_object
+#define DECODE_OBJECT_KEY_OR_RAISE_ENCODER_EXCEPTION(context_str, intern) {\
+    key = _decode_object_key(buffer, marker, intern);\
+    if (NULL == key) {\
+        if (PyErr_Occurred() && PyErr_ExceptionMatches((PyObject*)DecoderException)) {\
+            goto bail;\
+        }\
+        RAISE_DECODER_EXCEPTION("Failed to decode object key (" context_str ")");\
+    }\
+}
+
+/* Stores value (if not NULL, reference stolen even on failure) in the array of frame and then decodes further values
+ * until the array is either complete (returns 0) or a nested container follows (returns 1, with marker set to the
+ * container's marker). Returns -1 on failure (exception set).
+ */
+static inline int _fill_array(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, char *marker, PyObject *value) {
+    _container_params_t params = frame->params;
+    PyObject *list = frame->container;
+    Py_ssize_t list_pos = frame->list_pos;
+    int is_tuple = PyTuple_CheckExact(list);
+    int failed;
+
+    if (NULL != value && frame->rows >= 0) {
+        BAIL_ON_NONZERO(_decoder_rows_add(frame, params.counting ? list_pos : PyList_GET_SIZE(list), &value));
+    }
+    // take advantage of faster setting of list (or tuple) since count known
+    if (params.counting) {
+        if (NULL != value) {
+            // reference stolen
+            if (is_tuple) {
+                PyTuple_SET_ITEM(list, list_pos++, value);
+            } else {
+                PyList_SET_ITEM(list, list_pos++, value);
+            }
+            value = NULL;
+            if (--params.count > 0 && TYPE_NONE == params.type) {
+                READ_CHAR_OR_BAIL(params.marker, "array value type marker (sized)");
+            }
+        }
+        while (params.count > 0) {
+            if (TYPE_NOOP == params.marker) {
+                BAIL_ON_NONZERO(_decoder_skip_noops(buffer));
+                READ_CHAR_OR_BAIL(params.marker, "array value type marker (sized, after no-op)");
+                continue;
+            }
+            if (ARRAY_START == params.marker || OBJECT_START == params.marker) {
+                goto nested;
+            }
+            if (frame->rows >= 0) {
+                BAIL_ON_NONZERO(_decoder_rows_reject(frame, list_pos));
+            }
+            BAIL_ON_NULL(value = _decode_scalar(buffer, params.marker));
+            if (is_tuple) {
+                PyTuple_SET_ITEM(list, list_pos++, value);
+            } else {
+                PyList_SET_ITEM(list, list_pos++, value);
+            }
+            value = NULL;
+            // values in typed arrays have no marker
+            if (--params.count > 0 && TYPE_NONE == params.type) {
+                READ_CHAR_OR_BAIL(params.marker, "array value type marker (sized)");
+            }
+        }
+    } else {
+        if (NULL != value) {
+            failed = PyList_Append(list, value);
+            Py_CLEAR(value);
+            BAIL_ON_NONZERO(failed);
+            READ_CHAR_OR_BAIL(params.marker, "array value type marker");
+        }
+        while (ARRAY_END != params.marker) {
+            if (TYPE_NOOP == params.marker) {
+                BAIL_ON_NONZERO(_decoder_skip_noops(buffer));
+                READ_CHAR_OR_BAIL(params.marker, "array value type marker (after no-op)");
+                continue;
+            }
+            CHECK_CONTAINER_SIZE_OR_BAIL(PyList_GET_SIZE(list));
+            if (ARRAY_START == params.marker || OBJECT_START == params.marker) {
+                goto nested;
+            }
+            if (frame->rows >= 0) {
+                BAIL_ON_NONZERO(_decoder_rows_reject(frame, PyList_GET_SIZE(list)));
+            }
+            BAIL_ON_NULL(value = _decode_scalar(buffer, params.marker));
+            failed = PyList_Append(list, value);
+            Py_CLEAR(value);
+            BAIL_ON_NONZERO(failed);
+            READ_CHAR_OR_BAIL(params.marker, "array value type marker");
+        }
+    }
+    return 0;
+
+nested:
+    *marker = params.marker;
+    frame->params = params;
+    frame->list_pos = list_pos;
+    return 1;
+
+bail:
+    Py_XDECREF(value);
+    return -1;
+}
+
+/* Stores value (if not NULL, reference stolen even on failure) with frame->key in the object of frame and then decodes
+ * further keys & values until the object is either complete (returns 0) or a nested container follows (returns 1, with
+ * marker set to the container's marker and frame->key to its key). Returns -1 on failure (exception set).
+ */
+static inline int _fill_object(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame, char *value_marker,
+                              PyObject *value) {
+    _container_params_t params = frame->params;
+    PyObject *obj = frame->container;
+    // list of pairs (object_pairs_hook), dict or other mapping (dict_class)
+    int is_pairs = (NULL != buffer->prefs.object_pairs_hook);
+    int is_dict = !is_pairs && PyDict_CheckExact(obj);
+    PyObject *key = frame->key;
+    PyObject *item = NULL;
+    char marker;
+    int failed;
+
+    // key now owned by this function
+    frame->key = NULL;
+    for (;;) {
+        if (NULL != value) {
+            if (NULL != frame->spec) {
+                failed = _decoder_class_set(buffer, frame, key, value);
+                Py_CLEAR(key);
+                // reference stolen
+                value = NULL;
+                BAIL_ON_NONZERO(failed);
+                // might have reverted to a dict
+                obj = frame->container;
+                is_dict = PyDict_CheckExact(obj);
+            } else if (is_dict) {
+                failed = PyDict_SetItem(obj, key, value);
+                Py_CLEAR(key);
+                Py_CLEAR(value);
+                BAIL_ON_NONZERO(failed);
+            } else if (!is_pairs) {
+                failed = PyObject_SetItem(obj, key, value);
+                Py_CLEAR(key);
+                Py_CLEAR(value);
+                BAIL_ON_NONZERO(failed);
+            } else {
+                BAIL_ON_NULL(item = PyTuple_New(2));
+                // references stolen
+                PyTuple_SET_ITEM(item, 0, key);
+                PyTuple_SET_ITEM(item, 1, value);
+                key = value = NULL;
+                if (params.counting) {
+                    // reference stolen
+                    PyList_SET_ITEM(obj, frame->list_pos, item);
+                    item = NULL;
+                } else {
+                    failed = PyList_Append(obj, item);
+                    Py_CLEAR(item);
+                    BAIL_ON_NONZERO(failed);
+                }
+            }
+            frame->list_pos++;
+            if (params.counting) {
+                params.count--;
+            }
+            if (!params.counting || params.count > 0) {
+                READ_CHAR_OR_BAIL(params.marker, "object key length");
+            }
+        }
+        if (params.counting ? (params.count <= 0) : (OBJECT_END == params.marker)) {
+            return 0;
+        }
+        if (TYPE_NOOP == params.marker) {
+            BAIL_ON_NONZERO(_decoder_skip_noops(buffer));
+            READ_CHAR_OR_BAIL(params.marker, "object key length (after no-op)");
+            continue;
+        }
+        if (!params.counting) {
+            CHECK_CONTAINER_SIZE_OR_BAIL(frame->list_pos);
+        }
+        marker = params.marker;
+        DECODE_OBJECT_KEY_OR_RAISE_ENCODER_EXCEPTION("sized/unsized", buffer->prefs.intern_object_keys);
+        if (TYPE_NONE == params.type) {
+            READ_CHAR_OR_BAIL(marker, "object value type marker");
+        } else {
+            marker = params.type;
+        }
+        if (NULL != frame->filter) {
+            BAIL_ON_NEGATIVE(failed = _decoder_filter_member(buffer, frame, key));
+            if (!failed) {
+                // member not wanted (include/exclude)
+                Py_CLEAR(key);
+                BAIL_ON_NONZERO(_skip_value(buffer, marker, frame->depth));
+                if (params.counting) {
+                    params.count--;
+                }
+                if (!params.counting || params.count > 0) {
+                    READ_CHAR_OR_BAIL(params.marker, "object key length");
+                }
+                continue;
+            }
+        }
+        if (NULL != frame->class_node) {
+            BAIL_ON_NONZERO(_decoder_class_member(frame, key));
+        }
+        if (NULL != frame->raw_node) {
+            BAIL_ON_NEGATIVE(failed = _decoder_raw_member(frame, key));
+            if (failed) {
+                // stored at start of loop
+                BAIL_ON_NULL(value = _decode_raw(buffer, marker, TYPE_NONE != params.type, frame->depth));
+                continue;
+            }
+        }
+        if (ARRAY_START == marker || OBJECT_START == marker) {
+            *value_marker = marker;
+            frame->key = key;
+            frame->params = params;
+            return 1;
+        }
+        BAIL_ON_NULL(value = _decode_scalar(buffer, marker));
+    }
+
+bail:
+    Py_XDECREF(key);
+    Py_XDECREF(value);
+    return -1;
+}
+
+/* Returns the decoded container of frame (after resolving an out-of-band buffer reference, decoding into a class,
+ * applying object hooks or conversion to tuple / rows, if applicable) or NULL on failure.
+ */
+static PyObject* _end_container(_bjdata_decoder_buffer_t *buffer, _decoder_frame_t *frame) {
+    PyObject *obj = frame->container;
+    PyObject *hook = NULL;
+    PyObject *newobj;
+
+    frame->container = NULL;
+    if (OBJECT_START == frame->kind) {
+        if (NULL != buffer->prefs.buffers && NULL == frame->spec) {
+            obj = _decoder_out_of_band(buffer, obj);
+            if (NULL == obj || PyArray_Check(obj)) {
+                return obj;
+            }
+        }
+        if (NULL != frame->spec || NULL != buffer->prefs.classes) {
+            obj = _decoder_class_end(buffer, frame, obj);
+            if (NULL == obj || NULL != frame->spec) {
+                return obj;
+            }
+        }
+        hook = (NULL != buffer->prefs.object_pairs_hook) ? buffer->prefs.object_pairs_hook : buffer->prefs.object_hook;
+        // members skipped via include/exclude leave unused slots at the end of a list of pairs created with full count
+        if (NULL != buffer->prefs.object_pairs_hook && frame->params.counting &&
+            frame->list_pos < PyList_GET_SIZE(obj) &&
+            PyList_SetSlice(obj, frame->list_pos, PyList_GET_SIZE(obj), NULL)) {
+            Py_DECREF(obj);
+            return NULL;
+        }
+    } else {
+        // only arrays without a count are populated as a list
+        if (buffer->prefs.array_as_tuple && PyList_CheckExact(obj)) {
+            newobj = PyList_AsTuple(obj);
+            Py_DECREF(obj);
+            obj = newobj;
+        }
+        return _decoder_rows_finish(frame, obj);
+    }
+    if (NULL == hook) {
+        return obj;
+    }
+    newobj = PyObject_CallFunctionObjArgs(hook, obj, NULL);
+    Py_DECREF(obj);
+    return newobj;
+}
+
+// Decodes a non-container value with the given marker
+static PyObject* _decode_scalar(_bjdata_decoder_buffer_t *buffer, char marker) {
+    PyObject *obj;
+
+    switch (marker) {
+        case TYPE_NULL:
+            Py_RETURN_NONE;
+        case TYPE_BOOL_TRUE:
+            Py_RETURN_TRUE;
+        case TYPE_BOOL_FALSE:
+            Py_RETURN_FALSE;
+        case TYPE_CHAR:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_char(buffer), "char");
+        case TYPE_STRING:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_string(buffer), "string");
+        case TYPE_INT8:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_int8(buffer), "int8");
+        case TYPE_INT16:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_int16_32(buffer, 2), "int16");
+        case TYPE_INT32:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_int16_32(buffer, 4), "int32");
+        case TYPE_INT64:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_int64(buffer), "int64");
+        case TYPE_UINT8:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_uint8(buffer), "uint8");
+#if DIALECT == DIALECT_BJDATA
+        case TYPE_FLOAT16:
+        case TYPE_UINT16:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_uint16_32(buffer, 2), "uint16");
+        case TYPE_UINT32:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_uint16_32(buffer, 4), "uint32");
+        case TYPE_UINT64:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_uint64(buffer), "uint64");
+#endif
+        case TYPE_FLOAT32:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_float32(buffer), "float32");
+        case TYPE_FLOAT64:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_float64(buffer), "float64");
+        case TYPE_HIGH_PREC:
+            RETURN_OR_RAISE_DECODER_EXCEPTION(_decode_high_prec(buffer), "highprec");
+        default:
+            RAISE_DECODER_EXCEPTION("Invalid marker");
+    }
+
+bail:
+    return NULL;
+}
+
+/* Decodes a value of any type. Containers are decoded without recursion: those still being populated are kept on a
+ * heap-allocated stack, so that nesting depth is only limited by max_depth (if set) & available memory.
+ */
+static PyObject* _decode_value(_bjdata_decoder_buffer_t *buffer, char *given_marker) {
+    _decoder_stack_t stack = {NULL, 0, 0};
+    _decoder_frame_t *frame;
+    PyObject *value = NULL;
+    char marker;
+    int result;
+
+    if (NULL == given_marker) {
+        READ_CHAR_OR_BAIL(marker, "Type marker");
+    } else {
+        marker = *given_marker;
+    }
+
+    for (;;) {
+        if ((ARRAY_START == marker || OBJECT_START == marker) && buffer->prefs.raw_depth >= 0 &&
+            stack.size >= buffer->prefs.raw_depth) {
+            BAIL_ON_NULL(value = _decode_raw(buffer, marker,
+                                             stack.size > 0 && TYPE_NONE != stack.frames[stack.size - 1].params.type,
+                                             stack.size));
+        } else if (ARRAY_START == marker) {
+            BAIL_ON_NULL(frame = _decoder_stack_push(buffer, &stack, marker));
+            BAIL_ON_NONZERO(_begin_array(buffer, frame, &value));
+            // decoded in one go
+            if (NULL != value) {
+                _decoder_stack_pop(&stack);
+            }
+        } else if (OBJECT_START == marker) {
+            BAIL_ON_NULL(frame = _decoder_stack_push(buffer, &stack, marker));
+            BAIL_ON_NONZERO(_begin_object(buffer, frame));
+        } else {
+            BAIL_ON_NULL(value = _decode_scalar(buffer, marker));
+        }
+
+        // store value in its container (if any) & continue with the latter until another nested container follows
+        for (;;) {
+            if (0 == stack.size) {
+                _decoder_stack_free(&stack);
+                return value;
+            }
+            frame = &stack.frames[stack.size - 1];
+            if (ARRAY_START == frame->kind) {
+                result = _fill_array(buffer, frame, &marker, value);
+            } else {
+                result = _fill_object(buffer, frame, &marker, value);
+            }
+            // reference stolen (even on failure)
+            value = NULL;
+            BAIL_ON_NEGATIVE(result);
+            if (result) {
+                break;
+            }
+            value = _end_container(buffer, frame);
+            // the next object in the same array is likely of the same class
+            if (NULL != frame->spec && NULL != buffer->prefs.classes && stack.size > 1 &&
+                ARRAY_START == stack.frames[stack.size - 2].kind) {
+                stack.frames[stack.size - 2].last_spec = frame->spec;
+            }
+            _decoder_stack_pop(&stack);
+            BAIL_ON_NULL(value);
+        }
+    }
+
+bail:
+    Py_XDECREF(value);
+    _decoder_stack_free(&stack);
+    return NULL;
+}
+
+// Consumes a non-container value with the given marker without decoding it. Returns non-zero on failure.
+static int _skip_scalar(_bjdata_decoder_buffer_t *buffer, char marker) {
+    long long length;
+
+    switch (marker) {
+        case TYPE_NULL: case TYPE_BOOL_TRUE: case TYPE_BOOL_FALSE:
+            return 0;
+        case TYPE_CHAR: case TYPE_INT8: case TYPE_UINT8:
+            length = 1;
+            break;
+        case TYPE_INT16:
+#if DIALECT == DIALECT_BJDATA
+        case TYPE_UINT16: case TYPE_FLOAT16:
+#endif
+            length = 2;
+            break;
+        case TYPE_INT32: case TYPE_FLOAT32:
+#if DIALECT == DIALECT_BJDATA
+        case TYPE_UINT32:
+#endif
+            length = 4;
+            break;
+        case TYPE_INT64: case TYPE_FLOAT64:
+#if DIALECT == DIALECT_BJDATA
+        case TYPE_UINT64:
+#endif
+            length = 8;
+            break;
+        case TYPE_STRING: case TYPE_HIGH_PREC:
+            DECODE_LENGTH_OR_BAIL(length);
+            CHECK_STRING_LENGTH_OR_BAIL(length);
+            break;
+        default:
+            RAISE_DECODER_EXCEPTION("Invalid marker");
+    }
+    return _decoder_buffer_skip(buffer, length);
+
+bail:
+    return 1;
+}
+
+/* Consumes a value of any type (without creating any objects for it, or its contents being checked beyond what is
+ * required to find its end), e.g. an object member not wanted by include/exclude. Depth is that of the container holding
+ * the value. Like _decode_value, containers are tracked on an explicit stack rather than via recursion. Returns non-zero
+ * on failure.
+ */
+static int _skip_value(_bjdata_decoder_buffer_t *buffer, char marker, Py_ssize_t depth) {
+    _skip_frame_t local_frames[SKIP_STACK_LOCAL_SIZE];
+    _skip_frame_t *frames = local_frames;
+    _skip_frame_t *frame, *tmp;
+    _container_params_t *params;
+    Py_ssize_t size = 0;
+    Py_ssize_t capacity = SKIP_STACK_LOCAL_SIZE;
+    npy_intp dims[NPY_MAXDIMS];
+    long long length;
+    int ndim, bytelen;
+
+    for (;;) {
+        if (ARRAY_START == marker || OBJECT_START == marker) {
+            if (buffer->prefs.max_depth >= 0 && depth + size >= buffer->prefs.max_depth) {
+                RAISE_DECODER_EXCEPTION("Container nesting exceeds max_depth");
+            }
+            if (size == capacity) {
+                if (NULL == (tmp = PyMem_Malloc(sizeof(_skip_frame_t) * 2 * capacity))) {
+                    PyErr_NoMemory();
+                    goto bail;
+                }
+                memcpy(tmp, frames, sizeof(_skip_frame_t) * size);
+                if (local_frames != frames) {
+                    PyMem_Free(frames);
+                }
+                frames = tmp;
+                capacity *= 2;
+            }
+            frame = &frames[size++];
+            frame->kind = marker;
+            frame->size = 0;
+            frame->pending = 0;
+            frame->params = _get_container_params(buffer, OBJECT_START == marker,
+                                                  (ARRAY_START == marker) ? &ndim : NULL, dims);
+            if (frame->params.invalid) {
+                goto bail;
+            }
+            // typed arrays of fixed length (or no data) types are just their (packed) values
+            if (ARRAY_START == marker && frame->params.counting && _is_fixed_len_type(frame->params.type)) {
+                _get_type_info(frame->params.type, &bytelen);
+                if (frame->params.count > LLONG_MAX / bytelen) {
+                    RAISE_DECODER_EXCEPTION("Packed array too large");
+                }
+                BAIL_ON_NONZERO(_decoder_buffer_skip(buffer, frame->params.count * bytelen));
+                size--;
+            } else if (ARRAY_START == marker && _is_no_data_type(frame->params.type)) {
+                size--;
+            }
+        } else {
+            BAIL_ON_NONZERO(_skip_scalar(buffer, marker));
+        }
+
+        // continue with innermost container until another value follows
+        for (;;) {
+            if (0 == size) {
+                if (local_frames != frames) {
+                    PyMem_Free(frames);
+                }
+                return 0;
+            }
+            frame = &frames[size - 1];
+            params = &frame->params;
+            if (frame->pending) {
+                frame->pending = 0;
+                if (params->counting) {
+                    params->count--;
+                }
+                if (!params->counting || params->count > 0) {
+                    // values in typed arrays have no marker (whereas object keys always have a length marker)
+                    if (OBJECT_START == frame->kind || TYPE_NONE == params->type) {
+                        READ_CHAR_OR_BAIL(params->marker, "skipped value type marker");
+                    }
+                }
+            }
+            if (params->counting ? (params->count <= 0) :
+                                   (((ARRAY_START == frame->kind) ? ARRAY_END : OBJECT_END) == params->marker)) {
+                size--;
+                continue;
+            }
+            if (TYPE_NOOP == params->marker) {
+                BAIL_ON_NONZERO(_decoder_skip_noops(buffer));
+                READ_CHAR_OR_BAIL(params->marker, "skipped value type marker (after no-op)");
+                continue;
+            }
+            if (!params->counting) {
+                CHECK_CONTAINER_SIZE_OR_BAIL(frame->size);
+                frame->size++;
+            }
+            marker = params->marker;
+            if (OBJECT_START == frame->kind) {
+                DECODE_LENGTH_OR_BAIL_MARKER(length, marker);
+                CHECK_STRING_LENGTH_OR_BAIL(length);
+                BAIL_ON_NONZERO(_decoder_buffer_skip(buffer, length));
+                if (TYPE_NONE == params->type) {
+                    READ_CHAR_OR_BAIL(marker, "skipped object value type marker");
+                } else {
+                    marker = params->type;
+                }
+            }
+            frame->pending = 1;
+            break;
+        }
+    }
+
+bail:
+    if (local_frames != frames) {
+        PyMem_Free(frames);
+    }
+    return 1;
+}
+
+/* Returns RawBJData holding the encoded form of the value with the given marker (see _decoder_raw_slice for the meaning
+ * of typed), skipping over it. When reading from a stream, the skipped input is captured into a (bytes) copy. Depth is
+ * that of the container holding the value. Returns NULL on failure.
+ */
+static PyObject* _decode_raw(_bjdata_decoder_buffer_t *buffer, char marker, int typed, Py_ssize_t depth) {
+    Py_ssize_t start = buffer->total_read;
+    PyObject *data = NULL;
+    PyObject *raw;
+    int failed;
+
+    if (_decoder_buffer_read_fixed == buffer->read_func) {
+        BAIL_ON_NONZERO(_skip_value(buffer, marker, depth));
+        BAIL_ON_NULL(data = _decoder_raw_slice(buffer, marker, typed, start));
+    } else {
+        buffer->capture_len = 0;
+        buffer->capture_read_func = buffer->read_func;
+        buffer->read_func = _decoder_buffer_read_capture;
+        failed = _skip_value(buffer, marker, depth);
+        buffer->read_func = buffer->capture_read_func;
+        buffer->capture_read_func = NULL;
+        BAIL_ON_NONZERO(failed);
+        BAIL_ON_NULL(data = PyBytes_FromStringAndSize(NULL, 1 + buffer->capture_len));
+        PyBytes_AS_STRING(data)[0] = marker;
+        if (buffer->capture_len > 0) {
+            memcpy(&PyBytes_AS_STRING(data)[1], buffer->capture, buffer->capture_len);
+        }
+    }
+    // same byte order & dialect as decoded with, i.e. as is required to write it as-is again
+    raw = PyObject_CallFunction(RawBJData_from_valid, "Ois", data, buffer->prefs.islittle ? 1 : 0,
+                                DIALECT == DIALECT_UBJSON ? "ubjson" : "bjdata");
+    Py_DECREF(data);
+    return raw;
+
+bail:
+    Py_XDECREF(data);
+    return NULL;
+}
+
+/******************************************************************************/
+
+#undef DECODE_OBJECT_KEY_OR_RAISE_ENCODER_EXCEPTION
+#undef _decode_int_non_negative
+#undef _decode_high_prec
+#undef _decode_string
+#undef _get_container_params
+#undef _decode_nd_dims
+#undef _begin_array
+#undef _begin_object
+#undef _decode_object_key
+#undef _fill_array
+#undef _fill_object
+#undef _end_container
+#undef _decode_scalar
+#undef _decode_value
+#undef _skip_scalar
+#undef _skip_value
+#undef _decode_raw
@@ -17,6 +17,7 @@
 
 #include <Python.h>
 #include <bytesobject.h>
+#include <structmember.h>
 #include <string.h>
 
 #define NO_IMPORT_ARRAY
@@ -29,6 +30,17 @@
 #include "encoder.h"
 #include "python_funcs.h"
 
+#ifdef FD_IO_SUPPORTED
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// (not defined before Python 3.7, where PyThread_start_new_thread returns a signed value)
+#ifndef PYTHREAD_INVALID_THREAD_ID
+#define PYTHREAD_INVALID_THREAD_ID (-1)
+#endif
+
 /******************************************************************************/
 
 static char bytes_array_prefix[] = {ARRAY_START, CONTAINER_TYPE, TYPE_UINT8, CONTAINER_COUNT};
@@ -43,14 +55,78 @@ static char bytes_array_prefix[] = {ARRAY_START, CONTAINER_TYPE, TYPE_UINT8, CON
 #define BUFFER_INITIAL_SIZE 64
 // encoder buffer size when using fp (i.e. minimum number of bytes to buffer before writing out)
 #define BUFFER_FP_SIZE 256
+// buffer size when writing to a file descriptor directly (chunks at least this large are written as-is)
+#define BUFFER_FD_SIZE (1 << 16)
+// initial number of container frames allocated for the encoder stack (grows as required)
+#define ENCODER_STACK_INITIAL_SIZE 16
+// circular references are detected by scanning the frames of (up to) this many outermost containers, with any deeper
+// containers additionally being tracked in a set
+#define CIRCULAR_SCAN_DEPTH 32
+// payloads of at least this size are referenced rather than copied when collecting segments (see dumpb_iov)
+#define SEGMENT_VIEW_MIN_SIZE 1024
+// numpy arrays with payloads of at least this size are passed out-of-band if buffer_callback is set (see dump)
+#define OUT_OF_BAND_MIN_SIZE 1024
+// size of chunks in which values of a range are computed & written (see _encode_PyRange in encoder_dialect.h)
+#define RANGE_CHUNK_SIZE 4096
 
 static PyObject *EncoderException = NULL;
 static PyTypeObject *PyDec_Type = NULL;
 #define PyDec_Check(v) PyObject_TypeCheck(v, PyDec_Type)
+static PyTypeObject *RawBJData_Type = NULL;
+#define RawBJData_Check(v) PyObject_TypeCheck(v, RawBJData_Type)
+// bjdata.encoder namedtuple_as_object, slots_as_object & _field_names (see _encoder_type_resolve)
+static PyObject *namedtuple_as_object = NULL;
+static PyObject *slots_as_object = NULL;
+static PyObject *field_names = NULL;
+// WeakKeyDictionary of type to dict of field specs (see _encoder_field_spec)
+static PyObject *field_specs = NULL;
+// types with built-in handling, imported on first use (see _encoder_import_builtin_types)
+static PyObject *EnumType = NULL;
+static PyObject *UUIDType = NULL;
+static PyObject *PurePathType = NULL;
+// files which can be written via their file descriptor (see _bjdata_encoder_buffer_set_fd)
+static PyObject *FileIOType = NULL;
+static PyObject *BufferedWriterType = NULL;
+static int builtin_types_imported = 0;
+
+// Where the field names of a type are taken from (see _encoder_field_spec)
+enum {
+    // _field_names(type), i.e. dataclass or attrs class
+    FIELD_SOURCE_CLASS = 0,
+    // _field_names(type, True), i.e. __slots__
+    FIELD_SOURCE_SLOTS,
+    // type._fields (namedtuple)
+    FIELD_SOURCE_NAMEDTUPLE
+};
 
 /******************************************************************************/
 
 static int _encoder_buffer_write(_bjdata_encoder_buffer_t *buffer, const char* const chunk, size_t chunk_len);
+static int _encoder_write_fd(int fd, const char *chunk, size_t chunk_len);
+static int _encoder_buffer_flush_fd(_bjdata_encoder_buffer_t *buffer);
+static int _encoder_bg_start(_bjdata_encoder_buffer_t *buffer);
+static int _encoder_bg_submit(_bjdata_encoder_buffer_t *buffer, const char *chunk, size_t chunk_len);
+static int _encoder_bg_wait(_bjdata_encoder_buffer_t *buffer);
+static void _encoder_bg_stop(_bjdata_encoder_buffer_t *buffer);
+static int _encoder_buffer_write_payload(_bjdata_encoder_buffer_t *buffer, PyObject *obj, const char* const chunk,
+                                         size_t chunk_len);
+static _bjdata_encoder_frame_t* _encoder_stack_push(_bjdata_encoder_buffer_t *buffer, PyObject *obj, int kind);
+static int _encoder_stack_pop(_bjdata_encoder_buffer_t *buffer);
+static void _encoder_stack_unwind(_bjdata_encoder_buffer_t *buffer, Py_ssize_t depth);
+static int _encode_RawBJData(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static _bjdata_encoder_type_t* _encoder_type_lookup(_bjdata_encoder_buffer_t *buffer, PyTypeObject *type);
+static PyObject* _encoder_field_value(PyObject *obj, PyObject *field, int kind);
+static int _encoder_encode_key(PyObject *key, _bjdata_encoder_buffer_t *buffer);
+static int _encoder_range_params(PyObject *obj, long long *start, long long *step, Py_ssize_t *count);
+static int _encoder_write_count_slot(_bjdata_encoder_buffer_t *buffer, long long *offset);
+static int _encoder_patch_count(_bjdata_encoder_buffer_t *buffer, long long offset, Py_ssize_t count);
+static int _encoder_out_of_band(_bjdata_encoder_buffer_t *buffer, PyArrayObject *arr);
+static int _encoder_pass_out_of_band(_bjdata_encoder_buffer_t *buffer, PyArrayObject *arr, long long *index);
+
+/* Whether a count can be patched after having been written, i.e. output is in memory (but not split into segments) or
+ * fp is seekable
+ */
+#define ENCODER_CAN_PATCH(buffer) ((NULL == (buffer)->fp_write && NULL == (buffer)->segments) || NULL != (buffer)->fp)
 
 #define RECURSE_AND_BAIL_ON_NONZERO(action, recurse_msg) {\
     int ret;\
@@ -66,23 +142,6 @@ static int _encoder_buffer_write(_bjdata_encoder_buffer_t *buffer, const char* c
     WRITE_OR_BAIL(&ctmp, 1);\
 }
 
-/* These functions return non-zero on failure (an exception will have been set). Note that no type checking is performed
- * where a Python type is mentioned in the function name!
- */
-static int _encode_PyBytes(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
-static int _encode_PyObject_as_PyDecimal(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
-static int _encode_PyDecimal(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
-static int _encode_PyUnicode(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
-static int _encode_PyFloat(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
-static int _encode_PyLong(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
-static int _encode_longlong(long long num, _bjdata_encoder_buffer_t *buffer);
-#if PY_MAJOR_VERSION < 3
-static int _encode_PyInt(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
-#endif
-static int _encode_PySequence(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
-static int _encode_mapping_key(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
-static int _encode_PyMapping(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
-
 const int numpytypes[][2] = {
     {NPY_BOOL,       TYPE_UINT8},
     {NPY_BYTE,       TYPE_INT8},
@@ -133,11 +192,10 @@ _bjdata_encoder_buffer_t* _bjdata_encoder_buffer_create(_bjdata_encoder_prefs_t*
     buffer->raw = PyBytes_AS_STRING(buffer->obj);
     buffer->pos = 0;
 
-    BAIL_ON_NULL(buffer->markers = PySet_New(NULL));
-
     buffer->prefs = *prefs;
     buffer->fp_write = fp_write;
     Py_XINCREF(fp_write);
+    buffer->fd = -1;
 
     // treat Py_None as no default_func being supplied
     if (Py_None == buffer->prefs.default_func) {
@@ -151,10 +209,152 @@ bail:
     return NULL;
 }
 
+/* Makes _bjdata_encoder_buffer_finalise return the output as a list of segments (see _encoder_buffer_write_payload)
+ * rather than one bytes instance. Must be called before anything has been written. Returns non-zero on failure
+ * (exception set).
+ */
+int _bjdata_encoder_buffer_set_segments(_bjdata_encoder_buffer_t *buffer) {
+    return (NULL == (buffer->segments = PyList_New(0)));
+}
+
+/* Returns 1 if fp (or the file descriptor output is written to) is in append mode, i.e. seeking does not affect where
+ * output is written, otherwise 0. Returns -1 on failure (exception set).
+ */
+static int _encoder_fp_appends(_bjdata_encoder_buffer_t *buffer, PyObject *fp) {
+    PyObject *mode;
+    PyObject *append;
+    int found;
+
+#ifdef FD_IO_SUPPORTED
+    int flags;
+
+    if (buffer->fd >= 0 && -1 != (flags = fcntl(buffer->fd, F_GETFL))) {
+        return (flags & O_APPEND) ? 1 : 0;
+    }
+#else
+    UNUSED(buffer);
+#endif
+    if (NULL == (mode = PyObject_GetAttrString(fp, "mode"))) {
+        PyErr_Clear();
+        return 0;
+    }
+    // e.g. gzip.GzipFile.mode is an int
+    if (!PyUnicode_Check(mode)) {
+        Py_DECREF(mode);
+        return 0;
+    }
+    if (NULL == (append = PyUnicode_FromString("a"))) {
+        Py_DECREF(mode);
+        return -1;
+    }
+    found = PySequence_Contains(mode, append);
+    Py_DECREF(append);
+    Py_DECREF(mode);
+    return found;
+}
+
+/* Allows counts of iterators to be patched in fp (see _encoder_write_count_slot) once flushed, if fp is seekable (and
+ * not in append mode, where writes ignore the position). Returns non-zero on failure (exception set).
+ */
+int _bjdata_encoder_buffer_set_fp(_bjdata_encoder_buffer_t *buffer, PyObject *fp) {
+    PyObject *seekable = NULL;
+    PyObject *pos = NULL;
+    int is_seekable;
+    int appends;
+
+    if (!PyObject_HasAttrString(fp, "seekable")) {
+        return 0;
+    }
+    BAIL_ON_NULL(seekable = PyObject_CallMethod(fp, "seekable", NULL));
+    BAIL_ON_NEGATIVE(is_seekable = PyObject_IsTrue(seekable));
+    if (is_seekable) {
+        BAIL_ON_NULL(pos = PyObject_CallMethod(fp, "tell", NULL));
+        buffer->fp_start = PyLong_AsLongLong(pos);
+        BAIL_ON_NONZERO(-1 == buffer->fp_start && PyErr_Occurred());
+        // (offsets of aligned payloads are still relative to the start of the file)
+        BAIL_ON_NEGATIVE(appends = _encoder_fp_appends(buffer, fp));
+        if (!appends) {
+            Py_INCREF(fp);
+            buffer->fp = fp;
+        }
+    }
+    Py_DECREF(seekable);
+    Py_XDECREF(pos);
+    return 0;
+
+bail:
+    Py_XDECREF(seekable);
+    Py_XDECREF(pos);
+    return 1;
+}
+
+/* Makes output be written to the file descriptor of fp directly (in large chunks, without holding the GIL while doing
+ * so) instead of via fp_write, if fp is exactly io.FileIO or io.BufferedWriter (which is flushed first). Otherwise (or
+ * if not supported on this platform) does nothing. Must be called before anything has been written. Returns non-zero
+ * on failure (exception set).
+ */
+int _bjdata_encoder_buffer_set_fd(_bjdata_encoder_buffer_t *buffer, PyObject *fp) {
+#ifdef FD_IO_SUPPORTED
+    PyObject *ret = NULL;
+    int fd;
+
+    if ((PyObject *)Py_TYPE(fp) != FileIOType && (PyObject *)Py_TYPE(fp) != BufferedWriterType) {
+        return 0;
+    }
+    // e.g. if closed, in which case writing via fp_write raises the appropriate error instead
+    if (NULL == (ret = PyObject_CallMethod(fp, "fileno", NULL)) || -1 == (fd = (int)PyLong_AsLong(ret))) {
+        Py_XDECREF(ret);
+        PyErr_Clear();
+        return 0;
+    }
+    Py_CLEAR(ret);
+    if ((PyObject *)Py_TYPE(fp) == BufferedWriterType) {
+        BAIL_ON_NULL(ret = PyObject_CallMethod(fp, "flush", NULL));
+        Py_CLEAR(ret);
+        BAIL_ON_NULL(ret = PyObject_CallMethod(fp, "seekable", NULL));
+        if (Py_True == ret) {
+            buffer->fd_owner = fp;
+            Py_INCREF(fp);
+        }
+        Py_CLEAR(ret);
+    }
+    BAIL_ON_NONZERO(_PyBytes_Resize(&buffer->obj, BUFFER_FD_SIZE));
+    buffer->raw = PyBytes_AS_STRING(buffer->obj);
+    buffer->len = BUFFER_FD_SIZE;
+    if (buffer->prefs.background_write) {
+        BAIL_ON_NULL(buffer->bg_obj = PyBytes_FromStringAndSize(NULL, BUFFER_FD_SIZE));
+    }
+    buffer->fd = fd;
+    return 0;
+
+bail:
+    Py_XDECREF(ret);
+    return 1;
+#else
+    UNUSED(buffer);
+    UNUSED(fp);
+    return 0;
+#endif
+}
+
 void _bjdata_encoder_buffer_free(_bjdata_encoder_buffer_t **buffer) {
+    int i;
+
     if (NULL != buffer && NULL != *buffer) {
+        // the background writer might still be using the file descriptor (owned by fp/fd_owner) and bg_obj
+        _encoder_bg_stop(*buffer);
+        for (i = 0; i < ENCODER_TYPE_CACHE_SIZE; i++) {
+            Py_XDECREF((*buffer)->types[i].type);
+            Py_XDECREF((*buffer)->types[i].handler);
+        }
         Py_XDECREF((*buffer)->obj);
         Py_XDECREF((*buffer)->fp_write);
+        Py_XDECREF((*buffer)->fp);
+        Py_XDECREF((*buffer)->fd_owner);
+        Py_XDECREF((*buffer)->bg_obj);
+        Py_XDECREF((*buffer)->segments);
+        _encoder_stack_unwind(*buffer, 0);
+        PyMem_Free((*buffer)->frames);
         Py_XDECREF((*buffer)->markers);
         free(*buffer);
         *buffer = NULL;
@@ -182,6 +382,20 @@ static int _encoder_buffer_write(_bjdata_encoder_buffer_t *buffer, const char* c
         memcpy(&(buffer->raw[buffer->pos]), chunk, sizeof(char) * chunk_len);
         buffer->pos += chunk_len;
 
+    } else if (buffer->fd >= 0) {
+        if (chunk_len > (buffer->len - buffer->pos)) {
+            BAIL_ON_NONZERO(_encoder_buffer_flush_fd(buffer));
+            // large chunks (e.g. array payloads) are written as-is rather than copied into the buffer first
+            if (chunk_len >= buffer->len) {
+                BAIL_ON_NONZERO(_encoder_bg_wait(buffer));
+                BAIL_ON_NONZERO(_encoder_write_fd(buffer->fd, chunk, chunk_len));
+                buffer->flushed += chunk_len;
+                return 0;
+            }
+        }
+        memcpy(&(buffer->raw[buffer->pos]), chunk, sizeof(char) * chunk_len);
+        buffer->pos += chunk_len;
+
     } else {
         // increase buffer to fit all first
         if (chunk_len > (buffer->len - buffer->pos)) {
@@ -197,6 +411,7 @@ static int _encoder_buffer_write(_bjdata_encoder_buffer_t *buffer, const char* c
             BAIL_ON_NULL(fp_write_ret = PyObject_CallFunctionObjArgs(buffer->fp_write, buffer->obj, NULL));
             Py_DECREF(fp_write_ret);
             Py_DECREF(buffer->obj);
+            buffer->flushed += buffer->pos;
             buffer->len = BUFFER_FP_SIZE;
             BAIL_ON_NULL(buffer->obj = PyBytes_FromStringAndSize(NULL, buffer->len));
             buffer->raw = PyBytes_AS_STRING(buffer->obj);
@@ -209,17 +424,302 @@ bail:
     return 1;
 }
 
-// Flushes remaining bytes to writer and returns None or returns final bytes object (when no writer specified).
-// Does NOT free passed in buffer struct.
+// Writes all of chunk to the file descriptor fd, without holding the GIL. Returns non-zero on failure (exception set).
+static int _encoder_write_fd(int fd, const char *chunk, size_t chunk_len) {
+#ifdef FD_IO_SUPPORTED
+    ssize_t written;
+
+    while (chunk_len > 0) {
+        Py_BEGIN_ALLOW_THREADS
+        written = write(fd, chunk, chunk_len);
+        Py_END_ALLOW_THREADS
+        if (written < 0 && EINTR == errno) {
+            BAIL_ON_NONZERO(PyErr_CheckSignals());
+        } else if (written <= 0) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            goto bail;
+        } else {
+            chunk += written;
+            chunk_len -= (size_t)written;
+        }
+    }
+    return 0;
+
+bail:
+    return 1;
+#else
+    UNUSED(fd);
+    UNUSED(chunk);
+    UNUSED(chunk_len);
+    PyErr_SetString(PyExc_NotImplementedError, "File descriptor output not supported");
+    return 1;
+#endif
+}
+
+/* Writes the buffered output to the file descriptor (see _bjdata_encoder_buffer_set_fd), emptying the buffer. With
+ * background_write, the buffer is instead swapped with bg_obj (once the previous chunk has been written) and its
+ * contents handed to the background writer.
+ */
+static int _encoder_buffer_flush_fd(_bjdata_encoder_buffer_t *buffer) {
+    PyObject *tmp;
+
+    if (NULL != buffer->bg_obj) {
+        if (0 == buffer->pos) {
+            return 0;
+        }
+        BAIL_ON_NONZERO(_encoder_bg_wait(buffer));
+        tmp = buffer->bg_obj;
+        buffer->bg_obj = buffer->obj;
+        buffer->obj = tmp;
+        buffer->raw = PyBytes_AS_STRING(buffer->obj);
+        BAIL_ON_NONZERO(_encoder_bg_submit(buffer, PyBytes_AS_STRING(buffer->bg_obj), buffer->pos));
+    } else {
+        BAIL_ON_NONZERO(_encoder_write_fd(buffer->fd, buffer->raw, buffer->pos));
+    }
+    buffer->flushed += buffer->pos;
+    buffer->pos = 0;
+    return 0;
+
+bail:
+    return 1;
+}
+
+#ifdef FD_IO_SUPPORTED
+/* Background writer thread (see _encoder_bg_start). Runs without a thread state, i.e. must not use the Python API.
+ * Interrupted writes are repeated since signals are handled by the encoding thread.
+ */
+static void _encoder_bg_run(void *arg) {
+    _bjdata_encoder_bg_t *bg = (_bjdata_encoder_bg_t *)arg;
+    ssize_t written;
+
+    for (;;) {
+        PyThread_acquire_lock(bg->work, WAIT_LOCK);
+        if (bg->stop) {
+            PyThread_release_lock(bg->idle);
+            return;
+        }
+        while (bg->chunk_len > 0 && 0 == bg->error) {
+            written = write(bg->fd, bg->chunk, bg->chunk_len);
+            if (written > 0) {
+                bg->chunk += written;
+                bg->chunk_len -= (size_t)written;
+            } else if (written < 0 && EINTR != errno) {
+                bg->error = errno;
+            } else if (0 == written) {
+                bg->error = EIO;
+            }
+        }
+        PyThread_release_lock(bg->idle);
+    }
+}
+#endif
+
+/* Starts the thread writing chunks handed to it via _encoder_bg_submit to the file descriptor, i.e. without holding
+ * the GIL, whilst the encoder continues filling the other buffer. Both locks are held by the encoding thread
+ * initially. Returns non-zero on failure (exception set).
+ */
+static int _encoder_bg_start(_bjdata_encoder_buffer_t *buffer) {
+#ifdef FD_IO_SUPPORTED
+    _bjdata_encoder_bg_t *bg;
+
+    if (NULL == (bg = buffer->bg = PyMem_Malloc(sizeof(_bjdata_encoder_bg_t)))) {
+        PyErr_NoMemory();
+        goto bail;
+    }
+    memset(bg, 0, sizeof(_bjdata_encoder_bg_t));
+    bg->fd = buffer->fd;
+    if (NULL == (bg->work = PyThread_allocate_lock()) || NULL == (bg->idle = PyThread_allocate_lock())) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to allocate lock");
+        goto bail;
+    }
+    PyThread_acquire_lock(bg->work, NOWAIT_LOCK);
+    PyThread_acquire_lock(bg->idle, NOWAIT_LOCK);
+    if (PYTHREAD_INVALID_THREAD_ID == PyThread_start_new_thread(_encoder_bg_run, bg)) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to start background writer");
+        goto bail;
+    }
+    return 0;
+
+bail:
+    if (NULL != bg) {
+        if (NULL != bg->work) {
+            PyThread_free_lock(bg->work);
+        }
+        if (NULL != bg->idle) {
+            PyThread_free_lock(bg->idle);
+        }
+        PyMem_Free(bg);
+        buffer->bg = NULL;
+    }
+    return 1;
+#else
+    UNUSED(buffer);
+    PyErr_SetString(PyExc_NotImplementedError, "Background writing not supported");
+    return 1;
+#endif
+}
+
+/* Hands chunk (which must remain valid until the next _encoder_bg_wait call) to the background writer, starting it if
+ * not yet running. Requires it to be idle. Returns non-zero on failure (exception set).
+ */
+static int _encoder_bg_submit(_bjdata_encoder_buffer_t *buffer, const char *chunk, size_t chunk_len) {
+    if (NULL == buffer->bg) {
+        BAIL_ON_NONZERO(_encoder_bg_start(buffer));
+    }
+    buffer->bg->chunk = chunk;
+    buffer->bg->chunk_len = chunk_len;
+    buffer->bg_pending = 1;
+    PyThread_release_lock(buffer->bg->work);
+    return 0;
+
+bail:
+    return 1;
+}
+
+/* Waits (without holding the GIL) for the chunk handed to the background writer, if any, to have been written. Returns
+ * non-zero on failure (exception set), i.e. if writing any chunk failed.
+ */
+static int _encoder_bg_wait(_bjdata_encoder_buffer_t *buffer) {
+    if (buffer->bg_pending) {
+        if (!PyThread_acquire_lock(buffer->bg->idle, NOWAIT_LOCK)) {
+            Py_BEGIN_ALLOW_THREADS
+            PyThread_acquire_lock(buffer->bg->idle, WAIT_LOCK);
+            Py_END_ALLOW_THREADS
+        }
+        buffer->bg_pending = 0;
+    }
+    if (NULL != buffer->bg && 0 != buffer->bg->error) {
+        errno = buffer->bg->error;
+        PyErr_SetFromErrno(PyExc_OSError);
+        return 1;
+    }
+    return 0;
+}
+
+// Waits for the background writer (if started) to exit and frees it. Leaves any exception set as-is.
+static void _encoder_bg_stop(_bjdata_encoder_buffer_t *buffer) {
+    _bjdata_encoder_bg_t *bg = buffer->bg;
+
+    if (NULL == bg) {
+        return;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    if (buffer->bg_pending) {
+        PyThread_acquire_lock(bg->idle, WAIT_LOCK);
+    }
+    bg->stop = 1;
+    PyThread_release_lock(bg->work);
+    PyThread_acquire_lock(bg->idle, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+    buffer->bg_pending = 0;
+    PyThread_free_lock(bg->work);
+    PyThread_free_lock(bg->idle);
+    PyMem_Free(bg);
+    buffer->bg = NULL;
+}
+
+/* Writes chunk, the payload of obj (which exports exactly chunk via the buffer protocol), to the output. When
+ * collecting segments, a large payload is not copied: the output so far is appended as a bytes segment, followed by a
+ * memoryview of obj.
+ */
+static int _encoder_buffer_write_payload(_bjdata_encoder_buffer_t *buffer, PyObject *obj, const char* const chunk,
+                                         size_t chunk_len) {
+#if PY_MAJOR_VERSION >= 3
+    PyObject *segment = NULL;
+    PyObject *view = NULL;
+
+    if (NULL == buffer->segments || chunk_len < SEGMENT_VIEW_MIN_SIZE) {
+        return _encoder_buffer_write(buffer, chunk, chunk_len);
+    }
+    if (buffer->pos > 0) {
+        BAIL_ON_NULL(segment = PyBytes_FromStringAndSize(buffer->raw, buffer->pos));
+        BAIL_ON_NONZERO(PyList_Append(buffer->segments, segment));
+        Py_CLEAR(segment);
+        buffer->flushed += buffer->pos;
+        buffer->pos = 0;
+    }
+    // as flat bytes, whatever the shape & type of obj
+    BAIL_ON_NULL(view = PyMemoryView_FromObject(obj));
+    BAIL_ON_NULL(segment = PyObject_CallMethod(view, "cast", "s", "B"));
+    BAIL_ON_NONZERO(PyList_Append(buffer->segments, segment));
+    buffer->flushed += chunk_len;
+    Py_DECREF(segment);
+    Py_DECREF(view);
+    return 0;
+
+bail:
+    Py_XDECREF(segment);
+    Py_XDECREF(view);
+    return 1;
+#else
+    UNUSED(obj);
+    return _encoder_buffer_write(buffer, chunk, chunk_len);
+#endif
+}
+
+// Whether the (C-contiguous) array arr is to be passed to buffer_callback rather than written (see dump)
+static int _encoder_out_of_band(_bjdata_encoder_buffer_t *buffer, PyArrayObject *arr) {
+    return (NULL != buffer->prefs.buffer_callback && PyArray_NDIM(arr) > 0 && !PyDataType_REFCHK(PyArray_DESCR(arr)) &&
+            PyArray_NBYTES(arr) >= OUT_OF_BAND_MIN_SIZE);
+}
+
+/* Calls buffer_callback with a (flat, unsigned byte) memoryview of the C-contiguous array arr, setting index to that of
+ * the payload (i.e. the number of payloads passed before it). Returns non-zero on failure.
+ */
+static int _encoder_pass_out_of_band(_bjdata_encoder_buffer_t *buffer, PyArrayObject *arr, long long *index) {
+    PyObject *view = NULL;
+    PyObject *flat = NULL;
+    PyObject *ret;
+
+    BAIL_ON_NULL(view = PyMemoryView_FromObject((PyObject *)arr));
+#if PY_MAJOR_VERSION >= 3
+    BAIL_ON_NULL(flat = PyObject_CallMethod(view, "cast", "s", "B"));
+#else
+    // memoryview.cast not available
+    flat = view;
+    Py_INCREF(flat);
+#endif
+    BAIL_ON_NULL(ret = PyObject_CallFunctionObjArgs(buffer->prefs.buffer_callback, flat, NULL));
+    Py_DECREF(ret);
+    Py_DECREF(flat);
+    Py_DECREF(view);
+    *index = buffer->buffer_count++;
+    return 0;
+
+bail:
+    Py_XDECREF(flat);
+    Py_XDECREF(view);
+    return 1;
+}
+
+/* Flushes remaining bytes to writer and returns None or returns final bytes object (when no writer specified) or list
+ * of segments (see _bjdata_encoder_buffer_set_segments). Does NOT free passed in buffer struct.
+ */
 PyObject* _bjdata_encoder_buffer_finalise(_bjdata_encoder_buffer_t *buffer) {
     PyObject *fp_write_ret;
 
+    if (buffer->fd >= 0) {
+        BAIL_ON_NONZERO(_encoder_buffer_flush_fd(buffer));
+        BAIL_ON_NONZERO(_encoder_bg_wait(buffer));
+        // the writer (unaware of output written to its file descriptor) re-reads its position when seeking
+        if (NULL != buffer->fd_owner) {
+            BAIL_ON_NULL(fp_write_ret = PyObject_CallMethod(buffer->fd_owner, "seek", "ii", 0, 1));
+            Py_DECREF(fp_write_ret);
+        }
+        Py_RETURN_NONE;
+    }
     // shrink buffer to fit
     if (buffer->pos < buffer->len) {
         BAIL_ON_NONZERO(_PyBytes_Resize(&buffer->obj, buffer->pos));
         buffer->len = buffer->pos;
     }
-    if (NULL == buffer->fp_write) {
+    if (NULL != buffer->segments) {
+        if (buffer->pos > 0) {
+            BAIL_ON_NONZERO(PyList_Append(buffer->segments, buffer->obj));
+        }
+        Py_INCREF(buffer->segments);
+        return buffer->segments;
+    } else if (NULL == buffer->fp_write) {
         Py_INCREF(buffer->obj);
         return buffer->obj;
     } else {
@@ -236,284 +736,457 @@ bail:
 
 /******************************************************************************/
 
-static int _encode_PyBytes(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    const char *raw;
-    Py_ssize_t len;
-
-    raw = PyBytes_AS_STRING(obj);
-    len = PyBytes_GET_SIZE(obj);
+/* Returns new top frame for the given container (with items not set) or NULL on failure (exception set), including if
+ * obj is already being encoded (i.e. is a circular reference). Pointers to previously returned frames are invalidated
+ * by this call.
+ */
+static _bjdata_encoder_frame_t* _encoder_stack_push(_bjdata_encoder_buffer_t *buffer, PyObject *obj, int kind) {
+    _bjdata_encoder_frame_t *frame, *frames;
+    PyObject *ident = NULL;
+    Py_ssize_t capacity;
+    Py_ssize_t i;
+    int seen;
 
-    WRITE_OR_BAIL(bytes_array_prefix, sizeof(bytes_array_prefix));
-    BAIL_ON_NONZERO(_encode_longlong(len, buffer));
-    WRITE_OR_BAIL(raw, len);
-    // no ARRAY_END since length was specified
+    // circular reference check
+    for (i = (MIN(buffer->depth, CIRCULAR_SCAN_DEPTH)) - 1; i >= 0; i--) {
+        if (buffer->frames[i].obj == obj) {
+            PyErr_SetString(PyExc_ValueError, "Circular reference detected");
+            goto bail;
+        }
+    }
+    if (buffer->depth >= CIRCULAR_SCAN_DEPTH) {
+        if (NULL == buffer->markers) {
+            BAIL_ON_NULL(buffer->markers = PySet_New(NULL));
+        }
+        BAIL_ON_NULL(ident = PyLong_FromVoidPtr(obj));
+        if ((seen = PySet_Contains(buffer->markers, ident))) {
+            if (-1 != seen) {
+                PyErr_SetString(PyExc_ValueError, "Circular reference detected");
+            }
+            goto bail;
+        }
+    }
 
-    return 0;
+    if (buffer->depth == buffer->frames_capacity) {
+        capacity = (0 == buffer->frames_capacity) ? ENCODER_STACK_INITIAL_SIZE : 2 * buffer->frames_capacity;
+        if (NULL == (frames = PyMem_Resize(buffer->frames, _bjdata_encoder_frame_t, capacity))) {
+            PyErr_NoMemory();
+            goto bail;
+        }
+        buffer->frames = frames;
+        buffer->frames_capacity = capacity;
+    }
+    if (NULL != ident) {
+        BAIL_ON_NONZERO(PySet_Add(buffer->markers, ident));
+    }
+    frame = &buffer->frames[buffer->depth++];
+    Py_INCREF(obj);
+    frame->obj = obj;
+    frame->items = NULL;
+    frame->pos = 0;
+    frame->count = -1;
+    frame->count_offset = -1;
+    frame->ident = ident;
+    frame->kind = kind;
+    return frame;
 
 bail:
-    return 1;
+    Py_XDECREF(ident);
+    return NULL;
 }
 
-static int _encode_PyByteArray(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    const char *raw;
-    Py_ssize_t len;
+// Removes top frame, releasing any references it holds. Returns non-zero on failure (exception set).
+static int _encoder_stack_pop(_bjdata_encoder_buffer_t *buffer) {
+    _bjdata_encoder_frame_t *frame = &buffer->frames[--buffer->depth];
+    int ret = 0;
+
+    if (NULL != frame->ident) {
+        ret = (-1 == PySet_Discard(buffer->markers, frame->ident));
+        Py_DECREF(frame->ident);
+    }
+    Py_DECREF(frame->obj);
+    Py_XDECREF(frame->items);
+    return ret;
+}
 
-    raw = PyByteArray_AS_STRING(obj);
-    len = PyByteArray_GET_SIZE(obj);
+// Removes frames above the given depth following a failure (preserving the current exception)
+static void _encoder_stack_unwind(_bjdata_encoder_buffer_t *buffer, Py_ssize_t depth) {
+    PyObject *type, *value, *traceback;
+
+    PyErr_Fetch(&type, &value, &traceback);
+    while (buffer->depth > depth) {
+        if (_encoder_stack_pop(buffer)) {
+            PyErr_Clear();
+        }
+    }
+    PyErr_Restore(type, value, traceback);
+}
 
-    WRITE_OR_BAIL(bytes_array_prefix, sizeof(bytes_array_prefix));
-    BAIL_ON_NONZERO(_encode_longlong(len, buffer));
-    WRITE_OR_BAIL(raw, len);
-    // no ARRAY_END since length was specified
+/******************************************************************************/
 
+/* Imports the types with built-in handling (see _encoder_type_resolve) on first use, i.e. so that importing bjdata does
+ * not require importing all of their modules. Any which are not available are skipped.
+ */
+static int _encoder_import_builtin_types(void) {
+    static const char *names[][2] = {{"enum", "Enum"}, {"uuid", "UUID"}, {"pathlib", "PurePath"}};
+    PyObject **targets[] = {&EnumType, &UUIDType, &PurePathType};
+    PyObject *module;
+    PyObject *attr;
+    size_t i;
+
+    if (builtin_types_imported) {
+        return 0;
+    }
+    for (i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+        if (NULL == (module = PyImport_ImportModule(names[i][0]))) {
+            if (!PyErr_ExceptionMatches(PyExc_ImportError)) {
+                goto bail;
+            }
+            PyErr_Clear();
+            continue;
+        }
+        attr = PyObject_GetAttrString(module, names[i][1]);
+        Py_DECREF(module);
+        BAIL_ON_NULL(attr);
+        if (!PyType_Check(attr)) {
+            Py_DECREF(attr);
+            PyErr_Format(PyExc_ImportError, "%s.%s type import failure", names[i][0], names[i][1]);
+            goto bail;
+        }
+        Py_XDECREF(*targets[i]);
+        *targets[i] = attr;
+    }
+    builtin_types_imported = 1;
     return 0;
 
 bail:
     return 1;
 }
 
-/******************************************************************************/
+// Returns offset of the (object) slot with the given name in instances of type or -1 if name is not such a slot
+static Py_ssize_t _encoder_slot_offset(PyTypeObject *type, PyObject *name) {
+    PyObject *descr = _PyType_Lookup(type, name);
 
-static int _lookup_marker(npy_intp numpytypeid) {
-    int i, len = (sizeof(numpytypes) >> 3);
-    for(i = 0; i < len; i++){
-        if(numpytypeid == (npy_intp)numpytypes[i][0])
-            return numpytypes[i][1];
+    if (NULL != descr && Py_TYPE(descr) == &PyMemberDescr_Type &&
+        T_OBJECT_EX == ((PyMemberDescrObject*)descr)->d_member->type) {
+        return ((PyMemberDescrObject*)descr)->d_member->offset;
     }
     return -1;
 }
 
-static int _encode_NDarray(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    PyArrayObject *arr;
-    Py_INCREF(obj);
-    arr = (PyArrayObject *)PyArray_EnsureArray(obj);
-    BAIL_ON_NONZERO(arr == NULL);
+/* Returns new field spec of the given type (see ENCODER_FRAME_FIELDS), the field names being determined by source (one
+ * of FIELD_SOURCE_*). The spec is a tuple of (name, encoded key, slot offset or -1) tuples or, for a namedtuple, of (name,
+ * encoded key, item index) tuples, in field order or sorted by name if sort_keys is set. Specs are cached across calls,
+ * i.e. field names are only looked up & keys only encoded once per type (and prefs affecting the spec).
+ */
+static PyObject* _encoder_field_spec(_bjdata_encoder_buffer_t *buffer, PyTypeObject *type, int source) {
+    _bjdata_encoder_buffer_t *keys = NULL;
+    PyObject *variant = NULL;
+    PyObject *specs = NULL;
+    PyObject *names = NULL;
+    PyObject *fields = NULL;
+    PyObject *spec = NULL;
+    PyObject *name, *key, *field;
+    Py_ssize_t i;
+    Py_ssize_t count;
+
+    BAIL_ON_NULL(variant = PyLong_FromLong(source | (buffer->prefs.islittle ? 4 : 0) |
+                                           (DIALECT_UBJSON == buffer->prefs.dialect ? 8 : 0) |
+                                           (buffer->prefs.sort_keys ? 16 : 0)));
+    if (NULL != (specs = PyObject_GetItem(field_specs, (PyObject*)type))) {
+        if (NULL != (spec = PyDict_GetItem(specs, variant))) {
+            Py_INCREF(spec);
+            goto done;
+        }
+    } else {
+        if (!PyErr_ExceptionMatches(PyExc_KeyError)) {
+            goto bail;
+        }
+        PyErr_Clear();
+        BAIL_ON_NULL(specs = PyDict_New());
+        // not caching if type cannot be weakly referenced
+        if (PyObject_SetItem(field_specs, (PyObject*)type, specs)) {
+            if (!PyErr_ExceptionMatches(PyExc_TypeError)) {
+                goto bail;
+            }
+            PyErr_Clear();
+            Py_CLEAR(specs);
+        }
+    }
+
+    if (FIELD_SOURCE_NAMEDTUPLE == source) {
+        BAIL_ON_NULL(names = PyObject_GetAttrString((PyObject*)type, "_fields"));
+    } else {
+        BAIL_ON_NULL(names = PyObject_CallFunctionObjArgs(field_names, (PyObject*)type,
+                                                          (FIELD_SOURCE_SLOTS == source) ? Py_True : Py_False, NULL));
+    }
+    BAIL_ON_NULL(fields = PySequence_Fast(names, "field names must be a sequence"));
+    count = PySequence_Fast_GET_SIZE(fields);
+    BAIL_ON_NULL(spec = PyList_New(count));
+    BAIL_ON_NULL(keys = _bjdata_encoder_buffer_create(&buffer->prefs, NULL));
+    for (i = 0; i < count; i++) {
+        name = PySequence_Fast_GET_ITEM(fields, i);
+        keys->pos = 0;
+        BAIL_ON_NONZERO(_encoder_encode_key(name, keys));
+        BAIL_ON_NULL(key = PyBytes_FromStringAndSize(keys->raw, keys->pos));
+        field = Py_BuildValue("(ONn)", name, key,
+                              (FIELD_SOURCE_NAMEDTUPLE == source) ? i : _encoder_slot_offset(type, name));
+        BAIL_ON_NULL(field);
+        PyList_SET_ITEM(spec, i, field);
+    }
+    if (buffer->prefs.sort_keys) {
+        BAIL_ON_NONZERO(PyList_Sort(spec));
+    }
+    field = spec;
+    spec = PyList_AsTuple(field);
+    Py_DECREF(field);
+    BAIL_ON_NULL(spec);
+    if (NULL != specs) {
+        BAIL_ON_NONZERO(PyDict_SetItem(specs, variant, spec));
+    }
 
-    int ndim = PyArray_NDIM(arr);
-    int type = PyArray_TYPE(arr);
-    npy_intp bytes = PyArray_ITEMSIZE(arr);
+done:
+    _bjdata_encoder_buffer_free(&keys);
+    Py_XDECREF(variant);
+    Py_XDECREF(specs);
+    Py_XDECREF(names);
+    Py_XDECREF(fields);
+    return spec;
+
+bail:
+    Py_CLEAR(spec);
+    goto done;
+}
 
-    int marker = _lookup_marker(type);
+/* Returns new reference to the value of the given field (see _encoder_field_spec) of obj, kind being one of
+ * ENCODER_FRAME_FIELDS/NAMEDTUPLE. Returns NULL on failure (exception set).
+ */
+static PyObject* _encoder_field_value(PyObject *obj, PyObject *field, int kind) {
+    Py_ssize_t offset = PyLong_AsSsize_t(PyTuple_GET_ITEM(field, 2));
+    PyObject *value;
+
+    if (ENCODER_FRAME_NAMEDTUPLE == kind) {
+        if (offset >= PyTuple_GET_SIZE(obj)) {
+            PyErr_Format(PyExc_ValueError, "%s has fewer items than _fields", Py_TYPE(obj)->tp_name);
+            return NULL;
+        }
+        value = PyTuple_GET_ITEM(obj, offset);
+    } else if (offset < 0 || NULL == (value = *(PyObject**)((char*)obj + offset))) {
+        // not a slot (or unset, in which case this raises AttributeError)
+        return PyObject_GetAttr(obj, PyTuple_GET_ITEM(field, 0));
+    }
+    Py_INCREF(value);
+    return value;
+}
 
-    BAIL_ON_NONZERO(marker < 0)
-    if(ndim == 0){  /*scalar*/
-        WRITE_CHAR_OR_BAIL((char)marker);
-        if(marker == TYPE_STRING) {
-            _encode_longlong(bytes, buffer);
+/* Gets start, step & length of the given range. Returns 1 if it is not empty and its bounds fit into long long (i.e. it
+ * can be encoded as packed array), 0 if not or -1 on failure (exception set).
+ */
+static int _encoder_range_params(PyObject *obj, long long *start, long long *step, Py_ssize_t *count) {
+    static const char *names[] = {"start", "stop", "step"};
+    PyObject *attr;
+    long long values[3];
+    int i, overflow;
+
+    for (i = 0; i < 3; i++) {
+        BAIL_ON_NULL(attr = PyObject_GetAttrString(obj, names[i]));
+        values[i] = PyLong_AsLongLongAndOverflow(attr, &overflow);
+        Py_DECREF(attr);
+        if (overflow) {
+            return 0;
         }
-        WRITE_OR_BAIL(PyArray_BYTES(arr), bytes);
-        Py_DECREF(arr);
+        BAIL_ON_NONZERO(-1 == values[i] && PyErr_Occurred());
+    }
+    if (-1 == (*count = PyObject_Size(obj))) {
+        // more items than Py_ssize_t can hold (since bounds fit into long long, only on 32-bit platforms)
+        BAIL_ON_NONZERO(!PyErr_ExceptionMatches(PyExc_OverflowError));
+        PyErr_Clear();
         return 0;
     }
+    *start = values[0];
+    *step = values[2];
+    return (*count > 0);
 
-    npy_intp * dims = PyArray_DIMS(arr);
-    npy_intp total = PyArray_SIZE(arr);
+bail:
+    return -1;
+}
 
-    WRITE_CHAR_OR_BAIL(ARRAY_START);
-    WRITE_CHAR_OR_BAIL(CONTAINER_TYPE);
-    if(marker == TYPE_STRING) {
-        WRITE_CHAR_OR_BAIL(TYPE_CHAR);
-    } else {
-        WRITE_CHAR_OR_BAIL((char)marker);
-    }
-    WRITE_CHAR_OR_BAIL(CONTAINER_COUNT);
-    if(ndim == 1) {
-        BAIL_ON_NONZERO(_encode_longlong(bytes, buffer));
-    } else {
-        WRITE_CHAR_OR_BAIL(ARRAY_START);
-        for(int i=0 ; i<ndim; i++)
-            _encode_longlong(dims[i], buffer);
-        if(type == NPY_UNICODE)
-            _encode_longlong(4, buffer);
-        WRITE_CHAR_OR_BAIL(ARRAY_END);
-    }
-    WRITE_OR_BAIL(PyArray_BYTES(arr), bytes*total);
-    Py_DECREF(arr);
-    // no ARRAY_END since length was specified
+/* Writes a (fixed-width) placeholder count, storing its output offset in offset, for it to be set via
+ * _encoder_patch_count once known. Requires ENCODER_CAN_PATCH.
+ */
+static int _encoder_write_count_slot(_bjdata_encoder_buffer_t *buffer, long long *offset) {
+    char slot[10] = {CONTAINER_COUNT, TYPE_INT64};
 
+    *offset = buffer->flushed + (long long)buffer->pos;
+    // Note: a single write is never split when flushing, i.e. the slot is either still buffered or flushed entirely
+    WRITE_OR_BAIL(slot, sizeof(slot));
     return 0;
 
 bail:
     return 1;
 }
 
-/******************************************************************************/
-
-static int _encode_PyObject_as_PyDecimal(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    PyObject *decimal = NULL;
+static int _encoder_patch_count(_bjdata_encoder_buffer_t *buffer, long long offset, Py_ssize_t count) {
+    char slot[10] = {CONTAINER_COUNT, TYPE_INT64};
+    PyObject *chunk = NULL;
+    PyObject *ret;
+    unsigned long long value = (unsigned long long)count;
+    int i;
 
-    // Decimal class has no public C API
-    BAIL_ON_NULL(decimal =  PyObject_CallFunctionObjArgs((PyObject*)PyDec_Type, obj, NULL));
-    BAIL_ON_NONZERO(_encode_PyDecimal(decimal, buffer));
-    Py_DECREF(decimal);
+    for (i = 0; i < 8; i++) {
+        slot[2 + (buffer->prefs.islittle ? i : 7 - i)] = (char)(value >> (8 * i));
+    }
+    if (offset >= buffer->flushed) {
+        memcpy(&buffer->raw[offset - buffer->flushed], slot, sizeof(slot));
+        return 0;
+    }
+    // all output so far has to have reached the file before seeking it
+    BAIL_ON_NONZERO(_encoder_bg_wait(buffer));
+    BAIL_ON_NULL(chunk = PyBytes_FromStringAndSize(slot, sizeof(slot)));
+    BAIL_ON_NULL(ret = PyObject_CallMethod(buffer->fp, "seek", "L", buffer->fp_start + offset));
+    Py_DECREF(ret);
+    BAIL_ON_NULL(ret = PyObject_CallFunctionObjArgs(buffer->fp_write, chunk, NULL));
+    Py_DECREF(ret);
+    BAIL_ON_NULL(ret = PyObject_CallMethod(buffer->fp, "seek", "L", buffer->fp_start + buffer->flushed));
+    Py_DECREF(ret);
+    Py_DECREF(chunk);
     return 0;
 
 bail:
-    Py_XDECREF(decimal);
+    Py_XDECREF(chunk);
     return 1;
 }
 
-static int _encode_PyDecimal(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    PyObject *is_finite;
-    PyObject *str = NULL;
-    PyObject *encoded = NULL;
-    const char *raw;
-    Py_ssize_t len;
+/* Determines how values of the given type are encoded (see dump), storing the result in entry. Returns non-zero on
+ * failure (exception set).
+ */
+static int _encoder_type_resolve(_bjdata_encoder_buffer_t *buffer, PyTypeObject *type, _bjdata_encoder_type_t *entry) {
+    PyObject *mro = type->tp_mro;
+    PyObject *handler = NULL;
+    Py_ssize_t i;
+    int kind = ENCODER_TYPE_GENERIC;
 
-    // Decimal class has no public C API
-    BAIL_ON_NULL(is_finite = PyObject_CallMethod(obj, "is_finite", NULL));
+    // registered encoder for type or closest base
+    if (NULL != buffer->prefs.encoders && NULL != mro) {
+        for (i = 0; i < PyTuple_GET_SIZE(mro) && NULL == handler; i++) {
+            handler = PyDict_GetItem(buffer->prefs.encoders, PyTuple_GET_ITEM(mro, i));
+        }
+    }
 
-    if (Py_True == is_finite) {
-#if PY_MAJOR_VERSION >= 3
-        BAIL_ON_NULL(str = PyObject_Str(obj));
-#else
-        BAIL_ON_NULL(str = PyObject_Unicode(obj));
-#endif
-        BAIL_ON_NULL(encoded = PyUnicode_AsEncodedString(str, "utf-8", NULL));
-        raw = PyBytes_AS_STRING(encoded);
-        len = PyBytes_GET_SIZE(encoded);
-
-        WRITE_CHAR_OR_BAIL(TYPE_HIGH_PREC);
-        BAIL_ON_NONZERO(_encode_longlong(len, buffer));
-        WRITE_OR_BAIL(raw, len);
-        Py_DECREF(str);
-        Py_DECREF(encoded);
-    } else {
-        WRITE_CHAR_OR_BAIL(TYPE_NULL);
+    if (NULL != handler) {
+        if (namedtuple_as_object == handler && PyType_IsSubtype(type, &PyTuple_Type)) {
+            kind = ENCODER_TYPE_NAMEDTUPLE;
+            BAIL_ON_NULL(handler = _encoder_field_spec(buffer, type, FIELD_SOURCE_NAMEDTUPLE));
+        } else if (slots_as_object == handler) {
+            kind = ENCODER_TYPE_FIELDS;
+            BAIL_ON_NULL(handler = _encoder_field_spec(buffer, type, FIELD_SOURCE_SLOTS));
+        } else {
+            kind = ENCODER_TYPE_CALL;
+            Py_INCREF(handler);
+        }
+    } else if (NULL == buffer->prefs.default_func) {
+        // built-in encoders (see dump) only apply if default is not given, i.e. it still receives these types
+        BAIL_ON_NONZERO(_encoder_import_builtin_types());
+        if (PyObject_HasAttrString((PyObject*)type, "__dataclass_fields__") ||
+            PyObject_HasAttrString((PyObject*)type, "__attrs_attrs__")) {
+            kind = ENCODER_TYPE_FIELDS;
+            BAIL_ON_NULL(handler = _encoder_field_spec(buffer, type, FIELD_SOURCE_CLASS));
+        } else if (NULL != EnumType && PyType_IsSubtype(type, (PyTypeObject*)EnumType)) {
+            kind = ENCODER_TYPE_VALUE;
+        } else if ((NULL != UUIDType && PyType_IsSubtype(type, (PyTypeObject*)UUIDType)) ||
+                   (NULL != PurePathType && PyType_IsSubtype(type, (PyTypeObject*)PurePathType))) {
+            kind = ENCODER_TYPE_STR;
+        }
     }
 
-    Py_DECREF(is_finite);
+    Py_XDECREF(entry->type);
+    Py_XDECREF(entry->handler);
+    Py_INCREF(type);
+    entry->type = type;
+    entry->handler = handler;
+    entry->kind = kind;
     return 0;
 
 bail:
-    Py_XDECREF(is_finite);
-    Py_XDECREF(str);
-    Py_XDECREF(encoded);
     return 1;
 }
 
-/******************************************************************************/
-
-static int _encode_PyUnicode(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    PyObject *str;
-    const char *raw;
-    Py_ssize_t len;
-
-    BAIL_ON_NULL(str = PyUnicode_AsEncodedString(obj, "utf-8", NULL));
-    raw = PyBytes_AS_STRING(str);
-    len = PyBytes_GET_SIZE(str);
+/* Returns cache entry (borrowed, valid until the next lookup) describing how values of the given type are to be
+ * encoded or NULL on failure (exception set). Note: Entries are only replaced on collision, i.e. the same type is only
+ * resolved (which can be relatively expensive) once per call.
+ */
+static _bjdata_encoder_type_t* _encoder_type_lookup(_bjdata_encoder_buffer_t *buffer, PyTypeObject *type) {
+    _bjdata_encoder_type_t *entry = &buffer->types[((size_t)type >> 5) % ENCODER_TYPE_CACHE_SIZE];
 
-    if (1 == len) {
-        WRITE_CHAR_OR_BAIL(TYPE_CHAR);
-    } else {
-        WRITE_CHAR_OR_BAIL(TYPE_STRING);
-        BAIL_ON_NONZERO(_encode_longlong(len, buffer));
+    if (entry->type != type) {
+        BAIL_ON_NONZERO(_encoder_type_resolve(buffer, type, entry));
     }
-    WRITE_OR_BAIL(raw, len);
-    Py_DECREF(str);
-    return 0;
+    return entry;
 
 bail:
-    Py_XDECREF(str);
-    return 1;
+    return NULL;
 }
 
 /******************************************************************************/
 
-static int _encode_PyFloat(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    char numtmp[9]; // holds type char + float32/64
-    double abs;
-    double num = PyFloat_AsDouble(obj);
-
-    if (-1.0 == num && PyErr_Occurred()) {
+// Writes the (already encoded) data of a RawBJData instance as-is, if it was encoded with the same byte order & dialect
+static int _encode_RawBJData(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    PyObject *data = NULL;
+    PyObject *tmp = NULL;
+    PyObject *dialect = NULL;
+    int islittle;
+    int matches;
+    Py_buffer view;
+
+    BAIL_ON_NULL(tmp = PyObject_GetAttrString(obj, "islittle"));
+    BAIL_ON_NEGATIVE(islittle = PyObject_IsTrue(tmp));
+    Py_CLEAR(tmp);
+    BAIL_ON_NULL(tmp = PyObject_GetAttrString(obj, "dialect"));
+    BAIL_ON_NULL(dialect = PyUnicode_FromString(DIALECT_UBJSON == buffer->prefs.dialect ? "ubjson" : "bjdata"));
+    BAIL_ON_NEGATIVE(matches = PyObject_RichCompareBool(tmp, dialect, Py_EQ));
+    Py_CLEAR(tmp);
+    Py_CLEAR(dialect);
+    if (!matches || islittle != (0 != buffer->prefs.islittle)) {
+        PyErr_SetString(EncoderException, "RawBJData was encoded with a different dialect or byte order (islittle)");
         goto bail;
     }
 
-#ifndef USE__BJDATA
-
-#ifdef USE__FPCLASS
-    switch (_fpclass(num)) {
-        case _FPCLASS_SNAN:
-        case _FPCLASS_QNAN:
-        case _FPCLASS_NINF:
-        case _FPCLASS_PINF:
-#else
-    switch (fpclassify(num)) {
-        case FP_NAN:
-        case FP_INFINITE:
-#endif
-            WRITE_CHAR_OR_BAIL(TYPE_NULL);
-            return 0;
-#ifdef USE__FPCLASS
-        case _FPCLASS_NZ:
-        case _FPCLASS_PZ:
-#else
-        case FP_ZERO:
-#endif
-            BAIL_ON_NONZERO(_pyfuncs_ubj_PyFloat_Pack4(num, (unsigned char*)&numtmp[1], buffer->prefs.islittle));
-            numtmp[0] = TYPE_FLOAT32;
-            WRITE_OR_BAIL(numtmp, 5);
-            return 0;
-#ifdef USE__FPCLASS
-        case _FPCLASS_ND:
-        case _FPCLASS_PD:
-#else
-        case FP_SUBNORMAL:
-#endif
-            BAIL_ON_NONZERO(_encode_PyObject_as_PyDecimal(obj, buffer));
-            return 0;
-    }
-
-
-#else /*USE__BJDATA*/
-
-
-#ifdef USE__FPCLASS
-    switch (_fpclass(num)) {
-#else
-    switch (fpclassify(num)) {
-#endif
-
-#ifdef USE__FPCLASS
-        case _FPCLASS_NZ:
-        case _FPCLASS_PZ:
-#else
-        case FP_ZERO:
-#endif
-            BAIL_ON_NONZERO(_pyfuncs_ubj_PyFloat_Pack4(num, (unsigned char*)&numtmp[1], buffer->prefs.islittle));
-            numtmp[0] = TYPE_FLOAT32;
-            WRITE_OR_BAIL(numtmp, 5);
-            return 0;
-#ifdef USE__FPCLASS
-        case _FPCLASS_ND:
-        case _FPCLASS_PD:
-#else
-        case FP_SUBNORMAL:
-#endif
-            BAIL_ON_NONZERO(_encode_PyObject_as_PyDecimal(obj, buffer));
-            return 0;
+    BAIL_ON_NULL(data = PyObject_GetAttrString(obj, "data"));
+    // contents were validated on construction
+    if (PyBytes_CheckExact(data)) {
+        BAIL_ON_NONZERO(_encoder_buffer_write(buffer, PyBytes_AS_STRING(data), (size_t)PyBytes_GET_SIZE(data)));
+        Py_DECREF(data);
+        return 0;
     }
-
-#endif
-
-    abs = fabs(num);
-    if (!buffer->prefs.no_float32 && 1.18e-38 <= abs && 3.4e38 >= abs) {
-        BAIL_ON_NONZERO(_pyfuncs_ubj_PyFloat_Pack4(num, (unsigned char*)&numtmp[1], buffer->prefs.islittle));
-        numtmp[0] = TYPE_FLOAT32;
-        WRITE_OR_BAIL(numtmp, 5);
-    } else {
-        BAIL_ON_NONZERO(_pyfuncs_ubj_PyFloat_Pack8(num, (unsigned char*)&numtmp[1], buffer->prefs.islittle));
-        numtmp[0] = TYPE_FLOAT64;
-        WRITE_OR_BAIL(numtmp, 9);
+    BAIL_ON_NONZERO(PyObject_GetBuffer(data, &view, PyBUF_SIMPLE));
+    if (_encoder_buffer_write(buffer, view.buf, (size_t)view.len)) {
+        PyBuffer_Release(&view);
+        goto bail;
     }
+    PyBuffer_Release(&view);
+    Py_DECREF(data);
     return 0;
 
 bail:
+    Py_XDECREF(tmp);
+    Py_XDECREF(dialect);
+    Py_XDECREF(data);
     return 1;
 }
 
 /******************************************************************************/
 
+static int _lookup_marker(npy_intp numpytypeid) {
+    int i, len = (sizeof(numpytypes) >> 3);
+    for(i = 0; i < len; i++){
+        if(numpytypeid == (npy_intp)numpytypes[i][0])
+            return numpytypes[i][1];
+    }
+    return -1;
+}
+
+/******************************************************************************/
+
 #define WRITE_TYPE_AND_INT8_OR_BAIL(c1, c2) {\
     numtmp[0] = c1;\
     numtmp[1] = (char)c2;\
@@ -551,8 +1224,6 @@ bail:
     WRITE_OR_BAIL(numtmp, 9);\
 }
 
-#ifdef USE__BJDATA
-
 #define WRITE_UINT16_OR_BAIL(num) {\
     WRITE_INT_INTO_NUMTMP(num, 2);\
     numtmp[0] = TYPE_UINT16;\
@@ -569,293 +1240,36 @@ bail:
     WRITE_OR_BAIL(numtmp, 9);\
 }
 
-#endif
-
-
-static int _encode_longlong(long long num, _bjdata_encoder_buffer_t *buffer) {
-    char numtmp[9]; // large enough to hold type + maximum integer (INT64)
-    int islittle=(buffer->prefs.islittle);
-
-#ifdef USE__BJDATA
-    if (num >= 0) {
-        if (num < POWER_TWO(8)) {
-            WRITE_TYPE_AND_INT8_OR_BAIL(TYPE_UINT8, num);
-        } else if (num < POWER_TWO(16)) {
-            WRITE_UINT16_OR_BAIL(num);
-        } else if (num < POWER_TWO(32)) {
-            WRITE_UINT32_OR_BAIL(num);
-        } else {
-            WRITE_UINT64_OR_BAIL(num);
-        }
-#else
-    if (num >= 0) {
-        if (num < POWER_TWO(8)) {
-            WRITE_TYPE_AND_INT8_OR_BAIL(TYPE_UINT8, num);
-        } else if (num < POWER_TWO(15)) {
-            WRITE_INT16_OR_BAIL(num);
-        } else if (num < POWER_TWO(31)) {
-            WRITE_INT32_OR_BAIL(num);
-        } else {
-            WRITE_INT64_OR_BAIL(num);
-        }
-#endif
-    } else if (num >= -(POWER_TWO(7))) {
-        WRITE_TYPE_AND_INT8_OR_BAIL(TYPE_INT8, num);
-    } else if (num >= -(POWER_TWO(15))) {
-        WRITE_INT16_OR_BAIL(num);
-    } else if (num >= -(POWER_TWO(31))) {
-        WRITE_INT32_OR_BAIL(num);
-    } else {
-        WRITE_INT64_OR_BAIL(num);
-    }
-    return 0;
-
-bail:
-    return 1;
-}
-
-static int _encode_PyLong(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    int overflow;
-    long long num = PyLong_AsLongLongAndOverflow(obj, &overflow);
-
-    if (overflow) {
-        char numtmp[9]; // large enough to hold type + maximum integer (INT64)
-        unsigned long long unum = PyLong_AsUnsignedLongLong(obj);
-        int islittle=(buffer->prefs.islittle);
-        if(PyErr_Occurred()){
-	    PyErr_Clear();
-            BAIL_ON_NONZERO(_encode_PyObject_as_PyDecimal(obj, buffer));
-	}else{
-	    WRITE_UINT64_OR_BAIL(unum);
-	}
-        return 0;
-    } else if (num == -1 && PyErr_Occurred()) {
-        // unexpected as PyLong should fit if not overflowing
-        goto bail;
-    } else {
-        return _encode_longlong(num, buffer);
-    }
-
-bail:
-    return 1;
-}
-
-#if PY_MAJOR_VERSION < 3
-static int _encode_PyInt(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    long num = PyInt_AsLong(obj);
-
-    if (num == -1 && PyErr_Occurred()) {
-        // unexpected as PyInt should fit into long
-        return 1;
-    } else {
-        return _encode_longlong(num, buffer);
-    }
-}
-#endif
 
 /******************************************************************************/
 
-static int _encode_PySequence(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    PyObject *ident;        // id of sequence (for checking circular reference)
-    PyObject *seq = NULL;   // converted sequence (via PySequence_Fast)
-    Py_ssize_t len;
-    Py_ssize_t i;
-    int seen;
-
-    // circular reference check
-    BAIL_ON_NULL(ident = PyLong_FromVoidPtr(obj));
-    if ((seen = PySet_Contains(buffer->markers, ident))) {
-        if (-1 != seen) {
-            PyErr_SetString(PyExc_ValueError, "Circular reference detected");
-        }
-        goto bail;
-    }
-    BAIL_ON_NONZERO(PySet_Add(buffer->markers, ident));
-
-    BAIL_ON_NULL(seq = PySequence_Fast(obj, "_encode_PySequence expects sequence"));
-    len = PySequence_Fast_GET_SIZE(seq);
-
-    WRITE_CHAR_OR_BAIL(ARRAY_START);
-    if (buffer->prefs.container_count) {
-        WRITE_CHAR_OR_BAIL(CONTAINER_COUNT);
-        BAIL_ON_NONZERO(_encode_longlong(len, buffer));
-    }
-
-    for (i = 0; i < len; i++) {
-        BAIL_ON_NONZERO(_bjdata_encode_value(PySequence_Fast_GET_ITEM(seq, i), buffer));
-    }
-
-    if (!buffer->prefs.container_count) {
-        WRITE_CHAR_OR_BAIL(ARRAY_END);
-    }
-
-    if (-1 == PySet_Discard(buffer->markers, ident)) {
-        goto bail;
-    }
-    Py_DECREF(ident);
-    Py_DECREF(seq);
-    return 0;
-
-bail:
-    Py_XDECREF(ident);
-    Py_XDECREF(seq);
-    return 1;
-}
-
-/******************************************************************************/
-
-static int _encode_mapping_key(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    PyObject *str = NULL;
-    const char *raw;
-    Py_ssize_t len;
-
-    if (PyUnicode_Check(obj)) {
-        BAIL_ON_NULL(str = PyUnicode_AsEncodedString(obj, "utf-8", NULL));
-    }
-#if PY_MAJOR_VERSION < 3
-    else if (PyString_Check(obj)) {
-        BAIL_ON_NULL(str = PyString_AsEncodedObject(obj, "utf-8", NULL));
-    }
-#endif
-    else {
-        PyErr_SetString(EncoderException, "Mapping keys can only be strings");
-        goto bail;
-    }
-
-    raw = PyBytes_AS_STRING(str);
-    len = PyBytes_GET_SIZE(str);
-    BAIL_ON_NONZERO(_encode_longlong(len, buffer));
-    WRITE_OR_BAIL(raw, len);
-    Py_DECREF(str);
-    return 0;
-
-bail:
-    Py_XDECREF(str);
-    return 1;
-}
-
-static int _encode_PyMapping(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    PyObject *ident; // id of sequence (for checking circular reference)
-    PyObject *items = NULL;
-    PyObject *iter = NULL;
-    PyObject *item = NULL;
-    int seen;
-
-    // circular reference check
-    BAIL_ON_NULL(ident = PyLong_FromVoidPtr(obj));
-    if ((seen = PySet_Contains(buffer->markers, ident))) {
-        if (-1 != seen) {
-            PyErr_SetString(PyExc_ValueError, "Circular reference detected");
-        }
-        goto bail;
-    }
-    BAIL_ON_NONZERO(PySet_Add(buffer->markers, ident));
-
-    BAIL_ON_NULL(items = PyMapping_Items(obj));
-    if (buffer->prefs.sort_keys) {
-        BAIL_ON_NONZERO(PyList_Sort(items));
-    }
-
-    WRITE_CHAR_OR_BAIL(OBJECT_START);
-    if (buffer->prefs.container_count) {
-        WRITE_CHAR_OR_BAIL(CONTAINER_COUNT);
-        _encode_longlong(PyList_GET_SIZE(items), buffer);
-    }
-
-    BAIL_ON_NULL(iter = PyObject_GetIter(items));
-    while (NULL != (item = PyIter_Next(iter))) {
-        if (!PyTuple_Check(item) || 2 != PyTuple_GET_SIZE(item)) {
-            PyErr_SetString(PyExc_ValueError, "items must return 2-tuples");
-            goto bail;
-        }
-        BAIL_ON_NONZERO(_encode_mapping_key(PyTuple_GET_ITEM(item, 0), buffer));
-        BAIL_ON_NONZERO(_bjdata_encode_value(PyTuple_GET_ITEM(item, 1), buffer));
-        Py_CLEAR(item);
-    }
-    // for PyIter_Next
-    if (PyErr_Occurred()) {
-        goto bail;
-    }
-
-    if (!buffer->prefs.container_count) {
-        WRITE_CHAR_OR_BAIL(OBJECT_END);
-    }
+/* The value encoding functions are compiled once per dialect from encoder_dialect.h, i.e. dialect differences are
+ * resolved at compile time rather than for every encoded value.
+ */
+#define DIALECT DIALECT_BJDATA
+#define DIALECT_SUFFIX bjd
+#include "encoder_dialect.h"
+#undef DIALECT
+#undef DIALECT_SUFFIX
+
+#define DIALECT DIALECT_UBJSON
+#define DIALECT_SUFFIX ubj
+#include "encoder_dialect.h"
+#undef DIALECT
+#undef DIALECT_SUFFIX
 
-    if (-1 == PySet_Discard(buffer->markers, ident)) {
-        goto bail;
+int _bjdata_encode_value(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    if (DIALECT_UBJSON == buffer->prefs.dialect) {
+        return _encode_value_ubj(obj, buffer);
     }
-    Py_DECREF(iter);
-    Py_DECREF(items);
-    Py_DECREF(ident);
-    return 0;
-
-bail:
-    Py_XDECREF(item);
-    Py_XDECREF(iter);
-    Py_XDECREF(items);
-    Py_XDECREF(ident);
-    return 1;
+    return _encode_value_bjd(obj, buffer);
 }
 
-/******************************************************************************/
-
-int _bjdata_encode_value(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
-    PyObject *newobj = NULL; // result of default call (when encoding unsupported types)
-
-    if (Py_None == obj) {
-        WRITE_CHAR_OR_BAIL(TYPE_NULL);
-    } else if (Py_True == obj) {
-        WRITE_CHAR_OR_BAIL(TYPE_BOOL_TRUE);
-    } else if (Py_False == obj) {
-        WRITE_CHAR_OR_BAIL(TYPE_BOOL_FALSE);
-    } else if (PyUnicode_Check(obj)) {
-        BAIL_ON_NONZERO(_encode_PyUnicode(obj, buffer));
-#if PY_MAJOR_VERSION < 3
-    } else if (PyInt_Check(obj) && Py_TYPE(obj)!=NULL && strstr(Py_TYPE(obj)->tp_name, "numpy")==NULL) {
-        BAIL_ON_NONZERO(_encode_PyInt(obj, buffer));
-#endif
-    } else if (PyLong_Check(obj)) {
-        BAIL_ON_NONZERO(_encode_PyLong(obj, buffer));
-    } else if (PyFloat_Check(obj)) {
-        BAIL_ON_NONZERO(_encode_PyFloat(obj, buffer));
-    } else if (PyDec_Check(obj)) {
-        BAIL_ON_NONZERO(_encode_PyDecimal(obj, buffer));
-    } else if (PyBytes_Check(obj)) {
-        BAIL_ON_NONZERO(_encode_PyBytes(obj, buffer));
-    } else if (PyByteArray_Check(obj)) {
-        BAIL_ON_NONZERO(_encode_PyByteArray(obj, buffer));
-    } else if (PyArray_CheckAnyScalar(obj)) {
-        RECURSE_AND_BAIL_ON_NONZERO(_encode_NDarray(obj, buffer), " while encoding a Numpy scalar");
-    } else if (PySequence_Check(obj)) {
-        if (PyArray_CheckExact(obj)) {
-            RECURSE_AND_BAIL_ON_NONZERO(_encode_NDarray(obj, buffer), " while encoding a Numpy ndarray");
-        } else {
-            RECURSE_AND_BAIL_ON_NONZERO(_encode_PySequence(obj, buffer), " while encoding an array");
-        }
-    // order important since Mapping could also be Sequence
-    } else if (PyMapping_Check(obj)
-    // Unfortunately PyMapping_Check is no longer enough, see https://bugs.python.org/issue5945
-#if PY_MAJOR_VERSION >= 3
-               && PyObject_HasAttrString(obj, "items")
-#endif
-    ) {
-        RECURSE_AND_BAIL_ON_NONZERO(_encode_PyMapping(obj, buffer), " while encoding an object");
-    } else if (NULL == obj) {
-        PyErr_SetString(PyExc_RuntimeError, "Internal error - _bjdata_encode_value got NULL obj");
-        goto bail;
-    } else if (NULL != buffer->prefs.default_func) {
-        BAIL_ON_NULL(newobj = PyObject_CallFunctionObjArgs(buffer->prefs.default_func, obj, NULL));
-        RECURSE_AND_BAIL_ON_NONZERO(_bjdata_encode_value(newobj, buffer), " while encoding with default function");
-        Py_DECREF(newobj);
-    } else {
-        PyErr_Format(EncoderException, "Cannot encode item of type %s", obj->ob_type->tp_name);
-        goto bail;
+static int _encoder_encode_key(PyObject *key, _bjdata_encoder_buffer_t *buffer) {
+    if (DIALECT_UBJSON == buffer->prefs.dialect) {
+        return _encode_mapping_key_ubj(key, buffer);
     }
-    return 0;
-
-bail:
-    Py_XDECREF(newobj);
-    return 1;
+    return _encode_mapping_key_bjd(key, buffer);
 }
 
 int _bjdata_encoder_init(void) {
@@ -865,9 +1279,28 @@ int _bjdata_encoder_init(void) {
     // try to determine floating point format / endianess
     _pyfuncs_ubj_detect_formats();
 
-    // allow encoder to access EncoderException & Decimal class
+    // allow encoder to access EncoderException, field encoding helpers, RawBJData & Decimal class
     BAIL_ON_NULL(tmp_module = PyImport_ImportModule("bjdata.encoder"));
     BAIL_ON_NULL(EncoderException = PyObject_GetAttrString(tmp_module, "EncoderException"));
+    BAIL_ON_NULL(namedtuple_as_object = PyObject_GetAttrString(tmp_module, "namedtuple_as_object"));
+    BAIL_ON_NULL(slots_as_object = PyObject_GetAttrString(tmp_module, "slots_as_object"));
+    BAIL_ON_NULL(field_names = PyObject_GetAttrString(tmp_module, "_field_names"));
+    Py_CLEAR(tmp_module);
+
+    BAIL_ON_NULL(tmp_module = PyImport_ImportModule("weakref"));
+    BAIL_ON_NULL(tmp_obj = PyObject_GetAttrString(tmp_module, "WeakKeyDictionary"));
+    BAIL_ON_NULL(field_specs = PyObject_CallObject(tmp_obj, NULL));
+    Py_CLEAR(tmp_obj);
+    Py_CLEAR(tmp_module);
+
+    BAIL_ON_NULL(tmp_module = PyImport_ImportModule("bjdata.raw"));
+    BAIL_ON_NULL(tmp_obj = PyObject_GetAttrString(tmp_module, "RawBJData"));
+    if (!PyType_Check(tmp_obj)) {
+        PyErr_SetString(PyExc_ImportError, "bjdata.raw.RawBJData type import failure");
+        goto bail;
+    }
+    RawBJData_Type = (PyTypeObject*) tmp_obj;
+    tmp_obj = NULL;
     Py_CLEAR(tmp_module);
 
     BAIL_ON_NULL(tmp_module = PyImport_ImportModule("decimal"));
@@ -877,13 +1310,26 @@ int _bjdata_encoder_init(void) {
         goto bail;
     }
     PyDec_Type = (PyTypeObject*) tmp_obj;
+    tmp_obj = NULL;
+    Py_CLEAR(tmp_module);
+
+    BAIL_ON_NULL(tmp_module = PyImport_ImportModule("io"));
+    BAIL_ON_NULL(FileIOType = PyObject_GetAttrString(tmp_module, "FileIO"));
+    BAIL_ON_NULL(BufferedWriterType = PyObject_GetAttrString(tmp_module, "BufferedWriter"));
     Py_CLEAR(tmp_module);
 
     return 0;
 
 bail:
     Py_CLEAR(EncoderException);
+    Py_CLEAR(namedtuple_as_object);
+    Py_CLEAR(slots_as_object);
+    Py_CLEAR(field_names);
+    Py_CLEAR(field_specs);
+    Py_CLEAR(RawBJData_Type);
     Py_CLEAR(PyDec_Type);
+    Py_CLEAR(FileIOType);
+    Py_CLEAR(BufferedWriterType);
     Py_XDECREF(tmp_obj);
     Py_XDECREF(tmp_module);
     return 1;
@@ -892,5 +1338,16 @@ bail:
 
 void _bjdata_encoder_cleanup(void) {
     Py_CLEAR(EncoderException);
+    Py_CLEAR(namedtuple_as_object);
+    Py_CLEAR(slots_as_object);
+    Py_CLEAR(field_names);
+    Py_CLEAR(field_specs);
+    Py_CLEAR(RawBJData_Type);
     Py_CLEAR(PyDec_Type);
+    Py_CLEAR(EnumType);
+    Py_CLEAR(UUIDType);
+    Py_CLEAR(PurePathType);
+    Py_CLEAR(FileIOType);
+    Py_CLEAR(BufferedWriterType);
+    builtin_types_imported = 0;
 }
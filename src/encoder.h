@@ -27,12 +27,104 @@ extern "C" {
 
 typedef struct {
     PyObject *default_func;
+    // dict of type to callable (see dump), NULL if not set
+    PyObject *encoders;
     int container_count;
     int sort_keys;
     int no_float32;
     int islittle;
+    // one of DIALECT_*
+    int dialect;
+    // write mappings whose values all share one numeric type as typed objects (see _typed_object_type)
+    int typed_objects;
+    // if greater than one, payloads of packed arrays are aligned to multiples of this (see _encode_alignment)
+    int align;
+    // if not NULL, called with the payloads of large numpy arrays instead of writing them (see _encode_out_of_band)
+    PyObject *buffer_callback;
+    // write output to a file descriptor from a separate thread while encoding continues (see _encoder_bg_submit)
+    int background_write;
 } _bjdata_encoder_prefs_t;
 
+// What a frame's items are (see _bjdata_encoder_frame_t)
+enum {
+    // items of a list or tuple (accessed directly)
+    ENCODER_FRAME_SEQUENCE = 0,
+    // iterator over the items of any other sequence or of an iterator (e.g. generator) itself, i.e. also an array
+    ENCODER_FRAME_ITERATOR,
+    // list of (key, value) tuples of a mapping
+    ENCODER_FRAME_MAPPING,
+    // field spec (see _encoder_field_spec in encoder.c) of an object whose fields are attributes
+    ENCODER_FRAME_FIELDS,
+    // field spec of a namedtuple
+    ENCODER_FRAME_NAMEDTUPLE
+};
+
+// A sequence, mapping or object with fields being encoded (see _encode_value in encoder_dialect.h)
+typedef struct {
+    // the container itself (for detecting a circular reference)
+    PyObject *obj;
+    // see ENCODER_FRAME_*
+    PyObject *items;
+    // index of next item to encode
+    Py_ssize_t pos;
+    // number of items written as count of an ENCODER_FRAME_ITERATOR (container_count only), otherwise -1
+    Py_ssize_t count;
+    // output offset of the count slot to patch once an ENCODER_FRAME_ITERATOR (of unknown length) has been exhausted
+    // (see _encoder_write_count_slot in encoder.c), otherwise -1
+    long long count_offset;
+    // id of obj if also stored in markers (see _encoder_stack_push), otherwise NULL
+    PyObject *ident;
+    // one of ENCODER_FRAME_*
+    int kind;
+} _bjdata_encoder_frame_t;
+
+// How values of a type are encoded (see _encoder_type_lookup in encoder.c)
+enum {
+    // via the generic chain of type checks (see _encode_item in encoder_dialect.h)
+    ENCODER_TYPE_GENERIC = 0,
+    // by encoding the result of calling handler (from encoders) instead
+    ENCODER_TYPE_CALL,
+    // as object (dataclass, attrs or __slots__ class), handler being the field spec (see ENCODER_FRAME_FIELDS)
+    ENCODER_TYPE_FIELDS,
+    // as object (namedtuple), handler being the field spec (see ENCODER_FRAME_NAMEDTUPLE)
+    ENCODER_TYPE_NAMEDTUPLE,
+    // by encoding the value attribute instead (Enum)
+    ENCODER_TYPE_VALUE,
+    // as string via str() (UUID, PurePath)
+    ENCODER_TYPE_STR
+};
+
+// Exact types which are never looked up in encoders (see dump), i.e. always encoded via the generic chain
+#define ENCODER_TYPE_IS_PLAIN(t) ((t) == &PyUnicode_Type || (t) == &PyLong_Type || (t) == &PyFloat_Type ||\
+                                  (t) == &PyList_Type || (t) == &PyDict_Type || (t) == &PyTuple_Type ||\
+                                  (t) == &PyBool_Type || (t) == Py_TYPE(Py_None) || (t) == &PyBytes_Type ||\
+                                  (t) == &PyByteArray_Type)
+
+// number of entries in the (direct-mapped) cache of types looked up, per encoder buffer
+#define ENCODER_TYPE_CACHE_SIZE 16
+
+typedef struct {
+    // type (new reference), NULL if entry unused
+    PyTypeObject *type;
+    // see ENCODER_TYPE_* (new reference or NULL)
+    PyObject *handler;
+    int kind;
+} _bjdata_encoder_type_t;
+
+// State shared with the thread writing output to the file descriptor in the background (see _encoder_bg_start)
+typedef struct {
+    // acquired by the thread to wait for a chunk, released to hand one over (or to make it exit, if stop is set)
+    PyThread_type_lock work;
+    // acquired before handing over a chunk, released by the thread once written (or when exiting)
+    PyThread_type_lock idle;
+    const char *chunk;
+    size_t chunk_len;
+    int fd;
+    // errno of the first failed write (after which nothing more is written), otherwise zero
+    int error;
+    int stop;
+} _bjdata_encoder_bg_t;
+
 typedef struct {
     // holds PyBytes instance (buffer)
     PyObject *obj;
@@ -42,14 +134,43 @@ typedef struct {
     size_t pos;
     // if not NULL, full buffer will be written to this method
     PyObject *fp_write;
-    // PySet of sequences and mappings for detecting a circular reference
+    // file object fp_write belongs to if seekable (and container_count or align set), otherwise NULL
+    PyObject *fp;
+    // file descriptor output is written to instead of via fp_write (see _bjdata_encoder_buffer_set_fd), otherwise -1
+    int fd;
+    // (seekable) io.BufferedWriter fd belongs to, to resynchronise the position of once written, otherwise NULL
+    PyObject *fd_owner;
+    /* if prefs.background_write, buffer which the output (obj) is swapped with when written to fd. Its contents are
+     * written by the background writer (bg, started on first use) while obj is being filled.
+     */
+    PyObject *bg_obj;
+    _bjdata_encoder_bg_t *bg;
+    // whether bg is writing (or has written but not yet been waited for, see _encoder_bg_wait)
+    int bg_pending;
+    // if not NULL (dumpb_iov), list of output segments written so far: large payloads as memoryviews, rest as bytes
+    PyObject *segments;
+    // position of fp before encoding and number of bytes written to fp_write (or segments) so far, i.e. output offset
+    // of raw[0]
+    long long fp_start;
+    long long flushed;
+    // containers currently being encoded, outermost first
+    _bjdata_encoder_frame_t *frames;
+    Py_ssize_t depth;
+    Py_ssize_t frames_capacity;
+    // PySet of ids of containers nested too deeply to be checked by scanning frames (created on first use)
     PyObject *markers;
+    // number of payloads passed to buffer_callback so far
+    long long buffer_count;
+    _bjdata_encoder_type_t types[ENCODER_TYPE_CACHE_SIZE];
     _bjdata_encoder_prefs_t prefs;
 } _bjdata_encoder_buffer_t;
 
 /******************************************************************************/
 
 extern _bjdata_encoder_buffer_t* _bjdata_encoder_buffer_create(_bjdata_encoder_prefs_t* prefs, PyObject *fp_write);
+extern int _bjdata_encoder_buffer_set_segments(_bjdata_encoder_buffer_t *buffer);
+extern int _bjdata_encoder_buffer_set_fp(_bjdata_encoder_buffer_t *buffer, PyObject *fp);
+extern int _bjdata_encoder_buffer_set_fd(_bjdata_encoder_buffer_t *buffer, PyObject *fp);
 extern void _bjdata_encoder_buffer_free(_bjdata_encoder_buffer_t **buffer);
 extern PyObject* _bjdata_encoder_buffer_finalise(_bjdata_encoder_buffer_t *buffer);
 extern int _bjdata_encode_value(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
@@ -0,0 +1,1232 @@
+/*
+ * Copyright (c) 2020-2022 Qianqian Fang <q.fang at neu.edu>. All rights reserved.
+ * Copyright (c) 2016-2019 Iotic Labs Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://github.com/NeuroJSON/pybj/blob/master/LICENSE
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Dialect-specific part of the encoder. NOT a regular header: encoder.c includes this file once per dialect with
+ * DIALECT (DIALECT_BJDATA or DIALECT_UBJSON) and DIALECT_SUFFIX defined, so that each dialect gets its own copy of the
+ * encoding functions (with dialect checks resolved at compile time). Functions are renamed via DIALECT_FUNC below,
+ * e.g. _encode_value becomes _encode_value_bjd / _encode_value_ubj.
+ */
+
+#if !defined(DIALECT) || !defined(DIALECT_SUFFIX)
+#   error "DIALECT and DIALECT_SUFFIX must be defined before including encoder_dialect.h"
+#endif
+
+#define _encode_PyBytes DIALECT_FUNC(_encode_PyBytes)
+#define _encode_PyByteArray DIALECT_FUNC(_encode_PyByteArray)
+#define _encode_NDarray DIALECT_FUNC(_encode_NDarray)
+#define _ndarray_header_size DIALECT_FUNC(_ndarray_header_size)
+#define _encode_out_of_band DIALECT_FUNC(_encode_out_of_band)
+#define _encode_PyObject_as_PyDecimal DIALECT_FUNC(_encode_PyObject_as_PyDecimal)
+#define _encode_PyDecimal DIALECT_FUNC(_encode_PyDecimal)
+#define _encode_PyUnicode DIALECT_FUNC(_encode_PyUnicode)
+#define _encode_PyFloat DIALECT_FUNC(_encode_PyFloat)
+#define _encode_longlong DIALECT_FUNC(_encode_longlong)
+#define _encoded_int_size DIALECT_FUNC(_encoded_int_size)
+#define _encode_PyLong DIALECT_FUNC(_encode_PyLong)
+#define _encode_PyInt DIALECT_FUNC(_encode_PyInt)
+#define _encode_PyRange DIALECT_FUNC(_encode_PyRange)
+#define _begin_PySequence DIALECT_FUNC(_begin_PySequence)
+#define _encode_mapping_key DIALECT_FUNC(_encode_mapping_key)
+#define _typed_object_type DIALECT_FUNC(_typed_object_type)
+#define _encode_typed_object DIALECT_FUNC(_encode_typed_object)
+#define _encode_typed_fields DIALECT_FUNC(_encode_typed_fields)
+#define _begin_object_items DIALECT_FUNC(_begin_object_items)
+#define _begin_PyMapping DIALECT_FUNC(_begin_PyMapping)
+#define _encode_registered DIALECT_FUNC(_encode_registered)
+#define _encode_item DIALECT_FUNC(_encode_item)
+#define _encode_value DIALECT_FUNC(_encode_value)
+#define _encode_alignment DIALECT_FUNC(_encode_alignment)
+
+/* These functions return non-zero on failure (an exception will have been set). Note that no type checking is performed
+ * where a Python type is mentioned in the function name!
+ */
+static int _encode_PyBytes(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_PyByteArray(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_NDarray(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_PyObject_as_PyDecimal(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_PyDecimal(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_PyUnicode(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_PyFloat(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_PyLong(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_longlong(long long num, _bjdata_encoder_buffer_t *buffer);
+#if PY_MAJOR_VERSION < 3
+static int _encode_PyInt(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+#endif
+static int _encode_PyRange(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _begin_PySequence(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_mapping_key(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _typed_object_type(PyObject *items, _bjdata_encoder_buffer_t *buffer);
+static int _encode_typed_object(PyObject *items, int marker, _bjdata_encoder_buffer_t *buffer);
+static int _encode_typed_fields(PyObject *obj, PyObject *spec, int kind, _bjdata_encoder_buffer_t *buffer);
+static int _begin_object_items(PyObject *obj, PyObject *items, _bjdata_encoder_buffer_t *buffer);
+static int _begin_PyMapping(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_registered(PyObject *obj, _bjdata_encoder_type_t *entry, _bjdata_encoder_buffer_t *buffer);
+static int _encode_item(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_value(PyObject *obj, _bjdata_encoder_buffer_t *buffer);
+static int _encode_alignment(PyObject *value, PyObject *key, int kind, _bjdata_encoder_buffer_t *buffer);
+
+static int _encoded_int_size(long long num);
+static long long _ndarray_header_size(PyArrayObject *arr);
+static int _encode_out_of_band(PyArrayObject *arr, _bjdata_encoder_buffer_t *buffer);
+
+/******************************************************************************/
+
+static int _encode_PyBytes(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    const char *raw;
+    Py_ssize_t len;
+
+    raw = PyBytes_AS_STRING(obj);
+    len = PyBytes_GET_SIZE(obj);
+
+    WRITE_OR_BAIL(bytes_array_prefix, sizeof(bytes_array_prefix));
+    BAIL_ON_NONZERO(_encode_longlong(len, buffer));
+    BAIL_ON_NONZERO(_encoder_buffer_write_payload(buffer, obj, raw, len));
+    // no ARRAY_END since length was specified
+
+    return 0;
+
+bail:
+    return 1;
+}
+
+static int _encode_PyByteArray(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    const char *raw;
+    Py_ssize_t len;
+
+    raw = PyByteArray_AS_STRING(obj);
+    len = PyByteArray_GET_SIZE(obj);
+
+    WRITE_OR_BAIL(bytes_array_prefix, sizeof(bytes_array_prefix));
+    BAIL_ON_NONZERO(_encode_longlong(len, buffer));
+    BAIL_ON_NONZERO(_encoder_buffer_write_payload(buffer, obj, raw, len));
+    // no ARRAY_END since length was specified
+
+    return 0;
+
+bail:
+    return 1;
+}
+
+/******************************************************************************/
+
+static int _encode_NDarray(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    PyArrayObject *arr = NULL;
+    PyArrayObject *contiguous;
+    npy_intp *dims;
+    npy_intp bytes, total;
+    int ndim, type, marker, i;
+
+    Py_INCREF(obj);
+    BAIL_ON_NULL(arr = (PyArrayObject *)PyArray_EnsureArray(obj));
+    // payload is written as-is, i.e. has to be in row-major order
+    BAIL_ON_NULL(contiguous = PyArray_GETCONTIGUOUS(arr));
+    Py_DECREF(arr);
+    arr = contiguous;
+
+    if (_encoder_out_of_band(buffer, arr)) {
+        BAIL_ON_NONZERO(_encode_out_of_band(arr, buffer));
+        Py_DECREF(arr);
+        return 0;
+    }
+
+    ndim = PyArray_NDIM(arr);
+    type = PyArray_TYPE(arr);
+    bytes = PyArray_ITEMSIZE(arr);
+    marker = _lookup_marker(type);
+
+#if DIALECT == DIALECT_UBJSON
+    // UBJSON has neither unsigned (other than uint8) nor half-precision types and no ND-array container: such values
+    // are written element by element instead.
+    if (marker < 0 || ndim > 1 || TYPE_UINT16 == marker || TYPE_UINT32 == marker || TYPE_UINT64 == marker
+            || TYPE_FLOAT16 == marker) {
+        PyObject *items;
+        int ret;
+
+        BAIL_ON_NULL(items = PyArray_ToList(arr));
+        ret = _encode_value(items, buffer);
+        Py_DECREF(items);
+        Py_DECREF(arr);
+        return ret;
+    }
+#endif
+
+    if (marker < 0) {
+        PyErr_Format(EncoderException, "Cannot encode numpy array of dtype %d", type);
+        goto bail;
+    }
+    if(ndim == 0){  /*scalar*/
+        WRITE_CHAR_OR_BAIL((char)marker);
+        if(marker == TYPE_STRING) {
+            BAIL_ON_NONZERO(_encode_longlong(bytes, buffer));
+        }
+        WRITE_OR_BAIL(PyArray_BYTES(arr), bytes);
+        Py_DECREF(arr);
+        return 0;
+    }
+
+    dims = PyArray_DIMS(arr);
+    total = PyArray_SIZE(arr);
+
+    WRITE_CHAR_OR_BAIL(ARRAY_START);
+    WRITE_CHAR_OR_BAIL(CONTAINER_TYPE);
+    if(marker == TYPE_STRING) {
+        WRITE_CHAR_OR_BAIL(TYPE_CHAR);
+    } else {
+        WRITE_CHAR_OR_BAIL((char)marker);
+    }
+    WRITE_CHAR_OR_BAIL(CONTAINER_COUNT);
+    if(ndim == 1) {
+        BAIL_ON_NONZERO(_encode_longlong(total, buffer));
+    } else {
+        WRITE_CHAR_OR_BAIL(ARRAY_START);
+        for(i = 0; i < ndim; i++) {
+            BAIL_ON_NONZERO(_encode_longlong(dims[i], buffer));
+        }
+        if(type == NPY_UNICODE) {
+            BAIL_ON_NONZERO(_encode_longlong(4, buffer));
+        }
+        WRITE_CHAR_OR_BAIL(ARRAY_END);
+    }
+    BAIL_ON_NONZERO(_encoder_buffer_write_payload(buffer, (PyObject *)arr, PyArray_BYTES(arr), bytes*total));
+    Py_DECREF(arr);
+    // no ARRAY_END since length was specified
+
+    return 0;
+
+bail:
+    Py_XDECREF(arr);
+    return 1;
+}
+
+/* Passes the payload of the C-contiguous array arr to buffer_callback and writes an object referencing it instead, i.e.
+ * {BUFFER_KEY_DTYPE: arr.dtype.str, BUFFER_KEY_INDEX: index, BUFFER_KEY_SHAPE: [dims...]}
+ */
+static int _encode_out_of_band(PyArrayObject *arr, _bjdata_encoder_buffer_t *buffer) {
+    PyObject *dtype = NULL;
+#if PY_MAJOR_VERSION < 3
+    PyObject *str;
+#endif
+    long long index;
+    int i;
+
+    BAIL_ON_NONZERO(_encoder_pass_out_of_band(buffer, arr, &index));
+    // members in sorted order
+    WRITE_CHAR_OR_BAIL(OBJECT_START);
+    BAIL_ON_NONZERO(_encode_longlong(sizeof(BUFFER_KEY_DTYPE) - 1, buffer));
+    WRITE_OR_BAIL(BUFFER_KEY_DTYPE, sizeof(BUFFER_KEY_DTYPE) - 1);
+    BAIL_ON_NULL(dtype = PyObject_GetAttrString((PyObject *)PyArray_DESCR(arr), "str"));
+#if PY_MAJOR_VERSION < 3
+    // dtype.str is not unicode
+    str = dtype;
+    dtype = PyUnicode_FromObject(str);
+    Py_DECREF(str);
+    BAIL_ON_NULL(dtype);
+#endif
+    BAIL_ON_NONZERO(_encode_PyUnicode(dtype, buffer));
+    Py_CLEAR(dtype);
+    BAIL_ON_NONZERO(_encode_longlong(sizeof(BUFFER_KEY_INDEX) - 1, buffer));
+    WRITE_OR_BAIL(BUFFER_KEY_INDEX, sizeof(BUFFER_KEY_INDEX) - 1);
+    BAIL_ON_NONZERO(_encode_longlong(index, buffer));
+    BAIL_ON_NONZERO(_encode_longlong(sizeof(BUFFER_KEY_SHAPE) - 1, buffer));
+    WRITE_OR_BAIL(BUFFER_KEY_SHAPE, sizeof(BUFFER_KEY_SHAPE) - 1);
+    WRITE_CHAR_OR_BAIL(ARRAY_START);
+    for (i = 0; i < PyArray_NDIM(arr); i++) {
+        BAIL_ON_NONZERO(_encode_longlong(PyArray_DIMS(arr)[i], buffer));
+    }
+    WRITE_CHAR_OR_BAIL(ARRAY_END);
+    WRITE_CHAR_OR_BAIL(OBJECT_END);
+    return 0;
+
+bail:
+    Py_XDECREF(dtype);
+    return 1;
+}
+
+/* Returns the length of the header (i.e. the offset of the payload) _encode_NDarray writes for the given array, or -1
+ * if it is not written as a (non-empty) packed array.
+ */
+static long long _ndarray_header_size(PyArrayObject *arr) {
+    int ndim = PyArray_NDIM(arr);
+    int marker = _lookup_marker(PyArray_TYPE(arr));
+    long long size = 4;
+    int i;
+
+    if (marker < 0 || 0 == ndim || 0 == PyArray_SIZE(arr)) {
+        return -1;
+    }
+#if DIALECT == DIALECT_UBJSON
+    if (ndim > 1 || TYPE_UINT16 == marker || TYPE_UINT32 == marker || TYPE_UINT64 == marker
+            || TYPE_FLOAT16 == marker) {
+        return -1;
+    }
+#endif
+    if (1 == ndim) {
+        return size + _encoded_int_size(PyArray_SIZE(arr));
+    }
+    size += 2;
+    for (i = 0; i < ndim; i++) {
+        size += _encoded_int_size(PyArray_DIMS(arr)[i]);
+    }
+    if (NPY_UNICODE == PyArray_TYPE(arr)) {
+        size += _encoded_int_size(4);
+    }
+    return size;
+}
+
+/******************************************************************************/
+
+static int _encode_PyObject_as_PyDecimal(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    PyObject *decimal = NULL;
+
+    // Decimal class has no public C API
+    BAIL_ON_NULL(decimal =  PyObject_CallFunctionObjArgs((PyObject*)PyDec_Type, obj, NULL));
+    BAIL_ON_NONZERO(_encode_PyDecimal(decimal, buffer));
+    Py_DECREF(decimal);
+    return 0;
+
+bail:
+    Py_XDECREF(decimal);
+    return 1;
+}
+
+static int _encode_PyDecimal(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    PyObject *is_finite;
+    PyObject *str = NULL;
+    PyObject *encoded = NULL;
+    const char *raw;
+    Py_ssize_t len;
+
+    // Decimal class has no public C API
+    BAIL_ON_NULL(is_finite = PyObject_CallMethod(obj, "is_finite", NULL));
+
+    if (Py_True == is_finite) {
+#if PY_MAJOR_VERSION >= 3
+        BAIL_ON_NULL(str = PyObject_Str(obj));
+#else
+        BAIL_ON_NULL(str = PyObject_Unicode(obj));
+#endif
+        BAIL_ON_NULL(encoded = PyUnicode_AsEncodedString(str, "utf-8", NULL));
+        raw = PyBytes_AS_STRING(encoded);
+        len = PyBytes_GET_SIZE(encoded);
+
+        WRITE_CHAR_OR_BAIL(TYPE_HIGH_PREC);
+        BAIL_ON_NONZERO(_encode_longlong(len, buffer));
+        WRITE_OR_BAIL(raw, len);
+        Py_DECREF(str);
+        Py_DECREF(encoded);
+    } else {
+        WRITE_CHAR_OR_BAIL(TYPE_NULL);
+    }
+
+    Py_DECREF(is_finite);
+    return 0;
+
+bail:
+    Py_XDECREF(is_finite);
+    Py_XDECREF(str);
+    Py_XDECREF(encoded);
+    return 1;
+}
+
+/******************************************************************************/
+
+static int _encode_PyUnicode(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    PyObject *str;
+    const char *raw;
+    Py_ssize_t len;
+
+    BAIL_ON_NULL(str = PyUnicode_AsEncodedString(obj, "utf-8", NULL));
+    raw = PyBytes_AS_STRING(str);
+    len = PyBytes_GET_SIZE(str);
+
+    if (1 == len) {
+        WRITE_CHAR_OR_BAIL(TYPE_CHAR);
+    } else {
+        WRITE_CHAR_OR_BAIL(TYPE_STRING);
+        BAIL_ON_NONZERO(_encode_longlong(len, buffer));
+    }
+    WRITE_OR_BAIL(raw, len);
+    Py_DECREF(str);
+    return 0;
+
+bail:
+    Py_XDECREF(str);
+    return 1;
+}
+
+/******************************************************************************/
+
+static int _encode_PyFloat(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    char numtmp[9]; // holds type char + float32/64
+    double abs;
+    double num = PyFloat_AsDouble(obj);
+
+    if (-1.0 == num && PyErr_Occurred()) {
+        goto bail;
+    }
+
+#if DIALECT == DIALECT_UBJSON
+
+#ifdef USE__FPCLASS
+    switch (_fpclass(num)) {
+        case _FPCLASS_SNAN:
+        case _FPCLASS_QNAN:
+        case _FPCLASS_NINF:
+        case _FPCLASS_PINF:
+#else
+    switch (fpclassify(num)) {
+        case FP_NAN:
+        case FP_INFINITE:
+#endif
+            WRITE_CHAR_OR_BAIL(TYPE_NULL);
+            return 0;
+#ifdef USE__FPCLASS
+        case _FPCLASS_NZ:
+        case _FPCLASS_PZ:
+#else
+        case FP_ZERO:
+#endif
+            BAIL_ON_NONZERO(_pyfuncs_ubj_PyFloat_Pack4(num, (unsigned char*)&numtmp[1], buffer->prefs.islittle));
+            numtmp[0] = TYPE_FLOAT32;
+            WRITE_OR_BAIL(numtmp, 5);
+            return 0;
+#ifdef USE__FPCLASS
+        case _FPCLASS_ND:
+        case _FPCLASS_PD:
+#else
+        case FP_SUBNORMAL:
+#endif
+            BAIL_ON_NONZERO(_encode_PyObject_as_PyDecimal(obj, buffer));
+            return 0;
+    }
+
+
+#else /* DIALECT_BJDATA */
+
+
+#ifdef USE__FPCLASS
+    switch (_fpclass(num)) {
+#else
+    switch (fpclassify(num)) {
+#endif
+
+#ifdef USE__FPCLASS
+        case _FPCLASS_NZ:
+        case _FPCLASS_PZ:
+#else
+        case FP_ZERO:
+#endif
+            BAIL_ON_NONZERO(_pyfuncs_ubj_PyFloat_Pack4(num, (unsigned char*)&numtmp[1], buffer->prefs.islittle));
+            numtmp[0] = TYPE_FLOAT32;
+            WRITE_OR_BAIL(numtmp, 5);
+            return 0;
+#ifdef USE__FPCLASS
+        case _FPCLASS_ND:
+        case _FPCLASS_PD:
+#else
+        case FP_SUBNORMAL:
+#endif
+            BAIL_ON_NONZERO(_encode_PyObject_as_PyDecimal(obj, buffer));
+            return 0;
+    }
+
+#endif
+
+    abs = fabs(num);
+    if (!buffer->prefs.no_float32 && 1.18e-38 <= abs && 3.4e38 >= abs) {
+        BAIL_ON_NONZERO(_pyfuncs_ubj_PyFloat_Pack4(num, (unsigned char*)&numtmp[1], buffer->prefs.islittle));
+        numtmp[0] = TYPE_FLOAT32;
+        WRITE_OR_BAIL(numtmp, 5);
+    } else {
+        BAIL_ON_NONZERO(_pyfuncs_ubj_PyFloat_Pack8(num, (unsigned char*)&numtmp[1], buffer->prefs.islittle));
+        numtmp[0] = TYPE_FLOAT64;
+        WRITE_OR_BAIL(numtmp, 9);
+    }
+    return 0;
+
+bail:
+    return 1;
+}
+
+/******************************************************************************/
+
+static int _encode_longlong(long long num, _bjdata_encoder_buffer_t *buffer) {
+    char numtmp[9]; // large enough to hold type + maximum integer (INT64)
+    int islittle=(buffer->prefs.islittle);
+
+#if DIALECT == DIALECT_BJDATA
+    if (num >= 0) {
+        if (num < POWER_TWO(8)) {
+            WRITE_TYPE_AND_INT8_OR_BAIL(TYPE_UINT8, num);
+        } else if (num < POWER_TWO(16)) {
+            WRITE_UINT16_OR_BAIL(num);
+        } else if (num < POWER_TWO(32)) {
+            WRITE_UINT32_OR_BAIL(num);
+        } else {
+            WRITE_UINT64_OR_BAIL(num);
+        }
+#else
+    if (num >= 0) {
+        if (num < POWER_TWO(8)) {
+            WRITE_TYPE_AND_INT8_OR_BAIL(TYPE_UINT8, num);
+        } else if (num < POWER_TWO(15)) {
+            WRITE_INT16_OR_BAIL(num);
+        } else if (num < POWER_TWO(31)) {
+            WRITE_INT32_OR_BAIL(num);
+        } else {
+            WRITE_INT64_OR_BAIL(num);
+        }
+#endif
+    } else if (num >= -(POWER_TWO(7))) {
+        WRITE_TYPE_AND_INT8_OR_BAIL(TYPE_INT8, num);
+    } else if (num >= -(POWER_TWO(15))) {
+        WRITE_INT16_OR_BAIL(num);
+    } else if (num >= -(POWER_TWO(31))) {
+        WRITE_INT32_OR_BAIL(num);
+    } else {
+        WRITE_INT64_OR_BAIL(num);
+    }
+    return 0;
+
+bail:
+    return 1;
+}
+
+static int _encode_PyLong(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    int overflow;
+    long long num = PyLong_AsLongLongAndOverflow(obj, &overflow);
+
+    if (overflow) {
+#if DIALECT == DIALECT_BJDATA
+        char numtmp[9]; // large enough to hold type + maximum integer (INT64)
+        unsigned long long unum = PyLong_AsUnsignedLongLong(obj);
+        int islittle=(buffer->prefs.islittle);
+        if(PyErr_Occurred()){
+	    PyErr_Clear();
+            BAIL_ON_NONZERO(_encode_PyObject_as_PyDecimal(obj, buffer));
+	}else{
+	    WRITE_UINT64_OR_BAIL(unum);
+	}
+#else
+        // no unsigned 64-bit type in UBJSON
+        BAIL_ON_NONZERO(_encode_PyObject_as_PyDecimal(obj, buffer));
+#endif
+        return 0;
+    } else if (num == -1 && PyErr_Occurred()) {
+        // unexpected as PyLong should fit if not overflowing
+        goto bail;
+    } else {
+        return _encode_longlong(num, buffer);
+    }
+
+bail:
+    return 1;
+}
+
+#if PY_MAJOR_VERSION < 3
+static int _encode_PyInt(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    long num = PyInt_AsLong(obj);
+
+    if (num == -1 && PyErr_Occurred()) {
+        // unexpected as PyInt should fit into long
+        return 1;
+    } else {
+        return _encode_longlong(num, buffer);
+    }
+}
+#endif
+
+// Returns the number of bytes (including the type marker) _encode_longlong writes for the given number
+static int _encoded_int_size(long long num) {
+#if DIALECT == DIALECT_BJDATA
+    if (num >= 0) {
+        return (num < POWER_TWO(8)) ? 2 : (num < POWER_TWO(16)) ? 3 : (num < POWER_TWO(32)) ? 5 : 9;
+    }
+#else
+    if (num >= 0) {
+        return (num < POWER_TWO(8)) ? 2 : (num < POWER_TWO(15)) ? 3 : (num < POWER_TWO(31)) ? 5 : 9;
+    }
+#endif
+    return (num >= -(POWER_TWO(7))) ? 2 : (num >= -(POWER_TWO(15))) ? 3 : (num >= -(POWER_TWO(31))) ? 5 : 9;
+}
+
+/******************************************************************************/
+
+/* Writes the given range as packed array of the smallest integer type which fits all of its values (other than uint8,
+ * since such an array is decoded as bytes), the values being computed on the fly. Ranges which cannot be written this
+ * way (empty or beyond long long) are encoded as sequence instead.
+ */
+static int _encode_PyRange(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    char chunk[RANGE_CHUNK_SIZE];
+    char header[3] = {ARRAY_START, CONTAINER_TYPE, TYPE_NONE};
+    long long start, step, last, low, high;
+    unsigned long long value;
+    Py_ssize_t count, i, pos = 0;
+    int size, j, packable;
+
+    BAIL_ON_NEGATIVE(packable = _encoder_range_params(obj, &start, &step, &count));
+    // packed arrays are read as little-endian (as are ndarrays written), regardless of islittle
+    if (!packable || !buffer->prefs.islittle) {
+        return _begin_PySequence(obj, buffer);
+    }
+    // between start & stop, i.e. does not overflow
+    last = start + (count - 1) * step;
+    low = (MIN(start, last));
+    high = (MAX(start, last));
+    if (low >= -(POWER_TWO(7)) && high < POWER_TWO(7)) {
+        header[2] = TYPE_INT8;
+        size = 1;
+#if DIALECT == DIALECT_BJDATA
+    } else if (low >= 0 && high < POWER_TWO(16)) {
+        header[2] = TYPE_UINT16;
+        size = 2;
+    } else if (low >= 0 && high < POWER_TWO(32)) {
+        header[2] = TYPE_UINT32;
+        size = 4;
+    } else if (low >= 0) {
+        header[2] = TYPE_UINT64;
+        size = 8;
+#endif
+    } else if (low >= -(POWER_TWO(15)) && high < POWER_TWO(15)) {
+        header[2] = TYPE_INT16;
+        size = 2;
+    } else if (low >= -(POWER_TWO(31)) && high < POWER_TWO(31)) {
+        header[2] = TYPE_INT32;
+        size = 4;
+    } else {
+        header[2] = TYPE_INT64;
+        size = 8;
+    }
+    WRITE_OR_BAIL(header, sizeof(header));
+    WRITE_CHAR_OR_BAIL(CONTAINER_COUNT);
+    BAIL_ON_NONZERO(_encode_longlong(count, buffer));
+
+    for (i = 0; i < count; i++) {
+        // two's complement, i.e. also for negative values
+        value = (unsigned long long)start + (unsigned long long)i * (unsigned long long)step;
+        for (j = 0; j < size; j++) {
+            chunk[pos + j] = (char)(value >> (8 * j));
+        }
+        if ((pos += size) == RANGE_CHUNK_SIZE) {
+            WRITE_OR_BAIL(chunk, pos);
+            pos = 0;
+        }
+    }
+    WRITE_OR_BAIL(chunk, pos);
+    // no ARRAY_END since length was specified
+    return 0;
+
+bail:
+    return 1;
+}
+
+/* Writes start of given sequence (or iterator) and pushes a frame for it, i.e. its items are encoded subsequently by
+ * _encode_value (as are the items of _begin_PyMapping below). Only lists & tuples are accessed directly, i.e. other
+ * sequences are iterated over rather than copied first.
+ */
+static int _begin_PySequence(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    _bjdata_encoder_frame_t *frame;
+    Py_ssize_t count = -1;
+
+    if (PyList_CheckExact(obj) || PyTuple_CheckExact(obj)) {
+        BAIL_ON_NULL(frame = _encoder_stack_push(buffer, obj, ENCODER_FRAME_SEQUENCE));
+        Py_INCREF(obj);
+        frame->items = obj;
+        count = PySequence_Fast_GET_SIZE(obj);
+    } else if (buffer->prefs.container_count && !PySequence_Check(obj) && !ENCODER_CAN_PATCH(buffer)) {
+        // count of an iterator only known once exhausted (and cannot be written after its items)
+        BAIL_ON_NULL(frame = _encoder_stack_push(buffer, obj, ENCODER_FRAME_SEQUENCE));
+        BAIL_ON_NULL(frame->items = PySequence_List(obj));
+        count = PyList_GET_SIZE(frame->items);
+    } else {
+        if (buffer->prefs.container_count && PySequence_Check(obj)) {
+            BAIL_ON_NEGATIVE(count = PyObject_Size(obj));
+        }
+        BAIL_ON_NULL(frame = _encoder_stack_push(buffer, obj, ENCODER_FRAME_ITERATOR));
+        BAIL_ON_NULL(frame->items = PyObject_GetIter(obj));
+        frame->count = count;
+    }
+
+    WRITE_CHAR_OR_BAIL(ARRAY_START);
+    if (buffer->prefs.container_count) {
+        if (count < 0) {
+            // iterator: count patched by _encode_value once exhausted
+            BAIL_ON_NONZERO(_encoder_write_count_slot(buffer, &frame->count_offset));
+        } else {
+            WRITE_CHAR_OR_BAIL(CONTAINER_COUNT);
+            BAIL_ON_NONZERO(_encode_longlong(count, buffer));
+        }
+    }
+    return 0;
+
+bail:
+    return 1;
+}
+
+/******************************************************************************/
+
+static int _encode_mapping_key(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    PyObject *str = NULL;
+    const char *raw;
+    Py_ssize_t len;
+
+    if (PyUnicode_Check(obj)) {
+        BAIL_ON_NULL(str = PyUnicode_AsEncodedString(obj, "utf-8", NULL));
+    }
+#if PY_MAJOR_VERSION < 3
+    else if (PyString_Check(obj)) {
+        BAIL_ON_NULL(str = PyString_AsEncodedObject(obj, "utf-8", NULL));
+    }
+#endif
+    else {
+        PyErr_SetString(EncoderException, "Mapping keys can only be strings");
+        goto bail;
+    }
+
+    raw = PyBytes_AS_STRING(str);
+    len = PyBytes_GET_SIZE(str);
+    BAIL_ON_NONZERO(_encode_longlong(len, buffer));
+    WRITE_OR_BAIL(raw, len);
+    Py_DECREF(str);
+    return 0;
+
+bail:
+    Py_XDECREF(str);
+    return 1;
+}
+
+/* Returns the marker of the (fixed-length) type which all values of the given (non-empty) list of (key, value) tuples
+ * can be written as, i.e. the narrowest integer type if all are (exact) ints or a float type if all are floats. Returns
+ * 0 if there is no such type and -1 on failure (exception set).
+ */
+static int _typed_object_type(PyObject *items, _bjdata_encoder_buffer_t *buffer) {
+    PyObject *item;
+    PyObject *value;
+    PyTypeObject *type = NULL;
+    long long num, low = 0, high = 0;
+    double abs;
+    int overflow;
+    int float32 = !buffer->prefs.no_float32;
+    Py_ssize_t i;
+
+    for (i = 0; i < PyList_GET_SIZE(items); i++) {
+        item = PyList_GET_ITEM(items, i);
+        if (!PyTuple_Check(item) || 2 != PyTuple_GET_SIZE(item)) {
+            return 0;
+        }
+        value = PyTuple_GET_ITEM(item, 1);
+        if (NULL == type) {
+            type = Py_TYPE(value);
+            if (&PyLong_Type != type && &PyFloat_Type != type) {
+                return 0;
+            }
+        } else if (Py_TYPE(value) != type) {
+            return 0;
+        }
+
+        if (&PyLong_Type == type) {
+            num = PyLong_AsLongLongAndOverflow(value, &overflow);
+            if (overflow) {
+                return 0;
+            } else if (-1 == num && PyErr_Occurred()) {
+                return -1;
+            }
+            low = (0 == i) ? num : (MIN(low, num));
+            high = (0 == i) ? num : (MAX(high, num));
+        } else {
+            abs = fabs(PyFloat_AS_DOUBLE(value));
+#if DIALECT == DIALECT_UBJSON
+            // non-finite values are written as null
+            if (Py_IS_NAN(abs) || Py_IS_INFINITY(abs)) {
+                return 0;
+            }
+#endif
+            // as for individual values, float32 only used if all values are in its range
+            float32 = float32 && (0.0 == abs || (1.18e-38 <= abs && 3.4e38 >= abs));
+        }
+    }
+
+    if (&PyFloat_Type == type) {
+        return float32 ? TYPE_FLOAT32 : TYPE_FLOAT64;
+    } else if (low >= 0 && high < POWER_TWO(8)) {
+        return TYPE_UINT8;
+    } else if (low >= -(POWER_TWO(7)) && high < POWER_TWO(7)) {
+        return TYPE_INT8;
+#if DIALECT == DIALECT_BJDATA
+    } else if (low >= 0 && high < POWER_TWO(16)) {
+        return TYPE_UINT16;
+#endif
+    } else if (low >= -(POWER_TWO(15)) && high < POWER_TWO(15)) {
+        return TYPE_INT16;
+#if DIALECT == DIALECT_BJDATA
+    } else if (low >= 0 && high < POWER_TWO(32)) {
+        return TYPE_UINT32;
+#endif
+    } else if (low >= -(POWER_TWO(31)) && high < POWER_TWO(31)) {
+        return TYPE_INT32;
+#if DIALECT == DIALECT_BJDATA
+    } else if (low >= 0) {
+        return TYPE_UINT64;
+#endif
+    } else {
+        return TYPE_INT64;
+    }
+}
+
+/* Writes the given list of (key, value) tuples as object with values of the given type (see _typed_object_type), i.e.
+ * without a marker per value.
+ */
+static int _encode_typed_object(PyObject *items, int marker, _bjdata_encoder_buffer_t *buffer) {
+    char header[3] = {OBJECT_START, CONTAINER_TYPE, (char)marker};
+    char numtmp[8];
+    PyObject *item;
+    unsigned long long num;
+    int islittle = buffer->prefs.islittle;
+    int size, j;
+    Py_ssize_t i;
+
+    switch (marker) {
+        case TYPE_UINT8: case TYPE_INT8: size = 1; break;
+        case TYPE_UINT16: case TYPE_INT16: size = 2; break;
+        case TYPE_UINT32: case TYPE_INT32: case TYPE_FLOAT32: size = 4; break;
+        default: size = 8; break;
+    }
+
+    WRITE_OR_BAIL(header, sizeof(header));
+    WRITE_CHAR_OR_BAIL(CONTAINER_COUNT);
+    BAIL_ON_NONZERO(_encode_longlong(PyList_GET_SIZE(items), buffer));
+
+    for (i = 0; i < PyList_GET_SIZE(items); i++) {
+        item = PyList_GET_ITEM(items, i);
+        BAIL_ON_NONZERO(_encode_mapping_key(PyTuple_GET_ITEM(item, 0), buffer));
+        if (TYPE_FLOAT32 == marker) {
+            BAIL_ON_NONZERO(_pyfuncs_ubj_PyFloat_Pack4(PyFloat_AS_DOUBLE(PyTuple_GET_ITEM(item, 1)),
+                                                       (unsigned char*)numtmp, islittle));
+        } else if (TYPE_FLOAT64 == marker) {
+            BAIL_ON_NONZERO(_pyfuncs_ubj_PyFloat_Pack8(PyFloat_AS_DOUBLE(PyTuple_GET_ITEM(item, 1)),
+                                                       (unsigned char*)numtmp, islittle));
+        } else {
+            // two's complement, i.e. also for negative values (range already checked)
+            num = (unsigned long long)PyLong_AsLongLong(PyTuple_GET_ITEM(item, 1));
+            for (j = 0; j < size; j++) {
+                numtmp[islittle ? j : size - 1 - j] = (char)(num >> (8 * j));
+            }
+        }
+        WRITE_OR_BAIL(numtmp, size);
+    }
+    // no OBJECT_END since length was specified
+    return 0;
+
+bail:
+    return 1;
+}
+
+/* Writes the fields (see _encoder_field_spec) of obj, kind being one of ENCODER_FRAME_FIELDS/NAMEDTUPLE, as typed
+ * object if their values are all of one numeric type (as for mappings, see _typed_object_type). Returns 1 if written, 0
+ * if not (i.e. fields are to be encoded individually) and -1 on failure (exception set).
+ */
+static int _encode_typed_fields(PyObject *obj, PyObject *spec, int kind, _bjdata_encoder_buffer_t *buffer) {
+    PyObject *items = NULL;
+    PyObject *field, *value, *item;
+    Py_ssize_t i;
+    int marker;
+
+    BAIL_ON_NULL(items = PyList_New(PyTuple_GET_SIZE(spec)));
+    for (i = 0; i < PyTuple_GET_SIZE(spec); i++) {
+        field = PyTuple_GET_ITEM(spec, i);
+        BAIL_ON_NULL(value = _encoder_field_value(obj, field, kind));
+        item = PyTuple_Pack(2, PyTuple_GET_ITEM(field, 0), value);
+        Py_DECREF(value);
+        BAIL_ON_NULL(item);
+        PyList_SET_ITEM(items, i, item);
+    }
+    BAIL_ON_NEGATIVE(marker = _typed_object_type(items, buffer));
+    if (0 != marker) {
+        BAIL_ON_NONZERO(_encode_typed_object(items, marker, buffer));
+    }
+    Py_DECREF(items);
+    return 0 != marker;
+
+bail:
+    Py_XDECREF(items);
+    return -1;
+}
+
+/* Writes start of object for the given list of (key, value) tuples of obj (stealing the reference to items) and pushes a
+ * frame for it. With typed_objects, values all of one numeric type are instead written directly (see
+ * _encode_typed_object), without pushing a frame.
+ */
+static int _begin_object_items(PyObject *obj, PyObject *items, _bjdata_encoder_buffer_t *buffer) {
+    _bjdata_encoder_frame_t *frame;
+    int marker;
+    int failed;
+
+    if (buffer->prefs.sort_keys && 0 != PyList_Sort(items)) {
+        Py_DECREF(items);
+        goto bail;
+    }
+    // values written directly (i.e. without pushing a frame) if all of one numeric type
+    if (buffer->prefs.typed_objects && PyList_GET_SIZE(items) > 0 && 0 != (marker = _typed_object_type(items, buffer))) {
+        failed = (marker < 0) || _encode_typed_object(items, marker, buffer);
+        Py_DECREF(items);
+        return failed;
+    }
+
+    if (NULL == (frame = _encoder_stack_push(buffer, obj, ENCODER_FRAME_MAPPING))) {
+        Py_DECREF(items);
+        goto bail;
+    }
+    frame->items = items;
+
+    WRITE_CHAR_OR_BAIL(OBJECT_START);
+    if (buffer->prefs.container_count) {
+        WRITE_CHAR_OR_BAIL(CONTAINER_COUNT);
+        BAIL_ON_NONZERO(_encode_longlong(PyList_GET_SIZE(items), buffer));
+    }
+    return 0;
+
+bail:
+    return 1;
+}
+
+static int _begin_PyMapping(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    PyObject *items;
+
+    BAIL_ON_NULL(items = PyMapping_Items(obj));
+    return _begin_object_items(obj, items, buffer);
+
+bail:
+    return 1;
+}
+
+/******************************************************************************/
+
+// Encodes obj as described by its type's entry (see ENCODER_TYPE_*), kind not being ENCODER_TYPE_GENERIC
+static int _encode_registered(PyObject *obj, _bjdata_encoder_type_t *entry, _bjdata_encoder_buffer_t *buffer) {
+    // entry might be replaced whilst encoding (nested values), so hold on to handler
+    PyObject *handler = entry->handler;
+    PyObject *newobj = NULL;
+    _bjdata_encoder_frame_t *frame;
+    Py_ssize_t count;
+    int kind;
+    int typed;
+
+    Py_XINCREF(handler);
+    switch (entry->kind) {
+        case ENCODER_TYPE_CALL:
+            BAIL_ON_NULL(newobj = PyObject_CallFunctionObjArgs(handler, obj, NULL));
+            break;
+
+        case ENCODER_TYPE_VALUE:
+            BAIL_ON_NULL(newobj = PyObject_GetAttrString(obj, "value"));
+            break;
+
+        case ENCODER_TYPE_STR:
+            BAIL_ON_NULL(newobj = PyObject_Str(obj));
+            BAIL_ON_NONZERO(_encode_PyUnicode(newobj, buffer));
+            Py_DECREF(newobj);
+            return 0;
+
+        // fields are encoded by _encode_value, i.e. without creating any intermediate mapping
+        case ENCODER_TYPE_FIELDS:
+        case ENCODER_TYPE_NAMEDTUPLE:
+            count = PyTuple_GET_SIZE(handler);
+            kind = (ENCODER_TYPE_FIELDS == entry->kind) ? ENCODER_FRAME_FIELDS : ENCODER_FRAME_NAMEDTUPLE;
+            // as with mappings, values all of one numeric type are written as typed object
+            if (buffer->prefs.typed_objects && count > 0) {
+                BAIL_ON_NEGATIVE(typed = _encode_typed_fields(obj, handler, kind, buffer));
+                if (typed) {
+                    Py_DECREF(handler);
+                    return 0;
+                }
+            }
+            BAIL_ON_NULL(frame = _encoder_stack_push(buffer, obj, kind));
+            frame->items = handler;
+            handler = NULL;
+            WRITE_CHAR_OR_BAIL(OBJECT_START);
+            if (buffer->prefs.container_count) {
+                WRITE_CHAR_OR_BAIL(CONTAINER_COUNT);
+                BAIL_ON_NONZERO(_encode_longlong(count, buffer));
+            }
+            return 0;
+
+        default:
+            PyErr_SetString(PyExc_RuntimeError, "Internal error - unexpected encoder type kind");
+            goto bail;
+    }
+    Py_CLEAR(handler);
+
+    // Note: Result is encoded in full here (as for the default function, see _encode_item)
+    RECURSE_AND_BAIL_ON_NONZERO(_encode_value(newobj, buffer), " while encoding with registered encoder");
+    Py_DECREF(newobj);
+    return 0;
+
+bail:
+    Py_XDECREF(handler);
+    Py_XDECREF(newobj);
+    return 1;
+}
+
+static int _encode_item(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    PyObject *newobj = NULL; // result of default call (when encoding unsupported types)
+    _bjdata_encoder_type_t *entry;
+
+    // types with a registered or built-in encoder take precedence (see ENCODER_TYPE_IS_PLAIN for those never looked up)
+    if (NULL != obj && !ENCODER_TYPE_IS_PLAIN(Py_TYPE(obj))) {
+        BAIL_ON_NULL(entry = _encoder_type_lookup(buffer, Py_TYPE(obj)));
+        if (ENCODER_TYPE_GENERIC != entry->kind) {
+            return _encode_registered(obj, entry, buffer);
+        }
+    }
+
+    if (Py_None == obj) {
+        WRITE_CHAR_OR_BAIL(TYPE_NULL);
+    } else if (Py_True == obj) {
+        WRITE_CHAR_OR_BAIL(TYPE_BOOL_TRUE);
+    } else if (Py_False == obj) {
+        WRITE_CHAR_OR_BAIL(TYPE_BOOL_FALSE);
+    } else if (PyUnicode_Check(obj)) {
+        BAIL_ON_NONZERO(_encode_PyUnicode(obj, buffer));
+#if PY_MAJOR_VERSION < 3
+    } else if (PyInt_Check(obj) && Py_TYPE(obj)!=NULL && strstr(Py_TYPE(obj)->tp_name, "numpy")==NULL) {
+        BAIL_ON_NONZERO(_encode_PyInt(obj, buffer));
+#endif
+    } else if (PyLong_Check(obj)) {
+        BAIL_ON_NONZERO(_encode_PyLong(obj, buffer));
+    } else if (PyFloat_Check(obj)) {
+        BAIL_ON_NONZERO(_encode_PyFloat(obj, buffer));
+    } else if (PyDec_Check(obj)) {
+        BAIL_ON_NONZERO(_encode_PyDecimal(obj, buffer));
+    } else if (PyBytes_Check(obj)) {
+        BAIL_ON_NONZERO(_encode_PyBytes(obj, buffer));
+    } else if (PyByteArray_Check(obj)) {
+        BAIL_ON_NONZERO(_encode_PyByteArray(obj, buffer));
+    } else if (RawBJData_Check(obj)) {
+        BAIL_ON_NONZERO(_encode_RawBJData(obj, buffer));
+    } else if (PyArray_CheckAnyScalar(obj)) {
+        BAIL_ON_NONZERO(_encode_NDarray(obj, buffer));
+    } else if (PySequence_Check(obj)) {
+        if (PyArray_CheckExact(obj)) {
+            BAIL_ON_NONZERO(_encode_NDarray(obj, buffer));
+        } else if (PyRange_Check(obj)) {
+            BAIL_ON_NONZERO(_encode_PyRange(obj, buffer));
+        } else {
+            BAIL_ON_NONZERO(_begin_PySequence(obj, buffer));
+        }
+    // order important since Mapping could also be Sequence
+    } else if (PyMapping_Check(obj)
+    // Unfortunately PyMapping_Check is no longer enough, see https://bugs.python.org/issue5945
+#if PY_MAJOR_VERSION >= 3
+               && PyObject_HasAttrString(obj, "items")
+#endif
+    ) {
+        BAIL_ON_NONZERO(_begin_PyMapping(obj, buffer));
+    // e.g. generator (encoded as array), unless default given (which before these were supported received them)
+    } else if (NULL != obj && NULL == buffer->prefs.default_func && PyIter_Check(obj)) {
+        BAIL_ON_NONZERO(_begin_PySequence(obj, buffer));
+    } else if (NULL == obj) {
+        PyErr_SetString(PyExc_RuntimeError, "Internal error - _bjdata_encode_value got NULL obj");
+        goto bail;
+    } else if (NULL != buffer->prefs.default_func) {
+        // Note: Result is encoded in full here (rather than via the caller's loop) so that a default function returning
+        // another value it cannot encode itself is still subject to the recursion limit.
+        BAIL_ON_NULL(newobj = PyObject_CallFunctionObjArgs(buffer->prefs.default_func, obj, NULL));
+        RECURSE_AND_BAIL_ON_NONZERO(_encode_value(newobj, buffer), " while encoding with default function");
+        Py_DECREF(newobj);
+    } else {
+        PyErr_Format(EncoderException, "Cannot encode item of type %s", obj->ob_type->tp_name);
+        goto bail;
+    }
+    return 0;
+
+bail:
+    Py_XDECREF(newobj);
+    return 1;
+}
+
+/* Writes no-op markers before the given container item (preceded by key, if not NULL) if it is a packed array (see
+ * _encode_NDarray), such that its payload starts at a multiple of prefs.align in the output.
+ */
+static int _encode_alignment(PyObject *value, PyObject *key, int kind, _bjdata_encoder_buffer_t *buffer) {
+    char noops[64];
+    long long size;
+    long long pad;
+    Py_ssize_t len;
+#if PY_MAJOR_VERSION < 3
+    PyObject *encoded;
+#endif
+
+    // arrays passed out-of-band have no payload in the output
+    if (!PyArray_CheckExact(value) || _encoder_out_of_band(buffer, (PyArrayObject *)value) ||
+        (size = _ndarray_header_size((PyArrayObject *)value)) < 0) {
+        return 0;
+    }
+    if (ENCODER_FRAME_MAPPING == kind) {
+        // invalid keys are rejected by _encode_mapping_key
+        if (!PyUnicode_Check(key)) {
+            return 0;
+        }
+#if PY_MAJOR_VERSION >= 3
+        BAIL_ON_NULL(PyUnicode_AsUTF8AndSize(key, &len));
+#else
+        BAIL_ON_NULL(encoded = PyUnicode_AsEncodedString(key, "utf-8", NULL));
+        len = PyBytes_GET_SIZE(encoded);
+        Py_DECREF(encoded);
+#endif
+        size += _encoded_int_size(len) + len;
+    } else if (NULL != key) {
+        // already encoded (see _encoder_field_spec)
+        size += PyBytes_GET_SIZE(key);
+    }
+
+    size += buffer->fp_start + buffer->flushed + (long long)buffer->pos;
+    pad = (buffer->prefs.align - size % buffer->prefs.align) % buffer->prefs.align;
+    memset(noops, TYPE_NOOP, sizeof(noops));
+    while (pad > 0) {
+        len = (Py_ssize_t)(MIN(pad, (long long)sizeof(noops)));
+        WRITE_OR_BAIL(noops, len);
+        pad -= len;
+    }
+    return 0;
+
+bail:
+    return 1;
+}
+
+/* Encodes the given value, including all items of any (nested) containers. Sequences and mappings are not encoded
+ * recursively: _encode_item only writes the start of a container (pushing a frame for it), with its items then being
+ * encoded by the loop below until the container's frame has been popped again.
+ */
+static int _encode_value(PyObject *obj, _bjdata_encoder_buffer_t *buffer) {
+    // frames below this belong to a caller (i.e. when encoding the result of a default function)
+    Py_ssize_t base = buffer->depth;
+    Py_ssize_t depth;
+    Py_ssize_t pos;
+    _bjdata_encoder_frame_t *frame;
+    PyObject *container;
+    PyObject *items;
+    PyObject *item;
+    PyObject *key;
+    PyObject *value = NULL; // field value or item of an iterator (new reference)
+    int kind;
+    int failed;
+
+    BAIL_ON_NONZERO(_encode_item(obj, buffer));
+
+    while ((depth = buffer->depth) > base) {
+        // Note: frame is only valid until the next item has been encoded
+        frame = &buffer->frames[depth - 1];
+        container = frame->obj;
+        items = frame->items;
+        pos = frame->pos;
+        kind = frame->kind;
+
+        for (;;) {
+            if (ENCODER_FRAME_ITERATOR == kind) {
+                if (NULL == (item = value = PyIter_Next(items))) {
+                    BAIL_ON_NONZERO(PyErr_Occurred());
+                    break;
+                }
+            } else if (pos < PySequence_Fast_GET_SIZE(items)) {
+                item = PySequence_Fast_GET_ITEM(items, pos);
+            } else {
+                break;
+            }
+            pos++;
+            if (ENCODER_FRAME_MAPPING == kind) {
+                if (!PyTuple_Check(item) || 2 != PyTuple_GET_SIZE(item)) {
+                    PyErr_SetString(PyExc_ValueError, "items must return 2-tuples");
+                    goto bail;
+                }
+                key = PyTuple_GET_ITEM(item, 0);
+                item = PyTuple_GET_ITEM(item, 1);
+                if (buffer->prefs.align > 1) {
+                    BAIL_ON_NONZERO(_encode_alignment(item, key, kind, buffer));
+                }
+                BAIL_ON_NONZERO(_encode_mapping_key(key, buffer));
+            } else if (ENCODER_FRAME_SEQUENCE != kind && ENCODER_FRAME_ITERATOR != kind) {
+                key = PyTuple_GET_ITEM(item, 1);
+                BAIL_ON_NULL(item = value = _encoder_field_value(container, item, kind));
+                if (buffer->prefs.align > 1) {
+                    BAIL_ON_NONZERO(_encode_alignment(item, key, kind, buffer));
+                }
+                WRITE_OR_BAIL(PyBytes_AS_STRING(key), PyBytes_GET_SIZE(key));
+            } else if (buffer->prefs.align > 1) {
+                BAIL_ON_NONZERO(_encode_alignment(item, NULL, kind, buffer));
+            }
+            failed = _encode_item(item, buffer);
+            Py_CLEAR(value);
+            BAIL_ON_NONZERO(failed);
+            // item is a container: continue with its items first (frames might have been reallocated)
+            if (buffer->depth != depth) {
+                buffer->frames[depth - 1].pos = pos;
+                goto nested;
+            }
+        }
+
+        if (!buffer->prefs.container_count) {
+            WRITE_CHAR_OR_BAIL((ENCODER_FRAME_SEQUENCE == kind || ENCODER_FRAME_ITERATOR == kind) ? ARRAY_END :
+                                                                                                  OBJECT_END);
+        } else if (ENCODER_FRAME_ITERATOR == kind) {
+            frame = &buffer->frames[depth - 1];
+            if (frame->count_offset >= 0) {
+                BAIL_ON_NONZERO(_encoder_patch_count(buffer, frame->count_offset, pos));
+            } else if (pos != frame->count) {
+                PyErr_SetString(PyExc_RuntimeError, "sequence changed size during encoding");
+                goto bail;
+            }
+        }
+        BAIL_ON_NONZERO(_encoder_stack_pop(buffer));
+nested:
+        ;
+    }
+    return 0;
+
+bail:
+    // e.g. if writing the alignment or key of a field value or iterator item failed
+    Py_XDECREF(value);
+    _encoder_stack_unwind(buffer, base);
+    return 1;
+}
+
+/******************************************************************************/
+
+#undef _encode_PyBytes
+#undef _encode_PyByteArray
+#undef _encode_NDarray
+#undef _ndarray_header_size
+#undef _encode_out_of_band
+#undef _encode_PyObject_as_PyDecimal
+#undef _encode_PyDecimal
+#undef _encode_PyUnicode
+#undef _encode_PyFloat
+#undef _encode_longlong
+#undef _encoded_int_size
+#undef _encode_PyLong
+#undef _encode_PyInt
+#undef _encode_PyRange
+#undef _begin_PySequence
+#undef _encode_mapping_key
+#undef _typed_object_type
+#undef _encode_typed_object
+#undef _encode_typed_fields
+#undef _begin_object_items
+#undef _begin_PyMapping
+#undef _encode_registered
+#undef _encode_item
+#undef _encode_value
+#undef _encode_alignment
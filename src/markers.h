@@ -48,6 +48,10 @@ extern "C" {
 // Optional container parameters
 #define CONTAINER_TYPE '$'
 #define CONTAINER_COUNT '#'
+// Keys of the object written in place of a numpy array passed out-of-band (see buffer_callback of dump)
+#define BUFFER_KEY_INDEX "_BufferIndex_"
+#define BUFFER_KEY_DTYPE "_BufferDtype_"
+#define BUFFER_KEY_SHAPE "_BufferShape_"
 
 #if defined (__cplusplus)
 }
@@ -0,0 +1,552 @@
+/*
+ * Copyright (c) 2020-2022 Qianqian Fang <q.fang at neu.edu>. All rights reserved.
+ * Copyright (c) 2016-2019 Iotic Labs Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://github.com/NeuroJSON/pybj/blob/master/LICENSE
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "markers.h"
+#include "validator.h"
+
+/******************************************************************************/
+
+/* Validation scans the input in place: no Python objects are created (so it can run without holding the GIL) and,
+ * unless nesting is deeper than VALIDATE_STACK_SIZE, no memory is allocated either.
+ */
+
+// number of container levels tracked without allocating
+#define VALIDATE_STACK_SIZE 64
+
+// largest count/length which can be decoded
+#define VALIDATE_MAX_COUNT LLONG_MAX
+
+// what follows a marker (see _marker_info_t)
+#define VALUE_INVALID 0
+#define VALUE_NO_DATA 1
+#define VALUE_FIXED 2
+#define VALUE_STRING 3
+#define VALUE_ARRAY 4
+#define VALUE_OBJECT 5
+#define VALUE_HIGH_PREC 6
+
+#define INT_NONE 0
+#define INT_SIGNED 1
+#define INT_UNSIGNED 2
+
+typedef struct {
+    // one of VALUE_*
+    unsigned char value;
+    // payload length (for VALUE_FIXED)
+    unsigned char size;
+    // one of INT_*, i.e. whether usable as length/count
+    unsigned char integer;
+    // whether allowed as container type
+    unsigned char container_type;
+} _marker_info_t;
+
+#define MARKER_INFO_COMMON \
+    [TYPE_NULL] = {VALUE_NO_DATA, 0, INT_NONE, 1},\
+    [TYPE_BOOL_TRUE] = {VALUE_NO_DATA, 0, INT_NONE, 1},\
+    [TYPE_BOOL_FALSE] = {VALUE_NO_DATA, 0, INT_NONE, 1},\
+    [TYPE_INT8] = {VALUE_FIXED, 1, INT_SIGNED, 1},\
+    [TYPE_UINT8] = {VALUE_FIXED, 1, INT_UNSIGNED, 1},\
+    [TYPE_INT16] = {VALUE_FIXED, 2, INT_SIGNED, 1},\
+    [TYPE_INT32] = {VALUE_FIXED, 4, INT_SIGNED, 1},\
+    [TYPE_INT64] = {VALUE_FIXED, 8, INT_SIGNED, 1},\
+    [TYPE_FLOAT32] = {VALUE_FIXED, 4, INT_NONE, 1},\
+    [TYPE_FLOAT64] = {VALUE_FIXED, 8, INT_NONE, 1},\
+    [TYPE_CHAR] = {VALUE_FIXED, 1, INT_NONE, 1},\
+    [TYPE_HIGH_PREC] = {VALUE_HIGH_PREC, 0, INT_NONE, 1},\
+    [TYPE_STRING] = {VALUE_STRING, 0, INT_NONE, 1},\
+    [ARRAY_START] = {VALUE_ARRAY, 0, INT_NONE, 1},\
+    [OBJECT_START] = {VALUE_OBJECT, 0, INT_NONE, 1}
+
+static const _marker_info_t _marker_info_bjdata[256] = {
+    MARKER_INFO_COMMON,
+    [TYPE_UINT16] = {VALUE_FIXED, 2, INT_UNSIGNED, 1},
+    [TYPE_UINT32] = {VALUE_FIXED, 4, INT_UNSIGNED, 1},
+    [TYPE_UINT64] = {VALUE_FIXED, 8, INT_UNSIGNED, 1},
+    [TYPE_FLOAT16] = {VALUE_FIXED, 2, INT_NONE, 1}
+};
+
+static const _marker_info_t _marker_info_ubjson[256] = {
+    MARKER_INFO_COMMON
+};
+
+typedef struct {
+    const unsigned char *buf;
+    // length of buf (limited to max_size)
+    Py_ssize_t len;
+    Py_ssize_t pos;
+    // lookup table for dialect
+    const _marker_info_t *markers;
+    int islittle;
+    int dialect;
+    // largest permitted count/length
+    long long limit;
+    // offset of first invalid item (set when one of the functions below returns non-zero)
+    Py_ssize_t error;
+} _validate_state_t;
+
+typedef struct {
+    int in_mapping;
+    // TYPE_NONE unless typed container
+    char type;
+    int counting;
+    // remaining values (if counting)
+    long long count;
+} _validate_frame_t;
+
+#define INVALID_AT(offset) {\
+    state->error = (offset);\
+    return 1;\
+}
+
+#define INVALID_IF(condition, offset) {\
+    if (condition) {\
+        INVALID_AT(offset);\
+    }\
+}
+
+/******************************************************************************/
+
+/* Reads a non-negative integer with the given marker (or, if marker is TYPE_NONE, the marker at the current position).
+ * Returns non-zero if invalid.
+ */
+static int _validate_count(_validate_state_t *state, char marker, long long *value) {
+    Py_ssize_t start = state->pos;
+    const _marker_info_t *info;
+    unsigned long long raw = 0;
+    const unsigned char *data;
+    int i;
+
+    if (TYPE_NONE == marker) {
+        INVALID_IF(state->pos >= state->len, start);
+        marker = (char)state->buf[state->pos++];
+    }
+    info = &state->markers[(unsigned char)marker];
+    INVALID_IF(INT_NONE == info->integer, start);
+    INVALID_IF(state->len - state->pos < info->size, start);
+
+    data = &state->buf[state->pos];
+    for (i = 0; i < info->size; i++) {
+        raw |= (unsigned long long)data[state->islittle ? i : (info->size - 1 - i)] << (8 * i);
+    }
+    if (INT_SIGNED == info->integer && info->size < 8 && (raw >> (8 * info->size - 1))) {
+        // negative
+        INVALID_AT(start);
+    }
+    INVALID_IF(raw > (unsigned long long)state->limit, start);
+
+    state->pos += info->size;
+    *value = (long long)raw;
+    return 0;
+}
+
+/* Returns offset of the first invalid UTF-8 sequence in str or -1 if valid. Rejects the same input as Python's (strict)
+ * UTF-8 decoder, i.e. overlong forms, surrogates and code points above U+10FFFF.
+ */
+static Py_ssize_t _utf8_invalid_at(const unsigned char *str, Py_ssize_t len) {
+    Py_ssize_t i = 0;
+    unsigned char c;
+    uint64_t word;
+    int trailing;
+
+    while (i < len) {
+        c = str[i];
+        // ASCII fast path: check 8 bytes at a time
+        if (c < 0x80) {
+            while (len - i >= 8) {
+                memcpy(&word, &str[i], 8);
+                if (word & UINT64_C(0x8080808080808080)) {
+                    break;
+                }
+                i += 8;
+            }
+            while (i < len && str[i] < 0x80) {
+                i++;
+            }
+            continue;
+        }
+
+        // first continuation byte has a restricted range for some lead bytes (no overlong forms / surrogates)
+        if (c >= 0xC2 && c <= 0xDF) {
+            trailing = 1;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            trailing = 2;
+            if (len - i < 2 ||
+                (0xE0 == c && str[i + 1] < 0xA0) ||
+                (0xED == c && str[i + 1] > 0x9F)) {
+                return i;
+            }
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            trailing = 3;
+            if (len - i < 2 ||
+                (0xF0 == c && str[i + 1] < 0x90) ||
+                (0xF4 == c && str[i + 1] > 0x8F)) {
+                return i;
+            }
+        } else {
+            return i;
+        }
+        if (len - i <= trailing) {
+            return i;
+        }
+        for (; trailing > 0; trailing--) {
+            if ((str[i + trailing] & 0xC0) != 0x80) {
+                return i;
+            }
+        }
+        i += 1 + (c >= 0xF0 ? 3 : (c >= 0xE0 ? 2 : 1));
+    }
+    return -1;
+}
+
+// Validates length-prefixed UTF-8 data (string, high precision number or object key). Returns non-zero if invalid.
+static int _validate_string(_validate_state_t *state, char length_marker) {
+    long long length;
+    Py_ssize_t invalid;
+
+    if (_validate_count(state, length_marker, &length)) {
+        return 1;
+    }
+    INVALID_IF(state->len - state->pos < length, state->pos);
+    invalid = _utf8_invalid_at(&state->buf[state->pos], (Py_ssize_t)length);
+    INVALID_IF(invalid >= 0, state->pos + invalid);
+    state->pos += (Py_ssize_t)length;
+    return 0;
+}
+
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+// Whether the len bytes at str equal (lower case) word, ignoring case
+static int _equal_ignoring_case(const unsigned char *str, Py_ssize_t len, const char *word) {
+    Py_ssize_t i;
+
+    for (i = 0; i < len && '\0' != word[i]; i++) {
+        if ((str[i] | 0x20) != (unsigned char)word[i]) {
+            return 0;
+        }
+    }
+    return i == len && '\0' == word[i];
+}
+
+/* Whether str is a decimal number string as accepted by Python's Decimal (e.g. "-1.5E+3", "Infinity" or "NaN"), except
+ * that surrounding whitespace, underscores and non-ASCII digits are not permitted.
+ */
+static int _is_decimal(const unsigned char *str, Py_ssize_t len) {
+    Py_ssize_t i = 0;
+    Py_ssize_t digits = 0;
+
+    if (i < len && ('+' == str[i] || '-' == str[i])) {
+        i++;
+    }
+    // special values, NaN optionally followed by diagnostic digits
+    if (_equal_ignoring_case(&str[i], len - i, "inf") || _equal_ignoring_case(&str[i], len - i, "infinity")) {
+        return 1;
+    }
+    if (len - i >= 3 && _equal_ignoring_case(&str[i], 3, "nan")) {
+        i += 3;
+    } else if (len - i >= 4 && _equal_ignoring_case(&str[i], 4, "snan")) {
+        i += 4;
+    } else {
+        for (; i < len && IS_DIGIT(str[i]); i++) {
+            digits++;
+        }
+        if (i < len && '.' == str[i]) {
+            for (i++; i < len && IS_DIGIT(str[i]); i++) {
+                digits++;
+            }
+        }
+        if (!digits) {
+            return 0;
+        }
+        if (i < len && ('e' == str[i] || 'E' == str[i])) {
+            i++;
+            if (i < len && ('+' == str[i] || '-' == str[i])) {
+                i++;
+            }
+            if (i >= len) {
+                return 0;
+            }
+        }
+    }
+    for (; i < len; i++) {
+        if (!IS_DIGIT(str[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Validates length-prefixed high precision number. Returns non-zero (with the payload as the error offset) if invalid.
+static int _validate_high_prec(_validate_state_t *state) {
+    long long length;
+
+    if (_validate_count(state, TYPE_NONE, &length)) {
+        return 1;
+    }
+    INVALID_IF(state->len - state->pos < length, state->pos);
+    INVALID_IF(!_is_decimal(&state->buf[state->pos], (Py_ssize_t)length), state->pos);
+    state->pos += (Py_ssize_t)length;
+    return 0;
+}
+
+/* Reads container parameters following a container start marker into frame (frame->count being 1 if not counting).
+ * nd_array is set if the container has ND-array dimensions. Returns non-zero if invalid.
+ */
+static int _validate_container_params(_validate_state_t *state, _validate_frame_t *frame, int *nd_array) {
+    const unsigned char *buf = state->buf;
+    Py_ssize_t dims_pos;
+    long long ndim, length, i;
+    char dim_type;
+
+    frame->type = TYPE_NONE;
+    frame->counting = 0;
+    frame->count = 1;
+    *nd_array = 0;
+
+    if (state->pos < state->len && CONTAINER_TYPE == buf[state->pos]) {
+        INVALID_IF(state->len - state->pos < 2 || !state->markers[buf[state->pos + 1]].container_type,
+                   state->pos + 1);
+        frame->type = (char)buf[state->pos + 1];
+        state->pos += 2;
+    }
+    if (state->pos < state->len && CONTAINER_COUNT == buf[state->pos]) {
+        frame->counting = 1;
+        state->pos++;
+        // ND-array dimensions (BJData arrays only)
+        if (DIALECT_BJDATA == state->dialect && !frame->in_mapping && state->pos < state->len &&
+            ARRAY_START == buf[state->pos]) {
+            dims_pos = state->pos++;
+            ndim = 0;
+            frame->count = 1;
+            dim_type = TYPE_NONE;
+            if (state->pos < state->len && CONTAINER_TYPE == buf[state->pos]) {
+                INVALID_IF(state->len - state->pos < 3 || CONTAINER_COUNT != buf[state->pos + 2], state->pos + 2);
+                dim_type = (char)buf[state->pos + 1];
+                state->pos += 2;
+            }
+            // typed or untyped with count
+            if (state->pos < state->len && CONTAINER_COUNT == buf[state->pos]) {
+                state->pos++;
+                if (_validate_count(state, TYPE_NONE, &ndim)) {
+                    return 1;
+                }
+                for (i = 0; i < ndim; i++) {
+                    if (_validate_count(state, dim_type, &length)) {
+                        return 1;
+                    }
+                    INVALID_IF(length > 0 && frame->count > state->limit / length, dims_pos);
+                    frame->count *= length;
+                }
+            } else {
+                for (;;) {
+                    INVALID_IF(state->pos >= state->len, state->pos);
+                    if (ARRAY_END == buf[state->pos]) {
+                        state->pos++;
+                        break;
+                    }
+                    if (_validate_count(state, TYPE_NONE, &length)) {
+                        return 1;
+                    }
+                    INVALID_IF(length > 0 && frame->count > state->limit / length, dims_pos);
+                    frame->count *= length;
+                    ndim++;
+                }
+            }
+            *nd_array = ndim > 0;
+            INVALID_IF(*nd_array && TYPE_NONE != frame->type && VALUE_FIXED != state->markers[(unsigned char)frame->type].value,
+                       dims_pos);
+        } else if (_validate_count(state, TYPE_NONE, &frame->count)) {
+            return 1;
+        }
+    } else {
+        INVALID_IF(TYPE_NONE != frame->type, state->pos);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+
+Py_ssize_t _bjdata_validate_buffer(const char *buf, Py_ssize_t len, int islittle, int dialect, Py_ssize_t max_depth,
+                                   Py_ssize_t max_size) {
+    _validate_state_t state_storage;
+    _validate_state_t *state = &state_storage;
+    _validate_frame_t stack_storage[VALIDATE_STACK_SIZE];
+    _validate_frame_t *stack = stack_storage;
+    _validate_frame_t *frame, *new_stack;
+    Py_ssize_t stack_size = VALIDATE_STACK_SIZE;
+    Py_ssize_t depth = 0;
+    Py_ssize_t marker_pos, size;
+    const _marker_info_t *info;
+    char marker;
+    int nd_array, in_mapping;
+    Py_ssize_t result = VALIDATE_OK;
+
+    state->buf = (const unsigned char *)buf;
+    state->len = (max_size >= 0) ? MIN(len, max_size) : len;
+    state->pos = 0;
+    state->markers = (DIALECT_UBJSON == dialect) ? _marker_info_ubjson : _marker_info_bjdata;
+    state->islittle = islittle;
+    state->dialect = dialect;
+    state->limit = (max_size >= 0) ? (long long)max_size : VALIDATE_MAX_COUNT;
+    state->error = VALIDATE_OK;
+
+// record offset of first invalid item and finish
+#define INVALID_RESULT(offset) {\
+    result = (offset);\
+    goto done;\
+}
+
+    if (state->len < 1) {
+        INVALID_RESULT(0);
+    }
+    marker_pos = 0;
+    marker = (char)state->buf[state->pos++];
+
+    for (;;) {
+        // validate value (with marker at marker_pos and data starting at current position)
+        info = &state->markers[(unsigned char)marker];
+        switch (info->value) {
+            case VALUE_NO_DATA:
+                break;
+            case VALUE_FIXED:
+                if (state->len - state->pos < info->size ||
+                    (TYPE_CHAR == marker && state->buf[state->pos] >= 0x80)) {
+                    INVALID_RESULT(state->pos);
+                }
+                state->pos += info->size;
+                break;
+            case VALUE_STRING:
+                if (_validate_string(state, TYPE_NONE)) {
+                    INVALID_RESULT(state->error);
+                }
+                break;
+            case VALUE_HIGH_PREC:
+                if (_validate_high_prec(state)) {
+                    INVALID_RESULT(state->error);
+                }
+                break;
+            case VALUE_ARRAY:
+            case VALUE_OBJECT:
+                if (max_depth >= 0 && depth >= max_depth) {
+                    INVALID_RESULT(marker_pos);
+                }
+                if (depth >= stack_size) {
+                    if (stack_storage == stack) {
+                        new_stack = malloc(sizeof(_validate_frame_t) * stack_size * 2);
+                        if (NULL != new_stack) {
+                            memcpy(new_stack, stack, sizeof(_validate_frame_t) * stack_size);
+                        }
+                    } else {
+                        new_stack = realloc(stack, sizeof(_validate_frame_t) * stack_size * 2);
+                    }
+                    if (NULL == new_stack) {
+                        INVALID_RESULT(VALIDATE_FAILED);
+                    }
+                    stack = new_stack;
+                    stack_size *= 2;
+                }
+                frame = &stack[depth];
+                frame->in_mapping = (VALUE_OBJECT == info->value);
+                if (_validate_container_params(state, frame, &nd_array)) {
+                    INVALID_RESULT(state->error);
+                }
+                // packed (or no data) array, i.e. no individual values to scan
+                if (!frame->in_mapping && frame->counting && TYPE_NONE != frame->type &&
+                    (VALUE_FIXED == state->markers[(unsigned char)frame->type].value ||
+                     VALUE_NO_DATA == state->markers[(unsigned char)frame->type].value)) {
+                    size = state->markers[(unsigned char)frame->type].size;
+                    if (size > 0 && frame->count > (state->len - state->pos) / size) {
+                        INVALID_RESULT(state->pos);
+                    }
+                    state->pos += (Py_ssize_t)(frame->count * size);
+                } else {
+                    depth++;
+                }
+                break;
+            default:
+                INVALID_RESULT(marker_pos);
+        }
+
+        // find next value
+        for (;;) {
+            if (depth < 1) {
+                goto done;
+            }
+            frame = &stack[depth - 1];
+            if (frame->counting && frame->count < 1) {
+                depth--;
+                continue;
+            }
+            marker_pos = state->pos;
+            // typed array: values have no marker
+            if (!frame->in_mapping && TYPE_NONE != frame->type) {
+                marker = frame->type;
+                frame->count--;
+                break;
+            }
+            if (state->pos >= state->len) {
+                INVALID_RESULT(state->pos);
+            }
+            marker = (char)state->buf[state->pos++];
+            in_mapping = frame->in_mapping;
+            if (TYPE_NOOP == marker &&
+                !(in_mapping && frame->counting &&
+                  VALUE_NO_DATA == state->markers[(unsigned char)frame->type].value)) {
+                // skip any run of no-ops (e.g. alignment padding) at once
+                while (state->pos < state->len && TYPE_NOOP == state->buf[state->pos]) {
+                    state->pos++;
+                }
+                continue;
+            }
+            if (!frame->counting && (in_mapping ? OBJECT_END : ARRAY_END) == marker) {
+                depth--;
+                continue;
+            }
+            if (in_mapping) {
+                state->pos = marker_pos;
+                if (_validate_string(state, TYPE_NONE)) {
+                    INVALID_RESULT(state->error);
+                }
+                marker_pos = state->pos;
+                if (TYPE_NONE == frame->type) {
+                    if (state->pos >= state->len) {
+                        INVALID_RESULT(state->pos);
+                    }
+                    marker = (char)state->buf[state->pos++];
+                } else {
+                    marker = frame->type;
+                }
+            }
+            if (frame->counting) {
+                frame->count--;
+            }
+            break;
+        }
+    }
+
+#undef INVALID_RESULT
+
+done:
+    if (stack_storage != stack) {
+        free(stack);
+    }
+    return result;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2020-2022 Qianqian Fang <q.fang at neu.edu>. All rights reserved.
+ * Copyright (c) 2016-2019 Iotic Labs Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://github.com/NeuroJSON/pybj/blob/master/LICENSE
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <Python.h>
+
+/******************************************************************************/
+
+// Result of _bjdata_validate_buffer if value is valid
+#define VALIDATE_OK (-1)
+// Result of _bjdata_validate_buffer if out of memory (no exception is set since does not require the GIL)
+#define VALIDATE_FAILED (-2)
+
+/* Checks that buf starts with a valid value (without decoding it). Limits are ignored if negative. Returns VALIDATE_OK,
+ * VALIDATE_FAILED or the offset of the first invalid item. See decoder.validate (pure Python version) for details.
+ */
+extern Py_ssize_t _bjdata_validate_buffer(const char *buf, Py_ssize_t len, int islittle, int dialect,
+                                          Py_ssize_t max_depth, Py_ssize_t max_size);
+
+#if defined (__cplusplus)
+}
+#endif
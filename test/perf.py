@@ -89,6 +89,28 @@ else:
             return bjd_dec(obj)
     TEST_LIBS.append(PyUbjson)
 
+    class PyUbjsonCounted(PyUbjson):
+
+        @staticmethod
+        def name():
+            return 'py-bjdata %s (container_count)' % bjd_version
+
+        @staticmethod
+        def encode(obj):
+            return bjd_enc(obj, container_count=True)
+    TEST_LIBS.append(PyUbjsonCounted)
+
+    class PyUbjsonTypedObjects(PyUbjson):
+
+        @staticmethod
+        def name():
+            return 'py-bjdata %s (typed_objects)' % bjd_version
+
+        @staticmethod
+        def encode(obj):
+            return bjd_enc(obj, typed_objects=True)
+    TEST_LIBS.append(PyUbjsonTypedObjects)
+
 # simplebjdata
 
 try:
@@ -119,6 +141,18 @@ else:
 
 # ------------------------------------------------------------------------------
 
+# Inputs which can be specified by name instead of a JSON file
+GENERATED_INPUTS = {
+    # single object with many members
+    'WideObject10k': lambda: dict(('key%05d' % i, i) for i in range(10000)),
+    'WideObject100k': lambda: dict(('key%06d' % i, i) for i in range(100000)),
+    # many objects with the same keys
+    'Records10k': lambda: [{'id': i, 'name': 'name%d' % i, 'score': i * 0.5, 'valid': True} for i in range(10000)],
+    # maps of metrics, i.e. values all of one numeric type (see typed_objects)
+    'FloatMetrics10k': lambda: dict(('metric%05d' % i, i * 0.25) for i in range(10000)),
+    'IntMetrics10k': lambda: dict(('metric%05d' % i, i * 7) for i in range(10000))
+}
+
 
 @contextmanager
 def profiled(name=None, no_profile=False):
@@ -139,9 +173,13 @@ def profiled(name=None, no_profile=False):
 def test_all_with(name, repeats=1000):
     no_profile = True
 
-    with open(name, 'r') as in_file:
-        obj = j_load(in_file)
-        row_start = '"%s",%d' % (name, in_file.tell())
+    if name in GENERATED_INPUTS:
+        obj = GENERATED_INPUTS[name]()
+        row_start = '"%s",%d' % (name, len(j_enc(obj)))
+    else:
+        with open(name, 'r') as in_file:
+            obj = j_load(in_file)
+            row_start = '"%s",%d' % (name, in_file.tell())
 
     gc.disable()
     for lib in TEST_LIBS:
@@ -160,7 +198,8 @@ def test_all_with(name, repeats=1000):
         dec_time = time() - start
         gc.collect()
 
-        print('%s,"%s",%.3f,%.3f' % (row_start, lib.name(), enc_time, dec_time))
+        # (encoded size last, e.g. to compare that of typed_objects)
+        print('%s,"%s",%.3f,%.3f,%d' % (row_start, lib.name(), enc_time, dec_time, len(encoded)))
     gc.enable()
 
 
@@ -173,6 +212,7 @@ def main():
             raise ValueError
     except ValueError:
         print('USAGE: perf.py REPEATS INPUT1 [INPUT2] ..')
+        print('INPUT is either a JSON file or one of: %s' % ', '.join(sorted(GENERATED_INPUTS)))
         return 1
 
     for name in argv[2:]:
@@ -16,27 +16,39 @@
 
 from sys import version_info, getrecursionlimit, setrecursionlimit
 from functools import partial
-from io import BytesIO, SEEK_END
+from io import BytesIO, RawIOBase, SEEK_END
 from unittest import TestCase, skipUnless
 from pprint import pformat
 from decimal import Decimal
 from struct import pack
-from collections import OrderedDict
-
-from bjdata import (dump as bjddump, dumpb as bjddumpb, load as bjdload, loadb as bjdloadb, EncoderException,
-                    DecoderException, EXTENSION_ENABLED)
+from collections import OrderedDict, namedtuple, deque
+from enum import Enum, IntEnum
+from uuid import UUID
+from pathlib import PurePosixPath
+from os import close, remove
+from os.path import exists
+from tempfile import mkstemp
+
+from bjdata import (dump as bjddump, dumpb as bjddumpb, dumpb_iov as bjddumpb_iov, load as bjdload, loadb as bjdloadb,
+                    validate as bjdvalidate, EncoderException, DecoderException, RawBJData, preencode,
+                    namedtuple_as_object, slots_as_object, dump_shared, load_shared, EXTENSION_ENABLED)
 from bjdata.markers import (TYPE_NULL, TYPE_NOOP, TYPE_BOOL_TRUE, TYPE_BOOL_FALSE, TYPE_INT8, TYPE_UINT8, TYPE_INT16,
                             TYPE_INT32, TYPE_INT64, TYPE_UINT16, TYPE_UINT32, TYPE_UINT64, TYPE_FLOAT16, TYPE_FLOAT32, TYPE_FLOAT64,
                             TYPE_HIGH_PREC, TYPE_CHAR, TYPE_STRING, OBJECT_START, OBJECT_END, ARRAY_START, ARRAY_END,
                             CONTAINER_TYPE, CONTAINER_COUNT)
-from bjdata.compat import INTEGER_TYPES
+from bjdata.compat import INTEGER_TYPES, Sequence
 # Pure Python versions
-from bjdata.encoder import dump as bjdpuredump, dumpb as bjdpuredumpb
-from bjdata.decoder import load as bjdpureload, loadb as bjdpureloadb
+from bjdata.encoder import dump as bjdpuredump, dumpb as bjdpuredumpb, dumpb_iov as bjdpuredumpb_iov
+from bjdata.decoder import load as bjdpureload, loadb as bjdpureloadb, validate as bjdpurevalidate
 import numpy as np
 from numpy import array as ndarray, int8 as npint8
 from array import array as typedarray
 
+try:
+    from multiprocessing import shared_memory
+except ImportError:  # pragma: no cover
+    shared_memory = None
+
 PY2 = version_info[0] < 3
 
 if PY2:  # pragma: no cover
@@ -51,6 +63,10 @@ else:  # pragma: no cover
 
 class TestEncodeDecodePlain(TestCase):  # pylint: disable=too-many-public-methods
 
+    # whether encoding/decoding nesting depth is limited by the interpreter recursion limit
+    RECURSIVE_ENCODER = True
+    RECURSIVE_DECODER = True
+
     @staticmethod
     def bjdloadb(raw, *args, **kwargs):
         return bjdpureloadb(raw, *args, **kwargs)
@@ -59,6 +75,18 @@ class TestEncodeDecodePlain(TestCase):  # pylint: disable=too-many-public-method
     def bjddumpb(obj, *args, **kwargs):
         return bjdpuredumpb(obj, *args, **kwargs)
 
+    @staticmethod
+    def bjddumpb_iov(obj, *args, **kwargs):
+        return bjdpuredumpb_iov(obj, *args, **kwargs)
+
+    @staticmethod
+    def bjdloadb_segments(segments, *args, **kwargs):
+        return bjdpureloadb(segments, *args, **kwargs)
+
+    @staticmethod
+    def bjdvalidate(raw, *args, **kwargs):
+        return bjdpurevalidate(raw, *args, **kwargs)
+
     @staticmethod
     def __format_in_out(obj, encoded):
         return '\nInput:\n%s\nOutput (%d):\n%s' % (pformat(obj), len(encoded), encoded)
@@ -434,6 +462,18 @@ class TestEncodeDecodePlain(TestCase):  # pylint: disable=too-many-public-method
 
         self.assertEqual(self.bjdloadb(self.bjddumpb(obj1), object_pairs_hook=OrderedDict), obj1)
 
+    def test_object_wide(self):
+        # more members than dicts are presized for
+        check_enc_dec = partial(self.check_enc_dec, container_count=True)
+        check_enc_dec(dict(('key%d' % i, i) for i in range(70000)))
+
+        # keys repeated across objects, including ones which are not cached (non-ASCII / long)
+        keys = ['a', 'key', 'key\x00', u(r'\u00a9'), 'long' * 16] + ['k%d' % i for i in range(1000)]
+        records = [dict((key, i) for key in keys[i % 3:]) for i in range(20)]
+        for opts in ({'container_count': False}, {'container_count': True}):
+            check_enc_dec(records, **opts)
+            check_enc_dec(records, object_pairs_hook=OrderedDict, **opts)
+
     def test_object_fixed(self):
         raw_start = OBJECT_START + CONTAINER_TYPE + TYPE_INT8 + CONTAINER_COUNT + TYPE_UINT8
 
@@ -475,6 +515,217 @@ class TestEncodeDecodePlain(TestCase):  # pylint: disable=too-many-public-method
                                    TYPE_NOOP +
                                    TYPE_UINT8 + b'\x01' + 'a'.encode('utf-8') + TYPE_NULL), {'a': None})
 
+    def test_dict_class(self):
+        obj = OrderedDict((('b', 1), ('a', [{'d': None, 'c': OrderedDict()}]), ('', {})))
+        for opts in ({'container_count': False}, {'container_count': True}):
+            encoded = self.bjddumpb(obj, **opts)
+            for dict_class in (OrderedDict, dict, None):
+                decoded = self.bjdloadb(encoded, dict_class=dict_class)
+                self.assertEqual(decoded, obj)
+                self.assertIs(type(decoded['a'][0]), dict_class or dict)
+                if dict_class is OrderedDict:
+                    self.assertEqual(list(decoded), ['b', 'a', ''])
+                    self.assertEqual(list(decoded['a'][0]), ['d', 'c'])
+            # object_hook is still applied
+            self.assertEqual(self.bjdloadb(encoded, dict_class=OrderedDict, object_hook=list), ['b', 'a', ''])
+        # typed (no data) object
+        self.assertEqual(self.bjdloadb(OBJECT_START + CONTAINER_TYPE + TYPE_NULL + CONTAINER_COUNT + TYPE_UINT8 + b'\x02' +
+                                       TYPE_UINT8 + b'\x01' + b'a' + TYPE_UINT8 + b'\x01' + b'b', dict_class=OrderedDict),
+                         OrderedDict((('a', None), ('b', None))))
+
+        with self.assertRaises(TypeError):
+            self.bjdloadb(self.bjddumpb({}), dict_class=1)
+        with self.assertRaises(ValueError):
+            self.bjdloadb(self.bjddumpb({}), dict_class=OrderedDict, object_pairs_hook=OrderedDict)
+        # exceptions from creating or populating the mapping are propagated
+        with self.assertRaises(TypeError):
+            self.bjdloadb(self.bjddumpb({'a': 1}), dict_class=list)
+
+    def test_array_as(self):
+        obj = [1, [], [2, [None, True], {'a': [3.5]}], b'xy']
+        expected = (1, (), (2, (None, True), {'a': (3.5,)}), b'xy')
+        for opts in ({'container_count': False}, {'container_count': True}):
+            encoded = self.bjddumpb(obj, **opts)
+            self.assertEqual(self.bjdloadb(encoded, array_as='list'), obj)
+            decoded = self.bjdloadb(encoded, array_as='tuple')
+            self.assertEqual(decoded, expected)
+            self.assertIs(type(decoded[2][2]['a']), tuple)
+        # typed (no data) array
+        self.assertEqual(self.bjdloadb(ARRAY_START + CONTAINER_TYPE + TYPE_BOOL_TRUE + CONTAINER_COUNT + TYPE_UINT8 +
+                                       b'\x02', array_as='tuple'), (True, True))
+
+        with self.assertRaises(ValueError):
+            self.bjdloadb(self.bjddumpb([]), array_as='set')
+
+    def test_records_rows(self):
+        records = [{'x': 1, 'y': 'a'}, {'x': 2, 'y': None}, {'x': 3.5, 'y': [1, {'z': 2}]}]
+        for opts in ({'container_count': False}, {'container_count': True}):
+            encoded = self.bjddumpb(records, **opts)
+            self.assertEqual(self.bjdloadb(encoded), records)
+            self.assertEqual(self.bjdloadb(encoded, records='rows'),
+                             (('x', 'y'), [(1, 'a'), (2, None), (3.5, [1, {'z': 2}])]))
+            self.assertEqual(self.bjdloadb(encoded, records='rows', array_as='tuple'),
+                             (('x', 'y'), ((1, 'a'), (2, None), (3.5, (1, {'z': 2})))))
+            # nested
+            self.assertEqual(self.bjdloadb(self.bjddumpb({'t': records[:1], 'u': [records[:1]]}, **opts),
+                                           records='rows'),
+                             {'t': (('x', 'y'), [(1, 'a')]), 'u': [(('x', 'y'), [(1, 'a')])]})
+
+            # not records: mismatching keys (or key order) / non-object / empty after some rows
+            for obj in (records + [{'y': 1, 'x': 2}], records + [{'x': 1}], records + [{'x': 1, 'z': 2}],
+                        records + [1], records + [[]], records + [{}], [{}, {}], [], [1, records[0]]):
+                self.assertEqual(self.bjdloadb(self.bjddumpb(obj, **opts), records='rows'), obj)
+            self.assertEqual(self.bjdloadb(self.bjddumpb(records + [1], **opts), records='rows', array_as='tuple'),
+                             tuple(records[:2]) + ({'x': 3.5, 'y': (1, {'z': 2})}, 1))
+
+            # only objects decoded as dict are records
+            self.assertEqual(self.bjdloadb(encoded, records='rows', object_hook=lambda obj: obj.get('x')), [1, 2, 3.5])
+            self.assertEqual(self.bjdloadb(encoded, records='rows', dict_class=OrderedDict), records)
+
+        with self.assertRaises(ValueError):
+            self.bjdloadb(self.bjddumpb([]), records='columns')
+
+    def test_include_exclude(self):
+        obj = {'a': 1, 'b': {'c': 2, 'd': [3, {'e': 4}]}, 'f': 'x'}
+        for opts in ({'container_count': False}, {'container_count': True}):
+            encoded = self.bjddumpb(obj, **opts)
+            self.assertEqual(self.bjdloadb(encoded, include=['a', 'b.c']), {'a': 1, 'b': {'c': 2}})
+            self.assertEqual(self.bjdloadb(encoded, include=[('b', 'd')]), {'b': {'d': [3, {'e': 4}]}})
+            # paths continue through arrays
+            self.assertEqual(self.bjdloadb(encoded, include=['b.d.e']), {'b': {'d': [3, {'e': 4}]}})
+            self.assertEqual(self.bjdloadb(encoded, include=['b.d.x']), {'b': {'d': [3, {}]}})
+            # a path includes everything below it
+            self.assertEqual(self.bjdloadb(encoded, include=['b', 'b.c']), {'b': obj['b']})
+            self.assertEqual(self.bjdloadb(encoded, include='f'), {'f': 'x'})
+            self.assertEqual(self.bjdloadb(encoded, include=[]), {})
+            self.assertEqual(self.bjdloadb(encoded, exclude=['b.d', 'f']), {'a': 1, 'b': {'c': 2}})
+            self.assertEqual(self.bjdloadb(encoded, exclude=['b.d.e']), {'a': 1, 'b': {'c': 2, 'd': [3, {}]}, 'f': 'x'})
+            self.assertEqual(self.bjdloadb(encoded, include=['a', 'b.c'], object_pairs_hook=OrderedDict),
+                             OrderedDict((('a', 1), ('b', OrderedDict((('c', 2),))))))
+
+            # array of records
+            records = [{'id': i, 'name': 'n%d' % i, 'data': {'x': [i] * 3}} for i in range(5)]
+            self.assertEqual(self.bjdloadb(self.bjddumpb(records, **opts), include=['id', 'data.x']),
+                             [{'id': i, 'data': {'x': [i] * 3}} for i in range(5)])
+
+            # skipped values of every type
+            skipped = {'none': None, 'bool': [True, False], 'int': [-1, 2**7, 2**15, 2**31, 2**63 - 1, 2**64 - 1],
+                       'float': [1.5, 1e300], 'str': ['', 'a' * 100000], 'char': 'c', 'dec': Decimal('1.5'),
+                       'bytes': b'xyz', 'array': ndarray([[1, 2], [3, 4]], dtype='<f4'), 'nested': [[[{'a': []}]]]}
+            encoded = self.bjddumpb({'k': 1, 'skipped': skipped, 'last': 2}, **opts)
+            self.assertEqual(self.bjdloadb(encoded, include=['k', 'last']), {'k': 1, 'last': 2})
+            self.assertEqual(self.bjdloadb(encoded, exclude=['skipped']), {'k': 1, 'last': 2})
+            # truncated skipped value
+            with self.assert_raises_regex(DecoderException, 'Insufficient'):
+                self.bjdloadb(self.bjddumpb({'a': 'x' * 100, 'b': 1}, **opts)[:50], include=['b'])
+            # nesting limit applies to skipped values too
+            encoded = self.bjddumpb({'a': [[[1]]], 'b': 1}, **opts)
+            self.assertEqual(self.bjdloadb(encoded, include=['b'], max_depth=4), {'b': 1})
+            with self.assert_raises_regex(DecoderException, 'max_depth'):
+                self.bjdloadb(encoded, include=['b'], max_depth=3)
+
+        # typed object (without data) & typed array of strings
+        encoded = (OBJECT_START + CONTAINER_TYPE + TYPE_NULL + CONTAINER_COUNT + TYPE_UINT8 + b'\x02' +
+                   TYPE_UINT8 + b'\x01a' + TYPE_UINT8 + b'\x01b')
+        self.assertEqual(self.bjdloadb(encoded, exclude=['a']), {'b': None})
+        encoded = (OBJECT_START + TYPE_UINT8 + b'\x01a' + ARRAY_START + CONTAINER_TYPE + TYPE_STRING + CONTAINER_COUNT +
+                   TYPE_UINT8 + b'\x02' + TYPE_UINT8 + b'\x01x' + TYPE_UINT8 + b'\x02\xff\xff' + TYPE_UINT8 + b'\x01b' +
+                   TYPE_INT8 + b'\x05' + OBJECT_END)
+        # skipped string not decoded (hence no utf-8 error)
+        self.assertEqual(self.bjdloadb(encoded, include=['b']), {'b': 5})
+
+        for include, exclude, exception in ((['a'], ['b'], ValueError), ([()], None, ValueError),
+                                            ([('a', 1)], None, TypeError), (None, [1], TypeError)):
+            with self.assertRaises(exception):
+                self.bjdloadb(self.bjddumpb({}), include=include, exclude=exclude)
+
+    def test_raw_depth(self):
+        obj = {'a': 1, 'b': {'c': [1, 2, {'d': 'x'}], 'e': None}, 'f': [[1], []]}
+        for opts in ({'container_count': False}, {'container_count': True}):
+            encoded = self.bjddumpb(obj, **opts)
+            self.assertEqual(bytes(self.bjdloadb(encoded, raw_depth=0)), encoded)
+            decoded = self.bjdloadb(encoded, raw_depth=1)
+            self.assertEqual(decoded['a'], 1)
+            self.assertEqual(bytes(decoded['b']), self.bjddumpb(obj['b'], **opts))
+            self.assertEqual(bytes(decoded['f']), self.bjddumpb(obj['f'], **opts))
+            # raw values are written as-is
+            self.assertEqual(self.bjddumpb(decoded, **opts), encoded)
+            self.assertEqual(self.bjdloadb(bytes(decoded['b'])), obj['b'])
+            decoded = self.bjdloadb(encoded, raw_depth=2)
+            self.assertEqual(decoded['b']['e'], None)
+            self.assertIsInstance(decoded['b']['c'], RawBJData)
+            self.assertEqual(self.bjddumpb(decoded, **opts), encoded)
+            self.assertEqual(self.bjdloadb(encoded, raw_depth=4), obj)
+
+            decoded = self.bjdloadb(encoded, raw_paths=['b.c', 'a'])
+            self.assertEqual(bytes(decoded['a']), self.bjddumpb(1))
+            self.assertEqual(self.bjdloadb(bytes(decoded['b']['c'])), obj['b']['c'])
+            self.assertEqual(decoded['f'], obj['f'])
+            self.assertEqual(self.bjddumpb(decoded, **opts), encoded)
+            # raw_paths continue through arrays
+            decoded = self.bjdloadb(encoded, raw_paths='b.c.d')
+            self.assertEqual(bytes(decoded['b']['c'][2]['d']), self.bjddumpb('x'))
+
+        # within typed containers (the value is not preceded by its marker)
+        encoded = (ARRAY_START + CONTAINER_TYPE + TYPE_INT8 + CONTAINER_COUNT + TYPE_UINT8 + b'\x02\x05\x06')
+        self.assertEqual(list(self.bjdloadb(encoded, raw_depth=1)), [5, 6])
+        encoded = (OBJECT_START + CONTAINER_TYPE + TYPE_UINT8 + CONTAINER_COUNT + TYPE_UINT8 + b'\x01' + TYPE_UINT8 +
+                   b'\x01a\x07')
+        self.assertEqual(bytes(self.bjdloadb(encoded, raw_paths=['a'])['a']), TYPE_UINT8 + b'\x07')
+        self.assertEqual(bytes(self.bjdloadb(self.bjddumpb([[b'xy']]), raw_depth=1)[0]), self.bjddumpb([b'xy']))
+
+        # invalid raw values are still rejected
+        with self.assert_raises_regex(DecoderException, 'Insufficient'):
+            self.bjdloadb(self.bjddumpb({'a': [1, 2, 3]})[:-3], raw_depth=1)
+        with self.assertRaises(ValueError):
+            self.bjdloadb(self.bjddumpb({}), raw_depth=-1)
+        self.assertEqual(RawBJData(b'Z'), RawBJData(bytearray(b'Z')))
+        self.assertNotEqual(RawBJData(b'Z'), RawBJData(b'T'))
+
+        # raw values have the byte order & dialect they were decoded with
+        for opts in ({'islittle': False}, {'dialect': 'ubjson'}, {'islittle': False, 'dialect': 'ubjson'}):
+            encoded = self.bjddumpb(obj, **opts)
+            decoded = self.bjdloadb(encoded, raw_depth=1, **opts)
+            self.assertEqual((decoded['b'].islittle, decoded['b'].dialect),
+                             (0 if 'islittle' in opts else 1, opts.get('dialect', 'bjdata')))
+            self.assertEqual(self.bjddumpb(decoded, **opts), encoded)
+            with self.assert_raises_regex(EncoderException, 'different dialect or byte order'):
+                self.bjddumpb(decoded)
+
+    def test_preencode(self):
+        static = {'device': 'x' * 100, 'calibration': [1.5, 2.5, None]}
+        for opts in ({}, {'container_count': True}, {'islittle': False, 'dialect': 'ubjson'}):
+            raw = preencode(static, **opts)
+            self.assertIsInstance(raw, RawBJData)
+            self.assertEqual(self.bjddumpb({'seq': 1, 'static': raw}, **opts),
+                             self.bjddumpb({'seq': 1, 'static': static}, **opts))
+            self.assertEqual(self.bjddumpb([raw, raw], **opts), self.bjddumpb([static, static], **opts))
+            self.assertEqual(RawBJData(bytearray(raw.data), islittle=opts.get('islittle', True),
+                                       dialect=opts.get('dialect', 'bjdata')), raw)
+
+        self.assertEqual(self.bjddumpb([RawBJData(TYPE_INT16 + b'\x01\x02')]), ARRAY_START + TYPE_INT16 + b'\x01\x02' +
+                         ARRAY_END)
+        # contents are validated on construction
+        for data in (b'', TYPE_INT16 + b'\x01', ARRAY_START, TYPE_NULL + TYPE_NULL, b'\xff', TYPE_UINT8 + b'\x01\x02',
+                     TYPE_HIGH_PREC + TYPE_UINT8 + b'\x03abc'):
+            with self.assertRaises(ValueError):
+                RawBJData(data)
+        with self.assertRaises(ValueError):
+            # float16 is not part of UBJSON
+            RawBJData(TYPE_FLOAT16 + b'\x00\x00', dialect='ubjson')
+
+        # written only by an encoder with the same byte order & dialect
+        raw = preencode([1000, 1.5])
+        self.assertEqual((raw.islittle, raw.dialect), (1, 'bjdata'))
+        self.assertNotEqual(raw, RawBJData(raw.data, islittle=False))
+        for opts in ({'islittle': False}, {'dialect': 'ubjson'}):
+            with self.assert_raises_regex(EncoderException, 'different dialect or byte order'):
+                self.bjddumpb([raw], **opts)
+            with self.assert_raises_regex(EncoderException, 'different dialect or byte order'):
+                self.bjddumpb({'a': RawBJData(TYPE_NULL)}, **opts)
+        self.assertEqual(self.bjddumpb(RawBJData(TYPE_NULL, islittle=False, dialect='ubjson'), islittle=False,
+                                       dialect='ubjson'), TYPE_NULL)
+
     def test_intern_object_keys(self):
         encoded = self.bjddumpb({'asdasd': 1, 'qwdwqd': 2})
         mapping2 = self.bjdloadb(encoded, intern_object_keys=True)
@@ -492,14 +743,25 @@ class TestEncodeDecodePlain(TestCase):  # pylint: disable=too-many-public-method
         mapping = {'a': 1, 'b': 2}
         mapping['c'] = mapping
 
-        for container in (sequence, mapping):
+        # circular reference via deeply nested container
+        deep = current = [1]
+        for _ in range(100):
+            new_list = [2]
+            current.append({'a': new_list})
+            current = new_list
+        current.append(deep)
+
+        for container in (sequence, mapping, deep):
             with self.assertRaises(ValueError):
                 self.bjddumpb(container)
+        current.pop()
 
         # Refering to the same container multiple times is valid however
         sequence = [1, 2, 3]
         mapping = {'a': 1, 'b': 2}
         self.check_enc_dec([sequence, mapping, sequence, mapping])
+        current.extend((sequence, mapping, sequence, mapping))
+        self.check_enc_dec(deep)
 
     def test_unencodable(self):
         with self.assertRaises(EncoderException):
@@ -529,12 +791,35 @@ class TestEncodeDecodePlain(TestCase):  # pylint: disable=too-many-public-method
                 current.append(new_list)
                 current = new_list
 
-            with self.assert_raises_regex(RuntimeError, 'recursion'):
-                self.bjddumpb(obj)
+            if self.RECURSIVE_ENCODER:
+                with self.assert_raises_regex(RuntimeError, 'recursion'):
+                    self.bjddumpb(obj)
+            else:
+                depth = getrecursionlimit() * 50
+                obj = current = []
+                for _ in range(depth - 1):
+                    new_list = []
+                    current.append(new_list)
+                    current = new_list
+                self.assertEqual(self.bjddumpb(obj), ARRAY_START * depth + ARRAY_END * depth)
+                # default function results are still encoded recursively
+                with self.assert_raises_regex(RuntimeError, 'recursion'):
+                    self.bjddumpb(self, default=lambda obj: obj)
 
             raw = ARRAY_START * (getrecursionlimit() * 2)
-            with self.assert_raises_regex(RuntimeError, 'recursion'):
-                self.bjdloadb(raw)
+            if self.RECURSIVE_DECODER:
+                with self.assert_raises_regex(RuntimeError, 'recursion'):
+                    self.bjdloadb(raw)
+            else:
+                depth = getrecursionlimit() * 50
+                raw = ARRAY_START * depth + ARRAY_END * depth
+                current = self.bjdloadb(raw)
+                for _ in range(depth - 1):
+                    self.assertEqual(len(current), 1)
+                    current = current[0]
+                self.assertEqual(current, [])
+                with self.assert_raises_regex(DecoderException, 'max_depth'):
+                    self.bjdloadb(raw, max_depth=depth - 1)
         finally:
             setrecursionlimit(old_limit)
 
@@ -564,6 +849,414 @@ class TestEncodeDecodePlain(TestCase):  # pylint: disable=too-many-public-method
         self.assertEqual(dumpb_default(obj1), self.bjddumpb(obj2))
         self.assertEqual(dumpb_default(obj3), self.bjddumpb(obj4))
 
+    def test_encoders(self):
+        class Custom(object):
+            def __init__(self, value):
+                self.value = value
+
+        class SubCustom(Custom):
+            pass
+
+        class Color(Enum):
+            RED = 'r'
+
+        class Level(IntEnum):
+            HIGH = 3
+
+        Point = namedtuple('Point', 'x y')
+
+        encoders = {Custom: lambda obj: {'custom': obj.value}, set: sorted}
+        for opts in ({}, {'container_count': True}, {'sort_keys': True}):
+            encoded = self.bjddumpb([Custom(1), SubCustom([Custom(2)]), {3, 1}], encoders=encoders, **opts)
+            self.assertEqual(encoded, self.bjddumpb([{'custom': 1}, {'custom': [{'custom': 2}]}, [1, 3]], **opts))
+            # namedtuples are arrays unless registered
+            self.assertEqual(self.bjddumpb([Point(1, 2)], **opts), self.bjddumpb([[1, 2]], **opts))
+            self.assertEqual(self.bjddumpb([Point(1, 'y')], encoders={Point: namedtuple_as_object}, **opts),
+                             self.bjddumpb([{'x': 1, 'y': 'y'}], **opts))
+            # built-in encoders
+            uuid = UUID('12345678123456781234567812345678')
+            self.assertEqual(self.bjddumpb([Color.RED, Level.HIGH, uuid, PurePosixPath('/a/b')], **opts),
+                             self.bjddumpb(['r', 3, str(uuid), '/a/b'], **opts))
+            # registered encoders take precedence over built-in ones & the type table
+            self.assertEqual(self.bjddumpb([Color.RED, OrderedDict(a=1)], encoders={Enum: lambda obj: obj.name,
+                                                                                    OrderedDict: list}, **opts),
+                             self.bjddumpb(['RED', ['a']], **opts))
+
+        # used ahead of default
+        self.assertEqual(self.bjddumpb([Custom(1), {2}], encoders=encoders, default=lambda obj: 'default'),
+                         self.bjddumpb([{'custom': 1}, [2]]))
+        # built-in encoders are not used if default is given (which still receives these types)
+        self.assertEqual(self.bjddumpb([Color.RED, UUID(int=5), PurePosixPath('/a'), Level.HIGH],
+                                       default=lambda obj: {'custom': type(obj).__name__}),
+                         self.bjddumpb([{'custom': 'Color'}, {'custom': 'UUID'}, {'custom': 'PurePosixPath'}, 3]))
+        with self.assertRaises(ValueError):
+            self.bjddumpb([Custom('x')], encoders={Custom: lambda obj: int(obj.value)})
+        for encoders, exception in (({float: str}, TypeError), ({'a': str}, TypeError), ({Custom: 1}, TypeError)):
+            with self.assertRaises(exception):
+                self.bjddumpb(1, encoders=encoders)
+
+        try:
+            from dataclasses import make_dataclass, field
+            from typing import ClassVar
+        except ImportError:  # pragma: no cover
+            return
+
+        # class variables are not fields
+        Model = make_dataclass('Model', [('a', int), ('b', list, field(default_factory=list)), ('c', ClassVar[int], 5)])
+
+        for opts in ({}, {'container_count': True}, {'sort_keys': True}):
+            self.assertEqual(self.bjddumpb({'m': Model(1, [Model(2)])}, **opts),
+                             self.bjddumpb({'m': {'a': 1, 'b': [{'a': 2, 'b': []}]}}, **opts))
+        self.assertEqual(self.bjddumpb(Model(1), default=lambda obj: obj.a), self.bjddumpb(1))
+        model = Model(1)
+        model.b.append(model)
+        with self.assertRaises((ValueError, RecursionError)):
+            self.bjddumpb(model)
+
+    def test_encode_fields(self):
+        class Base(object):
+            __slots__ = ('a', '__b')
+
+            def __init__(self, a, b):
+                self.a = a
+                self.__b = b
+
+        class Slots(Base):
+            __slots__ = 'c'
+
+            def __init__(self, a, b, c):
+                super(Slots, self).__init__(a, b)
+                self.c = c
+
+        class Attribute(object):
+            def __init__(self, name):
+                self.name = name
+
+        class AttrsLike(object):
+            # as added by attrs (without depending on it)
+            __attrs_attrs__ = (Attribute('y'), Attribute('x'))
+
+            def __init__(self, x, y):
+                self.x = x
+                self.y = y
+
+        Point = namedtuple('Point', 'y x')
+        encoders = {Base: slots_as_object, Point: namedtuple_as_object}
+        long_key = 'k' * 300
+        Long = namedtuple('Long', [long_key])
+        encoders[Long] = namedtuple_as_object
+
+        for opts in ({}, {'container_count': True}, {'sort_keys': True}, {'islittle': False},
+                     {'dialect': 'ubjson', 'islittle': False}):
+            obj = [Slots(1, Point(2, 3), [AttrsLike(4, Slots(5, 6, 7))]), Long(8)]
+            expected = [{'a': 1, '_Base__b': {'y': 2, 'x': 3}, 'c': [{'y': {'a': 5, '_Base__b': 6, 'c': 7}, 'x': 4}]},
+                        {long_key: 8}]
+            # twice, i.e. also with cached field specs
+            for _ in range(2):
+                encoded = self.bjddumpb(obj, encoders=encoders, **opts)
+                self.assertEqual(encoded, self.bjddumpb(expected, **opts))
+            self.assertEqual(self.bjdloadb(encoded, islittle=opts.get('islittle', True),
+                                           dialect=opts.get('dialect', 'bjdata')), expected)
+
+        # unset slot
+        unset = Slots(1, 2, 3)
+        del unset.c
+        with self.assertRaises(AttributeError):
+            self.bjddumpb([unset], encoders=encoders)
+        # circular reference via fields
+        circular = Slots(1, 2, None)
+        circular.c = [circular]
+        with self.assertRaises((ValueError, RecursionError)):
+            self.bjddumpb(circular, encoders=encoders)
+
+        try:
+            from dataclasses import make_dataclass
+            model = make_dataclass('Model', ['a', 'b'], slots=True)
+        except (ImportError, TypeError):  # pragma: no cover
+            return
+        self.assertEqual(self.bjddumpb(model(1, model(2, None))), self.bjddumpb({'a': 1, 'b': {'a': 2, 'b': None}}))
+
+    def test_encode_iterables(self):
+        class Short(Sequence):
+            """Sequence which claims more items than it has"""
+            def __len__(self):
+                return 3
+
+            def __getitem__(self, index):
+                if index >= 2:
+                    raise IndexError
+                return index
+
+        expected = self.bjddumpb([1, 'a', [2]])
+        self.assertEqual(self.bjddumpb(iter([1, 'a', [2]])), expected)
+        self.assertEqual(self.bjddumpb((x for x in (1, 'a', iter([2])))), expected)
+        self.assertEqual(self.bjddumpb({'a': iter(())}), self.bjddumpb({'a': []}))
+        for opts in ({}, {'container_count': True}):
+            self.assertEqual(self.bjddumpb(deque([1, 'a', deque([2])]), **opts), self.bjddumpb([1, 'a', [2]], **opts))
+            # sets are not sequences (but iterators over them are)
+            with self.assertRaises(EncoderException):
+                self.bjddumpb({1}, **opts)
+            self.assertEqual(self.bjdloadb(self.bjddumpb(iter({1}), **opts)), [1])
+        with self.assertRaises(RuntimeError):
+            self.bjddumpb(Short(), container_count=True)
+
+        # if default is given, iterators are passed to it (as before they were supported) but sequences are not
+        class Counter(object):
+            def __iter__(self):
+                return self
+
+            def __next__(self):
+                raise StopIteration
+            next = __next__
+
+        for iterator in (iter([1]), (x for x in (1,)), Counter()):
+            self.assertEqual(self.bjddumpb(iterator, default=lambda obj: 'x'), self.bjddumpb('x'))
+        self.assertEqual(self.bjddumpb(deque([1]), default=lambda obj: 'x'), self.bjddumpb([1]))
+        self.assertEqual(self.bjddumpb(Counter()), self.bjddumpb([]))
+
+        # with container_count, the count of an iterator is written (as int64) after its items where possible
+        for islittle in (True, False):
+            def count(value):
+                return ARRAY_START + CONTAINER_COUNT + TYPE_INT64 + pack('<q' if islittle else '>q', value)
+
+            self.assertEqual(self.bjddumpb((x for x in (1, 'a', iter([2]))), container_count=True, islittle=islittle),
+                             count(3) + self.bjddumpb(1, islittle=islittle) + self.bjddumpb('a', islittle=islittle) +
+                             count(1) + self.bjddumpb(2, islittle=islittle))
+
+        # ranges are written as packed arrays, computed on the fly
+        for dialect in ('bjdata', 'ubjson'):
+            for values, type_ in ((range(5), TYPE_INT8), (range(-3, 300, 7), TYPE_INT16),
+                                  (range(2 ** 40, 2 ** 40 - 3, -1), TYPE_INT64), (range(0, 70000, 7), TYPE_INT32)):
+                if dialect == 'bjdata' and values[0] >= 0 and values[-1] >= 0 and type_ != TYPE_INT8:
+                    type_ = {TYPE_INT16: TYPE_UINT16, TYPE_INT32: TYPE_UINT32, TYPE_INT64: TYPE_UINT64}[type_]
+                encoded = self.bjddumpb(values, dialect=dialect)
+                self.assertEqual(encoded[:3], ARRAY_START + CONTAINER_TYPE + type_)
+                self.assertEqual(self.bjdloadb(encoded, dialect=dialect).tolist(), list(values))
+                # as a list when big-endian
+                self.assertEqual(self.bjddumpb(values, islittle=False, dialect=dialect),
+                                 self.bjddumpb(list(values), islittle=False, dialect=dialect))
+        # empty or beyond int64
+        for values in (range(0), range(5, 0), range(2 ** 63 - 1, 2 ** 63 + 1)):
+            self.assertEqual(self.bjddumpb(values), self.bjddumpb(list(values)))
+
+    def test_typed_objects(self):
+        for dialect in ('bjdata', 'ubjson'):
+            # no unsigned types (other than uint8) in UBJSON
+            uint16, uint64 = (TYPE_UINT16, TYPE_UINT64) if dialect == 'bjdata' else (TYPE_INT32, TYPE_INT64)
+            for islittle in (True, False):
+                opts = {'dialect': dialect, 'islittle': islittle}
+                for obj, type_ in (({'a': 1, 'b': 255}, TYPE_UINT8), ({'a': -1, 'b': 127}, TYPE_INT8),
+                                   ({'a': 1, 'b': 60000}, uint16), ({'a': -1, 'b': 2 ** 31 - 1}, TYPE_INT32),
+                                   ({'a': 2 ** 40}, uint64), ({'a': -2 ** 63, 'b': 0}, TYPE_INT64),
+                                   ({'a': 1.5, 'b': 0.0}, TYPE_FLOAT64)):
+                    encoded = self.bjddumpb(obj, typed_objects=True, **opts)
+                    self.assertEqual(encoded[:3], OBJECT_START + CONTAINER_TYPE + type_)
+                    self.assertEqual(self.bjdloadb(encoded, **opts), obj)
+                    self.assertIsNone(self.bjdvalidate(encoded, **opts))
+                # float32 only if all values fit
+                self.assertEqual(self.bjddumpb({'a': 1.5, 'b': 0.0}, typed_objects=True, no_float32=False, **opts)[:3],
+                                 OBJECT_START + CONTAINER_TYPE + TYPE_FLOAT32)
+                self.assertEqual(self.bjddumpb({'a': 1.5, 'b': 1e-300}, typed_objects=True, no_float32=False,
+                                               **opts)[:3], OBJECT_START + CONTAINER_TYPE + TYPE_FLOAT64)
+                # otherwise written as usual, also for nested values
+                for obj in ({}, {'a': 1, 'b': 1.5}, {'a': True, 'b': False}, {'a': 1, 'b': True}, {'a': 2 ** 63},
+                            {'a': 'x'}, {'a': [1]}, {'a': None}):
+                    for container_count in (False, True):
+                        self.assertEqual(self.bjddumpb({'x': obj}, typed_objects=True, container_count=container_count,
+                                                       **opts),
+                                         self.bjddumpb({'x': obj}, container_count=container_count, **opts))
+        self.assertEqual(self.bjddumpb({'b': 1, 'a': 2}, typed_objects=True, sort_keys=True),
+                         OBJECT_START + CONTAINER_TYPE + TYPE_UINT8 + CONTAINER_COUNT + TYPE_UINT8 + b'\x02' +
+                         TYPE_UINT8 + b'\x01a\x02' + TYPE_UINT8 + b'\x01b\x01')
+        # non-finite floats have no UBJSON representation
+        self.assertEqual(self.bjddumpb({'a': float('inf')}, typed_objects=True, dialect='ubjson'),
+                         self.bjddumpb({'a': float('inf')}, dialect='ubjson'))
+        self.assertEqual(self.bjddumpb({'a': float('inf')}, typed_objects=True)[:3],
+                         OBJECT_START + CONTAINER_TYPE + TYPE_FLOAT64)
+        with self.assertRaises(EncoderException):
+            self.bjddumpb({1: 1}, typed_objects=True)
+
+        # objects written from fields are typed as mappings are
+        class Slots(object):
+            __slots__ = ('x', 'y')
+
+            def __init__(self, x, y):
+                self.x = x
+                self.y = y
+
+        Point = namedtuple('Point', 'x y')
+        encoders = {Point: namedtuple_as_object, Slots: slots_as_object}
+        for sort_keys in (False, True):
+            for obj in (Point(1.5, 2.5), Slots(2, -1), Point(1, 'y'), Slots(1, 1.5)):
+                self.assertEqual(self.bjddumpb([obj], typed_objects=True, encoders=encoders, sort_keys=sort_keys),
+                                 self.bjddumpb([{'x': obj.x, 'y': obj.y}], typed_objects=True, sort_keys=sort_keys))
+        try:
+            from dataclasses import make_dataclass
+        except ImportError:  # pragma: no cover
+            return
+        Model = make_dataclass('Model', [('b', float), ('a', float)])
+        self.assertEqual(self.bjddumpb(Model(1.5, 2.5), typed_objects=True),
+                         self.bjddumpb({'b': 1.5, 'a': 2.5}, typed_objects=True))
+
+    def test_align(self):
+        payloads = (np.arange(1, 6) * 1.25, np.arange(-3, 9, dtype=np.int32).reshape(3, 4),
+                    np.arange(50, 70, dtype=np.int32)[::2])
+        for align in (8, 64):
+            for obj in (list(payloads), [1, 'x'] + list(payloads), {'a': payloads[0], 'key' * 100: [payloads[1]]},
+                        {'bb': payloads[2], 'c': None}):
+                for container_count in (False, True):
+                    encoded = self.bjddumpb(obj, align=align, container_count=container_count)
+                    for payload in payloads:
+                        if encoded.find(payload.tobytes()) >= 0:
+                            self.assertEqual(encoded.find(payload.tobytes()) % align, 0)
+                    self.assertIsNone(self.bjdvalidate(encoded))
+                    decoded = self.bjdloadb(encoded)
+                    self.assertEqual(repr(decoded), repr(obj))
+        # padding before header, i.e. payload at offset 8
+        self.assertEqual(self.bjddumpb([np.arange(3, dtype=np.int16)], align=4),
+                         ARRAY_START + TYPE_NOOP + ARRAY_START + CONTAINER_TYPE + TYPE_INT16 + CONTAINER_COUNT +
+                         TYPE_UINT8 + b'\x03' + b'\x00\x00\x01\x00\x02\x00' + ARRAY_END)
+        for align in (0, 1):
+            self.assertEqual(self.bjddumpb({'a': list(payloads)}, align=align), self.bjddumpb({'a': list(payloads)}))
+        # only packed arrays are aligned (UBJSON has no uint16)
+        self.assertEqual(self.bjddumpb([np.arange(3, dtype=np.uint16)], align=16, dialect='ubjson'),
+                         self.bjddumpb([np.arange(3, dtype=np.uint16)], dialect='ubjson'))
+        with self.assertRaises(ValueError):
+            self.bjddumpb([], align=-1)
+        # (long) runs of no-ops
+        self.assertEqual(self.bjdloadb(ARRAY_START + TYPE_NOOP * 10000 + TYPE_UINT8 + b'\x01' + TYPE_NOOP * 3 +
+                                       ARRAY_END), [1])
+        self.assertEqual(self.bjdloadb(OBJECT_START + CONTAINER_COUNT + TYPE_UINT8 + b'\x01' + TYPE_NOOP * 10000 +
+                                       TYPE_UINT8 + b'\x01' + b'a' + TYPE_NULL), {'a': None})
+
+    def test_dumpb_iov(self):
+        big = np.arange(1000, dtype=np.float64)
+        raw = b'\x01' * 2000
+        for make in (lambda: {'a': big, 'b': [raw, bytearray(raw), np.ones((30, 40), np.int32)], 'c': 'x'},
+                     lambda: [1, b'ab', big[:3], big[::2]], lambda: [iter([big]), (raw for _ in range(2))],
+                     lambda: 123, lambda: []):
+            for islittle, dialect in ((True, 'bjdata'), (False, 'ubjson')):
+                for kwargs in ({}, {'container_count': True}, {'align': 64}):
+                    encoded = b''.join(self.bjddumpb_iov(make(), islittle=islittle, dialect=dialect, **kwargs))
+                    self.assertIsNone(self.bjdvalidate(encoded, islittle=islittle, dialect=dialect))
+                    self.assertEqual(repr(self.bjdloadb(encoded, islittle=islittle, dialect=dialect)),
+                                     repr(self.bjdloadb(self.bjddumpb(make(), islittle=islittle, dialect=dialect),
+                                                        islittle=islittle, dialect=dialect)))
+        # large payloads are referenced, not copied
+        segments = self.bjddumpb_iov({'a': big, 'b': raw, 'c': b'small'})
+        views = [segment for segment in segments if isinstance(segment, memoryview)]
+        self.assertEqual(len(views), 2)
+        self.assertTrue(np.shares_memory(np.frombuffer(views[0], np.float64), big))
+        self.assertIs(views[1].obj, raw)
+        self.assertEqual(b''.join(segments), self.bjddumpb({'a': big, 'b': raw, 'c': b'small'}))
+        self.assertEqual(self.bjddumpb_iov({'a': 1}), [self.bjddumpb({'a': 1})])
+
+    def test_loadb_segments(self):
+        obj = {'a': np.arange(300, dtype=np.int32), 'b': [1.5, 'text', b'bytes' * 50, None], 'c': {'d': 2 ** 40}}
+        for align in (0, 16):
+            encoded = self.bjddumpb(obj, align=align)
+            expected = repr(self.bjdloadb(encoded))
+            # split inside of markers, lengths and payloads (incl. empty segments)
+            for step in (1, 7, 100, 1000):
+                segments = [encoded[i:i + step] for i in range(0, len(encoded), step)]
+                self.assertEqual(repr(self.bjdloadb_segments(segments)), expected)
+                self.assertEqual(repr(self.bjdloadb_segments(tuple([b''] + segments + [b'']))), expected)
+                self.assertEqual(repr(self.bjdloadb_segments([bytearray(segment) for segment in segments],
+                                                             include=['b'], raw_depth=2)),
+                                 repr(self.bjdloadb(encoded, include=['b'], raw_depth=2)))
+        self.assertEqual(repr(self.bjdloadb_segments(self.bjddumpb_iov(obj))), repr(obj))
+        encoded = self.bjddumpb(obj)
+        segments = [encoded[:10], memoryview(encoded)[10:500], encoded[500:]]
+        with self.assertRaises(DecoderException):
+            self.bjdloadb_segments(segments[:2])
+        with self.assertRaises(DecoderException):
+            self.bjdloadb_segments(segments, max_total_bytes=len(encoded) - 1)
+        with self.assertRaises(DecoderException):
+            self.bjdloadb_segments([])
+        with self.assertRaises(TypeError):
+            self.bjdloadb_segments([encoded, 1])
+
+    def test_buffer_callback(self):
+        big = np.arange(1000, dtype=np.float64).reshape(10, 100)
+        obj = {'a': big, 'b': [big.T, np.arange(512, dtype=np.complex64)], 'c': np.arange(10, dtype=np.int32), 'd': 'x'}
+        for kwargs in ({}, {'align': 64}, {'container_count': True}):
+            buffers = []
+            encoded = self.bjddumpb(obj, buffer_callback=buffers.append, **kwargs)
+            self.assertIsNone(self.bjdvalidate(encoded))
+            # large arrays (of any dtype, also non-contiguous) passed out-of-band, in order
+            self.assertEqual([len(buf) for buf in buffers], [8000, 8000, 4096])
+            self.assertLess(len(encoded), 400)
+            decoded = self.bjdloadb(encoded, buffers=buffers)
+            self.assertEqual(repr(decoded), repr(obj))
+            self.assertTrue(np.shares_memory(decoded['a'], big))
+            # without buffers references are decoded as objects
+            self.assertEqual(self.bjdloadb(encoded)['a'], {'_BufferDtype_': '<f8', '_BufferIndex_': 0,
+                                                           '_BufferShape_': [10, 100]})
+            self.assertEqual(repr(self.bjdloadb(encoded, buffers=[bytes(buf) for buf in buffers])), repr(obj))
+            with self.assertRaises(DecoderException):
+                self.bjdloadb(encoded, buffers=buffers[:1])
+            with self.assertRaises(DecoderException):
+                self.bjdloadb(encoded, buffers=[buffers[0][:-8]] + buffers[1:])
+        self.assertEqual(self.bjddumpb(big, buffer_callback=None), self.bjddumpb(big))
+        with self.assertRaises(TypeError):
+            self.bjddumpb(big, buffer_callback=1)
+
+    def test_zero_copy(self):
+        big = np.arange(1000, dtype=np.float64).reshape(10, 100)
+        obj = {'a': big, 'b': [np.arange(5, dtype=np.int16), b'xyz'], 'c': np.arange(6, dtype=np.uint8).reshape(2, 3)}
+        raw = bytearray(self.bjddumpb(obj))
+        raw_view = np.frombuffer(raw, np.uint8)
+        self.assertEqual(repr(self.bjdloadb(raw, zero_copy=True)), repr(obj))
+        for kwargs in ({}, {'max_total_bytes': len(raw)}):
+            decoded = self.bjdloadb_segments([raw], zero_copy=True, **kwargs)
+            self.assertEqual(repr(decoded), repr(obj))
+            for array in (decoded['a'], decoded['b'][0], decoded['c']):
+                self.assertTrue(np.shares_memory(array, raw_view))
+        # views of a writable input are writable
+        decoded['a'][0, 0] = -1
+        self.assertEqual(self.bjdloadb(raw)['a'][0, 0], -1)
+        decoded['a'][0, 0] = 0
+        self.assertFalse(np.shares_memory(self.bjdloadb_segments([raw])['a'], raw_view))
+        self.assertFalse(self.bjdloadb_segments([bytes(raw)], zero_copy=True)['a'].flags.writeable)
+        # payloads passed as segments by dumpb_iov are viewed in place, ones spanning segments copied
+        self.assertTrue(np.shares_memory(self.bjdloadb_segments(self.bjddumpb_iov(obj), zero_copy=True)['a'], big))
+        split = len(raw) // 2
+        decoded = self.bjdloadb_segments([raw[:split], raw[split:]], zero_copy=True)
+        self.assertEqual(repr(decoded), repr(obj))
+        self.assertFalse(np.shares_memory(decoded['a'], raw_view))
+        with self.assertRaises(DecoderException):
+            self.bjdloadb_segments([raw[:-1]], zero_copy=True)
+
+    @skipUnless(shared_memory, 'multiprocessing.shared_memory not available')
+    def test_shared(self):
+        obj = {'w': np.arange(1000, dtype=np.float32).reshape(10, 100), 'meta': {'id': 7, 'name': 'x'}}
+        shm = dump_shared(obj)
+        try:
+            with load_shared(shm.name) as doc:
+                self.assertEqual(repr(doc.value), repr(obj))
+                weights = doc.value['w']
+                self.assertEqual(weights.ctypes.data % 64, 0)
+                # the block is mapped rather than copied
+                weights[0, 0] = -1
+                self.assertEqual(load_shared(shm).value['w'][0, 0], -1)
+                with self.assertRaises(BufferError):
+                    doc.close()
+                del weights
+            copied = load_shared(shm.name, zero_copy=False)
+            copied.value['w'][0, 0] = 0
+            self.assertEqual(repr(copied.value), repr(obj))
+            copied.close()
+        finally:
+            shm.close()
+            shm.unlink()
+        shm = shared_memory.SharedMemory(create=True, size=16)
+        try:
+            with self.assertRaises(ValueError):
+                load_shared(shm.name)
+        finally:
+            shm.close()
+            shm.unlink()
+
     def test_decode_object_hook(self):
         with self.assertRaises(TypeError):
             self.check_enc_dec({'a': 1, 'b': 2}, object_hook=int)
@@ -586,10 +1279,204 @@ class TestEncodeDecodePlain(TestCase):  # pylint: disable=too-many-public-method
         with self.assertRaises(EncoderException):
             self.check_enc_dec({'a': 1, 'b': UnHandled()}, object_hook=object_hook, default=default)
 
+    def test_decode_classes(self):
+        class Slots(object):
+            __slots__ = ('u', '__v')
+
+            def __init__(self):
+                raise AssertionError('not called when decoding')
+
+        from dataclasses import make_dataclass, field
+        Model = make_dataclass('Model', ['a', ('b', str, field(default='b'))])
+        Point = namedtuple('Point', 'x y')
+        records = [{'x': 1, 'y': 2}, {'y': 3, 'x': 4}, {'x': 5, 'y': 6, 'z': 7}, {'a': 8, 'b': 'c'}, {'a': 9},
+                   {'u': 10, '_Slots__v': 11}, {'x': 12, 'y': 13}]
+        for opts in ({}, {'container_count': True}):
+            encoded = self.bjddumpb(records, **opts)
+            decoded = self.bjdloadb(encoded, classes=[Point, Model, Slots], object_hook=lambda obj: ('hook', obj))
+            self.assertEqual(decoded[:5], [Point(1, 2), Point(4, 3), ('hook', records[2]), Model(8, 'c'),
+                                           ('hook', {'a': 9})])
+            self.assertEqual((type(decoded[5]), decoded[5].u, decoded[5]._Slots__v), (Slots, 10, 11))
+            self.assertEqual(decoded[6], Point(12, 13))
+
+            encoded = self.bjddumpb({'p': [{'a': 1}, {'a': 2, 'b': 'x'}], 'q': {'r': {'x': 1, 'y': 2}}}, **opts)
+            self.assertEqual(self.bjdloadb(encoded, class_paths={'p': Model, ('q', 'r'): Point}),
+                             {'p': [Model(1), Model(2, 'x')], 'q': {'r': Point(1, 2)}})
+            self.assertEqual(self.bjdloadb(encoded, class_paths={'q.r': Point}, object_pairs_hook=OrderedDict),
+                             OrderedDict([('p', [OrderedDict([('a', 1)]), OrderedDict([('a', 2), ('b', 'x')])]),
+                                          ('q', OrderedDict([('r', Point(1, 2))]))]))
+            # keys which are not fields are an error (for class_paths)
+            with self.assert_raises_regex(DecoderException, 'not a field'):
+                self.bjdloadb(encoded, class_paths={'p': Point})
+            with self.assertRaises(TypeError):
+                self.bjdloadb(self.bjddumpb({'p': {'b': 'x'}}, **opts), class_paths={'p': Model})
+
+        with self.assertRaises(ValueError):
+            self.bjdloadb(encoded, classes=[Point, namedtuple('Other', 'y x')])
+        with self.assertRaises(ValueError):
+            self.bjdloadb(encoded, classes=[Point], dict_class=OrderedDict)
+        with self.assertRaises(TypeError):
+            self.bjdloadb(encoded, classes=[dict])
+        with self.assertRaises(TypeError):
+            self.bjdloadb(encoded, class_paths={'p': 'Model'})
+
+    def test_dialect(self):
+        for dialect in ('bjdata', 'ubjson'):
+            for obj in ({'a': [1, 456, -70000, 2 ** 40, 'x', None, True], 'b': {'c': 1.5}}, [256, 65536, 2 ** 32]):
+                for container_count in (False, True):
+                    self.assertEqual(self.bjdloadb(self.bjddumpb(obj, container_count=container_count, dialect=dialect),
+                                                   dialect=dialect), obj)
+
+        # unsigned & half precision types only exist in BJData
+        self.assertEqual(self.bjddumpb(456), TYPE_UINT16 + pack('<H', 456))
+        self.assertEqual(self.bjddumpb(456, dialect='ubjson'), TYPE_INT16 + pack('<h', 456))
+        self.assertEqual(self.bjddumpb(2 ** 63), TYPE_UINT64 + pack('<Q', 2 ** 63))
+        self.assertEqual(self.bjdloadb(self.bjddumpb(2 ** 63, dialect='ubjson'), dialect='ubjson'), 2 ** 63)
+        self.assertEqual(self.bjddumpb(2 ** 63, dialect='ubjson')[:1], TYPE_HIGH_PREC)
+        for marker in (TYPE_UINT16, TYPE_UINT32, TYPE_UINT64, TYPE_FLOAT16):
+            with self.assertRaises(DecoderException):
+                self.bjdloadb(marker + b'\x00' * 8, dialect='ubjson')
+        with self.assertRaises(DecoderException):
+            self.bjdloadb(TYPE_STRING + TYPE_UINT16 + pack('<H', 1) + b'a', dialect='ubjson')
+        # ND-array dimensions
+        with self.assertRaises(DecoderException):
+            self.bjdloadb(ARRAY_START + CONTAINER_TYPE + TYPE_INT8 + CONTAINER_COUNT + ARRAY_START + TYPE_UINT8 +
+                          b'\x01' + TYPE_UINT8 + b'\x01' + ARRAY_END + b'\x01', dialect='ubjson')
+
+        # non-finite floats are not allowed in UBJSON
+        for value in (float('nan'), float('inf')):
+            self.assertEqual(self.bjddumpb(value, dialect='ubjson'), TYPE_NULL)
+            self.assertEqual(self.bjddumpb(value, no_float32=False, dialect='ubjson'), TYPE_NULL)
+
+        # numpy arrays without a UBJSON equivalent are written as plain arrays
+        self.assertEqual(self.bjdloadb(self.bjddumpb(ndarray([1, 2, 3], np.uint16), dialect='ubjson'),
+                                       dialect='ubjson'), [1, 2, 3])
+        self.assertEqual(self.bjdloadb(self.bjddumpb(np.eye(2, dtype=np.int8), dialect='ubjson'), dialect='ubjson'),
+                         [[1, 0], [0, 1]])
+
+        for func in (partial(self.bjddumpb, 1), partial(self.bjdloadb, TYPE_NULL)):
+            with self.assertRaises(ValueError):
+                func(dialect='json')
+
+    def test_validate(self):
+        obj = {'a': [1, 2.5, None, True, u('\u00a9 text'), Decimal('1.5')], 'b': {'c': b'bytes', 'd': []},
+               'e': np.eye(3, dtype=np.int16), 'f': u('x') * 300}
+        for container_count in (False, True):
+            encoded = self.bjddumpb(obj, container_count=container_count)
+            self.assertIsNone(self.bjdvalidate(encoded))
+            self.assertIsNone(self.bjdvalidate(bytearray(encoded)))
+            # any truncation is detected
+            for length in range(len(encoded)):
+                self.assertIsNotNone(self.bjdvalidate(encoded[:length]))
+        self.assertIsNone(self.bjdvalidate(self.bjddumpb(obj, islittle=False), islittle=False))
+        # trailing input ignored (like loadb)
+        self.assertIsNone(self.bjdvalidate(TYPE_BOOL_TRUE * 3))
+        for number in (b'-1.5E+3', b'.5', b'5.', b'0E-10', b'+Infinity', b'-inf', b'NaN', b'sNaN12'):
+            encoded = TYPE_HIGH_PREC + TYPE_UINT8 + pack('B', len(number)) + number
+            self.assertIsNone(self.bjdvalidate(encoded), number)
+            self.assertEqual(str(self.bjdloadb(encoded)), str(Decimal(number.decode('ascii'))))
+
+        for raw, offset in (
+                (b'', 0),
+                (b'A', 0),
+                (ARRAY_START + TYPE_NULL + b'A', 2),
+                (TYPE_INT16 + b'\x01', 1),
+                (TYPE_CHAR + b'\xfe', 1),
+                (TYPE_STRING + TYPE_INT8 + b'\x81', 1),
+                (TYPE_STRING + TYPE_UINT8 + b'\x05' + b'abc', 3),
+                # invalid utf-8: continuation byte, overlong form, surrogate
+                (TYPE_STRING + TYPE_UINT8 + b'\x04' + b'ab\x80c', 5),
+                (TYPE_STRING + TYPE_UINT8 + b'\x02' + b'\xc0\x80', 3),
+                (TYPE_STRING + TYPE_UINT8 + b'\x04' + b'a\xed\xa0\x80', 4),
+                # high precision numbers must be decimal number strings
+                (TYPE_HIGH_PREC + TYPE_UINT8 + b'\x03' + b'abc', 3),
+                (TYPE_HIGH_PREC + TYPE_UINT8 + b'\x00', 3),
+                (TYPE_HIGH_PREC + TYPE_UINT8 + b'\x02' + b'1e', 3),
+                (TYPE_HIGH_PREC + TYPE_UINT8 + b'\x01' + b'.', 3),
+                (ARRAY_START + TYPE_HIGH_PREC + TYPE_UINT8 + b'\x04' + b'1.5x' + ARRAY_END, 4),
+                (OBJECT_START + TYPE_UINT8 + b'\x01' + b'\xff' + TYPE_NULL + OBJECT_END, 3),
+                (OBJECT_START + TYPE_UINT8 + b'\x01' + b'a' + TYPE_NULL + ARRAY_END, 5),
+                (ARRAY_START + CONTAINER_TYPE + TYPE_INT8 + ARRAY_END, 3),
+                (ARRAY_START + CONTAINER_TYPE + b'A' + CONTAINER_COUNT + TYPE_UINT8 + b'\x01', 2),
+                (ARRAY_START + CONTAINER_TYPE + TYPE_INT32 + CONTAINER_COUNT + TYPE_UINT8 + b'\x02' + b'\x00' * 7, 6),
+                (ARRAY_START + CONTAINER_COUNT + TYPE_INT8 + b'\xff', 2)):
+            self.assertEqual(self.bjdvalidate(raw), offset, raw)
+            with self.assertRaises(DecoderException):
+                self.bjdloadb(raw)
+
+        # limits
+        nested = ARRAY_START * 3 + ARRAY_END * 3
+        self.assertIsNone(self.bjdvalidate(nested, max_depth=3))
+        self.assertEqual(self.bjdvalidate(nested, max_depth=2), 2)
+        many_nulls = ARRAY_START + CONTAINER_TYPE + TYPE_NULL + CONTAINER_COUNT + TYPE_INT32 + pack('<i', 2 ** 30)
+        self.assertIsNone(self.bjdvalidate(many_nulls))
+        self.assertEqual(self.bjdvalidate(many_nulls, max_size=1000), 4)
+        self.assertIsNone(self.bjdvalidate(self.bjddumpb([1, 2, 3]), max_size=8))
+        self.assertEqual(self.bjdvalidate(self.bjddumpb([1, 2, 3]), max_size=7), 7)
+
+        # dialect
+        self.assertIsNone(self.bjdvalidate(TYPE_UINT16 + b'\x00\x01'))
+        self.assertEqual(self.bjdvalidate(TYPE_UINT16 + b'\x00\x01', dialect='ubjson'), 0)
+        self.assertEqual(self.bjdvalidate(self.bjddumpb(np.eye(2, dtype=np.int8)), dialect='ubjson'), 4)
+
+        for kwargs in ({'dialect': 'json'}, {'max_depth': -1}, {'max_size': -1}):
+            with self.assertRaises(ValueError):
+                self.bjdvalidate(TYPE_NULL, **kwargs)
+        with self.assertRaises(TypeError):
+            self.bjdvalidate(u('Z'))
+
+    def test_limits(self):
+        obj = {'a': [1, 2, 3], 'b': {'c': u('text')}, 'd': Decimal('1.5')}
+        for container_count in (False, True):
+            encoded = self.bjddumpb(obj, container_count=container_count)
+            self.assertEqual(self.bjdloadb(encoded, max_container_count=3, max_total_bytes=len(encoded), max_depth=2,
+                                           max_string_length=4), obj)
+            for kwargs in ({'max_container_count': 2}, {'max_total_bytes': len(encoded) - 1}, {'max_depth': 1},
+                           {'max_string_length': 3}):
+                with self.assertRaises(DecoderException):
+                    self.bjdloadb(encoded, **kwargs)
+
+        # limits exceeded by an object key are reported as such
+        for container_count in (False, True):
+            encoded = self.bjddumpb({'ab': 1}, container_count=container_count)
+            with self.assert_raises_regex(DecoderException, 'String length exceeds max_string_length'):
+                self.bjdloadb(encoded, max_string_length=0)
+            with self.assert_raises_regex(DecoderException, 'Input exceeds max_total_bytes'):
+                self.bjdloadb(encoded, max_total_bytes=encoded.index(b'ab') + 1)
+
+        # counted arrays without any data are also limited
+        many_nulls = ARRAY_START + CONTAINER_TYPE + TYPE_NULL + CONTAINER_COUNT + TYPE_INT32 + pack('<i', 2 ** 30)
+        with self.assert_raises_regex(DecoderException, 'max_container_count'):
+            self.bjdloadb(many_nulls, max_container_count=1000)
+        nd_array = (ARRAY_START + CONTAINER_TYPE + TYPE_INT8 + CONTAINER_COUNT + ARRAY_START + CONTAINER_COUNT +
+                    TYPE_UINT8 + b'\x02' + (TYPE_INT32 + pack('<i', 2 ** 20)) * 2)
+        with self.assert_raises_regex(DecoderException, 'max_container_count'):
+            self.bjdloadb(nd_array, max_container_count=1000)
+        # as are ones without a count
+        with self.assert_raises_regex(DecoderException, 'max_container_count'):
+            self.bjdloadb(ARRAY_START + TYPE_NULL * 3 + ARRAY_END, max_container_count=2)
+        # truncated packed array (declared size exceeds input)
+        with self.assertRaises(DecoderException):
+            self.bjdloadb(ARRAY_START + CONTAINER_TYPE + TYPE_FLOAT64 + CONTAINER_COUNT + TYPE_INT32 +
+                          pack('<i', 2 ** 30) + b'\x00' * 8)
+        # large packed arrays (read in chunks from file-like objects)
+        large = np.arange(3 * 10 ** 5, dtype=np.float64).reshape((3, -1))
+        self.assertTrue(np.array_equal(self.bjdloadb(self.bjddumpb(large)), large))
+        self.assertEqual(self.bjdloadb(ARRAY_START + CONTAINER_TYPE + TYPE_CHAR + CONTAINER_COUNT + TYPE_UINT8 + b'\x02'
+                                       + b'ab').tolist(), [b'a', b'b'])
+
+        for kwargs in ({'max_container_count': -1}, {'max_total_bytes': -1}, {'max_depth': -1},
+                       {'max_string_length': -1}):
+            with self.assertRaises(ValueError):
+                self.bjdloadb(TYPE_NULL, **kwargs)
+
 
 @skipUnless(EXTENSION_ENABLED, 'Extension not enabled')
 class TestEncodeDecodePlainExt(TestEncodeDecodePlain):
 
+    RECURSIVE_ENCODER = False
+    RECURSIVE_DECODER = False
+
     @staticmethod
     def bjdloadb(raw, *args, **kwargs):
         return bjdloadb(raw, *args, **kwargs)
@@ -598,6 +1485,18 @@ class TestEncodeDecodePlainExt(TestEncodeDecodePlain):
     def bjddumpb(obj, *args, **kwargs):
         return bjddumpb(obj, *args, **kwargs)
 
+    @staticmethod
+    def bjddumpb_iov(obj, *args, **kwargs):
+        return bjddumpb_iov(obj, *args, **kwargs)
+
+    @staticmethod
+    def bjdloadb_segments(segments, *args, **kwargs):
+        return bjdloadb(segments, *args, **kwargs)
+
+    @staticmethod
+    def bjdvalidate(raw, *args, **kwargs):
+        return bjdvalidate(raw, *args, **kwargs)
+
 
 class TestEncodeDecodeFp(TestEncodeDecodePlain):
     """Performs tests via file-like objects (BytesIO) instead of bytes instances"""
@@ -669,10 +1568,46 @@ class TestEncodeDecodeFp(TestEncodeDecodePlain):
         output.seek(0)
         self.assertEqual(self.bjdload(output), obj)
 
+    def test_fp_iterator_count(self):
+        class Writer(object):
+            """Non-seekable output"""
+            def __init__(self):
+                self.chunks = []
+
+            def write(self, data):
+                self.chunks.append(bytes(data))
+
+        # count of an iterator patched once written out, also when not at the start of the output
+        output = BytesIO()
+        output.write(b'prefix')
+        self.bjddump({'a': (str(i) for i in range(1000)), 'b': iter(())}, output, container_count=True)
+        self.assertEqual(self.bjdloadb(output.getvalue()[6:]), {'a': [str(i) for i in range(1000)], 'b': []})
+        self.assertEqual(output.tell(), len(output.getvalue()))
+        # otherwise iterators are materialised first
+        output = Writer()
+        self.bjddump(iter([1, 'a']), output, container_count=True)
+        self.assertEqual(b''.join(output.chunks), self.bjddumpb([1, 'a'], container_count=True))
+        # as they are when appending to a file (where writes ignore seeking)
+        handle, path = mkstemp()
+        close(handle)
+        try:
+            for buffering in (-1, 0):
+                with open(path, 'wb') as output:
+                    output.write(b'prefix')
+                with open(path, 'ab', buffering=buffering) as output:
+                    self.bjddump((i for i in range(20000)), output, container_count=True)
+                with open(path, 'rb') as output:
+                    self.assertEqual(output.read(), b'prefix' + self.bjddumpb(list(range(20000)), container_count=True))
+        finally:
+            remove(path)
+
 
 @skipUnless(EXTENSION_ENABLED, 'Extension not enabled')
 class TestEncodeDecodeFpExt(TestEncodeDecodeFp):
 
+    RECURSIVE_ENCODER = False
+    RECURSIVE_DECODER = False
+
     @staticmethod
     def bjdloadb(raw, *args, **kwargs):
         return bjdload(BytesIO(raw), *args, **kwargs)
@@ -683,6 +1618,10 @@ class TestEncodeDecodeFpExt(TestEncodeDecodeFp):
         bjddump(obj, out, *args, **kwargs)
         return out.getvalue()
 
+    @staticmethod
+    def bjdvalidate(raw, *args, **kwargs):
+        return bjdvalidate(raw, *args, **kwargs)
+
     @staticmethod
     def bjdload(fp, *args, **kwargs):
         return bjdload(fp, *args, **kwargs)
@@ -709,6 +1648,105 @@ class TestEncodeDecodeFpExt(TestEncodeDecodeFp):
         output.seek(0)
         self.assertEqual(self.bjdload(output), obj3)
 
+    # Streams read via readinto (extension only)
+    def test_fp_readinto(self):
+        class Stream(RawIOBase):
+            """Non-seekable stream returning at most step bytes per readinto (which read also uses)"""
+            def __init__(self, data, step):
+                RawIOBase.__init__(self)
+                self.data = data
+                self.pos = 0
+                self.step = step
+
+            def readable(self):
+                return True
+
+            def readinto(self, b):
+                count = min(len(b), len(self.data) - self.pos, self.step)
+                b[:count] = self.data[self.pos:self.pos + count]
+                self.pos += count
+                return count
+
+        class Reader(BytesIO):
+            """Overrides read, so must not be read via (inherited) readinto"""
+            reads = 0
+
+            def read(self, size=-1):
+                Reader.reads += 1
+                return BytesIO.read(self, size)
+
+        obj = {'a': np.arange(1000, dtype=np.float64), 'b': b'y' * 600, 's': ['x' * 1000, 'z'] * 3,
+               'm': np.arange(6, dtype=np.int32).reshape(2, 3)}
+        encoded = self.bjddumpb(obj)
+        # partial reads are repeated, with larger ones (e.g. array data) read into their destination directly
+        for step in (7, 300, len(encoded)):
+            stream = Stream(encoded, step)
+            self.assertEqual(repr(self.bjdload(stream)), repr(obj))
+            self.assertEqual(stream.pos, len(encoded))
+            with self.assertRaises(DecoderException):
+                self.bjdload(Stream(encoded[:-100], step))
+        # seekable input is still only consumed up to the end of the value
+        output = BytesIO(encoded + b'trailing')
+        self.assertEqual(repr(self.bjdload(output)), repr(obj))
+        self.assertEqual(output.tell(), len(encoded))
+        self.assertEqual(repr(self.bjdload(Reader(encoded))), repr(obj))
+        self.assertGreater(Reader.reads, 0)
+
+        class Invalid(Stream):
+            def readinto(self, b):
+                return len(b) + 1
+
+        with self.assertRaises(ValueError):
+            self.bjdload(Invalid(encoded, 1))
+
+    def test_fp_fd(self):
+        obj = {'a': np.arange(100000, dtype=np.float64), 's': 'x' * 70000, 'r': [{'id': i} for i in range(3000)]}
+        handle, path = mkstemp()
+        close(handle)
+        try:
+            for buffering in (-1, 0):
+                for kwargs in ({}, {'container_count': True}, {'align': 64}):
+                    # (when written directly, file object position is synchronised afterwards)
+                    expected = BytesIO()
+                    expected.write(b'pre')
+                    self.bjddump(obj, expected, **kwargs)
+                    for background_write in (False, True):
+                        with open(path, 'wb', buffering=buffering) as output:
+                            output.write(b'pre')
+                            self.bjddump(obj, output, background_write=background_write, **kwargs)
+                            self.assertEqual(output.tell(), expected.tell())
+                            output.write(b'post')
+                        with open(path, 'rb', buffering=buffering) as output:
+                            self.assertEqual(output.read(), expected.getvalue() + b'post')
+                # multiple values, each only consumed up to its end
+                with open(path, 'wb') as output:
+                    output.write(self.bjddumpb(obj) * 2 + b'trailing')
+                with open(path, 'rb', buffering=buffering) as output:
+                    for i in range(2):
+                        self.assertEqual(repr(self.bjdload(output)), repr(obj))
+                        self.assertEqual(output.tell(), len(self.bjddumpb(obj)) * (i + 1))
+                    self.assertEqual(output.read(), b'trailing')
+                with open(path, 'wb') as output:
+                    output.write(self.bjddumpb(obj)[:-10])
+                with open(path, 'rb', buffering=buffering) as output:
+                    with self.assertRaises(DecoderException):
+                        self.bjdload(output)
+            # counts of iterators are patched once all output before them has been written
+            expected = BytesIO()
+            self.bjddump([range(10), (i for i in range(40000))], expected, container_count=True)
+            with open(path, 'wb') as output:
+                self.bjddump([range(10), (i for i in range(40000))], output, container_count=True,
+                             background_write=True)
+            with open(path, 'rb') as output:
+                self.assertEqual(output.read(), expected.getvalue())
+            # write failures are raised by the encoding thread
+            if exists('/dev/full'):
+                with open('/dev/full', 'wb') as output:
+                    with self.assertRaises(OSError):
+                        self.bjddump(obj, output, background_write=True)
+        finally:
+            remove(path)
+
     # Multiple documents in same stream (issue #9)
     def test_fp_multi(self):
         obj = {'a': 123, 'b': b'some raw content'}